@@ -27,7 +27,9 @@ LOCAL_SRC_FILES:= \
 	glesTex.cpp \
 	fglmatrix.cpp \
 	fglframebuffer.cpp \
-	fglsurface.cpp
+	fglsurface.cpp \
+	fglworker.cpp \
+	fglkernels.cpp
 
 LOCAL_C_INCLUDES := \
 	$(LOCAL_PATH)/../include
@@ -72,3 +74,31 @@ LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/egl
 LOCAL_MODULE:= libGLES_fimg
 
 include $(BUILD_SHARED_LIBRARY)
+
+#
+# Build checks and benchmarks of CPU code paths
+#
+
+LOCAL_PATH := $(THIS_PATH)
+include $(CLEAR_VARS)
+
+LOCAL_ARM_MODE := arm
+
+LOCAL_SRC_FILES:= \
+	fglbench.cpp \
+	fglkernels.cpp
+
+LOCAL_C_INCLUDES := \
+	$(LOCAL_PATH)/../include
+
+LOCAL_CFLAGS += -DLOG_TAG=\"fglbench\"
+LOCAL_CFLAGS += -O2 -mcpu=arm1176jzf-s -mfpu=vfp -Wall -Wno-unused-parameter
+LOCAL_CFLAGS += -DFGL_PLATFORM_ANDROID
+
+LOCAL_SHARED_LIBRARIES := libcutils libutils
+LOCAL_LDLIBS := -lpthread
+
+LOCAL_MODULE_TAGS := eng
+LOCAL_MODULE:= fglbench
+
+include $(BUILD_EXECUTABLE)
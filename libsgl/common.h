@@ -24,6 +24,40 @@
 
 #define FGL_NPOT_TEXTURES
 
+/*
+ * Clear buffers using the 3D pipeline instead of CPU fills, which are still
+ * used for textures attached in formats that cannot be rendered to
+ */
+#define FGL_HARDWARE_CLEAR
+
+/* Convert textures in background thread */
+#define FGL_THREADED_TEXTURE_UPLOAD
+/* Smaller uploads are not worth passing to the thread (in bytes) */
+#define FGL_MIN_THREADED_UPLOAD_SIZE	16384
+
+/* Sub-allocate small surfaces from a few shared PMEM regions */
+#define FGL_SURFACE_POOL
+/* Size of a single PMEM region of the pool (in bytes) */
+#define FGL_POOL_CHUNK_SIZE		(1024 * 1024)
+/* Maximum number of PMEM regions of the pool */
+#define FGL_POOL_MAX_CHUNKS		8
+/* Larger surfaces get dedicated PMEM regions (in bytes) */
+#define FGL_POOL_MAX_SURFACE_SIZE	(256 * 1024)
+
+/* Keep static buffer arrays repacked to hardware vertex layout */
+#define FGL_PACKED_BUFFER_ARRAYS
+/* Number of packed arrays cached per buffer object */
+#define FGL_MAX_PACKED_ARRAYS		4
+/* Limit of memory used by packed arrays of a buffer (in buffer sizes) */
+#define FGL_MAX_PACKED_SIZE_RATIO	2
+
+/* Merge consecutive small draws using the same state (opt-in) */
+//#define FGL_DRAW_COALESCING
+/* Larger draws are submitted directly (in vertices) */
+#define FGL_COALESCE_MAX_DRAW		32
+/* Capacity of a merged draw (in vertices) */
+#define FGL_COALESCE_MAX_VERTICES	512
+
 #define FGL_MAX_TEXTURE_UNITS		2
 #define FGL_MAX_TEXTURE_OBJECTS		1024
 #define FGL_MAX_BUFFER_OBJECTS		1024
@@ -31,6 +65,9 @@
 #define FGL_MAX_RENDERBUFFER_OBJECTS	1024
 #define FGL_MAX_MIPMAP_LEVEL		11
 #define FGL_MAX_LIGHTS			8
+#define FGL_MAX_ORPHANED_SURFACES	8
+#define FGL_MAX_DAMAGE_RECTS		8
+#define FGL_MAX_BUFFER_AGE		4
 #define FGL_MAX_CLIP_PLANES		1
 #define FGL_MAX_MODELVIEW_STACK_DEPTH	16
 #define FGL_MAX_PROJECTION_STACK_DEPTH	2
@@ -30,6 +30,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <pthread.h>
 
 #include <sys/ioctl.h>
 #include <sys/mman.h>
@@ -46,6 +47,7 @@
 #include "types.h"
 #include "libfimg/fimg.h"
 #include "fglsurface.h"
+#include "s3c_g2d.h"
 
 #include <gralloc_priv.h>
 #include <linux/android_pmem.h>
@@ -324,6 +326,51 @@ static unsigned long fglGetBufferPhysicalAddress(android_native_buffer_t *buffer
 	return 0;
 }
 
+/*
+ * G2D engine
+ */
+
+#define G2D_DEVICE_NAME	"/dev/s3c-g2d"
+
+static pthread_once_t g2dOnce = PTHREAD_ONCE_INIT;
+static int g2dFd = -1;
+
+static void fglOpenG2D(void)
+{
+	int fd = open(G2D_DEVICE_NAME, O_RDWR, 0);
+	if (fd < 0) {
+		LOGW("EGL: Cannot open %s, copy back will use the CPU",
+							G2D_DEVICE_NAME);
+		return;
+	}
+
+	g2dFd = fd;
+}
+
+/* Returns G2D file descriptor or -1 if G2D is not available */
+static inline int fglGetG2D(void)
+{
+	pthread_once(&g2dOnce, fglOpenG2D);
+	return g2dFd;
+}
+
+static int fglGetG2DFormat(int format)
+{
+	/* Source and destination formats are always the same */
+	switch (format) {
+	case PIXEL_FORMAT_RGBA_8888:
+		return G2D_RGBA_8888;
+	case PIXEL_FORMAT_RGBX_8888:
+		return G2D_RGBX_8888;
+	case PIXEL_FORMAT_BGRA_8888:
+		return G2D_ARGB_8888;
+	case PIXEL_FORMAT_RGB_565:
+		return G2D_RGB_565;
+	default:
+		return -1;
+	}
+}
+
 /*
  * Android image surface
  */
@@ -443,74 +490,146 @@ class FGLWindowSurface : public FGLRenderSurface {
 		}
 	};
 
+	/*
+	 * Set of disjoint rectangles. Regions with more than
+	 * FGL_MAX_DAMAGE_RECTS rectangles are merged into their bounding
+	 * rectangle, so the region may grow, but never shrink.
+	 */
 	class Region {
-		Rect	storage[4];
+		/* Subtracting a rect can split each rect into four */
+		Rect	storage[4*FGL_MAX_DAMAGE_RECTS + 1];
 		ssize_t	count;
 
+		void append(const Rect &r)
+		{
+			if (!r.isEmpty())
+				storage[count++] = r;
+		}
+
+		/* Appends lhs minus rhs as up to four rects */
+		void appendDifference(const Rect &lhs, const Rect &rhs)
+		{
+			if (lhs.isEmpty())
+				return;
+
+			const int32_t top = max(lhs.top, rhs.top);
+			const int32_t bot = min(lhs.bottom, rhs.bottom);
+			if (lhs.left >= rhs.right || lhs.right <= rhs.left
+			    || top >= bot) {
+				/* no intersection */
+				append(lhs);
+				return;
+			}
+
+			if (lhs.top < rhs.top)
+				/* top rect */
+				append(Rect(lhs.left, lhs.top,
+						lhs.right, rhs.top));
+
+			if (lhs.left < rhs.left)
+				/* left-side rect */
+				append(Rect(lhs.left, top, rhs.left, bot));
+
+			if (lhs.right > rhs.right)
+				/* right-side rect */
+				append(Rect(rhs.right, top, lhs.right, bot));
+
+			if (lhs.bottom > rhs.bottom)
+				/* bottom rect */
+				append(Rect(lhs.left, rhs.bottom,
+						lhs.right, lhs.bottom));
+		}
+
 	public:
 		inline Region() :
 			count(0) {}
 
+		inline Region(const Rect &r) :
+			count(0)
+		{
+			append(r);
+		}
+
 		typedef const Rect *const_iterator;
 
 		const_iterator begin() const { return storage; }
 		const_iterator end() const { return storage+count; }
 
-		static Region subtract(const Rect &lhs, const Rect &rhs)
+		Rect bounds() const
 		{
-			Region reg;
-			Rect *storage = reg.storage;
+			if (!count)
+				return Rect(0, 0);
+
+			Rect b = storage[0];
+			for (ssize_t i = 1; i < count; ++i) {
+				b.left	= min(b.left, storage[i].left);
+				b.top	= min(b.top, storage[i].top);
+				b.right	= max(b.right, storage[i].right);
+				b.bottom = max(b.bottom, storage[i].bottom);
+			}
 
-			if (lhs.isEmpty())
-				return reg;
+			return b;
+		}
 
-			if (lhs.top < rhs.top) {
-				/* top rect */
-				storage->left	= lhs.left;
-				storage->top	= lhs.top;
-				storage->right	= lhs.right;
-				storage->bottom	= rhs.top;
-				++storage;
-			}
+		Region& orSelf(const Rect &r)
+		{
+			if (r.isEmpty())
+				return *this;
 
-			const int32_t top = max(lhs.top, rhs.top);
-			const int32_t bot = min(lhs.bottom, rhs.bottom);
-			if (top < bot) {
-				if (lhs.left < rhs.left) {
-					/* left-side rect */
-					storage->left	= lhs.left;
-					storage->top	= top;
-					storage->right	= rhs.left;
-					storage->bottom	= bot;
-					++storage;
-				}
-
-				if (lhs.right > rhs.right) {
-					/* right-side rect */
-					storage->left	= rhs.right;
-					storage->top	= top;
-					storage->right	= lhs.right;
-					storage->bottom	= bot;
-					++storage;
-				}
+			/* Keep rects disjoint: remove r from them first */
+			Region reg;
+			for (ssize_t i = 0; i < count; ++i)
+				reg.appendDifference(storage[i], r);
+			reg.append(r);
+
+			if (reg.count > FGL_MAX_DAMAGE_RECTS) {
+				Rect b = reg.bounds();
+				count = 0;
+				append(b);
+			} else {
+				*this = reg;
 			}
 
-			if (lhs.bottom > rhs.bottom) {
-				/* bottom rect */
-				storage->left	= lhs.left;
-				storage->top	= rhs.bottom;
-				storage->right	= lhs.right;
-				storage->bottom	= lhs.bottom;
-				++storage;
-			}
+			return *this;
+		}
+
+		Region& orSelf(const Region &r)
+		{
+			for (const_iterator cur = r.begin(); cur != r.end(); ++cur)
+				orSelf(*cur);
+
+			return *this;
+		}
+
+		static Region subtract(const Region &lhs, const Rect &rhs)
+		{
+			Region reg;
+
+			for (const_iterator cur = lhs.begin();
+			     cur != lhs.end(); ++cur)
+				reg.appendDifference(*cur, rhs);
 
-			reg.count = storage - reg.storage;
 			return reg;
 		}
 
 		bool isEmpty() const { return count <= 0; }
 	};
 
+	/*
+	 * Damage history, used to find out which parts of a dequeued buffer
+	 * are out of date, like EGL_EXT_buffer_age. Each buffer remembers
+	 * the frame it was queued with, and each of the last frames
+	 * remembers the area it updated.
+	 */
+	struct BufferFrame {
+		android_native_buffer_t	*buffer;
+		uint32_t		frame;
+	};
+
+	uint32_t		frame;
+	BufferFrame		bufferFrames[FGL_MAX_BUFFER_AGE];
+	Region			damage[FGL_MAX_BUFFER_AGE];
+
 	android_native_window_t	*nativeWin;
 	android_native_buffer_t	*buffer;
 	android_native_buffer_t	*previousBuffer;
@@ -518,7 +637,6 @@ class FGLWindowSurface : public FGLRenderSurface {
 	void			*bits;
 	int			bytesPerPixel;
 	Rect			dirtyRegion;
-	Rect			oldDirtyRegion;
 
 	int lock(android_native_buffer_t *buf, int usage, void **vaddr)
 	{
@@ -548,6 +666,82 @@ class FGLWindowSurface : public FGLRenderSurface {
 		}
 	}
 
+	/*
+	 * Copies the region between physically contiguous buffers using
+	 * the G2D engine, without touching CPU caches. Returns false if
+	 * the copy could not be done, so it must be performed by the CPU.
+	 */
+	bool copyBltG2D(android_native_buffer_t *dst,
+			android_native_buffer_t *src, const Region& clip)
+	{
+		/* NOTE: dst and src must be the same format */
+		int fd = fglGetG2D();
+		if (fd < 0)
+			return false;
+
+		int fmt = fglGetG2DFormat(src->format);
+		if (fmt < 0)
+			return false;
+
+		if (src->stride > G2D_MAX_WIDTH || src->height > G2D_MAX_HEIGHT
+		    || dst->stride > G2D_MAX_WIDTH
+		    || dst->height > G2D_MAX_HEIGHT)
+			return false;
+
+		unsigned long srcAddr = fglGetBufferPhysicalAddress(src);
+		unsigned long dstAddr = fglGetBufferPhysicalAddress(dst);
+		if (!srcAddr || !dstAddr)
+			return false;
+
+		s3c_g2d_params req;
+		memset(&req, 0, sizeof(req));
+
+		req.src_base_addr	= srcAddr;
+		req.src_full_width	= src->stride;
+		req.src_full_height	= src->height;
+		req.src_colorfmt	= fmt;
+
+		req.dst_base_addr	= dstAddr;
+		req.dst_full_width	= dst->stride;
+		req.dst_full_height	= dst->height;
+		req.dst_colorfmt	= fmt;
+
+		/* Plain copy of source pixels */
+		req.MaskedROP3		= G2D_ROP_SRC_ONLY;
+		req.UnMaskedROP3	= G2D_ROP_SRC_ONLY;
+
+		Region::const_iterator cur = clip.begin();
+		Region::const_iterator end = clip.end();
+
+		while (cur != end) {
+			const Rect &r = *cur++;
+
+			if (r.right <= r.left || r.bottom <= r.top)
+				continue;
+
+			req.src_start_x = req.dst_start_x = r.left;
+			req.src_start_y = req.dst_start_y = r.top;
+			req.src_work_width = req.dst_work_width =
+							r.right - r.left - 1;
+			req.src_work_height = req.dst_work_height =
+							r.bottom - r.top - 1;
+
+			req.cw_x1 = r.left;
+			req.cw_y1 = r.top;
+			req.cw_x2 = r.right - 1;
+			req.cw_y2 = r.bottom - 1;
+
+			/* The blit is complete when the ioctl returns */
+			if (ioctl(fd, S3C_G2D_ROTATOR_0, &req) < 0) {
+				LOGE("EGL: G2D blit failed (%s)",
+							strerror(errno));
+				return false;
+			}
+		}
+
+		return true;
+	}
+
 	void copyBlt(android_native_buffer_t *dst, void *dst_vaddr,
 			android_native_buffer_t *src, const void *src_vaddr,
 			const Region& clip)
@@ -590,6 +784,49 @@ class FGLWindowSurface : public FGLRenderSurface {
 		}
 	}
 
+	/*
+	 * Returns the number of frames since the buffer was queued, or 0
+	 * if its contents are unknown
+	 */
+	uint32_t getBufferAge(android_native_buffer_t *buf) const
+	{
+		for (unsigned i = 0; i < FGL_MAX_BUFFER_AGE; ++i) {
+			const BufferFrame &bf = bufferFrames[i];
+
+			if (bf.buffer == buf && bf.frame)
+				return frame - bf.frame;
+		}
+
+		return 0;
+	}
+
+	/* Records damage of the frame being queued in current buffer */
+	void queueDamage(const Region &area)
+	{
+		unsigned oldest = 0;
+
+		for (unsigned i = 0; i < FGL_MAX_BUFFER_AGE; ++i) {
+			if (bufferFrames[i].buffer == buffer) {
+				oldest = i;
+				break;
+			}
+
+			if (bufferFrames[i].frame < bufferFrames[oldest].frame)
+				oldest = i;
+		}
+
+		bufferFrames[oldest].buffer = buffer;
+		bufferFrames[oldest].frame = frame;
+		damage[frame % FGL_MAX_BUFFER_AGE] = area;
+		++frame;
+	}
+
+	void resetDamage()
+	{
+		memset(bufferFrames, 0, sizeof(bufferFrames));
+		frame = 1;
+	}
+
 	void doCopyBack()
 	{
 		dirtyRegion.andSelf(Rect(buffer->width, buffer->height));
@@ -597,11 +834,31 @@ class FGLWindowSurface : public FGLRenderSurface {
 		if (!previousBuffer)
 			return;
 
-		const Region copyBack =
-				Region::subtract(oldDirtyRegion, dirtyRegion);
+		/*
+		 * Previous buffer is complete, but current one misses
+		 * damage of all frames rendered since it was queued.
+		 */
+		Region stale;
+		uint32_t age = getBufferAge(buffer);
+		if (age < 2 || age > FGL_MAX_BUFFER_AGE) {
+			stale.orSelf(Rect(buffer->width, buffer->height));
+		} else {
+			for (uint32_t i = 1; i < age; ++i)
+				stale.orSelf(damage[(frame - i)
+							% FGL_MAX_BUFFER_AGE]);
+		}
+
+		const Region copyBack = Region::subtract(stale, dirtyRegion);
 		if (copyBack.isEmpty())
 			return;
 
+		/*
+		 * Rectangles already copied before a failure get copied
+		 * again by the CPU, which is harmless.
+		 */
+		if (copyBltG2D(buffer, previousBuffer, copyBack))
+			return;
+
 		void *prevBits;
 		int ret = lock(previousBuffer,
 					GRALLOC_USAGE_SW_READ_OFTEN, &prevBits);
@@ -624,6 +881,8 @@ public:
 		module(0),
 		bits(0)
 	{
+		resetDamage();
+
 		const hw_module_t *pModule;
 		hw_get_module(GRALLOC_HARDWARE_MODULE_ID, &pModule);
 		module = (const gralloc_module_t *)pModule;
@@ -660,13 +919,18 @@ public:
 			return false;
 		}
 
+		/* Copy back and the consumer need the rendering completed */
+		finishRendering();
+
 		if (!dirtyRegion.isEmpty()) {
 			/*
 			* Handle eglSetSwapRectangleANDROID()
 			* We copyback from the front buffer
 			*/
 			doCopyBack();
-			oldDirtyRegion = dirtyRegion;
+			queueDamage(dirtyRegion);
+		} else {
+			queueDamage(Rect(buffer->width, buffer->height));
 		}
 
 		if (previousBuffer) {
@@ -847,6 +1111,9 @@ public:
 		if (!buffer)
 			return;
 
+		/* Buffers may come back with unknown contents */
+		resetDamage();
+
 		delete color;
 		color = 0;
 
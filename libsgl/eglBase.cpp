@@ -31,6 +31,8 @@
 #include <unistd.h>
 #include <fcntl.h>
 
+#include <time.h>
+
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/types.h>
@@ -57,7 +59,9 @@
 static const char *const gVendorString     = "OpenFIMG";
 static const char *const gVersionString    = "1.4 pre-alpha";
 static const char *const gClientApisString = "OpenGL_ES";
-static const char *const gExtensionsString = "" PLATFORM_EXTENSIONS_STRING;
+static const char *const gExtensionsString =
+	"EGL_KHR_fence_sync "
+	PLATFORM_EXTENSIONS_STRING;
 
 #ifndef PLATFORM_HAS_FAST_TLS
 pthread_key_t eglContextKey = -1;
@@ -1041,6 +1045,10 @@ static EGLBoolean fglMakeCurrent(FGLContext *gl, FGLRenderSurface *d)
 {
 	FGLContext *current = getGlThreadSpecific();
 
+	/* Let others use the GPU while contexts are being switched */
+	if (current)
+		fimgReleaseHardware(current->fimg);
+
 	/* Current context (if available) should get detached */
 	if (!gl) {
 		if (!current)
@@ -1236,10 +1244,10 @@ EGLAPI EGLBoolean EGLAPIENTRY eglSwapBuffers(EGLDisplay dpy, EGLSurface surface)
 		return EGL_FALSE;
 	}
 
-	/* Flush the context attached to the surface if it's current */
-	FGLContext *ctx = getGlThreadSpecific();
-	if ((FGLContext *)d->ctx == ctx)
-		glFinish();
+	/*
+	 * Rendering is waited for by the surface itself, right before
+	 * the buffer is posted, see FGLRenderSurface::finishRendering().
+	 */
 
 	/* post the surface */
 	if (!d->swapBuffers())
@@ -1250,11 +1258,21 @@ EGLAPI EGLBoolean EGLAPIENTRY eglSwapBuffers(EGLDisplay dpy, EGLSurface surface)
 	if (d->ctx != EGL_NO_CONTEXT) {
 		FGLContext *c = (FGLContext *)d->ctx;
 		d->bindDrawSurface(c);
+		fimgEndFrame(c->fimg);
+		fimgReleaseHardware(c->fimg);
 	}
 
 	return EGL_TRUE;
 }
 
+void FGLRenderSurface::finishRendering()
+{
+	/* Flush the context attached to the surface if it's current */
+	FGLContext *gl = getGlThreadSpecific();
+	if (gl && (FGLContext *)ctx == gl)
+		glFinish();
+}
+
 EGLAPI EGLBoolean EGLAPIENTRY eglCopyBuffers(EGLDisplay dpy, EGLSurface surface,
 			EGLNativePixmapType target)
 {
@@ -1262,6 +1280,231 @@ EGLAPI EGLBoolean EGLAPIENTRY eglCopyBuffers(EGLDisplay dpy, EGLSurface surface,
 	return EGL_FALSE;
 }
 
+/*
+ * Fence sync objects
+ */
+
+/* Interval of polling for fences waited for with finite timeout */
+#define FGL_SYNC_POLL_INTERVAL	500 /* us */
+
+/*
+ * Fences are shared by all contexts of the process, but checking them needs
+ * the hardware. Contexts of other threads cannot be used for this, as they
+ * may be in use or destroyed at any time, so the sync code opens its own
+ * fimg context on first use and keeps it for the lifetime of the process.
+ * Access to it is serialized by fglSyncMutex.
+ */
+static pthread_mutex_t fglSyncMutex = PTHREAD_MUTEX_INITIALIZER;
+static fimgContext *fglSyncFimg;
+
+static bool fglInitSyncFimg(void)
+{
+	bool ret;
+
+	pthread_mutex_lock(&fglSyncMutex);
+	if (!fglSyncFimg)
+		fglSyncFimg = fimgCreateContext();
+	ret = (fglSyncFimg != NULL);
+	pthread_mutex_unlock(&fglSyncMutex);
+
+	return ret;
+}
+
+struct FGLSync {
+	enum {
+		MAGIC = 0x53474c46 /* FGLS */
+	};
+
+	uint32_t	magic;
+	EGLDisplay	dpy;
+	fimgFence	fence;
+	EGLint		status;
+
+	FGLSync(EGLDisplay dpy, FGLContext *ctx) :
+		magic(MAGIC),
+		dpy(dpy),
+		fence(fimgCreateFence(ctx->fimg)),
+		status(EGL_UNSIGNALED_KHR) {}
+
+	~FGLSync()
+	{
+		magic = 0;
+	}
+
+	bool isValid() const
+	{
+		return magic == MAGIC;
+	}
+
+	bool poll()
+	{
+		if (status == EGL_SIGNALED_KHR)
+			return true;
+
+		if (fimgFenceExpired(fence)) {
+			status = EGL_SIGNALED_KHR;
+			return true;
+		}
+
+		pthread_mutex_lock(&fglSyncMutex);
+		if (fimgFenceSignaled(fglSyncFimg, fence))
+			status = EGL_SIGNALED_KHR;
+		pthread_mutex_unlock(&fglSyncMutex);
+
+		return status == EGL_SIGNALED_KHR;
+	}
+
+	void wait()
+	{
+		if (status == EGL_SIGNALED_KHR)
+			return;
+
+		if (!fimgFenceExpired(fence)) {
+			pthread_mutex_lock(&fglSyncMutex);
+			fimgWaitFence(fglSyncFimg, fence);
+			pthread_mutex_unlock(&fglSyncMutex);
+		}
+
+		status = EGL_SIGNALED_KHR;
+	}
+};
+
+static inline FGLSync *fglEGLValidateSync(EGLDisplay dpy, EGLSyncKHR sync)
+{
+	FGLSync *s = (FGLSync *)sync;
+
+	if (!fglEGLValidateDisplay(dpy)) {
+		setError(EGL_BAD_DISPLAY);
+		return 0;
+	}
+
+	if (!s || !s->isValid() || s->dpy != dpy) {
+		setError(EGL_BAD_PARAMETER);
+		return 0;
+	}
+
+	return s;
+}
+
+static inline uint64_t fglGetTime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+extern void fglSubmitDraws(FGLContext *ctx);
+
+EGLAPI EGLSyncKHR EGLAPIENTRY eglCreateSyncKHR(EGLDisplay dpy,
+				EGLenum type, const EGLint *attrib_list)
+{
+	if (!fglEGLValidateDisplay(dpy)) {
+		setError(EGL_BAD_DISPLAY);
+		return EGL_NO_SYNC_KHR;
+	}
+
+	if (type != EGL_SYNC_FENCE_KHR
+	    || (attrib_list && attrib_list[0] != EGL_NONE)) {
+		setError(EGL_BAD_ATTRIBUTE);
+		return EGL_NO_SYNC_KHR;
+	}
+
+	FGLContext *ctx = getGlThreadSpecific();
+	if (!ctx || ctx->egl.dpy != dpy) {
+		setError(EGL_BAD_MATCH);
+		return EGL_NO_SYNC_KHR;
+	}
+
+	/* The fence must cover merged draws that are still waiting */
+	if (ctx->drawBatch.pending)
+		fglSubmitDraws(ctx);
+
+	if (!fglInitSyncFimg()) {
+		setError(EGL_BAD_ALLOC);
+		return EGL_NO_SYNC_KHR;
+	}
+
+	FGLSync *sync = new FGLSync(dpy, ctx);
+	if (!sync) {
+		setError(EGL_BAD_ALLOC);
+		return EGL_NO_SYNC_KHR;
+	}
+
+	return (EGLSyncKHR)sync;
+}
+
+EGLAPI EGLBoolean EGLAPIENTRY eglDestroySyncKHR(EGLDisplay dpy,
+							EGLSyncKHR sync)
+{
+	FGLSync *s = fglEGLValidateSync(dpy, sync);
+	if (!s)
+		return EGL_FALSE;
+
+	delete s;
+	return EGL_TRUE;
+}
+
+EGLAPI EGLint EGLAPIENTRY eglClientWaitSyncKHR(EGLDisplay dpy,
+			EGLSyncKHR sync, EGLint flags, EGLTimeKHR timeout)
+{
+	FGLSync *s = fglEGLValidateSync(dpy, sync);
+	if (!s)
+		return EGL_FALSE;
+
+	/*
+	 * Merged draws are submitted when the fence is created, so there is
+	 * nothing to do for EGL_SYNC_FLUSH_COMMANDS_BIT_KHR.
+	 */
+
+	if (s->poll())
+		return EGL_CONDITION_SATISFIED_KHR;
+
+	if (!timeout)
+		return EGL_TIMEOUT_EXPIRED_KHR;
+
+	if (timeout == EGL_FOREVER_KHR) {
+		s->wait();
+		return EGL_CONDITION_SATISFIED_KHR;
+	}
+
+	uint64_t start = fglGetTime();
+	do {
+		usleep(FGL_SYNC_POLL_INTERVAL);
+		if (s->poll())
+			return EGL_CONDITION_SATISFIED_KHR;
+	} while (fglGetTime() - start < timeout);
+
+	return EGL_TIMEOUT_EXPIRED_KHR;
+}
+
+EGLAPI EGLBoolean EGLAPIENTRY eglGetSyncAttribKHR(EGLDisplay dpy,
+			EGLSyncKHR sync, EGLint attribute, EGLint *value)
+{
+	FGLSync *s = fglEGLValidateSync(dpy, sync);
+	if (!s)
+		return EGL_FALSE;
+
+	switch (attribute) {
+	case EGL_SYNC_TYPE_KHR:
+		*value = EGL_SYNC_FENCE_KHR;
+		break;
+	case EGL_SYNC_STATUS_KHR:
+		s->poll();
+		*value = s->status;
+		break;
+	case EGL_SYNC_CONDITION_KHR:
+		*value = EGL_SYNC_PRIOR_COMMANDS_COMPLETE_KHR;
+		break;
+	default:
+		setError(EGL_BAD_ATTRIBUTE);
+		return EGL_FALSE;
+	}
+
+	return EGL_TRUE;
+}
+
 /*
  * Extension management
  */
@@ -1295,8 +1538,26 @@ static const FGLExtensionMap gExtensionMap[] = {
 		(EGLFunc)&glDeleteBuffers },
 	{ "glGenBuffers",
 		(EGLFunc)&glGenBuffers },
+	{ "glMapBufferOES",
+		(EGLFunc)&glMapBufferOES },
+	{ "glUnmapBufferOES",
+		(EGLFunc)&glUnmapBufferOES },
+	{ "glGetBufferPointervOES",
+		(EGLFunc)&glGetBufferPointervOES },
+	{ "glMapBufferRangeEXT",
+		(EGLFunc)&glMapBufferRangeEXT },
+	{ "glFlushMappedBufferRangeEXT",
+		(EGLFunc)&glFlushMappedBufferRangeEXT },
 	{ "glEGLImageTargetTexture2DOES",
 		(EGLFunc)&glEGLImageTargetTexture2DOES },
+	{ "eglCreateSyncKHR",
+		(EGLFunc)&eglCreateSyncKHR },
+	{ "eglDestroySyncKHR",
+		(EGLFunc)&eglDestroySyncKHR },
+	{ "eglClientWaitSyncKHR",
+		(EGLFunc)&eglClientWaitSyncKHR },
+	{ "eglGetSyncAttribKHR",
+		(EGLFunc)&eglGetSyncAttribKHR },
 	{ NULL, NULL }
 };
 
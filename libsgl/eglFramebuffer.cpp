@@ -406,6 +406,9 @@ public:
 			return false;
 		}
 
+		/* Wait for the GPU only before the buffer gets displayed */
+		finishRendering();
+
 		if (color) {
 			manager->put(yoffset);
 			delete color;
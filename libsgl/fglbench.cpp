@@ -0,0 +1,478 @@
+/*
+ * libsgl/fglbench.cpp
+ *
+ * SAMSUNG S3C6410 FIMG-3DSE (PROPER) OPENGL ES IMPLEMENTATION
+ *
+ * Copyrights:	2026 by agent < agent at local >
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks and benchmarks of CPU side code paths, runnable both on the
+ * device and on the build host. Each pixel kernel selected for the CPU
+ * is compared with its scalar reference, including unaligned rows and
+ * odd pixel counts, and both are timed on images of 256x256 to 1024x1024
+ * pixels. Object name management is exercised by several threads doing
+ * gen/bind/delete at the same time, which also checks that no name is
+ * handed out twice. Returns non-zero if any check fails.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "fglkernels.h"
+#include "fglobjectmanager.h"
+
+/*
+ * Helpers
+ */
+
+static uint64_t fglBenchTime(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void fglBenchFill(uint8_t *buf, size_t size, unsigned seed)
+{
+	srand(seed);
+
+	while (size--)
+		*(buf++) = rand() >> 4;
+}
+
+/*
+ * Pixel kernels
+ */
+
+enum {
+	KERNEL_CONVERT,
+	KERNEL_DOWNSAMPLE,
+	KERNEL_DECODE
+};
+
+struct FGLKernelDesc {
+	const char	*name;
+	size_t		offset;
+	int		type;
+	/* Bytes per pixel (per 4x4 block for decoding) */
+	unsigned	srcBpp;
+	unsigned	dstBpp;
+};
+
+#define KERNEL(name, type, srcBpp, dstBpp)	\
+	{ #name, offsetof(FGLKernels, name), type, srcBpp, dstBpp }
+
+static const FGLKernelDesc fglKernelDescs[] = {
+	KERNEL(convertRGB888, KERNEL_CONVERT, 3, 4),
+	KERNEL(convertRGBA8888, KERNEL_CONVERT, 4, 4),
+	KERNEL(convertL8, KERNEL_CONVERT, 1, 2),
+	KERNEL(convertA8, KERNEL_CONVERT, 1, 2),
+	KERNEL(downsampleRGB565, KERNEL_DOWNSAMPLE, 2, 2),
+	KERNEL(downsampleRGBA5551, KERNEL_DOWNSAMPLE, 2, 2),
+	KERNEL(downsampleRGBA4444, KERNEL_DOWNSAMPLE, 2, 2),
+	KERNEL(downsample8888, KERNEL_DOWNSAMPLE, 4, 4),
+	KERNEL(downsampleAL88, KERNEL_DOWNSAMPLE, 2, 2),
+	KERNEL(downsampleL8, KERNEL_DOWNSAMPLE, 1, 1),
+	KERNEL(decodeETC1, KERNEL_DECODE, 8, 2),
+};
+
+#undef KERNEL
+
+#define NUM_KERNELS	(sizeof(fglKernelDescs) / sizeof(fglKernelDescs[0]))
+
+/* Images of (FGL_BENCH_MIN_SIZE << i) pixels squared */
+#define FGL_BENCH_MIN_SIZE	256
+#define FGL_BENCH_MAX_SIZE	1024
+/* Number of pixels processed in each measurement */
+#define FGL_BENCH_PIXELS	(16 * 1024 * 1024)
+/* Extra bytes to shift rows off word alignment */
+#define FGL_BENCH_SLACK		16
+
+static void *fglKernel(const FGLKernels *set, const FGLKernelDesc *desc)
+{
+	return *(void **)((const uint8_t *)set + desc->offset);
+}
+
+/*
+ * Processes a whole image of size x size pixels. Source and destination
+ * rows are tightly packed and start at given offsets from the buffers.
+ * Count is the number of pixels (blocks for decoding) to process in each
+ * row, to test tails not covered by optimized loops.
+ */
+static void fglRunKernel(const FGLKernels *set, const FGLKernelDesc *desc,
+				uint8_t *dst, const uint8_t *src,
+				unsigned size, unsigned count)
+{
+	void *kernel = fglKernel(set, desc);
+	unsigned y;
+
+	switch (desc->type) {
+	case KERNEL_CONVERT: {
+		FGLConvertKernel convert = (FGLConvertKernel)kernel;
+
+		for (y = 0; y < size; ++y)
+			convert(dst + y*size*desc->dstBpp,
+				src + y*size*desc->srcBpp, count);
+		break; }
+	case KERNEL_DOWNSAMPLE: {
+		FGLDownsampleKernel downsample = (FGLDownsampleKernel)kernel;
+		unsigned srcStride = size*desc->srcBpp;
+		unsigned dstStride = size/2*desc->dstBpp;
+
+		for (y = 0; y < size/2; ++y)
+			downsample(dst + y*dstStride, src + 2*y*srcStride,
+					src + (2*y + 1)*srcStride, count);
+		/* Single row case, used for 1-pixel high levels */
+		downsample(dst + size/2*dstStride, src, src, count);
+		break; }
+	case KERNEL_DECODE: {
+		FGLDecodeKernel decode = (FGLDecodeKernel)kernel;
+		unsigned srcStride = size/4*desc->srcBpp;
+		unsigned dstStride = size*desc->dstBpp;
+
+		for (y = 0; y < size/4; ++y)
+			decode(dst + 4*y*dstStride, dstStride,
+					src + y*srcStride, count);
+		break; }
+	}
+}
+
+static size_t fglKernelDstSize(const FGLKernelDesc *desc, unsigned size)
+{
+	if (desc->type == KERNEL_DOWNSAMPLE)
+		return (size/2 + 1)*size/2*desc->dstBpp;
+
+	return size*size*desc->dstBpp;
+}
+
+static unsigned fglKernelCount(const FGLKernelDesc *desc, unsigned size)
+{
+	switch (desc->type) {
+	case KERNEL_DOWNSAMPLE:
+		return size/2;
+	case KERNEL_DECODE:
+		return size/4;
+	default:
+		return size;
+	}
+}
+
+/* Compares results of both sets with given alignment and row length */
+static bool fglCheckKernel(const FGLKernels *set, const FGLKernelDesc *desc,
+				uint8_t *dstRef, uint8_t *dst, const uint8_t *src,
+				unsigned size, unsigned srcOffset,
+				unsigned dstOffset, unsigned count)
+{
+	size_t dstSize = fglKernelDstSize(desc, size) + FGL_BENCH_SLACK;
+
+	memset(dstRef, 0xcd, dstSize);
+	memset(dst, 0xcd, dstSize);
+
+	fglRunKernel(&fglScalarKernels, desc, dstRef + dstOffset,
+					src + srcOffset, size, count);
+	fglRunKernel(set, desc, dst + dstOffset, src + srcOffset, size, count);
+
+	if (!memcmp(dstRef, dst, dstSize))
+		return true;
+
+	printf("%s: mismatch at size %u, count %u, offsets %u/%u\n",
+			desc->name, size, count, srcOffset, dstOffset);
+	return false;
+}
+
+static double fglTimeKernel(const FGLKernels *set, const FGLKernelDesc *desc,
+				uint8_t *dst, const uint8_t *src, unsigned size)
+{
+	unsigned count = fglKernelCount(desc, size);
+	unsigned reps = FGL_BENCH_PIXELS / (size*size);
+	uint64_t start;
+	unsigned i;
+
+	/* Warm up caches */
+	fglRunKernel(set, desc, dst, src, size, count);
+
+	start = fglBenchTime();
+	for (i = 0; i < reps; ++i)
+		fglRunKernel(set, desc, dst, src, size, count);
+
+	/* Nanoseconds per source pixel */
+	return (double)(fglBenchTime() - start) / reps / (size*size);
+}
+
+static int fglBenchKernels(void)
+{
+	const FGLKernels *set = fglGetKernels();
+	unsigned maxSrc = 4*FGL_BENCH_MAX_SIZE*FGL_BENCH_MAX_SIZE;
+	unsigned maxDst = 4*FGL_BENCH_MAX_SIZE*(FGL_BENCH_MAX_SIZE + 1);
+	uint8_t *src, *dstRef, *dst;
+	int failed = 0;
+	unsigned size;
+	unsigned i;
+
+	src = (uint8_t *)malloc(maxSrc + FGL_BENCH_SLACK);
+	dstRef = (uint8_t *)malloc(maxDst + FGL_BENCH_SLACK);
+	dst = (uint8_t *)malloc(maxDst + FGL_BENCH_SLACK);
+	if (!src || !dstRef || !dst) {
+		printf("Out of memory\n");
+		free(src);
+		free(dstRef);
+		free(dst);
+		return 1;
+	}
+
+	fglBenchFill(src, maxSrc + FGL_BENCH_SLACK, 1);
+
+	printf("Pixel kernels: %s vs %s, ns per pixel\n",
+					set->name, fglScalarKernels.name);
+	printf("%-20s %5s %9s %9s %7s\n", "kernel", "size",
+					"scalar", set->name, "speedup");
+
+	for (i = 0; i < NUM_KERNELS; ++i) {
+		const FGLKernelDesc *desc = &fglKernelDescs[i];
+
+		for (size = FGL_BENCH_MIN_SIZE; size <= FGL_BENCH_MAX_SIZE;
+								size *= 2) {
+			unsigned count = fglKernelCount(desc, size);
+			double scalar, optimized;
+			unsigned offset;
+			bool ok = true;
+
+			ok &= fglCheckKernel(set, desc, dstRef, dst, src,
+						size, 0, 0, count);
+			/* Tails not handled by unrolled loops */
+			ok &= fglCheckKernel(set, desc, dstRef, dst, src,
+						size, 0, 0, count - 1);
+			/* Rows not aligned to a word boundary */
+			for (offset = 1; offset < 4; ++offset) {
+				ok &= fglCheckKernel(set, desc, dstRef, dst,
+					src, size, offset, 0, count);
+				ok &= fglCheckKernel(set, desc, dstRef, dst,
+					src, size, 0, 2*offset, count);
+			}
+
+			if (!ok)
+				++failed;
+
+			scalar = fglTimeKernel(&fglScalarKernels, desc,
+							dst, src, size);
+			optimized = fglTimeKernel(set, desc, dst, src, size);
+
+			printf("%-20s %5u %9.2f %9.2f %6.2fx%s\n",
+				desc->name, size, scalar, optimized,
+				scalar / optimized, ok ? "" : " FAILED");
+		}
+	}
+
+	free(src);
+	free(dstRef);
+	free(dst);
+
+	return failed;
+}
+
+/*
+ * Object names
+ */
+
+/* Same as FGL_MAX_TEXTURE_OBJECTS */
+#define FGL_BENCH_OBJECTS	1024
+/* Names generated and deleted at once by each thread */
+#define FGL_BENCH_BATCH		8
+#define FGL_BENCH_ROUNDS	20000
+#define FGL_BENCH_MAX_THREADS	4
+
+typedef FGLObjectManager<int, FGL_BENCH_OBJECTS> FGLBenchManager;
+
+static FGLBenchManager fglBenchObjects;
+/* Number of threads holding each name, must never exceed 1 */
+static volatile int fglBenchUsers[FGL_BENCH_OBJECTS + 1];
+static volatile int fglBenchErrors;
+/* Serializes all calls, like the mutex used before names were lock-free */
+static pthread_mutex_t fglBenchMutex = PTHREAD_MUTEX_INITIALIZER;
+static bool fglBenchLocked;
+
+static inline void fglBenchLock(void)
+{
+	if (fglBenchLocked)
+		pthread_mutex_lock(&fglBenchMutex);
+}
+
+static inline void fglBenchUnlock(void)
+{
+	if (fglBenchLocked)
+		pthread_mutex_unlock(&fglBenchMutex);
+}
+
+static void fglBenchUse(unsigned name)
+{
+	if (__sync_fetch_and_add(&fglBenchUsers[name], 1))
+		__sync_fetch_and_add(&fglBenchErrors, 1);
+}
+
+static void fglBenchUnuse(unsigned name)
+{
+	__sync_fetch_and_sub(&fglBenchUsers[name], 1);
+}
+
+/* Does what glGenTextures, glBindTexture and glDeleteTextures do */
+static void *fglBenchObjectsThread(void *arg)
+{
+	int objects[FGL_BENCH_BATCH];
+	int names[FGL_BENCH_BATCH + 1];
+	unsigned seed = (uintptr_t)arg;
+	unsigned round, i;
+
+	for (round = 0; round < FGL_BENCH_ROUNDS; ++round) {
+		unsigned count = FGL_BENCH_BATCH;
+
+		/* Gen */
+		for (i = 0; i < FGL_BENCH_BATCH; ++i) {
+			fglBenchLock();
+			names[i] = fglBenchObjects.get(objects);
+			fglBenchUnlock();
+
+			if (names[i] < 0) {
+				__sync_fetch_and_add(&fglBenchErrors, 1);
+				return 0;
+			}
+
+			fglBenchUse(names[i]);
+		}
+
+		/* Bind, creating objects on first use */
+		for (i = 0; i < FGL_BENCH_BATCH; ++i) {
+			fglBenchLock();
+			if (!fglBenchObjects.isValid(names[i]))
+				__sync_fetch_and_add(&fglBenchErrors, 1);
+			else if (!fglBenchObjects[names[i]])
+				fglBenchObjects[names[i]] = &objects[i];
+			fglBenchUnlock();
+		}
+
+		/* Bind of a name not generated before, racing other threads */
+		seed = seed * 1103515245 + 12345;
+		unsigned name = 1 + (seed >> 16) % FGL_BENCH_OBJECTS;
+
+		fglBenchLock();
+		if (!fglBenchObjects.isValid(name)
+		    && fglBenchObjects.get(name, objects) == (int)name)
+			names[count++] = name;
+		fglBenchUnlock();
+
+		if (count > FGL_BENCH_BATCH)
+			fglBenchUse(name);
+
+		/* Delete */
+		for (i = 0; i < count; ++i) {
+			fglBenchUnuse(names[i]);
+
+			fglBenchLock();
+			fglBenchObjects[names[i]] = NULL;
+			fglBenchObjects.put(names[i]);
+			fglBenchUnlock();
+		}
+	}
+
+	return 0;
+}
+
+static double fglTimeObjects(unsigned threads, bool locked)
+{
+	pthread_t thread[FGL_BENCH_MAX_THREADS];
+	uint64_t start;
+	unsigned i;
+
+	fglBenchLocked = locked;
+
+	start = fglBenchTime();
+
+	for (i = 0; i < threads; ++i)
+		pthread_create(&thread[i], NULL, fglBenchObjectsThread,
+							(void *)(uintptr_t)i);
+
+	for (i = 0; i < threads; ++i)
+		pthread_join(thread[i], NULL);
+
+	/* Nanoseconds per gen, bind and delete of one name */
+	return (double)(fglBenchTime() - start)
+			/ (threads * FGL_BENCH_ROUNDS * FGL_BENCH_BATCH);
+}
+
+static int fglBenchObjectNames(void)
+{
+	unsigned threads;
+	unsigned name;
+	int failed = 0;
+
+	printf("Object names: gen/bind/delete, ns per name\n");
+	printf("%-20s %9s %9s %7s\n", "threads", "mutex",
+						"lock-free", "speedup");
+
+	for (threads = 1; threads <= FGL_BENCH_MAX_THREADS; threads *= 2) {
+		double locked, lockFree;
+		bool ok = true;
+
+		fglBenchErrors = 0;
+
+		locked = fglTimeObjects(threads, true);
+		lockFree = fglTimeObjects(threads, false);
+
+		/* Everything must be freed at the end */
+		for (name = 1; name <= FGL_BENCH_OBJECTS; ++name)
+			if (fglBenchObjects.isValid(name)
+			    || fglBenchUsers[name])
+				++fglBenchErrors;
+
+		if (fglBenchErrors) {
+			printf("%d names handed out twice or leaked\n",
+							fglBenchErrors);
+			ok = false;
+			++failed;
+		}
+
+		printf("%-20u %9.2f %9.2f %6.2fx%s\n", threads, locked,
+				lockFree, locked / lockFree,
+				ok ? "" : " FAILED");
+	}
+
+	return failed;
+}
+
+int main(int argc, char **argv)
+{
+	int failed = 0;
+
+	failed += fglBenchKernels();
+	failed += fglBenchObjectNames();
+
+	if (failed) {
+		printf("%d checks FAILED\n", failed);
+		return 1;
+	}
+
+	return 0;
+}
@@ -51,27 +51,78 @@ public:
 	}
 };
 
+/*
+ * Copy of an array stored in the buffer, repacked to the layout used by
+ * hardware vertex buffer - word aligned elements following each other.
+ * Identified by offset, stride and element width of the source array.
+ * Covers only the elements used by draws so far.
+ */
+struct FGLPackedArray {
+	int offset;
+	int stride;
+	int width;
+	/* Padded element width (stride of packed data) */
+	int packedWidth;
+	/* Number of elements */
+	int count;
+	void *data;
+};
+
 struct FGLBuffer {
 	void *memory;
 	int size;
 	GLenum usage;
+	bool mapped;
+	int mapOffset;
 	unsigned int name;
 	FGLObject<FGLBuffer, FGLBufferObjectBinding> object;
+	FGLPackedArray packed[FGL_MAX_PACKED_ARRAYS];
+	unsigned int packedNext;
+	/* Total size of packed arrays */
+	int packedSize;
 
 	FGLBuffer(unsigned int name) :
 		memory(0),
 		size(0),
 		usage(GL_STATIC_DRAW),
+		mapped(false),
+		mapOffset(0),
 		name(name),
-		object(this) {};
+		object(this),
+		packedNext(0),
+		packedSize(0)
+	{
+		for (int i = 0; i < FGL_MAX_PACKED_ARRAYS; ++i)
+			packed[i].data = 0;
+	}
 
 	~FGLBuffer()
 	{
 		destroy();
 	}
 
+	void dropPacked(FGLPackedArray *p)
+	{
+		if (!p->data)
+			return;
+
+		free(p->data);
+		p->data = 0;
+		packedSize -= p->count * p->packedWidth;
+	}
+
+	/* Drops packed copies, must be called whenever contents change */
+	void invalidatePacked(void)
+	{
+		for (int i = 0; i < FGL_MAX_PACKED_ARRAYS; ++i)
+			dropPacked(&packed[i]);
+	}
+
 	int create(int s)
 	{
+		mapped = false;
+		invalidatePacked();
+
 		if (size == s)
 			return 0;
 
@@ -96,6 +147,7 @@ struct FGLBuffer {
 		if (unlikely(!isValid()))
 			return;
 
+		invalidatePacked();
 		free(memory);
 		memory = 0;
 		size = 0;
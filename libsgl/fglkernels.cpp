@@ -0,0 +1,725 @@
+/*
+ * libsgl/fglkernels.cpp
+ *
+ * SAMSUNG S3C6410 FIMG-3DSE (PROPER) OPENGL ES IMPLEMENTATION
+ *
+ * Copyrights:	2026 by agent < agent at local >
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "platform.h"
+#include "fglkernels.h"
+
+/*
+ * Scalar kernels
+ */
+
+static void convertRGB888Scalar(void *dst, const void *src, unsigned count)
+{
+	const uint8_t *src8 = (const uint8_t *)src;
+	uint32_t *dst32 = (uint32_t *)dst;
+
+	while (count--) {
+		*(dst32++) = (0xff << 24) | (src8[0] << 16)
+					| (src8[1] << 8) | src8[2];
+		src8 += 3;
+	}
+}
+
+static void convertRGBA8888Scalar(void *dst, const void *src, unsigned count)
+{
+	const uint8_t *src8 = (const uint8_t *)src;
+	uint32_t *dst32 = (uint32_t *)dst;
+
+	while (count--) {
+		*(dst32++) = (src8[3] << 24) | (src8[0] << 16)
+					| (src8[1] << 8) | src8[2];
+		src8 += 4;
+	}
+}
+
+static void convertL8Scalar(void *dst, const void *src, unsigned count)
+{
+	const uint8_t *src8 = (const uint8_t *)src;
+	uint16_t *dst16 = (uint16_t *)dst;
+
+	while (count--)
+		*(dst16++) = 0xff00 | *(src8++);
+}
+
+static void convertA8Scalar(void *dst, const void *src, unsigned count)
+{
+	const uint8_t *src8 = (const uint8_t *)src;
+	uint16_t *dst16 = (uint16_t *)dst;
+
+	while (count--)
+		*(dst16++) = (*(src8++) << 8) | 0xff;
+}
+
+static void downsampleRGB565Scalar(void *dst, const void *src0,
+					const void *src1, unsigned count)
+{
+	const uint16_t *s0 = (const uint16_t *)src0;
+	const uint16_t *s1 = (const uint16_t *)src1;
+	uint16_t *d = (uint16_t *)dst;
+	const uint32_t mask = 0x07e0f81f;
+
+	while (count--) {
+		uint32_t p00 = s0[0];
+		uint32_t p10 = s0[1];
+		uint32_t p01 = s1[0];
+		uint32_t p11 = s1[1];
+
+		/* Spread components, so they can be summed at once */
+		p00 = (p00 | (p00 << 16)) & mask;
+		p10 = (p10 | (p10 << 16)) & mask;
+		p01 = (p01 | (p01 << 16)) & mask;
+		p11 = (p11 | (p11 << 16)) & mask;
+
+		uint32_t grb = ((p00 + p10 + p01 + p11) >> 2) & mask;
+		*(d++) = (grb & 0xffff) | (grb >> 16);
+
+		s0 += 2;
+		s1 += 2;
+	}
+}
+
+static void downsampleRGBA5551Scalar(void *dst, const void *src0,
+					const void *src1, unsigned count)
+{
+	const uint16_t *s0 = (const uint16_t *)src0;
+	const uint16_t *s1 = (const uint16_t *)src1;
+	uint16_t *d = (uint16_t *)dst;
+
+	while (count--) {
+		uint32_t p00 = s0[0];
+		uint32_t p10 = s0[1];
+		uint32_t p01 = s1[0];
+		uint32_t p11 = s1[1];
+
+		uint32_t r = ((p00 >> 11) + (p10 >> 11)
+				+ (p01 >> 11) + (p11 >> 11) + 2) >> 2;
+		uint32_t g = (((p00 >> 6) & 0x1f) + ((p10 >> 6) & 0x1f)
+				+ ((p01 >> 6) & 0x1f) + ((p11 >> 6) & 0x1f)
+				+ 2) >> 2;
+		uint32_t b = (((p00 >> 1) & 0x1f) + ((p10 >> 1) & 0x1f)
+				+ ((p01 >> 1) & 0x1f) + ((p11 >> 1) & 0x1f)
+				+ 2) >> 2;
+		uint32_t a = ((p00 & 1) + (p10 & 1)
+				+ (p01 & 1) + (p11 & 1) + 2) >> 2;
+		*(d++) = (r << 11) | (g << 6) | (b << 1) | a;
+
+		s0 += 2;
+		s1 += 2;
+	}
+}
+
+static void downsampleRGBA4444Scalar(void *dst, const void *src0,
+					const void *src1, unsigned count)
+{
+	const uint16_t *s0 = (const uint16_t *)src0;
+	const uint16_t *s1 = (const uint16_t *)src1;
+	uint16_t *d = (uint16_t *)dst;
+
+	while (count--) {
+		uint32_t p00 = s0[0];
+		uint32_t p10 = s0[1];
+		uint32_t p01 = s1[0];
+		uint32_t p11 = s1[1];
+
+		/* Spread components to separate bytes */
+		p00 = ((p00 << 12) & 0x0f0f0000) | (p00 & 0x0f0f);
+		p10 = ((p10 << 12) & 0x0f0f0000) | (p10 & 0x0f0f);
+		p01 = ((p01 << 12) & 0x0f0f0000) | (p01 & 0x0f0f);
+		p11 = ((p11 << 12) & 0x0f0f0000) | (p11 & 0x0f0f);
+
+		uint32_t rbga = (p00 + p10 + p01 + p11) >> 2;
+		*(d++) = (rbga & 0x0f0f) | ((rbga >> 12) & 0xf0f0);
+
+		s0 += 2;
+		s1 += 2;
+	}
+}
+
+static void downsample8888Scalar(void *dst, const void *src0,
+					const void *src1, unsigned count)
+{
+	const uint32_t *s0 = (const uint32_t *)src0;
+	const uint32_t *s1 = (const uint32_t *)src1;
+	uint32_t *d = (uint32_t *)dst;
+
+	while (count--) {
+		uint32_t p00 = s0[0];
+		uint32_t p10 = s0[1];
+		uint32_t p01 = s1[0];
+		uint32_t p11 = s1[1];
+
+		/* Two components summed at once in 16-bit lanes */
+		uint32_t rb = (p00 & 0x00ff00ff) + (p10 & 0x00ff00ff)
+				+ (p01 & 0x00ff00ff) + (p11 & 0x00ff00ff);
+		uint32_t ga = ((p00 >> 8) & 0x00ff00ff)
+				+ ((p10 >> 8) & 0x00ff00ff)
+				+ ((p01 >> 8) & 0x00ff00ff)
+				+ ((p11 >> 8) & 0x00ff00ff);
+		*(d++) = ((rb >> 2) & 0x00ff00ff) | ((ga << 6) & 0xff00ff00);
+
+		s0 += 2;
+		s1 += 2;
+	}
+}
+
+static void downsampleAL88Scalar(void *dst, const void *src0,
+					const void *src1, unsigned count)
+{
+	const uint8_t *s0 = (const uint8_t *)src0;
+	const uint8_t *s1 = (const uint8_t *)src1;
+	uint8_t *d = (uint8_t *)dst;
+
+	while (count--) {
+		d[0] = (s0[0] + s0[2] + s1[0] + s1[2]) >> 2;
+		d[1] = (s0[1] + s0[3] + s1[1] + s1[3]) >> 2;
+
+		d += 2;
+		s0 += 4;
+		s1 += 4;
+	}
+}
+
+static void downsampleL8Scalar(void *dst, const void *src0,
+					const void *src1, unsigned count)
+{
+	const uint8_t *s0 = (const uint8_t *)src0;
+	const uint8_t *s1 = (const uint8_t *)src1;
+	uint8_t *d = (uint8_t *)dst;
+
+	while (count--) {
+		*(d++) = (s0[0] + s0[1] + s1[0] + s1[1]) >> 2;
+
+		s0 += 2;
+		s1 += 2;
+	}
+}
+
+/*
+ * ETC1 block is a pair of 64-bit big endian words. Each half of the block
+ * (left and right or top and bottom, if flipped) has a base color, which
+ * every pixel modifies by one of four values of a table selected for the
+ * half. The four colors of both halves are computed first, so pixels are
+ * just looked up.
+ */
+
+static const int etc1Modifiers[8][2] = {
+	{  2,   8 }, {  5,  17 }, {  9,  29 }, { 13,  42 },
+	{ 18,  60 }, { 24,  80 }, { 33, 106 }, { 47, 183 },
+};
+
+static inline uint32_t etc1Word(const uint8_t *src)
+{
+	return (src[0] << 24) | (src[1] << 16) | (src[2] << 8) | src[3];
+}
+
+/* Base colors of both halves as 0x00BBGGRR */
+static inline void etc1BaseColors(uint32_t hi, uint32_t *base)
+{
+	unsigned c0[3], c1[3];
+
+	for (int i = 0; i < 3; ++i) {
+		unsigned shift = 24 - 8*i;
+
+		if (hi & 2) {
+			/* Differential mode, 5-bit color and 3-bit delta */
+			int delta = ((int)(hi << (29 - shift)) >> 29);
+			unsigned c = (hi >> (shift + 3)) & 0x1f;
+
+			c0[i] = (c << 3) | (c >> 2);
+			c = (c + delta) & 0x1f;
+			c1[i] = (c << 3) | (c >> 2);
+		} else {
+			/* Individual mode, two 4-bit colors */
+			unsigned c = (hi >> (shift + 4)) & 0xf;
+
+			c0[i] = (c << 4) | c;
+			c = (hi >> shift) & 0xf;
+			c1[i] = (c << 4) | c;
+		}
+	}
+
+	base[0] = c0[0] | (c0[1] << 8) | (c0[2] << 16);
+	base[1] = c1[0] | (c1[1] << 8) | (c1[2] << 16);
+}
+
+static inline uint16_t etc1PackRGB565(uint32_t bgr)
+{
+	return ((bgr & 0xf8) << 8) | ((bgr >> 5) & 0x7e0) | ((bgr >> 19) & 0x1f);
+}
+
+/* Pixel indices are stored column by column, LSBs in low half of lo */
+static inline void etc1WritePixels(void *dst, size_t stride,
+			const uint16_t (*colors)[4], uint32_t hi, uint32_t lo)
+{
+	uint8_t *row = (uint8_t *)dst;
+	bool flip = hi & 1;
+
+	for (unsigned y = 0; y < 4; ++y, row += stride) {
+		uint16_t *d = (uint16_t *)row;
+
+		for (unsigned x = 0; x < 4; ++x) {
+			unsigned i = 4*x + y;
+			unsigned idx = ((lo >> (i + 15)) & 2) | ((lo >> i) & 1);
+			unsigned half = flip ? (y >> 1) : (x >> 1);
+
+			d[x] = colors[half][idx];
+		}
+	}
+}
+
+static inline uint8_t etc1Clamp(int c)
+{
+	return (c < 0) ? 0 : ((c > 255) ? 255 : c);
+}
+
+static void decodeETC1Scalar(void *dst, size_t stride,
+					const void *src, unsigned count)
+{
+	const uint8_t *src8 = (const uint8_t *)src;
+	uint8_t *dst8 = (uint8_t *)dst;
+
+	while (count--) {
+		uint32_t hi = etc1Word(src8);
+		uint32_t lo = etc1Word(src8 + 4);
+		uint16_t colors[2][4];
+		uint32_t base[2];
+
+		etc1BaseColors(hi, base);
+
+		for (unsigned half = 0; half < 2; ++half) {
+			const int *mod = etc1Modifiers[(hi >> (5 - 3*half)) & 7];
+			static const int sign[4] = { 1, 1, -1, -1 };
+
+			for (unsigned idx = 0; idx < 4; ++idx) {
+				int m = sign[idx] * mod[idx & 1];
+				uint32_t c = base[half];
+
+				c = etc1Clamp((c & 0xff) + m)
+					| (etc1Clamp(((c >> 8) & 0xff) + m) << 8)
+					| (etc1Clamp((c >> 16) + m) << 16);
+				colors[half][idx] = etc1PackRGB565(c);
+			}
+		}
+
+		etc1WritePixels(dst8, stride, colors, hi, lo);
+
+		src8 += 8;
+		dst8 += 4 * 2;
+	}
+}
+
+const FGLKernels fglScalarKernels = {
+	"scalar",
+	convertRGB888Scalar,
+	convertRGBA8888Scalar,
+	convertL8Scalar,
+	convertA8Scalar,
+	downsampleRGB565Scalar,
+	downsampleRGBA5551Scalar,
+	downsampleRGBA4444Scalar,
+	downsample8888Scalar,
+	downsampleAL88Scalar,
+	downsampleL8Scalar,
+	decodeETC1Scalar,
+};
+
+/*
+ * ARMv6 SIMD kernels
+ *
+ * Byte components are unpacked to 16-bit lanes with UXTB16 and summed
+ * with UXTAB16, which both take an optional rotation, so even and odd
+ * bytes of a word are handled with two instructions and no masking.
+ * Lanes are packed back with PKHBT/PKHTB and pixel byte order is swapped
+ * with REV. Words are loaded directly, so rows not aligned to a word
+ * boundary are passed to the scalar kernels.
+ */
+
+#if !defined(__thumb__) && (defined(__ARM_ARCH_6__) \
+	|| defined(__ARM_ARCH_6J__) || defined(__ARM_ARCH_6K__) \
+	|| defined(__ARM_ARCH_6Z__) || defined(__ARM_ARCH_6ZK__) \
+	|| defined(__ARM_ARCH_7A__))
+#define FGL_ARMV6_KERNELS
+#endif
+
+#ifdef FGL_ARMV6_KERNELS
+
+static inline uint32_t uxtb16(uint32_t x)
+{
+	uint32_t r;
+	asm ("uxtb16 %0, %1" : "=r"(r) : "r"(x));
+	return r;
+}
+
+static inline uint32_t uxtb16ror8(uint32_t x)
+{
+	uint32_t r;
+	asm ("uxtb16 %0, %1, ror #8" : "=r"(r) : "r"(x));
+	return r;
+}
+
+static inline uint32_t uxtab16(uint32_t acc, uint32_t x)
+{
+	uint32_t r;
+	asm ("uxtab16 %0, %1, %2" : "=r"(r) : "r"(acc), "r"(x));
+	return r;
+}
+
+static inline uint32_t uxtab16ror8(uint32_t acc, uint32_t x)
+{
+	uint32_t r;
+	asm ("uxtab16 %0, %1, %2, ror #8" : "=r"(r) : "r"(acc), "r"(x));
+	return r;
+}
+
+/* Bottom half of lo, bottom half of hi in top half */
+static inline uint32_t pkhbt(uint32_t lo, uint32_t hi)
+{
+	uint32_t r;
+	asm ("pkhbt %0, %1, %2, lsl #16" : "=r"(r) : "r"(lo), "r"(hi));
+	return r;
+}
+
+/* Top half of hi, top half of lo in bottom half */
+static inline uint32_t pkhtb(uint32_t hi, uint32_t lo)
+{
+	uint32_t r;
+	asm ("pkhtb %0, %1, %2, asr #16" : "=r"(r) : "r"(hi), "r"(lo));
+	return r;
+}
+
+static inline uint32_t rev(uint32_t x)
+{
+	uint32_t r;
+	asm ("rev %0, %1" : "=r"(r) : "r"(x));
+	return r;
+}
+
+static inline uint32_t uqadd8(uint32_t a, uint32_t b)
+{
+	uint32_t r;
+	asm ("uqadd8 %0, %1, %2" : "=r"(r) : "r"(a), "r"(b));
+	return r;
+}
+
+static inline uint32_t uqsub8(uint32_t a, uint32_t b)
+{
+	uint32_t r;
+	asm ("uqsub8 %0, %1, %2" : "=r"(r) : "r"(a), "r"(b));
+	return r;
+}
+
+static inline bool isAligned(const void *ptr)
+{
+	return !((uintptr_t)ptr & 3);
+}
+
+static void convertRGB888ARMv6(void *dst, const void *src, unsigned count)
+{
+	const uint32_t *src32 = (const uint32_t *)src;
+	uint32_t *dst32 = (uint32_t *)dst;
+
+	if (!isAligned(src)) {
+		convertRGB888Scalar(dst, src, count);
+		return;
+	}
+
+	/* Four pixels from three words, rgbr gbrg brgb */
+	for (; count >= 4; count -= 4) {
+		uint32_t w0 = src32[0];
+		uint32_t w1 = src32[1];
+		uint32_t w2 = src32[2];
+
+		dst32[0] = 0xff000000 | (rev(w0) >> 8);
+		dst32[1] = 0xff000000 | (rev((w0 >> 24) | (w1 << 8)) >> 8);
+		dst32[2] = 0xff000000 | (rev((w1 >> 16) | (w2 << 16)) >> 8);
+		dst32[3] = 0xff000000 | (rev(w2) & 0x00ffffff);
+
+		src32 += 3;
+		dst32 += 4;
+	}
+
+	if (count)
+		convertRGB888Scalar(dst32, src32, count);
+}
+
+static void convertRGBA8888ARMv6(void *dst, const void *src, unsigned count)
+{
+	const uint32_t *src32 = (const uint32_t *)src;
+	uint32_t *dst32 = (uint32_t *)dst;
+
+	if (!isAligned(src)) {
+		convertRGBA8888Scalar(dst, src, count);
+		return;
+	}
+
+	while (count--) {
+		uint32_t abgr = rev(*(src32++));
+		*(dst32++) = (abgr >> 8) | (abgr << 24);
+	}
+}
+
+static void convertL8ARMv6(void *dst, const void *src, unsigned count)
+{
+	const uint32_t *src32 = (const uint32_t *)src;
+	uint32_t *dst32 = (uint32_t *)dst;
+
+	if (!isAligned(src) || !isAligned(dst)) {
+		convertL8Scalar(dst, src, count);
+		return;
+	}
+
+	for (; count >= 4; count -= 4) {
+		uint32_t w = *(src32++);
+		uint32_t even = uxtb16(w);
+		uint32_t odd = uxtb16ror8(w);
+
+		dst32[0] = 0xff00ff00 | pkhbt(even, odd);
+		dst32[1] = 0xff00ff00 | pkhtb(odd, even);
+		dst32 += 2;
+	}
+
+	if (count)
+		convertL8Scalar(dst32, src32, count);
+}
+
+static void convertA8ARMv6(void *dst, const void *src, unsigned count)
+{
+	const uint32_t *src32 = (const uint32_t *)src;
+	uint32_t *dst32 = (uint32_t *)dst;
+
+	if (!isAligned(src) || !isAligned(dst)) {
+		convertA8Scalar(dst, src, count);
+		return;
+	}
+
+	for (; count >= 4; count -= 4) {
+		uint32_t w = *(src32++);
+		uint32_t even = uxtb16(w);
+		uint32_t odd = uxtb16ror8(w);
+
+		dst32[0] = 0x00ff00ff | (pkhbt(even, odd) << 8);
+		dst32[1] = 0x00ff00ff | (pkhtb(odd, even) << 8);
+		dst32 += 2;
+	}
+
+	if (count)
+		convertA8Scalar(dst32, src32, count);
+}
+
+static void downsample8888ARMv6(void *dst, const void *src0,
+					const void *src1, unsigned count)
+{
+	const uint32_t *s0 = (const uint32_t *)src0;
+	const uint32_t *s1 = (const uint32_t *)src1;
+	uint32_t *d = (uint32_t *)dst;
+
+	while (count--) {
+		uint32_t p00 = s0[0];
+		uint32_t p10 = s0[1];
+		uint32_t p01 = s1[0];
+		uint32_t p11 = s1[1];
+
+		uint32_t rb = uxtab16(uxtab16(uxtab16(uxtb16(p00),
+							p10), p01), p11);
+		uint32_t ga = uxtab16ror8(uxtab16ror8(uxtab16ror8(
+					uxtb16ror8(p00), p10), p01), p11);
+		*(d++) = ((rb >> 2) & 0x00ff00ff) | ((ga << 6) & 0xff00ff00);
+
+		s0 += 2;
+		s1 += 2;
+	}
+}
+
+static void downsampleAL88ARMv6(void *dst, const void *src0,
+					const void *src1, unsigned count)
+{
+	const uint32_t *s0 = (const uint32_t *)src0;
+	const uint32_t *s1 = (const uint32_t *)src1;
+	uint8_t *d = (uint8_t *)dst;
+
+	if (!isAligned(src0) || !isAligned(src1)) {
+		downsampleAL88Scalar(dst, src0, src1, count);
+		return;
+	}
+
+	while (count--) {
+		uint32_t w0 = *(s0++);
+		uint32_t w1 = *(s1++);
+
+		/* Lanes hold sums of left and right pixel of both rows */
+		uint32_t l = uxtab16(uxtb16(w0), w1);
+		uint32_t a = uxtab16ror8(uxtb16ror8(w0), w1);
+		/* Luminance and alpha of left plus those of right pixel */
+		uint32_t la = pkhbt(l, a) + pkhtb(a, l);
+
+		d[0] = la >> 2;
+		d[1] = la >> 18;
+		d += 2;
+	}
+}
+
+static void downsampleL8ARMv6(void *dst, const void *src0,
+					const void *src1, unsigned count)
+{
+	const uint32_t *s0 = (const uint32_t *)src0;
+	const uint32_t *s1 = (const uint32_t *)src1;
+	uint8_t *d = (uint8_t *)dst;
+
+	if (!isAligned(src0) || !isAligned(src1)) {
+		downsampleL8Scalar(dst, src0, src1, count);
+		return;
+	}
+
+	/* Two pixels from four pixels of each row */
+	for (; count >= 2; count -= 2) {
+		uint32_t w0 = *(s0++);
+		uint32_t w1 = *(s1++);
+		uint32_t sum = uxtab16(uxtb16(w0), w1);
+
+		sum = uxtab16ror8(uxtab16ror8(sum, w0), w1);
+		d[0] = sum >> 2;
+		d[1] = sum >> 18;
+		d += 2;
+	}
+
+	if (count)
+		downsampleL8Scalar(d, s0, s1, count);
+}
+
+/*
+ * All three components of ETC1 colors are modified at once, with saturation
+ * given for free by UQADD8 and UQSUB8.
+ */
+static void decodeETC1ARMv6(void *dst, size_t stride,
+					const void *src, unsigned count)
+{
+	const uint8_t *src8 = (const uint8_t *)src;
+	uint8_t *dst8 = (uint8_t *)dst;
+
+	while (count--) {
+		uint32_t hi, lo;
+		uint16_t colors[2][4];
+		uint32_t base[2];
+
+		if (isAligned(src8)) {
+			hi = rev(((const uint32_t *)src8)[0]);
+			lo = rev(((const uint32_t *)src8)[1]);
+		} else {
+			hi = etc1Word(src8);
+			lo = etc1Word(src8 + 4);
+		}
+
+		etc1BaseColors(hi, base);
+
+		for (unsigned half = 0; half < 2; ++half) {
+			const int *mod = etc1Modifiers[(hi >> (5 - 3*half)) & 7];
+			uint32_t a = mod[0] * 0x010101;
+			uint32_t b = mod[1] * 0x010101;
+
+			colors[half][0] = etc1PackRGB565(uqadd8(base[half], a));
+			colors[half][1] = etc1PackRGB565(uqadd8(base[half], b));
+			colors[half][2] = etc1PackRGB565(uqsub8(base[half], a));
+			colors[half][3] = etc1PackRGB565(uqsub8(base[half], b));
+		}
+
+		etc1WritePixels(dst8, stride, colors, hi, lo);
+
+		src8 += 8;
+		dst8 += 4 * 2;
+	}
+}
+
+static const FGLKernels fglARMv6Kernels = {
+	"ARMv6 SIMD",
+	convertRGB888ARMv6,
+	convertRGBA8888ARMv6,
+	convertL8ARMv6,
+	convertA8ARMv6,
+	/*
+	 * 16-bit formats have components not aligned to bytes, which
+	 * the scalar kernels already sum all at once in a single register.
+	 */
+	downsampleRGB565Scalar,
+	downsampleRGBA5551Scalar,
+	downsampleRGBA4444Scalar,
+	downsample8888ARMv6,
+	downsampleAL88ARMv6,
+	downsampleL8ARMv6,
+	decodeETC1ARMv6,
+};
+
+/* Checks architecture version reported by the kernel */
+static bool fglCpuHasARMv6(void)
+{
+	char line[128];
+	bool ret = false;
+	FILE *file;
+
+	file = fopen("/proc/cpuinfo", "r");
+	if (!file)
+		return false;
+
+	while (fgets(line, sizeof(line), file)) {
+		const char *value;
+
+		if (strncmp(line, "CPU architecture", 16))
+			continue;
+
+		value = strchr(line, ':');
+		if (value)
+			ret = (atoi(value + 1) >= 6);
+		break;
+	}
+
+	fclose(file);
+
+	return ret;
+}
+
+#endif /* FGL_ARMV6_KERNELS */
+
+static pthread_once_t kernelsOnce = PTHREAD_ONCE_INIT;
+static const FGLKernels *kernels = &fglScalarKernels;
+
+static void fglSelectKernels(void)
+{
+#ifdef FGL_ARMV6_KERNELS
+	if (fglCpuHasARMv6())
+		kernels = &fglARMv6Kernels;
+#endif
+
+	LOGD("Using %s pixel kernels", kernels->name);
+}
+
+const FGLKernels *fglGetKernels(void)
+{
+	pthread_once(&kernelsOnce, fglSelectKernels);
+	return kernels;
+}
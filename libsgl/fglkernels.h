@@ -0,0 +1,85 @@
+/*
+ * libsgl/fglkernels.h
+ *
+ * SAMSUNG S3C6410 FIMG-3DSE (PROPER) OPENGL ES IMPLEMENTATION
+ *
+ * Copyrights:	2026 by agent < agent at local >
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LIBSGL_FGLKERNELS_
+#define _LIBSGL_FGLKERNELS_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Pixel processing kernels
+ *
+ * Texture format conversion and mipmap generation operate on whole rows
+ * of pixels. Each kernel exists in a portable scalar version and, where
+ * the CPU provides suitable instructions, in an optimized version giving
+ * bit-exact results. The set to use is selected once at runtime.
+ */
+
+/* Converts count pixels of a row */
+typedef void (*FGLConvertKernel)(void *dst, const void *src, unsigned count);
+
+/*
+ * Writes count pixels, each being the average of a 2x2 block made of
+ * pixels 2*i and 2*i + 1 of both source rows. Passing the same row twice
+ * averages pairs of adjacent pixels.
+ */
+typedef void (*FGLDownsampleKernel)(void *dst, const void *src0,
+					const void *src1, unsigned count);
+
+/*
+ * Decodes count blocks of 4x4 pixels, placed side by side, to a region
+ * of destination with rows separated by stride bytes.
+ */
+typedef void (*FGLDecodeKernel)(void *dst, size_t stride,
+					const void *src, unsigned count);
+
+struct FGLKernels {
+	const char		*name;
+
+	/* RGB888 to XRGB8888 (alpha set to 255) */
+	FGLConvertKernel	convertRGB888;
+	/* RGBA8888 to ARGB8888 */
+	FGLConvertKernel	convertRGBA8888;
+	/* L8 to AL88 (alpha set to 255) */
+	FGLConvertKernel	convertL8;
+	/* A8 to AL88 (luminance set to 255) */
+	FGLConvertKernel	convertA8;
+
+	FGLDownsampleKernel	downsampleRGB565;
+	FGLDownsampleKernel	downsampleRGBA5551;
+	FGLDownsampleKernel	downsampleRGBA4444;
+	/* Any format with four 8-bit components */
+	FGLDownsampleKernel	downsample8888;
+	FGLDownsampleKernel	downsampleAL88;
+	FGLDownsampleKernel	downsampleL8;
+
+	/* ETC1 to RGB565 */
+	FGLDecodeKernel		decodeETC1;
+};
+
+/* Reference implementation, available on every CPU */
+extern const FGLKernels fglScalarKernels;
+
+/* Returns the best set of kernels supported by the CPU */
+extern const FGLKernels *fglGetKernels(void);
+
+#endif /* _LIBSGL_FGLKERNELS_ */
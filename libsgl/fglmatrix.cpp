@@ -32,6 +32,287 @@
  *	4x4 matrix (for geometry transformation)
  */
 
+/*
+ *	Classification
+ */
+
+static FGLmatrixType fglClassifyMatrix(const GLfloat *m)
+{
+	if (m[MAT4(0, 3)] != 0 || m[MAT4(1, 3)] != 0
+	    || m[MAT4(2, 3)] != 0 || m[MAT4(3, 3)] != 1)
+		return FGL_MATRIX_TYPE_GENERAL;
+
+	if (m[MAT4(0, 0)] != 1 || m[MAT4(0, 1)] != 0 || m[MAT4(0, 2)] != 0
+	    || m[MAT4(1, 0)] != 0 || m[MAT4(1, 1)] != 1 || m[MAT4(1, 2)] != 0
+	    || m[MAT4(2, 0)] != 0 || m[MAT4(2, 1)] != 0 || m[MAT4(2, 2)] != 1)
+		return FGL_MATRIX_TYPE_AFFINE;
+
+	if (m[MAT4(3, 0)] != 0 || m[MAT4(3, 1)] != 0 || m[MAT4(3, 2)] != 0)
+		return FGL_MATRIX_TYPE_TRANSLATE;
+
+	return FGL_MATRIX_TYPE_IDENTITY;
+}
+
+/*
+ *	Multiplication kernels
+ *
+ *	All of them compute dst = a * b, where dst must not overlap a or b.
+ */
+
+/*
+ * ARM11 VFP can execute arithmetic on short vectors of registers, which
+ * issues one instruction for four multiplications or multiply-accumulates
+ * and keeps the pipeline busy without any scheduling effort. Each column
+ * of the product is a sum of columns of a scaled by elements of column
+ * of b, so columns of a are kept in vector banks and elements of b are
+ * used as scalar operands. Results are the same as of the C version,
+ * because VFP multiply-accumulate rounds after both steps.
+ *
+ * VFPv3 and newer units do not implement short vectors in hardware
+ * anymore, so this is used for ARMv6 only.
+ */
+#if defined(__arm__) && !defined(__thumb__) && defined(__VFP_FP__) \
+	&& !defined(__SOFTFP__) && (defined(__ARM_ARCH_6__) \
+	|| defined(__ARM_ARCH_6J__) || defined(__ARM_ARCH_6K__) \
+	|| defined(__ARM_ARCH_6Z__) || defined(__ARM_ARCH_6ZK__))
+#define FGL_VFP_MATRIX
+#endif
+
+#ifdef FGL_VFP_MATRIX
+
+static void fglMultiplyGeneral(GLfloat *dst, const GLfloat *a,
+							const GLfloat *b)
+{
+	asm volatile (
+		/* Vector length 4, stride 1 */
+		"fmrx	r12, fpscr\n"
+		"bic	r3, r12, #0x00370000\n"
+		"orr	r3, r3, #0x00030000\n"
+		"fmxr	fpscr, r3\n"
+
+		/* Columns of a (banks 1 and 2) */
+		"fldmias	%1, {s8-s23}\n"
+
+		/* Columns 0 and 1 */
+		"fldmias	%2!, {s0-s7}\n"
+		"fmuls	s24, s8, s0\n"
+		"fmuls	s28, s8, s4\n"
+		"fmacs	s24, s12, s1\n"
+		"fmacs	s28, s12, s5\n"
+		"fmacs	s24, s16, s2\n"
+		"fmacs	s28, s16, s6\n"
+		"fmacs	s24, s20, s3\n"
+		"fmacs	s28, s20, s7\n"
+		"fstmias	%0!, {s24-s31}\n"
+
+		/* Columns 2 and 3 */
+		"fldmias	%2, {s0-s7}\n"
+		"fmuls	s24, s8, s0\n"
+		"fmuls	s28, s8, s4\n"
+		"fmacs	s24, s12, s1\n"
+		"fmacs	s28, s12, s5\n"
+		"fmacs	s24, s16, s2\n"
+		"fmacs	s28, s16, s6\n"
+		"fmacs	s24, s20, s3\n"
+		"fmacs	s28, s20, s7\n"
+		"fstmias	%0, {s24-s31}\n"
+
+		/* Back to scalar mode */
+		"fmxr	fpscr, r12\n"
+		: "+r"(dst), "+r"(b)
+		: "r"(a)
+		: "r3", "r12", "memory",
+		  "s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+		  "s8", "s9", "s10", "s11", "s12", "s13", "s14", "s15",
+		  "s16", "s17", "s18", "s19", "s20", "s21", "s22", "s23",
+		  "s24", "s25", "s26", "s27", "s28", "s29", "s30", "s31");
+}
+
+#else
+
+static void fglMultiplyGeneral(GLfloat *dst, const GLfloat *a,
+							const GLfloat *b)
+{
+	for (int i = 0; i < 4; ++i) {
+		dst[MAT4(i, 0)] = a[MAT4(0, 0)]*b[MAT4(i, 0)]
+				+ a[MAT4(1, 0)]*b[MAT4(i, 1)]
+				+ a[MAT4(2, 0)]*b[MAT4(i, 2)]
+				+ a[MAT4(3, 0)]*b[MAT4(i, 3)];
+		dst[MAT4(i, 1)] = a[MAT4(0, 1)]*b[MAT4(i, 0)]
+				+ a[MAT4(1, 1)]*b[MAT4(i, 1)]
+				+ a[MAT4(2, 1)]*b[MAT4(i, 2)]
+				+ a[MAT4(3, 1)]*b[MAT4(i, 3)];
+		dst[MAT4(i, 2)] = a[MAT4(0, 2)]*b[MAT4(i, 0)]
+				+ a[MAT4(1, 2)]*b[MAT4(i, 1)]
+				+ a[MAT4(2, 2)]*b[MAT4(i, 2)]
+				+ a[MAT4(3, 2)]*b[MAT4(i, 3)];
+		dst[MAT4(i, 3)] = a[MAT4(0, 3)]*b[MAT4(i, 0)]
+				+ a[MAT4(1, 3)]*b[MAT4(i, 1)]
+				+ a[MAT4(2, 3)]*b[MAT4(i, 2)]
+				+ a[MAT4(3, 3)]*b[MAT4(i, 3)];
+	}
+}
+
+#endif /* FGL_VFP_MATRIX */
+
+/* Both matrices affine: last row of the product is (0, 0, 0, 1) */
+static void fglMultiplyAffine(GLfloat *dst, const GLfloat *a,
+							const GLfloat *b)
+{
+	for (int i = 0; i < 3; ++i) {
+		dst[MAT4(i, 0)] = a[MAT4(0, 0)]*b[MAT4(i, 0)]
+				+ a[MAT4(1, 0)]*b[MAT4(i, 1)]
+				+ a[MAT4(2, 0)]*b[MAT4(i, 2)];
+		dst[MAT4(i, 1)] = a[MAT4(0, 1)]*b[MAT4(i, 0)]
+				+ a[MAT4(1, 1)]*b[MAT4(i, 1)]
+				+ a[MAT4(2, 1)]*b[MAT4(i, 2)];
+		dst[MAT4(i, 2)] = a[MAT4(0, 2)]*b[MAT4(i, 0)]
+				+ a[MAT4(1, 2)]*b[MAT4(i, 1)]
+				+ a[MAT4(2, 2)]*b[MAT4(i, 2)];
+		dst[MAT4(i, 3)] = 0;
+	}
+
+	dst[MAT4(3, 0)] = a[MAT4(0, 0)]*b[MAT4(3, 0)]
+			+ a[MAT4(1, 0)]*b[MAT4(3, 1)]
+			+ a[MAT4(2, 0)]*b[MAT4(3, 2)]
+			+ a[MAT4(3, 0)];
+	dst[MAT4(3, 1)] = a[MAT4(0, 1)]*b[MAT4(3, 0)]
+			+ a[MAT4(1, 1)]*b[MAT4(3, 1)]
+			+ a[MAT4(2, 1)]*b[MAT4(3, 2)]
+			+ a[MAT4(3, 1)];
+	dst[MAT4(3, 2)] = a[MAT4(0, 2)]*b[MAT4(3, 0)]
+			+ a[MAT4(1, 2)]*b[MAT4(3, 1)]
+			+ a[MAT4(2, 2)]*b[MAT4(3, 2)]
+			+ a[MAT4(3, 2)];
+	dst[MAT4(3, 3)] = 1;
+}
+
+/* Translation b applied first: only last column of a changes */
+static void fglMultiplyTranslateRight(GLfloat *dst, const GLfloat *a,
+							const GLfloat *b)
+{
+	memcpy(dst, a, 12 * sizeof(GLfloat));
+
+	dst[MAT4(3, 0)] = a[MAT4(0, 0)]*b[MAT4(3, 0)]
+			+ a[MAT4(1, 0)]*b[MAT4(3, 1)]
+			+ a[MAT4(2, 0)]*b[MAT4(3, 2)]
+			+ a[MAT4(3, 0)];
+	dst[MAT4(3, 1)] = a[MAT4(0, 1)]*b[MAT4(3, 0)]
+			+ a[MAT4(1, 1)]*b[MAT4(3, 1)]
+			+ a[MAT4(2, 1)]*b[MAT4(3, 2)]
+			+ a[MAT4(3, 1)];
+	dst[MAT4(3, 2)] = a[MAT4(0, 2)]*b[MAT4(3, 0)]
+			+ a[MAT4(1, 2)]*b[MAT4(3, 1)]
+			+ a[MAT4(2, 2)]*b[MAT4(3, 2)]
+			+ a[MAT4(3, 2)];
+	dst[MAT4(3, 3)] = a[MAT4(0, 3)]*b[MAT4(3, 0)]
+			+ a[MAT4(1, 3)]*b[MAT4(3, 1)]
+			+ a[MAT4(2, 3)]*b[MAT4(3, 2)]
+			+ a[MAT4(3, 3)];
+}
+
+/* Translation a applied last: last row of b gets added to other rows */
+static void fglMultiplyTranslateLeft(GLfloat *dst, const GLfloat *a,
+							const GLfloat *b)
+{
+	for (int i = 0; i < 4; ++i) {
+		GLfloat w = b[MAT4(i, 3)];
+
+		dst[MAT4(i, 0)] = b[MAT4(i, 0)] + a[MAT4(3, 0)]*w;
+		dst[MAT4(i, 1)] = b[MAT4(i, 1)] + a[MAT4(3, 1)]*w;
+		dst[MAT4(i, 2)] = b[MAT4(i, 2)] + a[MAT4(3, 2)]*w;
+		dst[MAT4(i, 3)] = w;
+	}
+}
+
+/* Selects the cheapest way to multiply and returns type of the product */
+static FGLmatrixType fglMultiplyMatrices(GLfloat *dst,
+			const GLfloat *a, FGLmatrixType typeA,
+			const GLfloat *b, FGLmatrixType typeB)
+{
+	FGLmatrixType type = (typeA > typeB) ? typeA : typeB;
+
+	if (typeA == FGL_MATRIX_TYPE_IDENTITY) {
+		memcpy(dst, b, 16 * sizeof(GLfloat));
+		return typeB;
+	}
+
+	if (typeB == FGL_MATRIX_TYPE_IDENTITY) {
+		memcpy(dst, a, 16 * sizeof(GLfloat));
+		return typeA;
+	}
+
+	if (typeB == FGL_MATRIX_TYPE_TRANSLATE)
+		fglMultiplyTranslateRight(dst, a, b);
+	else if (typeA == FGL_MATRIX_TYPE_TRANSLATE)
+		fglMultiplyTranslateLeft(dst, a, b);
+	else if (type == FGL_MATRIX_TYPE_AFFINE)
+		fglMultiplyAffine(dst, a, b);
+	else
+		fglMultiplyGeneral(dst, a, b);
+
+	return type;
+}
+
+/*
+	Inverse of affine matrix consists of inverted upper 3x3 matrix and
+	translation by the original one transformed by it and negated.
+*/
+static bool fglInverseAffine(GLfloat *dst, const GLfloat *m)
+{
+	GLfloat det, invDet;
+
+	det =	m[MAT4(0, 0)]*(m[MAT4(1, 1)]*m[MAT4(2, 2)]
+				- m[MAT4(2, 1)]*m[MAT4(1, 2)])
+		- m[MAT4(1, 0)]*(m[MAT4(0, 1)]*m[MAT4(2, 2)]
+				- m[MAT4(2, 1)]*m[MAT4(0, 2)])
+		+ m[MAT4(2, 0)]*(m[MAT4(0, 1)]*m[MAT4(1, 2)]
+				- m[MAT4(1, 1)]*m[MAT4(0, 2)]);
+
+	if(det == 0)
+		// Singular matrix
+		return false;
+
+	invDet = 1/det;
+
+	dst[MAT4(0, 0)] = invDet*(m[MAT4(1, 1)]*m[MAT4(2, 2)]
+					- m[MAT4(2, 1)]*m[MAT4(1, 2)]);
+	dst[MAT4(0, 1)] = invDet*(m[MAT4(2, 1)]*m[MAT4(0, 2)]
+					- m[MAT4(0, 1)]*m[MAT4(2, 2)]);
+	dst[MAT4(0, 2)] = invDet*(m[MAT4(0, 1)]*m[MAT4(1, 2)]
+					- m[MAT4(1, 1)]*m[MAT4(0, 2)]);
+	dst[MAT4(0, 3)] = 0;
+
+	dst[MAT4(1, 0)] = invDet*(m[MAT4(2, 0)]*m[MAT4(1, 2)]
+					- m[MAT4(1, 0)]*m[MAT4(2, 2)]);
+	dst[MAT4(1, 1)] = invDet*(m[MAT4(0, 0)]*m[MAT4(2, 2)]
+					- m[MAT4(2, 0)]*m[MAT4(0, 2)]);
+	dst[MAT4(1, 2)] = invDet*(m[MAT4(1, 0)]*m[MAT4(0, 2)]
+					- m[MAT4(0, 0)]*m[MAT4(1, 2)]);
+	dst[MAT4(1, 3)] = 0;
+
+	dst[MAT4(2, 0)] = invDet*(m[MAT4(1, 0)]*m[MAT4(2, 1)]
+					- m[MAT4(2, 0)]*m[MAT4(1, 1)]);
+	dst[MAT4(2, 1)] = invDet*(m[MAT4(2, 0)]*m[MAT4(0, 1)]
+					- m[MAT4(0, 0)]*m[MAT4(2, 1)]);
+	dst[MAT4(2, 2)] = invDet*(m[MAT4(0, 0)]*m[MAT4(1, 1)]
+					- m[MAT4(1, 0)]*m[MAT4(0, 1)]);
+	dst[MAT4(2, 3)] = 0;
+
+	dst[MAT4(3, 0)] = -(dst[MAT4(0, 0)]*m[MAT4(3, 0)]
+				+ dst[MAT4(1, 0)]*m[MAT4(3, 1)]
+				+ dst[MAT4(2, 0)]*m[MAT4(3, 2)]);
+	dst[MAT4(3, 1)] = -(dst[MAT4(0, 1)]*m[MAT4(3, 0)]
+				+ dst[MAT4(1, 1)]*m[MAT4(3, 1)]
+				+ dst[MAT4(2, 1)]*m[MAT4(3, 2)]);
+	dst[MAT4(3, 2)] = -(dst[MAT4(0, 2)]*m[MAT4(3, 0)]
+				+ dst[MAT4(1, 2)]*m[MAT4(3, 1)]
+				+ dst[MAT4(2, 2)]*m[MAT4(3, 2)]);
+	dst[MAT4(3, 3)] = 1;
+
+	return true;
+}
+
 /*
  *	Matrix loading
  */
@@ -44,6 +325,8 @@ void FGLmatrix::zero(void)
 		(*this)[i][2] = 0;
 		(*this)[i][3] = 0;
 	}
+
+	type = FGL_MATRIX_TYPE_GENERAL;
 }
 
 void FGLmatrix::identity(void)
@@ -54,11 +337,15 @@ void FGLmatrix::identity(void)
 	(*this)[1][1] = 1;
 	(*this)[2][2] = 1;
 	(*this)[3][3] = 1;
+
+	type = FGL_MATRIX_TYPE_IDENTITY;
 }
 
 void FGLmatrix::load(const GLfloat *m)
 {
 	memcpy(data, m, 16 * sizeof(GLfloat));
+
+	type = fglClassifyMatrix(data);
 }
 
 void FGLmatrix::load(const GLfixed *m)
@@ -69,6 +356,8 @@ void FGLmatrix::load(const GLfixed *m)
 		(*this)[x][2] = floatFromFixed(m[MAT4(x, 2)]);
 		(*this)[x][3] = floatFromFixed(m[MAT4(x, 3)]);
 	}
+
+	type = fglClassifyMatrix(data);
 }
 
 void FGLmatrix::rotate(GLfloat angle, GLfloat x, GLfloat y, GLfloat z)
@@ -113,6 +402,8 @@ void FGLmatrix::rotate(GLfloat angle, GLfloat x, GLfloat y, GLfloat z)
 	(*this)[0][2] = xz * ci - ys;
 	(*this)[1][2] = yz * ci + xs;
 	(*this)[2][2] = z2 * ci + c;
+
+	type = FGL_MATRIX_TYPE_AFFINE;
 }
 
 void FGLmatrix::translate(GLfloat x, GLfloat y, GLfloat z)
@@ -122,6 +413,8 @@ void FGLmatrix::translate(GLfloat x, GLfloat y, GLfloat z)
 	(*this)[3][0] = x;
 	(*this)[3][1] = y;
 	(*this)[3][2] = z;
+
+	type = FGL_MATRIX_TYPE_TRANSLATE;
 }
 
 void FGLmatrix::scale(GLfloat x, GLfloat y, GLfloat z)
@@ -131,6 +424,8 @@ void FGLmatrix::scale(GLfloat x, GLfloat y, GLfloat z)
 	(*this)[0][0] = x;
 	(*this)[1][1] = y;
 	(*this)[2][2] = z;
+
+	type = FGL_MATRIX_TYPE_AFFINE;
 }
 
 void FGLmatrix::frustum(GLfloat l, GLfloat r, GLfloat b, GLfloat t,
@@ -149,6 +444,8 @@ void FGLmatrix::frustum(GLfloat l, GLfloat r, GLfloat b, GLfloat t,
 
 	(*this)[3][2] = (-2.0 * f * n) / (f - n);
 	(*this)[3][3] = 0.0f ;
+
+	type = FGL_MATRIX_TYPE_GENERAL;
 }
 
 void FGLmatrix::ortho(GLfloat l, GLfloat r, GLfloat b, GLfloat t,
@@ -165,6 +462,8 @@ void FGLmatrix::ortho(GLfloat l, GLfloat r, GLfloat b, GLfloat t,
 	(*this)[3][0] = (r + l) / (l - r);
 	(*this)[3][1] = (t + b) / (b - t);
 	(*this)[3][2] = (f + n) / (n - f);
+
+	type = FGL_MATRIX_TYPE_AFFINE;
 }
 
 void FGLmatrix::inverseTranslate(GLfloat x, GLfloat y, GLfloat z)
@@ -174,6 +473,8 @@ void FGLmatrix::inverseTranslate(GLfloat x, GLfloat y, GLfloat z)
 	(*this)[3][0] = -x;
 	(*this)[3][1] = -y;
 	(*this)[3][2] = -z;
+
+	type = FGL_MATRIX_TYPE_TRANSLATE;
 }
 
 /*
@@ -187,6 +488,8 @@ void FGLmatrix::inverseScale(GLfloat x, GLfloat y, GLfloat z)
 	(*this)[0][0] = 1.0f/x;
 	(*this)[1][1] = 1.0f/y;
 	(*this)[2][2] = 1.0f/z;
+
+	type = FGL_MATRIX_TYPE_AFFINE;
 }
 
 /*
@@ -206,6 +509,8 @@ void FGLmatrix::inverseFrustum(GLfloat left, GLfloat right,
 	(*this)[3][1] = (bottom + top) / (2 * zNear);
 	(*this)[3][2] = -1;
 	(*this)[3][3] = (zFar + zNear) / (-2 * zFar * zNear);
+
+	type = FGL_MATRIX_TYPE_GENERAL;
 }
 
 /*
@@ -223,6 +528,8 @@ void FGLmatrix::inverseOrtho(GLfloat left, GLfloat right,
 	(*this)[3][0] = (left + right) / 2;
 	(*this)[3][1] = (bottom + top) / 2;
 	(*this)[3][2] = (zNear + zFar) / -2;
+
+	type = FGL_MATRIX_TYPE_AFFINE;
 }
 
 /*
@@ -236,53 +543,30 @@ void FGLmatrix::multiply(const GLfloat *m)
 	index ^= 1;
 	work = &storage[16*index];
 
-	for (int i = 0; i < 4; ++i) {
-		work[MAT4(i, 0)] = (*this)[0][0]*m[MAT4(i, 0)]
-					+ (*this)[1][0]*m[MAT4(i, 1)]
-					+ (*this)[2][0]*m[MAT4(i, 2)]
-					+ (*this)[3][0]*m[MAT4(i, 3)];
-		work[MAT4(i, 1)] = (*this)[0][1]*m[MAT4(i, 0)]
-					+ (*this)[1][1]*m[MAT4(i, 1)]
-					+ (*this)[2][1]*m[MAT4(i, 2)]
-					+ (*this)[3][1]*m[MAT4(i, 3)];
-		work[MAT4(i, 2)] = (*this)[0][2]*m[MAT4(i, 0)]
-					+ (*this)[1][2]*m[MAT4(i, 1)]
-					+ (*this)[2][2]*m[MAT4(i, 2)]
-					+ (*this)[3][2]*m[MAT4(i, 3)];
-		work[MAT4(i, 3)] = (*this)[0][3]*m[MAT4(i, 0)]
-					+ (*this)[1][3]*m[MAT4(i, 1)]
-					+ (*this)[2][3]*m[MAT4(i, 2)]
-					+ (*this)[3][3]*m[MAT4(i, 3)];
-	}
+	type = fglMultiplyMatrices(work, data, type,
+						m, fglClassifyMatrix(m));
 
 	data = work;
 }
 
 void FGLmatrix::multiply(const GLfixed *m)
+{
+	GLfloat tmp[16];
+
+	for (int i = 0; i < 16; ++i)
+		tmp[i] = floatFromFixed(m[i]);
+
+	multiply(tmp);
+}
+
+void FGLmatrix::multiply(FGLmatrix const &m)
 {
 	GLfloat *work;
 
 	index ^= 1;
 	work = &storage[16*index];
 
-	for (int i = 0; i < 4; ++i) {
-		work[MAT4(i, 0)] = (*this)[0][0]*floatFromFixed(m[MAT4(i, 0)])
-				+ (*this)[1][0]*floatFromFixed(m[MAT4(i, 1)])
-				+ (*this)[2][0]*floatFromFixed(m[MAT4(i, 2)])
-				+ (*this)[3][0]*floatFromFixed(m[MAT4(i, 3)]);
-		work[MAT4(i, 1)] = (*this)[0][1]*floatFromFixed(m[MAT4(i, 0)])
-				+ (*this)[1][1]*floatFromFixed(m[MAT4(i, 1)])
-				+ (*this)[2][1]*floatFromFixed(m[MAT4(i, 2)])
-				+ (*this)[3][1]*floatFromFixed(m[MAT4(i, 3)]);
-		work[MAT4(i, 2)] = (*this)[0][2]*floatFromFixed(m[MAT4(i, 0)])
-				+ (*this)[1][2]*floatFromFixed(m[MAT4(i, 1)])
-				+ (*this)[2][2]*floatFromFixed(m[MAT4(i, 2)])
-				+ (*this)[3][2]*floatFromFixed(m[MAT4(i, 3)]);
-		work[MAT4(i, 3)] = (*this)[0][3]*floatFromFixed(m[MAT4(i, 0)])
-				+ (*this)[1][3]*floatFromFixed(m[MAT4(i, 1)])
-				+ (*this)[2][3]*floatFromFixed(m[MAT4(i, 2)])
-				+ (*this)[3][3]*floatFromFixed(m[MAT4(i, 3)]);
-	}
+	type = fglMultiplyMatrices(work, data, type, m.data, m.type);
 
 	data = work;
 }
@@ -294,48 +578,21 @@ void FGLmatrix::leftMultiply(FGLmatrix const &m)
 	index ^= 1;
 	work = &storage[16*index];
 
-	for (int i = 0; i < 4; ++i) {
-		work[MAT4(i, 0)] = m[0][0]*(*this)[i][0]
-					+ m[1][0]*(*this)[i][1]
-					+ m[2][0]*(*this)[i][2]
-					+ m[3][0]*(*this)[i][3];
-		work[MAT4(i, 1)] = m[0][1]*(*this)[i][0]
-					+ m[1][1]*(*this)[i][1]
-					+ m[2][1]*(*this)[i][2]
-					+ m[3][1]*(*this)[i][3];
-		work[MAT4(i, 2)] = m[0][2]*(*this)[i][0]
-					+ m[1][2]*(*this)[i][1]
-					+ m[2][2]*(*this)[i][2]
-					+ m[3][2]*(*this)[i][3];
-		work[MAT4(i, 3)] = m[0][3]*(*this)[i][0]
-					+ m[1][3]*(*this)[i][1]
-					+ m[2][3]*(*this)[i][2]
-					+ m[3][3]*(*this)[i][3];
-	}
+	type = fglMultiplyMatrices(work, m.data, m.type, data, type);
 
 	data = work;
 }
 
 void FGLmatrix::multiply(const FGLmatrix &a, const FGLmatrix &b)
 {
-	for (int i = 0; i < 4; ++i) {
-		(*this)[i][0] = a[0][0]*b[i][0]
-				+ a[1][0]*b[i][1]
-				+ a[2][0]*b[i][2]
-				+ a[3][0]*b[i][3];
-		(*this)[i][1] = a[0][1]*b[i][0]
-				+ a[1][1]*b[i][1]
-				+ a[2][1]*b[i][2]
-				+ a[3][1]*b[i][3];
-		(*this)[i][2] = a[0][2]*b[i][0]
-				+ a[1][2]*b[i][1]
-				+ a[2][2]*b[i][2]
-				+ a[3][2]*b[i][3];
-		(*this)[i][3] = a[0][3]*b[i][0]
-				+ a[1][3]*b[i][1]
-				+ a[2][3]*b[i][2]
-				+ a[3][3]*b[i][3];
-	}
+	GLfloat *work;
+
+	index ^= 1;
+	work = &storage[16*index];
+
+	type = fglMultiplyMatrices(work, a.data, a.type, b.data, b.type);
+
+	data = work;
 }
 
 void FGLmatrix::inverse(void)
@@ -343,8 +600,24 @@ void FGLmatrix::inverse(void)
 	GLfloat det, invDet;
 	GLfloat *work;
 
-	index ^= 1;
-	work = &storage[16*index];
+	switch (type) {
+	case FGL_MATRIX_TYPE_IDENTITY:
+		return;
+	case FGL_MATRIX_TYPE_TRANSLATE:
+		(*this)[3][0] = -(*this)[3][0];
+		(*this)[3][1] = -(*this)[3][1];
+		(*this)[3][2] = -(*this)[3][2];
+		return;
+	case FGL_MATRIX_TYPE_AFFINE:
+		work = &storage[16*(index ^ 1)];
+		if (!fglInverseAffine(work, data))
+			return;
+		index ^= 1;
+		data = work;
+		return;
+	default:
+		break;
+	}
 
 	det =	((*this)[0][3]*(*this)[1][2]*(*this)[2][1]*(*this)[3][0]) -
 		((*this)[0][2]*(*this)[1][3]*(*this)[2][1]*(*this)[3][0]) -
@@ -377,6 +650,9 @@ void FGLmatrix::inverse(void)
 
 	invDet = 1/det;
 
+	index ^= 1;
+	work = &storage[16*index];
+
 	work[MAT4(0, 0)] = invDet*((-(*this)[1][3]*(*this)[2][2]*(*this)[3][1])
 				+ ((*this)[1][2]*(*this)[2][3]*(*this)[3][1])
 				+ ((*this)[1][3]*(*this)[2][1]*(*this)[3][2])
@@ -495,4 +771,7 @@ void FGLmatrix::transpose(void)
 	}
 
 	data = work;
+
+	if (type != FGL_MATRIX_TYPE_IDENTITY)
+		type = fglClassifyMatrix(data);
 }
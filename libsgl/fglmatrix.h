@@ -5,15 +5,35 @@
 #include "types.h"
 
 #define MAT4(x, y)	(4*(x) + (y))
+
+/*
+ * Matrices are classified by the operations that built them, so products
+ * and inverses of the common cases can skip most of the arithmetic.
+ * Classes are ordered from the most specific one, a product of matrices
+ * belonging to the more general class of its factors.
+ */
+enum FGLmatrixType {
+	/* Identity matrix */
+	FGL_MATRIX_TYPE_IDENTITY = 0,
+	/* Identity matrix with translation in the last column */
+	FGL_MATRIX_TYPE_TRANSLATE,
+	/* Last row equal to (0, 0, 0, 1) */
+	FGL_MATRIX_TYPE_AFFINE,
+	/* Anything else */
+	FGL_MATRIX_TYPE_GENERAL
+};
+
 struct FGLmatrix {
 	GLfloat storage[2*16];
 
 	GLfloat *data;
 	int index;
+	FGLmatrixType type;
 
 	inline FGLmatrix() :
 		data(storage),
-		index(0) {};
+		index(0),
+		type(FGL_MATRIX_TYPE_GENERAL) {};
 
 	inline FGLmatrix(FGLmatrix const &m) :
 		data(storage),
@@ -26,10 +46,10 @@ struct FGLmatrix {
 	void identity(void);
 	void load(const GLfloat *m);
 	void load(const GLfixed *m);
-	inline void load(FGLmatrix const &m) { load(m.data); };
+	inline void load(FGLmatrix const &m) { *this = m; };
 	void multiply(const GLfloat *m);
 	void multiply(const GLfixed *m);
-	inline void multiply(FGLmatrix const &m) { multiply(m.data); };
+	void multiply(FGLmatrix const &m);
 	void leftMultiply(FGLmatrix const &m);
 	void multiply(FGLmatrix const &a, FGLmatrix const &b);
 	void rotate(GLfloat angle, GLfloat x, GLfloat y, GLfloat z);
@@ -46,7 +66,7 @@ struct FGLmatrix {
 
 	inline GLfloat *operator[](unsigned int i) { return &data[MAT4(i, 0)]; };
 	inline const GLfloat *operator[](unsigned int i) const { return &data[MAT4(i, 0)]; };
-	inline FGLmatrix &operator=(FGLmatrix const &m) { memcpy(data, m.data, 16 * sizeof(GLfloat)); return *this; };
+	inline FGLmatrix &operator=(FGLmatrix const &m) { memcpy(data, m.data, 16 * sizeof(GLfloat)); type = m.type; return *this; };
 };
 
 #endif
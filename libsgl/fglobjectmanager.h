@@ -22,23 +22,59 @@
 #ifndef _LIBSGL_FGLPOOLALLOCATOR_
 #define _LIBSGL_FGLPOOLALLOCATOR_
 
-#include <pthread.h>
+#include <stdint.h>
 
+/*
+ * Names are allocated lock-free from a bitmap of used names, claimed and
+ * released with atomic compare-and-swap. Object pointers and owners are
+ * stored in plain arrays indexed by name, so lookups done when binding
+ * objects are wait-free single loads.
+ */
 template<typename T, int size>
 class FGLObjectManager {
+	enum {
+		BITMAP_WORDS = (size + 31) / 32
+	};
+
 	/* Array of pointers addressed by used names */
 	T		**pool;
-	void		**owners;
-	/* Stack of unused names */
-	unsigned	*unused;
-	unsigned	write;
+	void * volatile	*owners;
+	/* Bitmap of used names (bit of name N is N - 1) */
+	volatile uint32_t bitmap[BITMAP_WORDS];
 	bool		valid;
-	pthread_mutex_t	mutex;
+
+	/* Atomically sets bit of given name, fails if it is already set */
+	inline bool claim(unsigned name)
+	{
+		volatile uint32_t *word = &bitmap[(name - 1) / 32];
+		uint32_t bit = 1U << ((name - 1) % 32);
+		uint32_t old;
+
+		do {
+			old = *word;
+			if (old & bit)
+				return false;
+		} while (!__sync_bool_compare_and_swap(word, old, old | bit));
+
+		return true;
+	}
+
+	inline void release(unsigned name)
+	{
+		__sync_fetch_and_and(&bitmap[(name - 1) / 32],
+						~(1U << ((name - 1) % 32)));
+	}
+
 public:
 	FGLObjectManager() :
-		pool(NULL), unused(NULL), valid(false)
+		pool(NULL), owners(NULL), valid(false)
 	{
-		pthread_mutex_init(&mutex, NULL);
+		for (unsigned i = 0; i < BITMAP_WORDS; ++i)
+			bitmap[i] = 0;
+
+		/* Names past the size are never free */
+		if (size % 32)
+			bitmap[BITMAP_WORDS - 1] = ~0U << (size % 32);
 
 		if(size <= 0)
 			return;
@@ -53,19 +89,9 @@ public:
 			return;
 		}
 
-		unused = new unsigned[size];
-		if (unused == NULL) {
-			delete[] owners;
-			delete[] pool;
-			return;
-		}
-
-		write = size;
-
 		for(unsigned i = 0; i < size; i++) {
-			pool[i] = (T *)i;
+			pool[i] = NULL;
 			owners[i] = 0;
-			unused[i] = i + 1;
 		}
 
 		valid = true;
@@ -74,34 +100,29 @@ public:
 	~FGLObjectManager()
 	{
 		delete[] owners;
-		delete[] unused;
 		delete[] pool;
-
-		pthread_mutex_destroy(&mutex);
 	}
 
 	inline int get(void *owner)
 	{
-		int name;
-
-		pthread_mutex_lock(&mutex);
+		for (unsigned i = 0; i < BITMAP_WORDS; ++i) {
+			uint32_t word;
 
-		if(write == 0) {
-			/* Out of names */
-			pthread_mutex_unlock(&mutex);
-			return -1;
-		}
+			while ((word = bitmap[i]) != ~0U) {
+				unsigned name = 32*i + __builtin_ctz(~word) + 1;
 
-		--write;
+				/* Lost the race, try next free bit */
+				if (!claim(name))
+					continue;
 
-		name = unused[write];
-
-		pool[name - 1] = NULL;
-		owners[name - 1] = owner;
-
-		pthread_mutex_unlock(&mutex);
+				pool[name - 1] = NULL;
+				owners[name - 1] = owner;
+				return name;
+			}
+		}
 
-		return name;
+		/* Out of names */
+		return -1;
 	}
 
 	inline int get(unsigned name, void *owner)
@@ -109,54 +130,31 @@ public:
 		if (name == 0 || name > size)
 			return -1;
 
-		pthread_mutex_lock(&mutex);
-
-		if (owners[name - 1]) {
-			pthread_mutex_unlock(&mutex);
+		if (!claim(name))
 			return -1;
-		}
-
-		unsigned pos = (unsigned)pool[name - 1];
 
-		--write;
-		unused[pos] = unused[write];
-		pool[unused[write] - 1] = (T *)pos;
 		pool[name - 1] = NULL;
 		owners[name - 1] = owner;
 
-		pthread_mutex_unlock(&mutex);
-
 		return name;
 	}
 
 	inline void put(unsigned name)
 	{
-		pthread_mutex_lock(&mutex);
-
+		pool[name - 1] = NULL;
 		owners[name - 1] = 0;
-		pool[name - 1] = (T *)write;
-		unused[write] = name;
-		++write;
-
-		pthread_mutex_unlock(&mutex);
+		release(name);
 	}
 
 	inline void clean(void *owner)
 	{
-		pthread_mutex_lock(&mutex);
-
 		for(unsigned i = 0; i < size; i++) {
 			if (owners[i] != owner)
 				continue;
 			if (pool[i])
 				delete pool[i];
-			owners[i] = 0;
-			pool[i] = (T *)write;
-			unused[write] = i + 1;
-			++write;
+			put(i + 1);
 		}
-
-		pthread_mutex_unlock(&mutex);
 	}
 
 	inline const T* &operator[](unsigned name) const
@@ -174,16 +172,7 @@ public:
 		if (!name || name > size)
 			return false;
 
-		pthread_mutex_lock(&mutex);
-
-		if (!owners[name - 1]) {
-			pthread_mutex_unlock(&mutex);
-			return false;
-		}
-
-		pthread_mutex_unlock(&mutex);
-
-		return true;
+		return owners[name - 1] != 0;
 	}
 };
 
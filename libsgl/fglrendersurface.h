@@ -46,6 +46,12 @@ protected:
 	uint32_t	width;
 	uint32_t	height;
 
+	/*
+	 * Waits for rendering to the surface to complete. Platforms call it
+	 * as late as possible, right before the buffer is given away.
+	 */
+	void finishRendering();
+
 public:
 	EGLDisplay	dpy;
 	uint32_t	config;
@@ -29,6 +29,8 @@
 #include <sys/types.h>
 #include <errno.h>
 #include <unistd.h>
+#include <string.h>
+#include <pthread.h>
 
 #include <linux/android_pmem.h>
 
@@ -118,6 +120,425 @@ void FGLLocalSurface::flush(void)
 		LOGW("Could not flush PMEM surface %d", fd);
 }
 
+/*
+ * Surface pool
+ *
+ * Every dedicated surface costs an open, mmap and PMEM_GET_PHYS and is
+ * rounded up to a page, which is a lot for small textures. Surfaces up
+ * to FGL_POOL_MAX_SURFACE_SIZE are instead sub-allocated from a few large
+ * PMEM regions (chunks) managed in pages. Surfaces of at least a page get
+ * a run of pages, smaller ones a slot of a slab - a run of pages split
+ * into equal slots of one size class.
+ */
+
+#ifdef FGL_SURFACE_POOL
+
+#define FGL_POOL_PAGE_SIZE	4096
+#define FGL_POOL_CHUNK_PAGES	(FGL_POOL_CHUNK_SIZE / FGL_POOL_PAGE_SIZE)
+#define FGL_POOL_SLAB_PAGES	4
+#define FGL_POOL_SLAB_SIZE	(FGL_POOL_SLAB_PAGES * FGL_POOL_PAGE_SIZE)
+
+struct FGLPoolChunk {
+	int		fd;
+	uint8_t		*vaddr;
+	intptr_t	paddr;
+	unsigned	freePages;
+	/* Bitmap of used pages */
+	uint32_t	pages[FGL_POOL_CHUNK_PAGES / 32];
+};
+
+struct FGLPoolSlab {
+	FGLPoolSlab	*next;
+	FGLPoolChunk	*chunk;
+	unsigned long	offset;
+	unsigned	sizeClass;
+	unsigned	slotSize;
+	unsigned	slots;
+	unsigned	count;
+	/* Bitmap of used slots */
+	uint64_t	used;
+};
+
+/*
+ * Slot sizes. Steps of 1.5 and 2 keep the waste of small mipmapped
+ * textures (4/3 of power of two sizes) low.
+ */
+static const unsigned poolSlotSizes[] = {
+	256, 384, 512, 768, 1024, 1536, 2048, 3072
+};
+
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static FGLPoolChunk *poolChunks[FGL_POOL_MAX_CHUNKS];
+static FGLPoolSlab *poolSlabs[NELEM(poolSlotSizes)];
+static FGLPoolStats poolStats;
+
+static FGLPoolChunk *fglPoolMapChunk(void)
+{
+	FGLPoolChunk *chunk;
+	pmem_region region;
+	void *vaddr;
+
+	chunk = new FGLPoolChunk;
+	if (!chunk)
+		return 0;
+
+	chunk->fd = open("/dev/pmem_gpu1", O_RDWR, 0);
+	if (chunk->fd < 0) {
+		LOGE("EGL: Could not open PMEM device (%s)", strerror(errno));
+		goto err_open;
+	}
+
+	vaddr = mmap(NULL, FGL_POOL_CHUNK_SIZE, PROT_WRITE | PROT_READ,
+						MAP_SHARED, chunk->fd, 0);
+	if (vaddr == MAP_FAILED) {
+		LOGE("EGL: PMEM pool allocation failed (%s)", strerror(errno));
+		goto err_mmap;
+	}
+	chunk->vaddr = (uint8_t *)vaddr;
+
+	if (ioctl(chunk->fd, PMEM_GET_PHYS, &region) < 0) {
+		LOGE("EGL: PMEM_GET_PHYS failed (%s)", strerror(errno));
+		goto err_phys;
+	}
+	chunk->paddr = region.offset;
+
+	chunk->freePages = FGL_POOL_CHUNK_PAGES;
+	memset(chunk->pages, 0, sizeof(chunk->pages));
+
+	++poolStats.chunks;
+	poolStats.mapped += FGL_POOL_CHUNK_SIZE;
+	poolStats.peakMapped = max(poolStats.peakMapped, poolStats.mapped);
+
+	return chunk;
+
+err_phys:
+	munmap(vaddr, FGL_POOL_CHUNK_SIZE);
+err_mmap:
+	close(chunk->fd);
+err_open:
+	delete chunk;
+	return 0;
+}
+
+static void fglPoolUnmapChunk(FGLPoolChunk *chunk)
+{
+	munmap(chunk->vaddr, FGL_POOL_CHUNK_SIZE);
+	close(chunk->fd);
+	delete chunk;
+
+	--poolStats.chunks;
+	poolStats.mapped -= FGL_POOL_CHUNK_SIZE;
+}
+
+static inline bool fglPoolPageUsed(const FGLPoolChunk *chunk, unsigned page)
+{
+	return chunk->pages[page / 32] & (1U << (page % 32));
+}
+
+static void fglPoolMarkPages(FGLPoolChunk *chunk,
+				unsigned first, unsigned count, bool used)
+{
+	for (unsigned page = first; page < first + count; ++page) {
+		if (used)
+			chunk->pages[page / 32] |= 1U << (page % 32);
+		else
+			chunk->pages[page / 32] &= ~(1U << (page % 32));
+	}
+
+	if (used)
+		chunk->freePages -= count;
+	else
+		chunk->freePages += count;
+}
+
+/* Finds first run of free pages of given length, returns -1 if none */
+static int fglPoolFindPages(const FGLPoolChunk *chunk, unsigned count)
+{
+	unsigned first = 0;
+	unsigned run = 0;
+
+	if (chunk->freePages < count)
+		return -1;
+
+	for (unsigned page = 0; page < FGL_POOL_CHUNK_PAGES; ++page) {
+		if (!(page % 32) && chunk->pages[page / 32] == 0xffffffff) {
+			/* Skip fully used words */
+			page += 31;
+			run = 0;
+			continue;
+		}
+
+		if (fglPoolPageUsed(chunk, page)) {
+			run = 0;
+			continue;
+		}
+
+		if (!run++)
+			first = page;
+
+		if (run == count)
+			return first;
+	}
+
+	return -1;
+}
+
+static FGLPoolChunk *fglPoolAllocPages(unsigned count, unsigned long *offset)
+{
+	FGLPoolChunk *chunk;
+	int page;
+	unsigned i;
+
+	for (i = 0; i < FGL_POOL_MAX_CHUNKS; ++i) {
+		chunk = poolChunks[i];
+		if (!chunk)
+			continue;
+
+		page = fglPoolFindPages(chunk, count);
+		if (page >= 0)
+			goto found;
+	}
+
+	for (i = 0; i < FGL_POOL_MAX_CHUNKS; ++i)
+		if (!poolChunks[i])
+			break;
+
+	if (i == FGL_POOL_MAX_CHUNKS)
+		return 0;
+
+	chunk = fglPoolMapChunk();
+	if (!chunk)
+		return 0;
+
+	poolChunks[i] = chunk;
+	page = 0;
+
+found:
+	fglPoolMarkPages(chunk, page, count, true);
+	poolStats.reserved += count * FGL_POOL_PAGE_SIZE;
+	*offset = page * FGL_POOL_PAGE_SIZE;
+
+	return chunk;
+}
+
+static void fglPoolFreePages(FGLPoolChunk *chunk,
+				unsigned long offset, unsigned count)
+{
+	fglPoolMarkPages(chunk, offset / FGL_POOL_PAGE_SIZE, count, false);
+	poolStats.reserved -= count * FGL_POOL_PAGE_SIZE;
+
+	if (chunk->freePages < FGL_POOL_CHUNK_PAGES)
+		return;
+
+	/* Keep the last chunk mapped to avoid remapping it over and over */
+	if (poolStats.chunks == 1)
+		return;
+
+	for (unsigned i = 0; i < FGL_POOL_MAX_CHUNKS; ++i) {
+		if (poolChunks[i] == chunk) {
+			poolChunks[i] = 0;
+			break;
+		}
+	}
+
+	fglPoolUnmapChunk(chunk);
+}
+
+static FGLPoolSlab *fglPoolAllocSlot(unsigned sizeClass,
+							unsigned long *offset)
+{
+	FGLPoolSlab *slab;
+	unsigned slot;
+
+	for (slab = poolSlabs[sizeClass]; slab; slab = slab->next)
+		if (slab->count < slab->slots)
+			break;
+
+	if (!slab) {
+		slab = new FGLPoolSlab;
+		if (!slab)
+			return 0;
+
+		slab->chunk = fglPoolAllocPages(FGL_POOL_SLAB_PAGES,
+								&slab->offset);
+		if (!slab->chunk) {
+			delete slab;
+			return 0;
+		}
+
+		slab->sizeClass = sizeClass;
+		slab->slotSize = poolSlotSizes[sizeClass];
+		slab->slots = FGL_POOL_SLAB_SIZE / slab->slotSize;
+		slab->count = 0;
+		slab->used = 0;
+		slab->next = poolSlabs[sizeClass];
+		poolSlabs[sizeClass] = slab;
+	}
+
+	slot = __builtin_ctzll(~slab->used);
+	slab->used |= 1ULL << slot;
+	++slab->count;
+
+	*offset = slab->offset + slot * slab->slotSize;
+	return slab;
+}
+
+static void fglPoolFreeSlot(FGLPoolSlab *slab, unsigned long offset)
+{
+	unsigned slot = (offset - slab->offset) / slab->slotSize;
+	FGLPoolSlab **link = &poolSlabs[slab->sizeClass];
+
+	slab->used &= ~(1ULL << slot);
+	if (--slab->count)
+		return;
+
+	/* Return pages of empty slab */
+	while (*link != slab)
+		link = &(*link)->next;
+	*link = slab->next;
+
+	fglPoolFreePages(slab->chunk, slab->offset, FGL_POOL_SLAB_PAGES);
+	delete slab;
+}
+
+FGLPoolSurface::FGLPoolSurface(unsigned long req_size) :
+	chunk(0),
+	slab(0),
+	offset(0),
+	requested(req_size)
+{
+	unsigned sizeClass;
+
+	pthread_mutex_lock(&poolLock);
+
+	for (sizeClass = 0; sizeClass < NELEM(poolSlotSizes); ++sizeClass)
+		if (req_size <= poolSlotSizes[sizeClass])
+			break;
+
+	if (sizeClass < NELEM(poolSlotSizes)) {
+		slab = fglPoolAllocSlot(sizeClass, &offset);
+		if (slab) {
+			chunk = slab->chunk;
+			size = slab->slotSize;
+		}
+	} else {
+		unsigned count = (req_size + FGL_POOL_PAGE_SIZE - 1)
+							/ FGL_POOL_PAGE_SIZE;
+
+		chunk = fglPoolAllocPages(count, &offset);
+		size = count * FGL_POOL_PAGE_SIZE;
+	}
+
+	if (chunk) {
+		vaddr = chunk->vaddr + offset;
+		paddr = chunk->paddr + offset;
+
+		++poolStats.surfaces;
+		poolStats.used += size;
+		poolStats.requested += requested;
+		poolStats.peakUsed = max(poolStats.peakUsed, poolStats.used);
+	}
+
+	pthread_mutex_unlock(&poolLock);
+}
+
+FGLPoolSurface::~FGLPoolSurface()
+{
+	if (!isValid())
+		return;
+
+	pthread_mutex_lock(&poolLock);
+
+	--poolStats.surfaces;
+	poolStats.used -= size;
+	poolStats.requested -= requested;
+
+	if (slab)
+		fglPoolFreeSlot(slab, offset);
+	else
+		fglPoolFreePages(chunk, offset, size / FGL_POOL_PAGE_SIZE);
+
+	pthread_mutex_unlock(&poolLock);
+}
+
+int FGLPoolSurface::lock(int usage)
+{
+	return 0;
+}
+
+int FGLPoolSurface::unlock(void)
+{
+	return 0;
+}
+
+void FGLPoolSurface::flush(void)
+{
+	struct pmem_region region;
+
+	region.offset = offset;
+	region.len = size;
+
+	if (ioctl(chunk->fd, PMEM_CACHE_FLUSH, &region) != 0)
+		LOGW("Could not flush PMEM pool surface %d", chunk->fd);
+}
+
+void fglGetPoolStats(FGLPoolStats *stats)
+{
+	pthread_mutex_lock(&poolLock);
+
+	*stats = poolStats;
+	stats->largestFree = 0;
+
+	for (unsigned i = 0; i < FGL_POOL_MAX_CHUNKS; ++i) {
+		const FGLPoolChunk *chunk = poolChunks[i];
+		unsigned run = 0;
+
+		if (!chunk)
+			continue;
+
+		for (unsigned page = 0; page < FGL_POOL_CHUNK_PAGES; ++page) {
+			if (fglPoolPageUsed(chunk, page)) {
+				run = 0;
+				continue;
+			}
+
+			if (++run * FGL_POOL_PAGE_SIZE > stats->largestFree)
+				stats->largestFree = run * FGL_POOL_PAGE_SIZE;
+		}
+	}
+
+	pthread_mutex_unlock(&poolLock);
+}
+
+FGLSurface *fglCreateLocalSurface(unsigned long size)
+{
+	if (size <= FGL_POOL_MAX_SURFACE_SIZE) {
+		FGLPoolSurface *surface = new FGLPoolSurface(size);
+
+		if (surface && surface->isValid())
+			return surface;
+
+		/* Pool is exhausted, try a dedicated region */
+		delete surface;
+	}
+
+	return new FGLLocalSurface(size);
+}
+
+#else /* FGL_SURFACE_POOL */
+
+void fglGetPoolStats(FGLPoolStats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+}
+
+FGLSurface *fglCreateLocalSurface(unsigned long size)
+{
+	return new FGLLocalSurface(size);
+}
+
+#endif /* FGL_SURFACE_POOL */
+
 FGLExternalSurface::FGLExternalSurface(void *v, intptr_t p, size_t s)
 {
 	vaddr = v;
@@ -63,6 +63,26 @@ public:
 	virtual bool	isValid(void) { return fd >= 0; };
 };
 
+struct FGLPoolChunk;
+struct FGLPoolSlab;
+
+/* Surface sub-allocated from the surface pool */
+class FGLPoolSurface : public FGLSurface {
+	FGLPoolChunk	*chunk;
+	FGLPoolSlab	*slab;
+	unsigned long	offset;
+	unsigned long	requested;
+public:
+			FGLPoolSurface(unsigned long size);
+	virtual		~FGLPoolSurface();
+
+	virtual void	flush(void);
+	virtual int	lock(int usage = 0);
+	virtual int	unlock(void);
+
+	virtual bool	isValid(void) { return chunk != 0; };
+};
+
 class FGLExternalSurface : public FGLSurface {
 public:
 			FGLExternalSurface(void *v, intptr_t p, size_t s);
@@ -75,4 +95,30 @@ public:
 	virtual bool	isValid(void) { return true; };
 };
 
+/* Surface pool statistics */
+struct FGLPoolStats {
+	/* PMEM regions currently mapped */
+	unsigned	chunks;
+	/* Surfaces currently allocated from the pool */
+	unsigned	surfaces;
+	/* Bytes of mapped PMEM regions */
+	size_t		mapped;
+	/* Bytes of pages taken by slabs and page runs */
+	size_t		reserved;
+	/* Bytes of blocks given to surfaces */
+	size_t		used;
+	/* Bytes requested by surfaces */
+	size_t		requested;
+	/* Largest run of free pages in bytes */
+	size_t		largestFree;
+	/* Peak values of mapped and used */
+	size_t		peakMapped;
+	size_t		peakUsed;
+};
+
+extern void fglGetPoolStats(FGLPoolStats *stats);
+
+/* Creates a local surface, taking small ones from the surface pool */
+extern FGLSurface *fglCreateLocalSurface(unsigned long size);
+
 #endif
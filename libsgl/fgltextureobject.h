@@ -26,6 +26,7 @@
 #include "fglobject.h"
 #include "fglimage.h"
 #include "fglframebufferattachable.h"
+#include "fglworker.h"
 
 struct FGLTexture;
 struct FGLTextureState;
@@ -51,6 +52,8 @@ struct FGLTexture : public FGLFramebufferAttachable {
 	GLenum		sWrap;
 	GLenum		tWrap;
 	GLboolean	genMipmap;
+	/* Base level region to propagate to mipmaps (l, t, r, b) */
+	GLint		mipmapRect[4];
 	GLint		cropRect[4];
 	FGLImage	*eglImage;
 	GLfloat		invWidth;
@@ -62,6 +65,8 @@ struct FGLTexture : public FGLFramebufferAttachable {
 	bool		convert;
 	bool		valid;
 	bool		dirty;
+	/* Last background upload job writing the surface */
+	uint32_t	upload;
 
 	FGLTexture(unsigned int name = 0) :
 		object(this),
@@ -78,8 +83,11 @@ struct FGLTexture : public FGLFramebufferAttachable {
 		invReady(false),
 		fimg(NULL),
 		valid(false),
-		dirty(false)
+		dirty(false),
+		upload(FGL_NO_JOB)
 	{
+		cleanMipmaps();
+
 		fimg = fimgCreateTexture();
 		if(fimg == NULL)
 			return;
@@ -92,6 +100,8 @@ struct FGLTexture : public FGLFramebufferAttachable {
 		if(!isValid())
 			return;
 
+		waitForUpload();
+
 		if (eglImage)
 			eglImage->disconnect();
 		else
@@ -110,6 +120,31 @@ struct FGLTexture : public FGLFramebufferAttachable {
 		return (surface != 0);
 	}
 
+	inline bool usesMipmaps(void) const
+	{
+		return minFilter != GL_NEAREST && minFilter != GL_LINEAR;
+	}
+
+	inline bool mipmapsDirty(void) const
+	{
+		return mipmapRect[2] > mipmapRect[0];
+	}
+
+	inline void cleanMipmaps(void)
+	{
+		mipmapRect[0] = mipmapRect[1] = 0;
+		mipmapRect[2] = mipmapRect[3] = 0;
+	}
+
+	inline void waitForUpload(void)
+	{
+		if (upload == FGL_NO_JOB)
+			return;
+
+		fglWaitForJob(upload);
+		upload = FGL_NO_JOB;
+	}
+
 	virtual GLenum getType(void) const
 	{
 		return GL_TEXTURE;
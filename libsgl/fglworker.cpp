@@ -0,0 +1,149 @@
+/*
+ * libsgl/fglworker.cpp
+ *
+ * SAMSUNG S3C6410 FIMG-3DSE (PROPER) OPENGL ES IMPLEMENTATION
+ *
+ * Copyrights:	2026 by agent < agent at local >
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <pthread.h>
+
+#include "platform.h"
+#include "fglworker.h"
+
+static pthread_mutex_t workerLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t workerQueued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t workerDone = PTHREAD_COND_INITIALIZER;
+
+static FGLJob *jobHead;
+static FGLJob *jobTail;
+static uint32_t queuedSeq;
+static volatile uint32_t doneSeq;
+
+enum {
+	WORKER_STOPPED = 0,
+	WORKER_RUNNING,
+	WORKER_FAILED
+};
+
+static int workerState = WORKER_STOPPED;
+
+static inline bool fglSeqDone(uint32_t seq)
+{
+	return (int32_t)(doneSeq - seq) >= 0;
+}
+
+static void *fglWorkerThread(void *arg)
+{
+	pthread_mutex_lock(&workerLock);
+
+	for (;;) {
+		while (!jobHead)
+			pthread_cond_wait(&workerQueued, &workerLock);
+
+		FGLJob *job = jobHead;
+		jobHead = job->next;
+		if (!jobHead)
+			jobTail = 0;
+
+		pthread_mutex_unlock(&workerLock);
+
+		job->run();
+		delete job;
+
+		pthread_mutex_lock(&workerLock);
+
+		++doneSeq;
+		pthread_cond_broadcast(&workerDone);
+	}
+
+	return NULL;
+}
+
+static void fglStartWorker(void)
+{
+	pthread_t thread;
+
+	if (pthread_create(&thread, NULL, fglWorkerThread, NULL)) {
+		LOGW("Failed to create worker thread, "
+					"jobs will be executed immediately");
+		workerState = WORKER_FAILED;
+		return;
+	}
+
+	pthread_detach(thread);
+	workerState = WORKER_RUNNING;
+}
+
+uint32_t fglQueueJob(FGLJob *job)
+{
+	uint32_t seq;
+
+	pthread_mutex_lock(&workerLock);
+
+	if (workerState == WORKER_STOPPED)
+		fglStartWorker();
+
+	if (workerState != WORKER_RUNNING) {
+		pthread_mutex_unlock(&workerLock);
+		job->run();
+		delete job;
+		return FGL_NO_JOB;
+	}
+
+	job->next = 0;
+	if (jobTail)
+		jobTail->next = job;
+	else
+		jobHead = job;
+	jobTail = job;
+
+	seq = ++queuedSeq;
+
+	pthread_cond_signal(&workerQueued);
+	pthread_mutex_unlock(&workerLock);
+
+	return seq;
+}
+
+bool fglIsJobDone(uint32_t seq)
+{
+	if (seq == FGL_NO_JOB)
+		return true;
+
+	/* Make results of the job visible after seeing it done */
+	bool done = fglSeqDone(seq);
+	__sync_synchronize();
+
+	return done;
+}
+
+void fglWaitForJob(uint32_t seq)
+{
+	if (fglIsJobDone(seq))
+		return;
+
+	pthread_mutex_lock(&workerLock);
+
+	while (!fglSeqDone(seq))
+		pthread_cond_wait(&workerDone, &workerLock);
+
+	pthread_mutex_unlock(&workerLock);
+}
@@ -0,0 +1,56 @@
+/*
+ * libsgl/fglworker.h
+ *
+ * SAMSUNG S3C6410 FIMG-3DSE (PROPER) OPENGL ES IMPLEMENTATION
+ *
+ * Copyrights:	2026 by agent < agent at local >
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LIBSGL_FGLWORKER_
+#define _LIBSGL_FGLWORKER_
+
+#include <stdint.h>
+
+/*
+ * Background worker
+ *
+ * Jobs are executed by a single thread in the order they were queued.
+ * Each queued job gets a sequence number, which can be used to check
+ * whether the job (and all jobs queued before it) has completed.
+ */
+
+class FGLJob {
+public:
+	FGLJob		*next;
+
+			FGLJob() : next(0) {};
+	virtual		~FGLJob() {};
+
+	/* Called in worker thread. The job is deleted afterwards. */
+	virtual void	run(void) = 0;
+};
+
+/* Sequence number of no job, always completed */
+#define FGL_NO_JOB	0
+
+/* Queues the job, returns FGL_NO_JOB if it was executed immediately */
+extern uint32_t fglQueueJob(FGLJob *job);
+/* Checks whether the job has been completed */
+extern bool fglIsJobDone(uint32_t seq);
+/* Waits until the job completes */
+extern void fglWaitForJob(uint32_t seq);
+
+#endif /* _LIBSGL_FGLWORKER_ */
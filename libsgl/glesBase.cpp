@@ -25,6 +25,7 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <climits>
 #include <errno.h>
 #include <pthread.h>
 #include <fcntl.h>
@@ -76,7 +77,15 @@ FGLvec4f FGLContext::defaultVertex[4 + FGL_MAX_TEXTURE_UNITS] = {
 GL_API void GL_APIENTRY glColor4f (GLfloat red, GLfloat green,
 						GLfloat blue, GLfloat alpha)
 {
-	FGLContext *ctx = getContext();
+	FGLContext *ctx = getContextNoFlush();
+	GLfloat *color = ctx->vertex[FGL_ARRAY_COLOR];
+
+	/* Same color again does not need to end merged draws */
+	if (color[FGL_COMP_RED] == red && color[FGL_COMP_GREEN] == green
+	    && color[FGL_COMP_BLUE] == blue && color[FGL_COMP_ALPHA] == alpha)
+		return;
+
+	fglFlushDraws(ctx);
 
 	ctx->vertex[FGL_ARRAY_COLOR][FGL_COMP_RED] 	= red;
 	ctx->vertex[FGL_ARRAY_COLOR][FGL_COMP_GREEN]	= green;
@@ -173,6 +182,9 @@ GL_API void GL_APIENTRY glDeleteBuffers (GLsizei n, const GLuint *buffers)
 	if(n <= 0)
 		return;
 
+	/* Merged draws not submitted yet might use them */
+	fglFlushDraws(getContextNoFlush());
+
 	while(n--) {
 		name = *buffers;
 		buffers++;
@@ -191,7 +203,7 @@ GL_API void GL_APIENTRY glBindBuffer (GLenum target, GLuint buffer)
 {
 	FGLBufferObjectBinding *binding;
 
-	FGLContext *ctx = getContext();
+	FGLContext *ctx = getContextNoFlush();
 
 	switch (target) {
 	case GL_ARRAY_BUFFER:
@@ -200,6 +212,9 @@ GL_API void GL_APIENTRY glBindBuffer (GLenum target, GLuint buffer)
 	case GL_ELEMENT_ARRAY_BUFFER:
 		binding = &ctx->elementArrayBuffer;
 		break;
+	case GL_PIXEL_PACK_BUFFER_NV:
+		binding = &ctx->pixelPackBuffer;
+		break;
 	default:
 		setError(GL_INVALID_ENUM);
 		return;
@@ -243,6 +258,9 @@ GL_API void GL_APIENTRY glBufferData (GLenum target, GLsizeiptr size,
 	case GL_ELEMENT_ARRAY_BUFFER:
 		binding = &ctx->elementArrayBuffer;
 		break;
+	case GL_PIXEL_PACK_BUFFER_NV:
+		binding = &ctx->pixelPackBuffer;
+		break;
 	default:
 		setError(GL_INVALID_ENUM);
 		return;
@@ -288,6 +306,9 @@ GL_API void GL_APIENTRY glBufferSubData (GLenum target, GLintptr offset,
 	case GL_ELEMENT_ARRAY_BUFFER:
 		binding = &ctx->elementArrayBuffer;
 		break;
+	case GL_PIXEL_PACK_BUFFER_NV:
+		binding = &ctx->pixelPackBuffer;
+		break;
 	default:
 		setError(GL_INVALID_ENUM);
 		return;
@@ -306,6 +327,7 @@ GL_API void GL_APIENTRY glBufferSubData (GLenum target, GLintptr offset,
 	}
 
 	memcpy((uint8_t *)buf->memory + offset, data, size);
+	buf->invalidatePacked();
 }
 
 GL_API GLboolean GL_APIENTRY glIsBuffer (GLuint buffer)
@@ -316,6 +338,221 @@ GL_API GLboolean GL_APIENTRY glIsBuffer (GLuint buffer)
 	return GL_TRUE;
 }
 
+GL_API void *GL_APIENTRY glMapBufferOES (GLenum target, GLenum access)
+{
+	FGLBufferObjectBinding *binding;
+
+	FGLContext *ctx = getContext();
+
+	switch (target) {
+	case GL_ARRAY_BUFFER:
+		binding = &ctx->arrayBuffer;
+		break;
+	case GL_ELEMENT_ARRAY_BUFFER:
+		binding = &ctx->elementArrayBuffer;
+		break;
+	case GL_PIXEL_PACK_BUFFER_NV:
+		binding = &ctx->pixelPackBuffer;
+		break;
+	default:
+		setError(GL_INVALID_ENUM);
+		return 0;
+	}
+
+	if (access != GL_WRITE_ONLY_OES) {
+		setError(GL_INVALID_ENUM);
+		return 0;
+	}
+
+	if (!binding->isBound()) {
+		setError(GL_INVALID_OPERATION);
+		return 0;
+	}
+
+	FGLBuffer *buf = binding->get();
+
+	if (!buf->isValid() || buf->mapped) {
+		setError(GL_INVALID_OPERATION);
+		return 0;
+	}
+
+	buf->invalidatePacked();
+	buf->mapped = true;
+	buf->mapOffset = 0;
+	return buf->memory;
+}
+
+/*
+ * Read access to buffer contents, i.e. results of readbacks into pixel
+ * pack buffers, is only defined through mappings created here.
+ */
+GL_API void *GL_APIENTRY glMapBufferRangeEXT (GLenum target, GLintptr offset,
+					GLsizeiptr length, GLbitfield access)
+{
+	FGLBufferObjectBinding *binding;
+
+	FGLContext *ctx = getContext();
+
+	switch (target) {
+	case GL_ARRAY_BUFFER:
+		binding = &ctx->arrayBuffer;
+		break;
+	case GL_ELEMENT_ARRAY_BUFFER:
+		binding = &ctx->elementArrayBuffer;
+		break;
+	case GL_PIXEL_PACK_BUFFER_NV:
+		binding = &ctx->pixelPackBuffer;
+		break;
+	default:
+		setError(GL_INVALID_ENUM);
+		return 0;
+	}
+
+	const GLbitfield rwBits = GL_MAP_READ_BIT_EXT | GL_MAP_WRITE_BIT_EXT;
+	const GLbitfield noReadBits = GL_MAP_INVALIDATE_RANGE_BIT_EXT
+					| GL_MAP_INVALIDATE_BUFFER_BIT_EXT
+					| GL_MAP_UNSYNCHRONIZED_BIT_EXT;
+	const GLbitfield allBits = rwBits | noReadBits
+					| GL_MAP_FLUSH_EXPLICIT_BIT_EXT;
+
+	if (offset < 0 || length <= 0 || (access & ~allBits)) {
+		setError(GL_INVALID_VALUE);
+		return 0;
+	}
+
+	if (!(access & rwBits)
+	    || ((access & GL_MAP_READ_BIT_EXT) && (access & noReadBits))) {
+		setError(GL_INVALID_OPERATION);
+		return 0;
+	}
+
+	if ((access & GL_MAP_FLUSH_EXPLICIT_BIT_EXT)
+	    && !(access & GL_MAP_WRITE_BIT_EXT)) {
+		setError(GL_INVALID_OPERATION);
+		return 0;
+	}
+
+	if (!binding->isBound()) {
+		setError(GL_INVALID_OPERATION);
+		return 0;
+	}
+
+	FGLBuffer *buf = binding->get();
+
+	if (!buf->isValid() || buf->mapped) {
+		setError(GL_INVALID_OPERATION);
+		return 0;
+	}
+
+	if (offset > buf->size || length > buf->size - offset) {
+		setError(GL_INVALID_VALUE);
+		return 0;
+	}
+
+	if (access & GL_MAP_WRITE_BIT_EXT)
+		buf->invalidatePacked();
+	buf->mapped = true;
+	buf->mapOffset = offset;
+	return (uint8_t *)buf->memory + offset;
+}
+
+GL_API void GL_APIENTRY glFlushMappedBufferRangeEXT (GLenum target,
+					GLintptr offset, GLsizeiptr length)
+{
+	FGLBufferObjectBinding *binding;
+
+	FGLContext *ctx = getContext();
+
+	switch (target) {
+	case GL_ARRAY_BUFFER:
+		binding = &ctx->arrayBuffer;
+		break;
+	case GL_ELEMENT_ARRAY_BUFFER:
+		binding = &ctx->elementArrayBuffer;
+		break;
+	case GL_PIXEL_PACK_BUFFER_NV:
+		binding = &ctx->pixelPackBuffer;
+		break;
+	default:
+		setError(GL_INVALID_ENUM);
+		return;
+	}
+
+	if (!binding->isBound() || !binding->get()->mapped) {
+		setError(GL_INVALID_OPERATION);
+		return;
+	}
+
+	/* Mappings point directly at buffer memory, nothing to do */
+}
+
+GL_API GLboolean GL_APIENTRY glUnmapBufferOES (GLenum target)
+{
+	FGLBufferObjectBinding *binding;
+
+	FGLContext *ctx = getContext();
+
+	switch (target) {
+	case GL_ARRAY_BUFFER:
+		binding = &ctx->arrayBuffer;
+		break;
+	case GL_ELEMENT_ARRAY_BUFFER:
+		binding = &ctx->elementArrayBuffer;
+		break;
+	case GL_PIXEL_PACK_BUFFER_NV:
+		binding = &ctx->pixelPackBuffer;
+		break;
+	default:
+		setError(GL_INVALID_ENUM);
+		return GL_FALSE;
+	}
+
+	if (!binding->isBound() || !binding->get()->mapped) {
+		setError(GL_INVALID_OPERATION);
+		return GL_FALSE;
+	}
+
+	binding->get()->mapped = false;
+	return GL_TRUE;
+}
+
+GL_API void GL_APIENTRY glGetBufferPointervOES (GLenum target,
+						GLenum pname, GLvoid **params)
+{
+	FGLBufferObjectBinding *binding;
+
+	FGLContext *ctx = getContext();
+
+	switch (target) {
+	case GL_ARRAY_BUFFER:
+		binding = &ctx->arrayBuffer;
+		break;
+	case GL_ELEMENT_ARRAY_BUFFER:
+		binding = &ctx->elementArrayBuffer;
+		break;
+	case GL_PIXEL_PACK_BUFFER_NV:
+		binding = &ctx->pixelPackBuffer;
+		break;
+	default:
+		setError(GL_INVALID_ENUM);
+		return;
+	}
+
+	if (pname != GL_BUFFER_MAP_POINTER_OES) {
+		setError(GL_INVALID_ENUM);
+		return;
+	}
+
+	if (!binding->isBound()) {
+		setError(GL_INVALID_OPERATION);
+		return;
+	}
+
+	FGLBuffer *buf = binding->get();
+
+	*params = buf->mapped ? (uint8_t *)buf->memory + buf->mapOffset : 0;
+}
+
 /*
  * Arrays
  */
@@ -335,9 +572,6 @@ static inline void fglSetupAttribute(FGLContext *ctx, GLint idx, GLint size,
 	ctx->array[idx].stride	= (stride) ? stride : width;
 	ctx->array[idx].width	= width;
 	ctx->array[idx].pointer	= pointer;
-
-	if(ctx->array[idx].enabled)
-		fimgSetAttribute(ctx->fimg, idx, type, size);
 }
 
 GL_API void GL_APIENTRY glVertexPointer (GLint size, GLenum type,
@@ -382,7 +616,7 @@ GL_API void GL_APIENTRY glVertexPointer (GLint size, GLenum type,
 		return;
 	}
 
-	FGLContext *ctx = getContext();
+	FGLContext *ctx = getContextNoFlush();
 
 	fglSetupAttribute(ctx, FGL_ARRAY_VERTEX, size, fglType, stride,
 							fglStride, pointer);
@@ -420,7 +654,7 @@ GL_API void GL_APIENTRY glNormalPointer (GLenum type, GLsizei stride,
 		return;
 	}
 
-	FGLContext *ctx = getContext();
+	FGLContext *ctx = getContextNoFlush();
 
 	fglSetupAttribute(ctx, FGL_ARRAY_NORMAL, 3, fglType, stride,
 							fglStride, pointer);
@@ -462,7 +696,7 @@ GL_API void GL_APIENTRY glColorPointer (GLint size, GLenum type,
 		return;
 	}
 
-	FGLContext *ctx = getContext();
+	FGLContext *ctx = getContextNoFlush();
 
 	fglSetupAttribute(ctx, FGL_ARRAY_COLOR, 4, fglType, stride,
 							fglStride, pointer);
@@ -491,7 +725,7 @@ GL_API void GL_APIENTRY glPointSizePointerOES (GLenum type, GLsizei stride,
 		return;
 	}
 
-	FGLContext *ctx = getContext();
+	FGLContext *ctx = getContextNoFlush();
 
 	fglSetupAttribute(ctx, FGL_ARRAY_POINT_SIZE, 1, fglType, stride,
 							fglStride, pointer);
@@ -539,7 +773,7 @@ GL_API void GL_APIENTRY glTexCoordPointer (GLint size, GLenum type,
 		return;
 	}
 
-	FGLContext *ctx = getContext();
+	FGLContext *ctx = getContextNoFlush();
 
 	fglSetupAttribute(ctx, FGL_ARRAY_TEXTURE(ctx->clientActiveTexture),
 				size, fglType, stride, fglStride, pointer);
@@ -548,12 +782,11 @@ GL_API void GL_APIENTRY glTexCoordPointer (GLint size, GLenum type,
 static void fglEnableClientState(FGLContext *ctx, GLint idx)
 {
 	ctx->array[idx].enabled = GL_TRUE;
-	fimgSetAttribute(ctx->fimg, idx, ctx->array[idx].type, ctx->array[idx].size);
 }
 
 GL_API void GL_APIENTRY glEnableClientState (GLenum array)
 {
-	FGLContext *ctx = getContext();
+	FGLContext *ctx = getContextNoFlush();
 	GLint idx;
 
 	switch (array) {
@@ -581,19 +814,14 @@ GL_API void GL_APIENTRY glEnableClientState (GLenum array)
 	fglEnableClientState(ctx, idx);
 }
 
-static const GLint fglDefaultAttribSize[4 + FGL_MAX_TEXTURE_UNITS] = {
-	4, 3, 4, 1, 4, 4
-};
-
 static void fglDisableClientState(FGLContext *ctx, GLint idx)
 {
 	ctx->array[idx].enabled = GL_FALSE;
-	fimgSetAttribute(ctx->fimg, idx, FGHI_ATTRIB_DT_FLOAT, fglDefaultAttribSize[idx]);
 }
 
 GL_API void GL_APIENTRY glDisableClientState (GLenum array)
 {
-	FGLContext *ctx = getContext();
+	FGLContext *ctx = getContextNoFlush();
 	GLint idx;
 
 	switch (array) {
@@ -630,7 +858,7 @@ GL_API void GL_APIENTRY glClientActiveTexture (GLenum texture)
 		return;
 	}
 
-	FGLContext *ctx = getContext();
+	FGLContext *ctx = getContextNoFlush();
 
 	ctx->clientActiveTexture = unit;
 }
@@ -663,7 +891,11 @@ static inline void fglSetupMatrices(FGLContext *ctx)
 	if (ctx->matrix.dirty[FGL_MATRIX_MODELVIEW]
 		|| ctx->matrix.dirty[FGL_MATRIX_PROJECTION])
 	{
-		/* Calculate and load transformation matrix */
+		/*
+		 * Calculate and load transformation matrix. Products of
+		 * affine matrices take the fast path and results equal to
+		 * the ones already in hardware are not uploaded again.
+		 */
 		FGLmatrix *proj, *modview, *transform;
 
 		transform = &ctx->matrix.transformMatrix;
@@ -698,9 +930,10 @@ static inline void fglSetupMatrices(FGLContext *ctx)
 	} while (i--);
 }
 
-static inline void fglSetupTextures(FGLContext *ctx)
+static inline GLuint fglSetupTextures(FGLContext *ctx)
 {
 	bool flush = false;
+	GLuint units = 0;
 	int i = FGL_MAX_TEXTURE_UNITS - 1;
 
 	do {
@@ -720,6 +953,9 @@ static inline void fglSetupTextures(FGLContext *ctx)
 		}
 
 		/* Texture is ready */
+		tex->waitForUpload();
+		if (tex->mipmapsDirty() && tex->usesMipmaps())
+			fglUpdateMipmaps(tex);
 		if (tex->dirty) {
 			tex->surface->flush();
 			tex->dirty = false;
@@ -730,11 +966,246 @@ static inline void fglSetupTextures(FGLContext *ctx)
 		fimgCompatSetTextureFunc(ctx->fimg,
 					i, ctx->texture[i].fglFunc);
 
-		ctx->busyTexture[i] = tex;
-	} while (i--);
+		ctx->busyTexture[i] = tex;
+		units |= 1 << i;
+	} while (i--);
+
+	if (flush)
+		fimgInvalidateTextureCache(ctx->fimg);
+
+	return units;
+}
+
+/*
+ * Elements of arrays used by a draw. Count is the number of elements
+ * counted from the start of arrays (not from first), 0 if not known.
+ * For indexed draws it is only counted when an array gets packed,
+ * as it takes a scan over all the indices.
+ */
+struct FGLDrawRange {
+	GLint		first;
+	GLint		count;
+	GLenum		type;
+	const GLvoid	*indices;
+	GLsizei		indexCount;
+};
+
+#ifdef FGL_PACKED_BUFFER_ARRAYS
+
+/*
+ * Arrays of static buffers are repacked once to the layout of hardware
+ * vertex buffer, so every following draw copies them with plain memcpy
+ * (or word copies when indexed) instead of per element packing.
+ */
+
+static inline bool fglNeedsPacking(const FGLArrayState *array)
+{
+	uintptr_t align = (uintptr_t)array->pointer | array->stride;
+
+	return array->width % 4 || array->stride != array->width || align % 4;
+}
+
+/*
+ * Returns packed copy of at least given number of first elements of the
+ * array, creating it if needed. Copies use at most a fixed multiple of
+ * buffer size in total, arrays not fitting in it are not packed.
+ */
+static const FGLPackedArray *fglGetPackedArray(FGLArrayState *array,
+								GLint count)
+{
+	FGLBuffer *buf = array->buffer;
+	int offset = (intptr_t)buf->getOffset(array->pointer);
+	FGLPackedArray *packed = 0;
+
+	if (count <= 0)
+		return 0;
+
+	for (int i = 0; i < FGL_MAX_PACKED_ARRAYS; ++i) {
+		FGLPackedArray *p = &buf->packed[i];
+
+		if (p->data && p->offset == offset
+		    && p->stride == array->stride
+		    && p->width == array->width) {
+			if (p->count >= count)
+				return p;
+
+			/* Replace with a longer copy */
+			packed = p;
+			break;
+		}
+	}
+
+	/* Arrays reaching past the end of buffer are used unpacked */
+	if (offset < 0 || buf->size - offset < array->width
+	    || (buf->size - offset - array->width) / array->stride + 1 < count)
+		return 0;
+
+	int packedWidth = (array->width + 3) & ~3;
+	int64_t limit = (int64_t)FGL_MAX_PACKED_SIZE_RATIO * buf->size;
+	int64_t size = (int64_t)count * packedWidth;
+
+	if (size > limit)
+		return 0;
+
+	if (!packed) {
+		packed = &buf->packed[buf->packedNext];
+		buf->packedNext = (buf->packedNext + 1) % FGL_MAX_PACKED_ARRAYS;
+	}
+
+	buf->dropPacked(packed);
+
+	/* Drop other copies, oldest first, until the new one fits */
+	for (int i = 0; buf->packedSize + size > limit; ++i) {
+		unsigned slot = (buf->packedNext + i) % FGL_MAX_PACKED_ARRAYS;
+
+		buf->dropPacked(&buf->packed[slot]);
+	}
+
+	uint8_t *data = (uint8_t *)calloc(count, packedWidth);
+	if (!data)
+		return 0;
+
+	const uint8_t *src = (const uint8_t *)array->pointer;
+	uint8_t *dst = data;
+
+	for (int i = 0; i < count; ++i) {
+		memcpy(dst, src, array->width);
+		src += array->stride;
+		dst += packedWidth;
+	}
+
+	packed->offset = offset;
+	packed->stride = array->stride;
+	packed->width = array->width;
+	packed->packedWidth = packedWidth;
+	packed->count = count;
+	packed->data = data;
+	buf->packedSize += size;
+
+	return packed;
+}
+
+/* Returns the number of vertices referenced by indices, 0 if unknown */
+static GLint fglCountIndexedVertices(GLenum type, const GLvoid *indices,
+								GLsizei count)
+{
+	GLint max = -1;
+
+	if (!indices)
+		return 0;
+
+	switch (type) {
+	case GL_UNSIGNED_BYTE: {
+		const GLubyte *idx = (const GLubyte *)indices;
+
+		for (GLsizei i = 0; i < count; ++i)
+			if (idx[i] > max)
+				max = idx[i];
+		break; }
+	case GL_UNSIGNED_SHORT: {
+		const GLushort *idx = (const GLushort *)indices;
+
+		for (GLsizei i = 0; i < count; ++i)
+			if (idx[i] > max)
+				max = idx[i];
+		break; }
+	}
+
+	return max + 1;
+}
+
+static inline GLint fglGetDrawCount(FGLDrawRange *range)
+{
+	if (range->indices) {
+		range->count = fglCountIndexedVertices(range->type,
+					range->indices, range->indexCount);
+		range->indices = 0;
+	}
+
+	return range->count;
+}
+
+#endif /* FGL_PACKED_BUFFER_ARRAYS */
+
+static inline void fglSetupArray(FGLContext *ctx, fimgArray *array,
+				GLint attrib, GLint idx, FGLDrawRange *range)
+{
+	FGLArrayState *state = &ctx->array[idx];
+	GLint first = range->first;
+
+	fimgSetAttribute(ctx->fimg, attrib, state->type, state->size);
+
+#ifdef FGL_PACKED_BUFFER_ARRAYS
+	if (state->buffer && state->buffer->usage == GL_STATIC_DRAW
+	    && !state->buffer->mapped && fglNeedsPacking(state)) {
+		const FGLPackedArray *packed =
+				fglGetPackedArray(state, fglGetDrawCount(range));
+
+		if (packed) {
+			array->pointer	= (const uint8_t *)packed->data
+						+ first*packed->packedWidth;
+			array->stride	= packed->packedWidth;
+			array->width	= packed->packedWidth;
+			return;
+		}
+	}
+#endif
+
+	array->pointer	= (const uint8_t *)state->pointer
+						+ first*state->stride;
+	array->stride	= state->stride;
+	array->width	= state->width;
+}
+
+/*
+ * The vertex shader consumes only position, color and coordinates
+ * of enabled texture units. Arrays of these are packed into consecutive
+ * host interface attributes, while attributes without enabled arrays are
+ * passed to the shader as constants, so they take neither vertex buffer
+ * space nor host interface bandwidth. Returns the number of attributes.
+ */
+static GLint fglSetupAttributes(FGLContext *ctx, fimgArray *arrays,
+				FGLDrawRange *range, GLuint texUnits)
+{
+	GLint attrib = 1;
+
+	if (ctx->array[FGL_ARRAY_VERTEX].enabled) {
+		fglSetupArray(ctx, &arrays[0], 0, FGL_ARRAY_VERTEX, range);
+	} else {
+		arrays[0].pointer	= &ctx->vertex[FGL_ARRAY_VERTEX];
+		arrays[0].stride	= 0;
+		arrays[0].width		= 16;
+		fimgSetAttribute(ctx->fimg, 0, FGHI_ATTRIB_DT_FLOAT, 4);
+	}
+
+	if (ctx->array[FGL_ARRAY_COLOR].enabled) {
+		fglSetupArray(ctx, &arrays[attrib], attrib,
+						FGL_ARRAY_COLOR, range);
+		++attrib;
+		fimgCompatSetAttribConst(ctx->fimg, FGFP_ATTRIB_COLOR, NULL);
+	} else {
+		fimgCompatSetAttribConst(ctx->fimg, FGFP_ATTRIB_COLOR,
+					ctx->vertex[FGL_ARRAY_COLOR]);
+	}
+
+	for (int i = 0; i < FGL_MAX_TEXTURE_UNITS; ++i) {
+		GLint idx = FGL_ARRAY_TEXTURE(i);
+
+		if (!(texUnits & (1 << i)) || !ctx->array[idx].enabled) {
+			fimgCompatSetAttribConst(ctx->fimg,
+					FGFP_ATTRIB_TEXTURE(i), ctx->vertex[idx]);
+			continue;
+		}
+
+		fglSetupArray(ctx, &arrays[attrib], attrib, idx, range);
+		++attrib;
+		fimgCompatSetAttribConst(ctx->fimg,
+					FGFP_ATTRIB_TEXTURE(i), NULL);
+	}
 
-	if (flush)
-		fimgInvalidateTextureCache(ctx->fimg);
+	fimgSetAttribCount(ctx->fimg, attrib);
+
+	return attrib;
 }
 
 static void fglSetScissor(FGLContext *ctx, GLint x, GLint y,
@@ -763,6 +1234,10 @@ static inline int fglSetupFramebuffer(FGLContext *ctx)
 
 	int flipY = (fba->getType() != GL_TEXTURE);
 
+	/* Texture might be still uploaded in background */
+	if (!flipY)
+		static_cast<FGLTexture *>(fba)->waitForUpload();
+
 	fimgSetFrameBufSize(ctx->fimg, width, height, flipY);
 	fimgSetFrameBufParams(ctx->fimg, pix->flags, pix->pixFormat);
 	fimgSetColorBufBaseAddr(ctx->fimg, fba->surface->paddr);
@@ -827,6 +1302,254 @@ static inline int fglSetupFramebuffer(FGLContext *ctx)
 	return 0;
 }
 
+/*
+ * Draw coalescing
+ *
+ * Small draws are not sent to the hardware immediately. Their vertices
+ * are copied to a batch as separate points, lines or triangles and
+ * following draws of the same kind are appended to it, skipping state
+ * setup, for as long as only client arrays change in between. Any other
+ * call submits the batch before touching the state, see getContext(), so
+ * all merged draws share the state and go to the hardware as a single one.
+ */
+
+/* Batch space for a single attribute, of at most four words per vertex */
+#define FGL_COALESCE_ATTRIB_SIZE	(16*FGL_COALESCE_MAX_VERTICES)
+
+static bool fglAllocBatch(FGLDrawBatch *batch)
+{
+	if (!batch->data)
+		batch->data = (uint8_t *)malloc((2 + FGL_MAX_TEXTURE_UNITS)
+						* FGL_COALESCE_ATTRIB_SIZE);
+
+	return batch->data != 0;
+}
+
+static inline uint8_t *fglBatchData(FGLDrawBatch *batch, GLint attrib)
+{
+	return batch->data + attrib*FGL_COALESCE_ATTRIB_SIZE;
+}
+
+#ifdef FGL_DRAW_COALESCING
+
+/* Finds arrays feeding attributes, in the order of fglSetupAttributes */
+static GLint fglGetBatchSources(FGLContext *ctx, GLuint texUnits,
+								GLint *sources)
+{
+	GLint attrib = 1;
+
+	if (ctx->array[FGL_ARRAY_VERTEX].enabled)
+		sources[0] = FGL_ARRAY_VERTEX;
+	else
+		sources[0] = -1;
+
+	if (ctx->array[FGL_ARRAY_COLOR].enabled)
+		sources[attrib++] = FGL_ARRAY_COLOR;
+
+	for (int i = 0; i < FGL_MAX_TEXTURE_UNITS; ++i) {
+		GLint idx = FGL_ARRAY_TEXTURE(i);
+
+		if ((texUnits & (1 << i)) && ctx->array[idx].enabled)
+			sources[attrib++] = idx;
+	}
+
+	return attrib;
+}
+
+static bool fglBatchArraysMatch(FGLContext *ctx)
+{
+	FGLDrawBatch *batch = &ctx->drawBatch;
+	GLint sources[2 + FGL_MAX_TEXTURE_UNITS];
+	GLint attribs;
+
+	attribs = fglGetBatchSources(ctx, batch->texUnits, sources);
+	if (attribs != batch->attribs)
+		return false;
+
+	for (GLint i = 0; i < attribs; ++i) {
+		if (sources[i] != batch->source[i])
+			return false;
+
+		if (sources[i] < 0)
+			continue;
+
+		const FGLArrayState *array = &ctx->array[sources[i]];
+
+		if (array->type != batch->type[i]
+		    || array->size != batch->size[i])
+			return false;
+	}
+
+	return true;
+}
+
+/* Sets up the state for a new batch, just as a regular draw would */
+static bool fglBeginBatch(FGLContext *ctx, uint32_t mode)
+{
+	FGLDrawBatch *batch = &ctx->drawBatch;
+	fimgArray arrays[4 + FGL_MAX_TEXTURE_UNITS];
+
+	if (!fglAllocBatch(batch))
+		return false;
+
+	/* Errors are reported by the regular path */
+	if (fglSetupFramebuffer(ctx))
+		return false;
+
+	fglSetupMatrices(ctx);
+	batch->texUnits = fglSetupTextures(ctx);
+	/* Vertices are copied to the batch, so nothing needs packing */
+	FGLDrawRange range = { 0, 0, 0, 0, 0 };
+	fglSetupAttributes(ctx, arrays, &range, batch->texUnits);
+
+	batch->attribs = fglGetBatchSources(ctx,
+					batch->texUnits, batch->source);
+
+	for (GLint i = 0; i < batch->attribs; ++i) {
+		if (batch->source[i] < 0)
+			continue;
+
+		const FGLArrayState *array = &ctx->array[batch->source[i]];
+
+		batch->type[i] = array->type;
+		batch->size[i] = array->size;
+		batch->width[i] = (array->width + 3) & ~3;
+	}
+
+	batch->mode = mode;
+	batch->count = 0;
+	batch->drawTex = false;
+	batch->pending = true;
+
+	return true;
+}
+
+/*
+ * Lists vertices of a draw as separate primitives, with strips and fans
+ * converted to triangles. Returns the number of listed vertices.
+ */
+static GLint fglListBatchVertices(GLenum mode, GLsizei count,
+					GLuint *list, uint32_t *fglMode)
+{
+	GLint n = 0;
+	GLint i;
+
+	switch (mode) {
+	case GL_POINTS:
+		*fglMode = FGPE_POINTS;
+		for (i = 0; i < count; ++i)
+			list[n++] = i;
+		break;
+	case GL_LINES:
+		*fglMode = FGPE_LINES;
+		for (i = 0; i < (count & ~1); ++i)
+			list[n++] = i;
+		break;
+	case GL_TRIANGLES:
+		*fglMode = FGPE_TRIANGLES;
+		for (i = 0; i < count - count % 3; ++i)
+			list[n++] = i;
+		break;
+	case GL_TRIANGLE_STRIP:
+		*fglMode = FGPE_TRIANGLES;
+		for (i = 2; i < count; ++i) {
+			/* Odd triangles have swapped order to keep winding */
+			list[n++] = (i % 2) ? i - 1 : i - 2;
+			list[n++] = (i % 2) ? i - 2 : i - 1;
+			list[n++] = i;
+		}
+		break;
+	case GL_TRIANGLE_FAN:
+		*fglMode = FGPE_TRIANGLES;
+		for (i = 2; i < count; ++i) {
+			list[n++] = 0;
+			list[n++] = i - 1;
+			list[n++] = i;
+		}
+		break;
+	}
+
+	return n;
+}
+
+/* Merges the draw into current batch, returns false if it can't be merged */
+static bool fglCoalesceDraw(FGLContext *ctx, GLenum mode, GLint first,
+			GLsizei count, GLenum type, const GLvoid *indices)
+{
+	FGLDrawBatch *batch = &ctx->drawBatch;
+	GLuint list[3*FGL_COALESCE_MAX_DRAW];
+	uint32_t fglMode;
+	GLint n = 0;
+
+	if (count <= FGL_COALESCE_MAX_DRAW)
+		n = fglListBatchVertices(mode, count, list, &fglMode);
+
+	/* Type is zero for non-indexed draws */
+	if (!n || (type && ((type != GL_UNSIGNED_BYTE
+	    && type != GL_UNSIGNED_SHORT) || !indices))) {
+		fglFlushDraws(ctx);
+		return false;
+	}
+
+	if (batch->pending && (batch->drawTex || batch->mode != fglMode
+	    || batch->count + n > FGL_COALESCE_MAX_VERTICES
+	    || !fglBatchArraysMatch(ctx)))
+		fglSubmitDraws(ctx);
+
+	if (!batch->pending && !fglBeginBatch(ctx, fglMode))
+		return false;
+
+	for (GLint i = 0; i < n; ++i) {
+		if (!type)
+			list[i] += first;
+		else if (type == GL_UNSIGNED_BYTE)
+			list[i] = ((const GLubyte *)indices)[list[i]];
+		else
+			list[i] = ((const GLushort *)indices)[list[i]];
+	}
+
+	for (GLint a = 0; a < batch->attribs; ++a) {
+		if (batch->source[a] < 0)
+			continue;
+
+		const FGLArrayState *array = &ctx->array[batch->source[a]];
+		const uint8_t *src = (const uint8_t *)array->pointer;
+		GLint width = batch->width[a];
+		uint8_t *dst = fglBatchData(batch, a) + batch->count*width;
+
+		for (GLint i = 0; i < n; ++i, dst += width)
+			memcpy(dst, src + list[i]*array->stride, array->width);
+	}
+
+	batch->count += n;
+	return true;
+}
+
+static void fglSubmitMergedDraws(FGLContext *ctx)
+{
+	FGLDrawBatch *batch = &ctx->drawBatch;
+	fimgArray arrays[4 + FGL_MAX_TEXTURE_UNITS];
+
+	for (GLint a = 0; a < batch->attribs; ++a) {
+		if (batch->source[a] < 0) {
+			arrays[a].pointer	= &ctx->vertex[FGL_ARRAY_VERTEX];
+			arrays[a].stride	= 0;
+			arrays[a].width		= 16;
+			continue;
+		}
+
+		arrays[a].pointer	= fglBatchData(batch, a);
+		arrays[a].stride	= batch->width[a];
+		arrays[a].width		= batch->width[a];
+	}
+
+	ctx->finished = false;
+
+	fimgDrawArrays(ctx->fimg, batch->mode, arrays, batch->count);
+}
+
+#endif /* FGL_DRAW_COALESCING */
+
 GL_API void GL_APIENTRY glDrawArrays (GLenum mode, GLint first, GLsizei count)
 {
 	uint32_t fglMode;
@@ -837,31 +1560,26 @@ GL_API void GL_APIENTRY glDrawArrays (GLenum mode, GLint first, GLsizei count)
 	}
 
 	fimgArray arrays[4 + FGL_MAX_TEXTURE_UNITS];
-	FGLContext *ctx = getContext();
+	FGLContext *ctx = getContextNoFlush();
+
+#ifdef FGL_DRAW_COALESCING
+	if (fglCoalesceDraw(ctx, mode, first, count, 0, 0))
+		return;
+#else
+	fglFlushDraws(ctx);
+#endif
 
 	if (fglSetupFramebuffer(ctx)) {
 		setError(GL_INVALID_FRAMEBUFFER_OPERATION_OES);
 		return;
 	}
 
-	for(int i = 0; i < (4 + FGL_MAX_TEXTURE_UNITS); ++i) {
-		if(ctx->array[i].enabled) {
-			arrays[i].pointer	=
-					(const uint8_t *)ctx->array[i].pointer
-					+ first*ctx->array[i].stride;
-			arrays[i].stride	= ctx->array[i].stride;
-			arrays[i].width		= ctx->array[i].width;
-		} else {
-			arrays[i].pointer	= &ctx->vertex[i];
-			arrays[i].stride	= 0;
-			arrays[i].width		= 16;
-		}
-	}
+	FGLDrawRange range = {
+		first, (count > INT_MAX - first) ? 0 : first + count, 0, 0, 0
+	};
 
 	fglSetupMatrices(ctx);
-	fglSetupTextures(ctx);
-
-	fimgSetAttribCount(ctx->fimg, 4 + FGL_MAX_TEXTURE_UNITS);
+	fglSetupAttributes(ctx, arrays, &range, fglSetupTextures(ctx));
 
 	switch (mode) {
 	case GL_POINTS:
@@ -877,7 +1595,7 @@ GL_API void GL_APIENTRY glDrawArrays (GLenum mode, GLint first, GLsizei count)
 	case GL_LINE_LOOP:
 		if (count < 2)
 			return;
-		fglMode = FGPE_LINE_STRIP;
+		fglMode = FGPE_LINE_LOOP;
 		break;
 	case GL_LINES:
 		if (count < 2)
@@ -909,17 +1627,6 @@ GL_API void GL_APIENTRY glDrawArrays (GLenum mode, GLint first, GLsizei count)
 	ctx->finished = false;
 
 	fimgDrawArrays(ctx->fimg, fglMode, arrays, count);
-
-	if (mode == GL_LINE_LOOP) {
-	/*
-	* Line loops have to be emulated using line strips,
-	* as the buffered geometry transfer code doesn't get well
-	* with them.
-	*/
-		const uint8_t indices[2] = { count - 1, 0 };
-		fimgDrawElementsUByteIdx(ctx->fimg,
-						fglMode, arrays, 2, indices);
-	}
 }
 
 GL_API void GL_APIENTRY glDrawElements (GLenum mode, GLsizei count, GLenum type,
@@ -927,32 +1634,28 @@ GL_API void GL_APIENTRY glDrawElements (GLenum mode, GLsizei count, GLenum type,
 {
 	uint32_t fglMode;
 	fimgArray arrays[4 + FGL_MAX_TEXTURE_UNITS];
-	FGLContext *ctx = getContext();
+	FGLContext *ctx = getContextNoFlush();
+
+	if(ctx->elementArrayBuffer.isBound())
+		indices = ctx->elementArrayBuffer.get()->getAddress(indices);
+
+#ifdef FGL_DRAW_COALESCING
+	if (fglCoalesceDraw(ctx, mode, 0, count, type, indices))
+		return;
+#else
+	fglFlushDraws(ctx);
+#endif
 
 	if (fglSetupFramebuffer(ctx)) {
 		setError(GL_INVALID_FRAMEBUFFER_OPERATION_OES);
 		return;
 	}
 
-	if(ctx->elementArrayBuffer.isBound())
-		indices = ctx->elementArrayBuffer.get()->getAddress(indices);
-
-	for(int i = 0; i < (4 + FGL_MAX_TEXTURE_UNITS); ++i) {
-		if(ctx->array[i].enabled) {
-			arrays[i].pointer	= ctx->array[i].pointer;
-			arrays[i].stride	= ctx->array[i].stride;
-			arrays[i].width		= ctx->array[i].width;
-		} else {
-			arrays[i].pointer	= &ctx->vertex[i];
-			arrays[i].stride	= 0;
-			arrays[i].width		= 16;
-		}
-	}
+	/* Vertices are counted only if any array gets packed */
+	FGLDrawRange range = { 0, 0, type, indices, count };
 
 	fglSetupMatrices(ctx);
-	fglSetupTextures(ctx);
-
-	fimgSetAttribCount(ctx->fimg, 4 + FGL_MAX_TEXTURE_UNITS);
+	fglSetupAttributes(ctx, arrays, &range, fglSetupTextures(ctx));
 
 	switch (mode) {
 	case GL_POINTS:
@@ -968,7 +1671,7 @@ GL_API void GL_APIENTRY glDrawElements (GLenum mode, GLsizei count, GLenum type,
 	case GL_LINE_LOOP:
 		if (count < 2)
 			return;
-		fglMode = FGPE_LINE_STRIP;
+		fglMode = FGPE_LINE_LOOP;
 		break;
 	case GL_LINES:
 		if (count < 2)
@@ -1000,95 +1703,164 @@ GL_API void GL_APIENTRY glDrawElements (GLenum mode, GLsizei count, GLenum type,
 	ctx->finished = false;
 
 	switch (type) {
-	case GL_UNSIGNED_BYTE: {
-		const uint8_t *indices8 = (const uint8_t *)indices;
+	case GL_UNSIGNED_BYTE:
 		fimgDrawElementsUByteIdx(ctx->fimg, fglMode, arrays,
-							count, indices8);
-		if (mode == GL_LINE_LOOP) {
-		/*
-		 * Line loops have to be emulated using line strips,
-		 * as the buffered geometry transfer code doesn't get well
-		 * with them.
-		 */
-			uint8_t tmp[2];
-			tmp[0] = indices8[count - 1];
-			tmp[1] = indices8[0];
-			fimgDrawElementsUByteIdx(ctx->fimg, fglMode,
-								arrays, 2, tmp);
-		}
+					count, (const uint8_t *)indices);
 		break;
-	}
-	case GL_UNSIGNED_SHORT: {
-		const uint16_t *indices16 = (const uint16_t *)indices;
+	case GL_UNSIGNED_SHORT:
 		fimgDrawElementsUShortIdx(ctx->fimg, fglMode, arrays,
-							count, indices16);
-		if (mode == GL_LINE_LOOP) {
-		/*
-		 * Line loops have to be emulated using line strips,
-		 * as the buffered geometry transfer code doesn't get well
-		 * with them.
-		 */
-			uint16_t tmp[2];
-			tmp[0] = indices16[count - 1];
-			tmp[1] = indices16[0];
-			fimgDrawElementsUShortIdx(ctx->fimg, fglMode,
-								arrays, 2, tmp);
-		}
+					count, (const uint16_t *)indices);
 		break;
-	}
 	default:
 		setError(GL_INVALID_ENUM);
 	}
 }
 
 /*
-	Draw texture
+	Clear
 */
 
-GL_API void GL_APIENTRY glDrawTexfOES (GLfloat x, GLfloat y, GLfloat z, GLfloat width, GLfloat height)
+#ifdef FGL_HARDWARE_CLEAR
+void fglHardwareClear(FGLContext *ctx, GLbitfield mask)
 {
-	FGLContext *ctx = getContext();
-	GLboolean arrayEnabled[4 + FGL_MAX_TEXTURE_UNITS];
-	GLfloat vertices[3*4];
-	GLfloat texcoords[2][2*4];
+	FGLAbstractFramebuffer *fb = ctx->framebuffer.get();
+	uint32_t depthFormat = fb->getDepthFormat();
+	unsigned int buffers = 0;
 
 	if (fglSetupFramebuffer(ctx)) {
 		setError(GL_INVALID_FRAMEBUFFER_OPERATION_OES);
 		return;
 	}
 
-	/* Save current state and prepare to drawing */
+	if (mask & GL_COLOR_BUFFER_BIT)
+		buffers |= FIMG_CLEAR_COLOR;
 
-	GLint viewportX = ctx->viewport.x;
-	GLint viewportY = ctx->viewport.y;
-	GLsizei viewportW = ctx->viewport.width;
-	GLsizei viewportH = ctx->viewport.height;
-	GLfloat zNear = ctx->viewport.zNear;
-	GLfloat zFar = ctx->viewport.zFar;
+	if ((mask & GL_DEPTH_BUFFER_BIT) && (depthFormat & 0xff))
+		buffers |= FIMG_CLEAR_DEPTH;
+
+	if ((mask & GL_STENCIL_BUFFER_BIT) && (depthFormat >> 8))
+		buffers |= FIMG_CLEAR_STENCIL;
+
+	if (!buffers)
+		return;
+
+	ctx->finished = false;
+
+	fimgClear(ctx->fimg, buffers, &ctx->clear.red,
+				ctx->clear.depth, ctx->clear.stencil);
+}
+#endif
+
+/*
+	Draw texture
+*/
+
+/*
+ * Consecutive DrawTex rectangles are merged just like small draws, but
+ * regardless of FGL_DRAW_COALESCING, as they depend on much less state.
+ * They are drawn as triangles given in window coordinates by a shader
+ * variant skipping transformation, so user matrices are left untouched.
+ */
+
+/* Triangles of a rectangle made of its corners, in strip order */
+static const GLint fglDrawTexCorners[6] = { 0, 1, 2, 2, 1, 3 };
+
+static bool fglBeginDrawTex(FGLContext *ctx)
+{
+	FGLDrawBatch *batch = &ctx->drawBatch;
+	GLuint units;
+
+	if (!fglAllocBatch(batch)) {
+		setError(GL_OUT_OF_MEMORY);
+		return false;
+	}
+
+	if (fglSetupFramebuffer(ctx)) {
+		setError(GL_INVALID_FRAMEBUFFER_OPERATION_OES);
+		return false;
+	}
+
+	units = fglSetupTextures(ctx);
+
+	batch->texUnits = units;
+	batch->attribs = 1;
+	for (int i = 0; i < FGL_MAX_TEXTURE_UNITS; ++i)
+		if (units & (1 << i))
+			++batch->attribs;
+
+	batch->mode = FGPE_TRIANGLES;
+	batch->count = 0;
+	batch->drawTex = true;
+	batch->pending = true;
+
+	return true;
+}
+
+static void fglSubmitDrawTex(FGLContext *ctx)
+{
+	FGLDrawBatch *batch = &ctx->drawBatch;
+	fimgArray arrays[4 + FGL_MAX_TEXTURE_UNITS];
+	GLint attrib = 1;
 
 	fimgSetViewportBypass(ctx->fimg);
 	fimgSetFaceCullEnable(ctx->fimg, 0);
+	fimgCompatSetTransformBypass(ctx->fimg, 1);
+
+	arrays[0].pointer	= fglBatchData(batch, 0);
+	arrays[0].stride	= 12;
+	arrays[0].width		= 12;
+	fimgSetAttribute(ctx->fimg, 0, FGHI_ATTRIB_DT_FLOAT, 3);
+
+	fimgCompatSetAttribConst(ctx->fimg, FGFP_ATTRIB_COLOR,
+					ctx->vertex[FGL_ARRAY_COLOR]);
+
+	for (int i = 0; i < FGL_MAX_TEXTURE_UNITS; i++) {
+		if (!(batch->texUnits & (1 << i))) {
+			fimgCompatSetAttribConst(ctx->fimg, FGFP_ATTRIB_TEXTURE(i),
+					ctx->vertex[FGL_ARRAY_TEXTURE(i)]);
+			continue;
+		}
+
+		arrays[attrib].pointer	= fglBatchData(batch, attrib);
+		arrays[attrib].stride	= 8;
+		arrays[attrib].width	= 8;
 
-	for (int i = 0; i < 4 + FGL_MAX_TEXTURE_UNITS; i++) {
-		arrayEnabled[i] = ctx->array[i].enabled;
-		fglDisableClientState(ctx, i);
+		fimgSetAttribute(ctx->fimg, attrib, FGHI_ATTRIB_DT_FLOAT, 2);
+		fimgCompatSetAttribConst(ctx->fimg,
+					FGFP_ATTRIB_TEXTURE(i), NULL);
+		++attrib;
 	}
 
-	/* TODO: Replace this with dedicated shader or conditional operation */
-	FGLmatrix *matrix = &ctx->matrix.transformMatrix;
-	matrix->identity();
+	fimgSetAttribCount(ctx->fimg, attrib);
 
-	fimgLoadMatrix(ctx->fimg, FGFP_MATRIX_TRANSFORM, matrix->data);
-	fimgLoadMatrix(ctx->fimg, FGFP_MATRIX_LIGHTING, matrix->data);
-	ctx->matrix.dirty[FGL_MATRIX_MODELVIEW] = 1;
-	fimgLoadMatrix(ctx->fimg, FGFP_MATRIX_TEXTURE(0), matrix->data);
-	ctx->matrix.dirty[FGL_MATRIX_TEXTURE(0)] = 1;
-	fimgLoadMatrix(ctx->fimg, FGFP_MATRIX_TEXTURE(1), matrix->data);
-	ctx->matrix.dirty[FGL_MATRIX_TEXTURE(1)] = 1;
+	ctx->finished = false;
+
+	fimgDrawArrays(ctx->fimg, FGPE_TRIANGLES, arrays, batch->count);
+
+	/* Restore previous state */
+
+	fimgCompatSetTransformBypass(ctx->fimg, 0);
+	fimgSetDepthRange(ctx->fimg, ctx->viewport.zNear, ctx->viewport.zFar);
+	fimgSetViewportParams(ctx->fimg, ctx->viewport.x, ctx->viewport.y,
+				ctx->viewport.width, ctx->viewport.height);
+	fimgSetFaceCullEnable(ctx->fimg, ctx->enable.cullFace);
+}
+
+GL_API void GL_APIENTRY glDrawTexfOES (GLfloat x, GLfloat y, GLfloat z, GLfloat width, GLfloat height)
+{
+	FGLContext *ctx = getContextNoFlush();
+	FGLDrawBatch *batch = &ctx->drawBatch;
 
-	// fimgCompatLightingEnable(ctx->fimg, 0);
-	/* End of TODO */
+	if (batch->pending && (!batch->drawTex
+	    || batch->count + 6 > FGL_COALESCE_MAX_VERTICES))
+		fglSubmitDraws(ctx);
+
+	if (!batch->pending && !fglBeginDrawTex(ctx))
+		return;
 
+	GLfloat zNear = ctx->viewport.zNear;
+	GLfloat zFar = ctx->viewport.zFar;
+	GLfloat corners[4][3];
 	float zD;
 
 	if (z <= 0)
@@ -1098,92 +1870,71 @@ GL_API void GL_APIENTRY glDrawTexfOES (GLfloat x, GLfloat y, GLfloat z, GLfloat
 	else
 		zD = zNear + z*(zFar - zNear);
 
-	vertices[ 0] = x;
-	vertices[ 1] = y + height;
-	vertices[ 2] = zD;
-	vertices[ 3] = x + width;
-	vertices[ 4] = y + height;
-	vertices[ 5] = zD;
-	vertices[ 6] = x;
-	vertices[ 7] = y;
-	vertices[ 8] = zD;
-	vertices[ 9] = x + width;
-	vertices[10] = y;
-	vertices[11] = zD;
-
-	/* Proceed with drawing */
-
-	fimgArray arrays[4 + FGL_MAX_TEXTURE_UNITS];
+	corners[0][0] = x;
+	corners[0][1] = y + height;
+	corners[1][0] = x + width;
+	corners[1][1] = y + height;
+	corners[2][0] = x;
+	corners[2][1] = y;
+	corners[3][0] = x + width;
+	corners[3][1] = y;
 
-	arrays[FGL_ARRAY_VERTEX].pointer	= vertices;
-	arrays[FGL_ARRAY_VERTEX].stride		= 12;
-	arrays[FGL_ARRAY_VERTEX].width		= 12;
-	fimgSetAttribute(ctx->fimg, FGL_ARRAY_VERTEX, FGHI_ATTRIB_DT_FLOAT, 3);
+	GLfloat *pos = (GLfloat *)fglBatchData(batch, 0) + 3*batch->count;
 
-	for (int i = FGL_ARRAY_NORMAL;
-	     i < FGL_ARRAY_TEXTURE + FGL_MAX_TEXTURE_UNITS; i++) {
-		arrays[i].pointer	= &ctx->vertex[i];
-		arrays[i].stride	= 0;
-		arrays[i].width		= 16;
+	for (int i = 0; i < 6; ++i, pos += 3) {
+		pos[0] = corners[fglDrawTexCorners[i]][0];
+		pos[1] = corners[fglDrawTexCorners[i]][1];
+		pos[2] = zD;
 	}
 
-	for (int i = 0; i < FGL_MAX_TEXTURE_UNITS; i++) {
-		FGLTexture *tex;
-		bool enabled = ctx->textureExternal[i].enabled;
-
-		if (enabled)
-			tex = ctx->textureExternal[i].getTexture();
-
-		if (!enabled) {
-			tex = ctx->texture[i].getTexture();
-			enabled = ctx->texture[i].enabled;
-		}
+	GLint attrib = 1;
 
-		if (!enabled || !tex->isComplete())
+	for (int i = 0; i < FGL_MAX_TEXTURE_UNITS; i++) {
+		if (!(batch->texUnits & (1 << i)))
 			continue;
 
+		FGLTexture *tex = ctx->busyTexture[i];
+
 		if (!tex->invReady) {
 			tex->invWidth = 1.0f/tex->width;
 			tex->invHeight = 1.0f/tex->height;
 			tex->invReady = true;
 		}
 
-		texcoords[i][ 0] = tex->invWidth*tex->cropRect[0];
-		texcoords[i][ 1] = tex->invHeight*(tex->cropRect[1] + tex->cropRect[3]);
-		texcoords[i][ 2] = tex->invWidth*(tex->cropRect[0] + tex->cropRect[2]);
-		texcoords[i][ 3] = tex->invHeight*(tex->cropRect[1] + tex->cropRect[3]);
-		texcoords[i][ 4] = tex->invWidth*tex->cropRect[0];
-		texcoords[i][ 5] = tex->invHeight*(tex->cropRect[1]);
-		texcoords[i][ 6] = tex->invWidth*(tex->cropRect[0] + tex->cropRect[2]);
-		texcoords[i][ 7] = tex->invHeight*tex->cropRect[1];
+		GLfloat s0 = tex->invWidth*tex->cropRect[0];
+		GLfloat s1 = tex->invWidth*(tex->cropRect[0] + tex->cropRect[2]);
+		GLfloat t0 = tex->invHeight*tex->cropRect[1];
+		GLfloat t1 = tex->invHeight*(tex->cropRect[1] + tex->cropRect[3]);
+		GLfloat *coord = (GLfloat *)fglBatchData(batch, attrib)
+							+ 2*batch->count;
 
-		arrays[FGL_ARRAY_TEXTURE(i)].pointer	= texcoords[i];
-		arrays[FGL_ARRAY_TEXTURE(i)].stride	= 8;
-		arrays[FGL_ARRAY_TEXTURE(i)].width	= 8;
+		for (int j = 0; j < 6; ++j, coord += 2) {
+			GLint corner = fglDrawTexCorners[j];
 
-		fimgSetAttribute(ctx->fimg, FGL_ARRAY_TEXTURE(i), FGHI_ATTRIB_DT_FLOAT, 2);
-	}
-
-	fglSetupTextures(ctx);
+			coord[0] = (corner & 1) ? s1 : s0;
+			coord[1] = (corner & 2) ? t0 : t1;
+		}
 
-	fimgSetAttribCount(ctx->fimg, 4 + FGL_MAX_TEXTURE_UNITS);
+		++attrib;
+	}
 
-	ctx->finished = false;
+	batch->count += 6;
+}
 
-	fimgDrawArrays(ctx->fimg, FGPE_TRIANGLE_STRIP, arrays, 4);
+void fglSubmitDraws(FGLContext *ctx)
+{
+	FGLDrawBatch *batch = &ctx->drawBatch;
 
-	/* Restore previous state */
+	batch->pending = false;
 
-	for (int i = 0; i < 4 + FGL_MAX_TEXTURE_UNITS; i++) {
-		if (arrayEnabled[i])
-			fglEnableClientState(ctx, i);
-		else
-			fglDisableClientState(ctx, i);
+	if (batch->drawTex) {
+		fglSubmitDrawTex(ctx);
+		return;
 	}
 
-	fimgSetDepthRange(ctx->fimg, zNear, zFar);
-	fimgSetViewportParams(ctx->fimg, viewportX, viewportY, viewportW, viewportH);
-	fimgSetFaceCullEnable(ctx->fimg, ctx->enable.cullFace);
+#ifdef FGL_DRAW_COALESCING
+	fglSubmitMergedDraws(ctx);
+#endif
 }
 
 GL_API void GL_APIENTRY glDrawTexsOES (GLshort x, GLshort y, GLshort z, GLshort width, GLshort height)
@@ -1707,7 +2458,13 @@ GL_API void GL_APIENTRY glBlendFunc (GLenum sfactor, GLenum dfactor)
 		return;
 	}
 
-	FGLContext *ctx = getContext();
+	FGLContext *ctx = getContextNoFlush();
+
+	if (ctx->perFragment.blendSrc == sfactor
+	    && ctx->perFragment.blendDst == dfactor)
+		return;
+
+	fglFlushDraws(ctx);
 
 	ctx->perFragment.blendSrc = sfactor;
 	ctx->perFragment.fglBlendSrc = fglSrc;
@@ -1858,9 +2615,46 @@ GL_API void GL_APIENTRY glStencilMask (GLuint mask)
 	Enable/disable
 */
 
+/* Returns current state of capability or -1 if it is not tracked */
+static int fglGetEnable(FGLContext *ctx, GLenum cap)
+{
+	switch (cap) {
+	case GL_TEXTURE_2D:
+		return ctx->texture[ctx->activeTexture].enabled;
+	case GL_TEXTURE_EXTERNAL_OES:
+		return ctx->textureExternal[ctx->activeTexture].enabled;
+	case GL_CULL_FACE:
+		return ctx->enable.cullFace;
+	case GL_POLYGON_OFFSET_FILL:
+		return ctx->enable.polyOffFill;
+	case GL_SCISSOR_TEST:
+		return ctx->enable.scissorTest;
+	case GL_ALPHA_TEST:
+		return ctx->enable.alphaTest;
+	case GL_STENCIL_TEST:
+		return ctx->enable.stencilTest;
+	case GL_DEPTH_TEST:
+		return ctx->enable.depthTest;
+	case GL_BLEND:
+		return ctx->enable.blend;
+	case GL_DITHER:
+		return ctx->enable.dither;
+	case GL_COLOR_LOGIC_OP:
+		return ctx->enable.colorLogicOp;
+	default:
+		return -1;
+	}
+}
+
 static inline void fglSet(GLenum cap, bool state)
 {
-	FGLContext *ctx = getContext();
+	FGLContext *ctx = getContextNoFlush();
+
+	/* Redundant changes do not need to end merged draws */
+	if (fglGetEnable(ctx, cap) == state)
+		return;
+
+	fglFlushDraws(ctx);
 
 	switch (cap) {
 	case GL_TEXTURE_2D:
@@ -1871,11 +2665,11 @@ static inline void fglSet(GLenum cap, bool state)
 		break;
 	case GL_CULL_FACE:
 		fimgSetFaceCullEnable(ctx->fimg, state);
-		ctx->enable.cullFace = 1;
+		ctx->enable.cullFace = state;
 		break;
 	case GL_POLYGON_OFFSET_FILL:
 		fimgEnableDepthOffset(ctx->fimg, state);
-		ctx->enable.polyOffFill = 1;
+		ctx->enable.polyOffFill = state;
 		break;
 	case GL_SCISSOR_TEST: {
 		FGLAbstractFramebuffer *fb = ctx->framebuffer.get();
@@ -1954,15 +2748,20 @@ GL_API void GL_APIENTRY glDisable (GLenum cap)
 
 GL_API void GL_APIENTRY glFlush (void)
 {
-	/* Nothing to do here */
+	FGLContext *ctx = getContext();
+
+	/* Draws are submitted immediately, just let others use the GPU */
+	fimgReleaseHardware(ctx->fimg);
 }
 
 GL_API void GL_APIENTRY glFinish (void)
 {
 	FGLContext *ctx = getContext();
 
-	if (ctx->finished)
+	if (ctx->finished) {
+		fimgReleaseHardware(ctx->fimg);
 		return;
+	}
 
 	fimgFinish(ctx->fimg);
 
@@ -2114,10 +2913,6 @@ FGLContext *fglCreateContext(void)
 		return NULL;
 	}
 
-	for(int i = 0; i < 4 + FGL_MAX_TEXTURE_UNITS; i++)
-		fimgSetAttribute(ctx->fimg, i, FGHI_ATTRIB_DT_FLOAT,
-						fglDefaultAttribSize[i]);
-
 	return ctx;
 }
 
@@ -2127,11 +2922,13 @@ extern FGLObjectManager<FGLRenderbuffer, FGL_MAX_RENDERBUFFER_OBJECTS> fglRender
 
 void fglDestroyContext(FGLContext *ctx)
 {
+	free(ctx->drawBatch.data);
 	fglBufferObjects.clean(ctx);
 	fglTextureObjects.clean(ctx);
 	fglFramebufferObjects.clean(ctx);
 	fglRenderbufferObjects.clean(ctx);
 
+	fglReleaseOrphans(ctx, true);
 	fimgDestroyContext(ctx->fimg);
 	delete ctx;
 }
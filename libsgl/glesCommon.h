@@ -67,10 +67,47 @@ static inline GLint unitFromTextureEnum(GLenum texture)
 	return unit;
 }
 
+/*
+	Drawing
+*/
+
+#ifdef FGL_HARDWARE_CLEAR
+extern void fglHardwareClear(FGLContext *ctx, GLbitfield mask);
+#endif
+
+extern void fglSubmitDraws(FGLContext *ctx);
+
+/* Sends merged draws to the hardware, if there are any waiting */
+static inline void fglFlushDraws(FGLContext *ctx)
+{
+	if (ctx->drawBatch.pending)
+		fglSubmitDraws(ctx);
+}
+
 /*
 	Context management
 */
 
+/*
+ * Returns current context leaving merged draws pending. Only for calls
+ * which cannot affect them, that is drawing and client array setup.
+ */
+static inline FGLContext *getContextNoFlush(void)
+{
+	FGLContext *ctx = getGlThreadSpecific();
+
+	if(!ctx) {
+		LOGE("GL context is NULL!");
+		exit(EINVAL);
+	}
+
+	return ctx;
+}
+
+/*
+ * Any other call might change state used by merged draws, so they
+ * are submitted before the call gets the context.
+ */
 #ifdef GLES_DEBUG
 #define getContext() ( \
 	LOGD("%s called getContext()", __func__), \
@@ -80,16 +117,42 @@ static inline FGLContext *_getContext(void)
 static inline FGLContext *getContext(void)
 #endif
 {
-	FGLContext *ctx = getGlThreadSpecific();
+	FGLContext *ctx = getContextNoFlush();
 
-	if(!ctx) {
-		LOGE("GL context is NULL!");
-		exit(EINVAL);
-	}
+	fglFlushDraws(ctx);
 
 	return ctx;
 }
 
+/*
+	Texturing
+*/
+
+/* Formats of EXT_texture_compression_dxt1, missing in ES 1.1 headers */
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT		0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT	0x83F1
+#endif
+
+/*
+	Pixel readback
+*/
+
+/* Pack buffer target of NV_pixel_buffer_object, missing in ES 1.1 headers */
+#ifndef GL_PIXEL_PACK_BUFFER_NV
+#define GL_PIXEL_PACK_BUFFER_NV			0x88EB
+#define GL_PIXEL_PACK_BUFFER_BINDING_NV		0x88ED
+#endif
+
+/*
+	Textures
+*/
+
+/* Frees texture surfaces orphaned by redefinition, optionally waiting */
+extern void fglReleaseOrphans(FGLContext *ctx, bool wait);
+/* Regenerates mipmaps from changed region of base level, if any */
+extern void fglUpdateMipmaps(FGLTexture *obj);
+
 /*
 	Error handling
 */
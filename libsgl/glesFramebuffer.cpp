@@ -152,6 +152,9 @@ GL_API void GL_APIENTRY glDeleteRenderbuffersOES (GLsizei n, const GLuint* rende
 	if (n <= 0)
 		return;
 
+	/* Merged draws not submitted yet might use them */
+	fglFlushDraws(getContextNoFlush());
+
 	do {
 		name = *renderbuffers;
 		renderbuffers++;
@@ -262,7 +265,7 @@ GL_API void GL_APIENTRY glRenderbufferStorageOES (GLenum target,
 	}
 
 	if (!obj->surface) {
-		obj->surface = new FGLLocalSurface(size);
+		obj->surface = fglCreateLocalSurface(size);
 		if (!obj->surface || !obj->surface->isValid()) {
 			delete obj->surface;
 			obj->surface = 0;
@@ -390,6 +393,9 @@ GL_API void GL_APIENTRY glDeleteFramebuffersOES (GLsizei n, const GLuint* frameb
 	if (n <= 0)
 		return;
 
+	/* Merged draws not submitted yet might use them */
+	fglFlushDraws(getContextNoFlush());
+
 	while(n--) {
 		name = *framebuffers;
 		framebuffers++;
@@ -59,11 +59,30 @@ static char const * const gExtensionsString =
 	"GL_OES_rgb8_rgba8 "
 	"GL_OES_depth24 "
 	"GL_OES_stencil8 "
+	"GL_OES_mapbuffer "
+	"GL_EXT_map_buffer_range "
+	"GL_NV_pixel_buffer_object "
+	"GL_OES_compressed_paletted_texture "
+	"GL_OES_compressed_ETC1_RGB8_texture "
 	"GL_EXT_texture_format_BGRA8888 "
+	"GL_EXT_texture_compression_dxt1 "
 	"GL_ARB_texture_non_power_of_two"
 ;
 
 static const GLint fglCompressedTextureFormats[] = {
+	GL_PALETTE4_RGB8_OES,
+	GL_PALETTE4_RGBA8_OES,
+	GL_PALETTE4_R5_G6_B5_OES,
+	GL_PALETTE4_RGBA4_OES,
+	GL_PALETTE4_RGB5_A1_OES,
+	GL_PALETTE8_RGB8_OES,
+	GL_PALETTE8_RGBA8_OES,
+	GL_PALETTE8_R5_G6_B5_OES,
+	GL_PALETTE8_RGBA4_OES,
+	GL_PALETTE8_RGB5_A1_OES,
+	GL_ETC1_RGB8_OES,
+	GL_COMPRESSED_RGB_S3TC_DXT1_EXT,
+	GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,
 };
 
 const FGLPixelFormat FGLPixelFormat::table[] = {
@@ -749,6 +768,12 @@ void fglGetState(FGLContext *ctx, GLenum pname, FGLStateGetter &state)
 		else
 			state.putInteger(0);
 		break;
+	case GL_PIXEL_PACK_BUFFER_BINDING_NV:
+		if (ctx->pixelPackBuffer.isBound())
+			state.putInteger(ctx->pixelPackBuffer.get()->getName());
+		else
+			state.putInteger(0);
+		break;
 	case GL_VIEWPORT:
 		state.putFloat(ctx->viewport.x);
 		state.putFloat(ctx->viewport.y);
@@ -1166,6 +1191,9 @@ GL_API void GL_APIENTRY glGetBufferParameteriv (GLenum target,
 	case GL_ELEMENT_ARRAY_BUFFER:
 		binding = &ctx->elementArrayBuffer;
 		break;
+	case GL_PIXEL_PACK_BUFFER_NV:
+		binding = &ctx->pixelPackBuffer;
+		break;
 	default:
 		setError(GL_INVALID_ENUM);
 		return;
@@ -1185,6 +1213,12 @@ GL_API void GL_APIENTRY glGetBufferParameteriv (GLenum target,
 	case GL_BUFFER_USAGE:
 		*params = buf->usage;
 		break;
+	case GL_BUFFER_ACCESS_OES:
+		*params = GL_WRITE_ONLY_OES;
+		break;
+	case GL_BUFFER_MAPPED_OES:
+		*params = buf->mapped;
+		break;
 	default:
 		setError(GL_INVALID_ENUM);
 	}
@@ -82,13 +82,12 @@ static inline void unpackPixel555(uint8_t *dst, uint16_t src)
 }
 
 static void convertToUByteRGBA555(FGLContext *ctx, uint8_t *dst,
-			uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+			uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+			unsigned dstStride)
 {
 	FGLAbstractFramebuffer *fb = ctx->framebuffer.get();
 	FGLFramebufferAttachable *fba = fb->get(FGL_ATTACHMENT_COLOR);
 	const uint16_t *src = (const uint16_t *)fba->surface->vaddr;
-	unsigned alignment = ctx->packAlignment;
-	unsigned dstStride = (4*width + alignment - 1) & ~(alignment - 1);
 	unsigned srcStride = 2*fb->getWidth();
 	unsigned xOffset = 2*x;
 	unsigned yOffset = srcStride*(fb->getHeight() - y - height);
@@ -117,13 +116,12 @@ static inline void unpackPixel565(uint8_t *dst, uint16_t src)
 }
 
 static void convertToUByteRGBA565(FGLContext *ctx, uint8_t *dst,
-			uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+			uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+			unsigned dstStride)
 {
 	FGLAbstractFramebuffer *fb = ctx->framebuffer.get();
 	FGLFramebufferAttachable *fba = fb->get(FGL_ATTACHMENT_COLOR);
 	const uint16_t *src = (const uint16_t *)fba->surface->vaddr;
-	unsigned alignment = ctx->packAlignment;
-	unsigned dstStride = (4*width + alignment - 1) & ~(alignment - 1);
 	unsigned srcStride = 2*fb->getWidth();
 	unsigned xOffset = 2*x;
 	unsigned yOffset = srcStride*(fb->getHeight() - y - height);
@@ -152,13 +150,12 @@ static inline void unpackPixel4444(uint8_t *dst, uint16_t src)
 }
 
 static void convertToUByteRGBA4444(FGLContext *ctx, uint8_t *dst,
-			uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+			uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+			unsigned dstStride)
 {
 	FGLAbstractFramebuffer *fb = ctx->framebuffer.get();
 	FGLFramebufferAttachable *fba = fb->get(FGL_ATTACHMENT_COLOR);
 	const uint16_t *src = (const uint16_t *)fba->surface->vaddr;
-	unsigned alignment = ctx->packAlignment;
-	unsigned dstStride = (4*width + alignment - 1) & ~(alignment - 1);
 	unsigned srcStride = 2*fb->getWidth();
 	unsigned xOffset = 2*x;
 	unsigned yOffset = srcStride*(fb->getHeight() - y - height);
@@ -187,13 +184,12 @@ static inline void unpackPixel1555(uint8_t *dst, uint16_t src)
 }
 
 static void convertToUByteRGBA1555(FGLContext *ctx, uint8_t *dst,
-			uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+			uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+			unsigned dstStride)
 {
 	FGLAbstractFramebuffer *fb = ctx->framebuffer.get();
 	FGLFramebufferAttachable *fba = fb->get(FGL_ATTACHMENT_COLOR);
 	const uint16_t *src = (const uint16_t *)fba->surface->vaddr;
-	unsigned alignment = ctx->packAlignment;
-	unsigned dstStride = (4*width + alignment - 1) & ~(alignment - 1);
 	unsigned srcStride = 2*fb->getWidth();
 	unsigned xOffset = 2*x;
 	unsigned yOffset = srcStride*(fb->getHeight() - y - height);
@@ -225,13 +221,13 @@ static inline void unpackPixel8888(uint32_t *dst, uint32_t src)
 }
 
 static void convertToUByteBGRA8888(FGLContext *ctx, uint32_t *dst,
-			uint32_t x, uint32_t y, uint32_t width, uint32_t height)
+			uint32_t x, uint32_t y, uint32_t width, uint32_t height,
+			unsigned stride)
 {
 	FGLAbstractFramebuffer *fb = ctx->framebuffer.get();
 	FGLFramebufferAttachable *fba = fb->get(FGL_ATTACHMENT_COLOR);
 	const uint32_t *src = (const uint32_t *)fba->surface->vaddr;
-	unsigned alignment = ctx->packAlignment;
-	unsigned dstStride = ((4*width + alignment - 1) & ~(alignment - 1)) / 4;
+	unsigned dstStride = stride / 4;
 	unsigned srcStride = fb->getWidth();
 	unsigned xOffset = x;
 	unsigned yOffset = srcStride*(fb->getHeight() - y - height);
@@ -289,33 +285,25 @@ static void burstCopy16(void *dst, const void *src, unsigned len)
 		fallbackCopy(d, s, len);
 }
 
-GL_API void GL_APIENTRY glReadPixels (GLint x, GLint y,
-				GLsizei width, GLsizei height, GLenum format,
-				GLenum type, GLvoid *pixels)
+static inline unsigned fglReadPixelSize(const FGLPixelFormat *cfg,
+						GLenum format, GLenum type)
 {
-	FGLContext *ctx = getContext();
+	if (format == cfg->readFormat && type == cfg->readType)
+		return cfg->pixelSize;
 
-	FGLAbstractFramebuffer *fb = ctx->framebuffer.get();
-	if (!fb->isValid()) {
-		setError(GL_INVALID_FRAMEBUFFER_OPERATION_OES);
-		return;
-	}
+	if (format == GL_RGBA && type == GL_UNSIGNED_BYTE)
+		return 4;
+
+	return 0;
+}
 
+static void fglReadPixels(FGLContext *ctx, GLint x, GLint y,
+				GLsizei width, GLsizei height, GLenum format,
+				GLenum type, unsigned alignment, GLvoid *pixels)
+{
+	FGLAbstractFramebuffer *fb = ctx->framebuffer.get();
 	FGLFramebufferAttachable *fba = fb->get(FGL_ATTACHMENT_COLOR);
 	FGLSurface *draw = fba->surface;
-	if (!draw || !draw->vaddr) {
-		setError(GL_INVALID_OPERATION);
-		return;
-	}
-
-	if (width <= 0 || height <= 0 || x < 0 || y < 0) {
-		setError(GL_INVALID_VALUE);
-		return;
-	}
-
-	if ((GLuint)x >= fb->getWidth() || (GLuint)y >= fb->getHeight())
-		// Nothing to copy
-		return;
 
 	glFinish();
 	draw->flush();
@@ -323,19 +311,21 @@ GL_API void GL_APIENTRY glReadPixels (GLint x, GLint y,
 	const FGLPixelFormat *cfg = FGLPixelFormat::get(fb->getColorFormat());
 	unsigned srcBpp = cfg->pixelSize;
 	unsigned srcStride = srcBpp * fb->getWidth();
-	unsigned alignment = ctx->packAlignment;
+	unsigned pixelSize = fglReadPixelSize(cfg, format, type);
+	unsigned dstStride = (pixelSize*width + alignment - 1) & ~(alignment - 1);
+
+	// Only the part inside the framebuffer is written
+	if ((GLuint)x + width > fb->getWidth())
+		width = fb->getWidth() - x;
+	if ((GLuint)y + height > fb->getHeight())
+		height = fb->getHeight() - y;
 
 	if (format == cfg->readFormat && type == cfg->readType) {
 		// No format conversion needed
 		unsigned yOffset = (fb->getHeight() - y - 1) * srcStride;
 		const uint8_t *src = (const uint8_t *)draw->vaddr + yOffset;
-
-		unsigned dstStride = (srcBpp*width + alignment - 1) & ~(alignment - 1);
 		uint8_t *dst = (uint8_t *)pixels;
 
-		if ((GLuint)y + height > fb->getHeight())
-			height = fb->getHeight() - y;
-
 		if (!x && (GLuint)width == fb->getWidth()) {
 			// Copy whole lines line-by-line
 			if (srcStride < 32) {
@@ -357,9 +347,6 @@ GL_API void GL_APIENTRY glReadPixels (GLint x, GLint y,
 		}
 
 		// Copy line parts line-by-line
-		if ((GLuint)(x + width) > fb->getWidth())
-			width = fb->getWidth() - x;
-
 		unsigned xOffset = srcBpp * x;
 		unsigned srcWidth = srcBpp * width;
 
@@ -386,35 +373,120 @@ GL_API void GL_APIENTRY glReadPixels (GLint x, GLint y,
 		switch (fb->getColorFormat()) {
 		case FGL_PIXFMT_XRGB1555:
 			convertToUByteRGBA555(ctx, (uint8_t *)pixels,
-							x, y, width, height);
+					x, y, width, height, dstStride);
 			break;
 		case FGL_PIXFMT_RGB565:
 			convertToUByteRGBA565(ctx, (uint8_t *)pixels,
-							x, y, width, height);
+					x, y, width, height, dstStride);
 			break;
 		case FGL_PIXFMT_ARGB4444:
 			convertToUByteRGBA4444(ctx, (uint8_t *)pixels,
-							x, y, width, height);
+					x, y, width, height, dstStride);
 			break;
 		case FGL_PIXFMT_ARGB1555:
 			convertToUByteRGBA1555(ctx, (uint8_t *)pixels,
-							x, y, width, height);
+					x, y, width, height, dstStride);
 			break;
 		/* BGRX8888 -> RGBX8888 */
 		case FGL_PIXFMT_XRGB8888:
 		case FGL_PIXFMT_ARGB8888:
 			convertToUByteBGRA8888(ctx, (uint32_t *)pixels,
-							x, y, width, height);
+					x, y, width, height, dstStride);
 			break;
 		default:
 			LOGW("Unsupported pixel format %d in glReadPixels.",
 							fb->getColorFormat());
 		}
-		// We are done
+	}
+}
+
+/*
+ * Readback into a pixel pack buffer, with pixels being an offset into it.
+ * Done right away like any other readback. The hardware cannot order
+ * a copy of the framebuffer with its rendering, so deferring it would only
+ * move the wait for the hardware to whatever touches the framebuffer next.
+ */
+static void fglReadPixelsToBuffer(FGLContext *ctx, GLint x, GLint y,
+				GLsizei width, GLsizei height, GLenum format,
+				GLenum type, unsigned pixelSize, GLintptr offset)
+{
+	FGLAbstractFramebuffer *fb = ctx->framebuffer.get();
+	FGLBuffer *buf = ctx->pixelPackBuffer.get();
+	unsigned alignment = ctx->packAlignment;
+
+	/*
+	 * Check the part inside the framebuffer, which is all that gets
+	 * written. Done in 64 bits, so huge sizes cannot wrap around.
+	 */
+	uint64_t stride = ((uint64_t)pixelSize*width + alignment - 1)
+						& ~(uint64_t)(alignment - 1);
+	uint64_t clipWidth = width;
+	uint64_t clipHeight = height;
+
+	if ((GLuint)x + clipWidth > fb->getWidth())
+		clipWidth = fb->getWidth() - x;
+	if ((GLuint)y + clipHeight > fb->getHeight())
+		clipHeight = fb->getHeight() - y;
+
+	if (!buf->isValid() || offset < 0
+	    || (uint64_t)offset + stride*(clipHeight - 1)
+				+ pixelSize*clipWidth > (uint64_t)buf->size) {
+		setError(GL_INVALID_OPERATION);
 		return;
 	}
 
-	setError(GL_INVALID_ENUM);
+	if (buf->mapped) {
+		setError(GL_INVALID_OPERATION);
+		return;
+	}
+
+	fglReadPixels(ctx, x, y, width, height, format, type, alignment,
+					(uint8_t *)buf->memory + offset);
+}
+
+GL_API void GL_APIENTRY glReadPixels (GLint x, GLint y,
+				GLsizei width, GLsizei height, GLenum format,
+				GLenum type, GLvoid *pixels)
+{
+	FGLContext *ctx = getContext();
+
+	FGLAbstractFramebuffer *fb = ctx->framebuffer.get();
+	if (!fb->isValid()) {
+		setError(GL_INVALID_FRAMEBUFFER_OPERATION_OES);
+		return;
+	}
+
+	FGLFramebufferAttachable *fba = fb->get(FGL_ATTACHMENT_COLOR);
+	FGLSurface *draw = fba->surface;
+	if (!draw || !draw->vaddr) {
+		setError(GL_INVALID_OPERATION);
+		return;
+	}
+
+	if (width <= 0 || height <= 0 || x < 0 || y < 0) {
+		setError(GL_INVALID_VALUE);
+		return;
+	}
+
+	const FGLPixelFormat *cfg = FGLPixelFormat::get(fb->getColorFormat());
+	unsigned pixelSize = fglReadPixelSize(cfg, format, type);
+	if (!pixelSize) {
+		setError(GL_INVALID_ENUM);
+		return;
+	}
+
+	if ((GLuint)x >= fb->getWidth() || (GLuint)y >= fb->getHeight())
+		// Nothing to copy
+		return;
+
+	if (ctx->pixelPackBuffer.isBound()) {
+		fglReadPixelsToBuffer(ctx, x, y, width, height, format,
+					type, pixelSize, (GLintptr)pixels);
+		return;
+	}
+
+	fglReadPixels(ctx, x, y, width, height, format, type,
+						ctx->packAlignment, pixels);
 }
 
 /*
@@ -718,10 +790,20 @@ static inline void fglColorClear(FGLContext *ctx, bool lineByLine,
 	FGLAbstractFramebuffer *fb = ctx->framebuffer.get();
 	FGLFramebufferAttachable *fba = fb->get(FGL_ATTACHMENT_COLOR);
 	FGLSurface *draw = fba->surface;
+	const FGLPixelFormat *pix = FGLPixelFormat::get(fb->getColorFormat());
 	bool is32bpp = false;
 	uint32_t mask = 0;
-	uint32_t color = getFillColor(ctx, &mask, &is32bpp);
+	uint32_t color;
+
+	/* Only 16 and 32-bit formats can be filled */
+	if (pix->pixelSize != 2 && pix->pixelSize != 4)
+		return;
+
+	/* Texture might be still uploaded in background */
+	if (fba->getType() == GL_TEXTURE)
+		static_cast<FGLTexture *>(fba)->waitForUpload();
 
+	color = getFillColor(ctx, &mask, &is32bpp);
 	if (mask == 0xffffffff || (!is32bpp && mask == 0xffff))
 		return;
 
@@ -882,6 +964,18 @@ GL_API void GL_APIENTRY glClear (GLbitfield mask)
 	if ((mask & FGL_CLEAR_MASK) == 0)
 		return;
 
+#ifdef FGL_HARDWARE_CLEAR
+	const FGLPixelFormat *pix = FGLPixelFormat::get(fb->getColorFormat());
+
+	/*
+	 * Draw the clear in order with other rendering, unless the color
+	 * buffer is a texture in format that the hardware cannot render to.
+	 */
+	if (pix->pixFormat != (uint32_t)-1) {
+		fglHardwareClear(ctx, mask);
+		return;
+	}
+#endif
 	/* Make sure the hardware isn't rendering */
 	glFinish();
 	/* Clear the buffers in software */
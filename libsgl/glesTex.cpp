@@ -34,6 +34,7 @@
 #include "glesCommon.h"
 #include "fglobjectmanager.h"
 #include "fglimage.h"
+#include "fglkernels.h"
 #include "libfimg/fimg.h"
 #include "s3c_g2d.h"
 
@@ -73,6 +74,9 @@ GL_API void GL_APIENTRY glDeleteTextures (GLsizei n, const GLuint *textures)
 	if(n <= 0)
 		return;
 
+	/* Merged draws not submitted yet might use them */
+	fglFlushDraws(getContextNoFlush());
+
 	do {
 		name = *textures;
 		textures++;
@@ -90,7 +94,7 @@ GL_API void GL_APIENTRY glDeleteTextures (GLsizei n, const GLuint *textures)
 GL_API void GL_APIENTRY glBindTexture (GLenum target, GLuint texture)
 {
 	FGLTextureObjectBinding *binding;
-	FGLContext *ctx = getContext();
+	FGLContext *ctx = getContextNoFlush();
 
 	switch (target) {
 	case GL_TEXTURE_2D:
@@ -104,6 +108,17 @@ GL_API void GL_APIENTRY glBindTexture (GLenum target, GLuint texture)
 		return;
 	}
 
+	/*
+	 * Binding the same texture again does not need to end merged draws,
+	 * unless it is an EGL image, which gets refreshed on every bind.
+	 */
+	FGLTexture *bound = binding->get();
+	if (texture == 0 ? bound == NULL
+	    : (bound && bound->name == texture && !bound->eglImage))
+		return;
+
+	fglFlushDraws(ctx);
+
 	if(texture == 0) {
 		binding->bind(0);
 		return;
@@ -175,159 +190,129 @@ static int fglGetFormatInfo(GLenum format, GLenum type, bool *conv)
 	}
 }
 
-static void fglGenerateMipmaps(FGLTexture *obj)
-{
-	int level = 0;
-	int skip = 1;
-
-	int w = obj->width;
-	int h = obj->height;
-	if ((w&h) == 1)
-		return;
+/*
+ * Destination of texture image upload. Captures everything needed to
+ * write texture memory, so the upload can be done without accessing
+ * the texture object, which may be modified in the meantime.
+ */
+struct FGLTextureImage {
+	uint8_t		*vaddr;
+	uint32_t	pixFormat;
+	GLenum		format;
+	unsigned	width;
+	unsigned	height;
+	unsigned	maxLevel;
+	/* Level offsets in bytes */
+	unsigned	offset[FGL_MAX_MIPMAP_LEVEL + 1];
+
+	FGLTextureImage(FGLTexture *obj) :
+		vaddr((uint8_t *)obj->surface->vaddr),
+		pixFormat(obj->pixFormat),
+		format(obj->format),
+		width(obj->width),
+		height(obj->height),
+		maxLevel(obj->maxLevel)
+	{
+		const FGLPixelFormat *pix = FGLPixelFormat::get(pixFormat);
+
+		for (int lvl = 0; lvl <= obj->maxLevel; ++lvl)
+			offset[lvl] = pix->pixelSize
+				* fimgGetTexMipmapOffset(obj->fimg, lvl);
+	}
+};
 
-	w = (w>>1) ? : 1;
-	h = (h>>1) ? : 1;
+/*
+ * Regenerates mipmaps in the area affected by given region of base level
+ * (left, top, right, bottom).
+ */
+static void fglGenerateMipmaps(const FGLTextureImage *img, const GLint *rect)
+{
+	const FGLKernels *kernels = fglGetKernels();
+	FGLDownsampleKernel downsample;
 
-	const FGLPixelFormat *pix = FGLPixelFormat::get(obj->pixFormat);
-	void *curLevel = obj->surface->vaddr;
-	void *nextLevel = (uint8_t *)obj->surface->vaddr
-			+ pix->pixelSize*fimgGetTexMipmapOffset(obj->fimg, 1);
-
-processNextLevel:
-	++level;
-	int stride = w;
-	int bs = w;
-	switch (obj->pixFormat) {
-	case FGL_PIXFMT_RGB565: {
-		uint16_t const * src = (uint16_t const *)curLevel;
-		uint16_t* dst = (uint16_t*)nextLevel;
-		const uint32_t mask = 0x07E0F81F;
-		for (int y=0 ; y<h ; y++) {
-			size_t offset = (y*2) * bs;
-			for (int x=0 ; x<w ; x++) {
-				uint32_t p00 = src[offset];
-				uint32_t p10 = src[offset+1];
-				uint32_t p01 = src[offset+bs];
-				uint32_t p11 = src[offset+bs+1];
-				p00 = (p00 | (p00 << 16)) & mask;
-				p01 = (p01 | (p01 << 16)) & mask;
-				p10 = (p10 | (p10 << 16)) & mask;
-				p11 = (p11 | (p11 << 16)) & mask;
-				uint32_t grb = ((p00 + p10 + p01 + p11) >> 2) & mask;
-				uint32_t rgb = (grb & 0xFFFF) | (grb >> 16);
-				dst[x + y*stride] = rgb;
-				offset += 2;
-			}
-		}
-		break; }
-	case FGL_PIXFMT_RGBA5551: {
-		uint16_t const * src = (uint16_t const *)curLevel;
-		uint16_t* dst = (uint16_t*)nextLevel;
-		for (int y=0 ; y<h ; y++) {
-			size_t offset = (y*2) * bs;
-			for (int x=0 ; x<w ; x++) {
-				uint32_t p00 = src[offset];
-				uint32_t p10 = src[offset+1];
-				uint32_t p01 = src[offset+bs];
-				uint32_t p11 = src[offset+bs+1];
-				uint32_t r = ((p00>>11)+(p10>>11)+(p01>>11)+(p11>>11)+2)>>2;
-				uint32_t g = (((p00>>6)+(p10>>6)+(p01>>6)+(p11>>6)+2)>>2)&0x3F;
-				uint32_t b = ((p00&0x3E)+(p10&0x3E)+(p01&0x3E)+(p11&0x3E)+4)>>3;
-				uint32_t a = ((p00&1)+(p10&1)+(p01&1)+(p11&1)+2)>>2;
-				dst[x + y*stride] = (r<<11)|(g<<6)|(b<<1)|a;
-				offset += 2;
-			}
-		}
-		break; }
+	switch (img->pixFormat) {
+	case FGL_PIXFMT_RGB565:
+		downsample = kernels->downsampleRGB565;
+		break;
+	case FGL_PIXFMT_RGBA5551:
+		downsample = kernels->downsampleRGBA5551;
+		break;
+	case FGL_PIXFMT_RGBA4444:
+		downsample = kernels->downsampleRGBA4444;
+		break;
 	case FGL_PIXFMT_XRGB8888:
 	case FGL_PIXFMT_ARGB8888:
 	case FGL_PIXFMT_XBGR8888:
-	case FGL_PIXFMT_ABGR8888: {
-		uint32_t const * src = (uint32_t const *)curLevel;
-		uint32_t* dst = (uint32_t*)nextLevel;
-		for (int y=0 ; y<h ; y++) {
-			size_t offset = (y*2) * bs;
-			for (int x=0 ; x<w ; x++) {
-				uint32_t p00 = src[offset];
-				uint32_t p10 = src[offset+1];
-				uint32_t p01 = src[offset+bs];
-				uint32_t p11 = src[offset+bs+1];
-				uint32_t rb00 = p00 & 0x00FF00FF;
-				uint32_t rb01 = p01 & 0x00FF00FF;
-				uint32_t rb10 = p10 & 0x00FF00FF;
-				uint32_t rb11 = p11 & 0x00FF00FF;
-				uint32_t ga00 = (p00 >> 8) & 0x00FF00FF;
-				uint32_t ga01 = (p01 >> 8) & 0x00FF00FF;
-				uint32_t ga10 = (p10 >> 8) & 0x00FF00FF;
-				uint32_t ga11 = (p11 >> 8) & 0x00FF00FF;
-				uint32_t rb = (rb00 + rb01 + rb10 + rb11)>>2;
-				uint32_t ga = (ga00 + ga01 + ga10 + ga11)>>2;
-				uint32_t rgba = (rb & 0x00FF00FF) | ((ga & 0x00FF00FF)<<8);
-				dst[x + y*stride] = rgba;
-				offset += 2;
-			}
-		}
-		break; }
+	case FGL_PIXFMT_ABGR8888:
+		downsample = kernels->downsample8888;
+		break;
 	case FGL_PIXFMT_AL88:
-		skip = 2;
-		/* Fall-through */
-	case FGL_PIXFMT_L8: {
-		uint8_t const * src = (uint8_t const *)curLevel;
-		uint8_t* dst = (uint8_t*)nextLevel;
-		bs *= skip;
-		stride *= skip;
-		for (int y=0 ; y<h ; y++) {
-			size_t offset = (y*2) * bs;
-			for (int x=0 ; x<w ; x++) {
-				for (int c=0 ; c<skip ; c++) {
-					uint32_t p00 = src[c+offset];
-					uint32_t p10 = src[c+offset+skip];
-					uint32_t p01 = src[c+offset+bs];
-					uint32_t p11 = src[c+offset+bs+skip];
-					dst[x + y*stride + c] = (p00 + p10 + p01 + p11) >> 2;
-				}
-				offset += 2*skip;
-			}
-		}
-		break; }
-	case FGL_PIXFMT_RGBA4444: {
-		uint16_t const * src = (uint16_t const *)curLevel;
-		uint16_t* dst = (uint16_t*)nextLevel;
-		for (int y=0 ; y<h ; y++) {
-			size_t offset = (y*2) * bs;
-			for (int x=0 ; x<w ; x++) {
-				uint32_t p00 = src[offset];
-				uint32_t p10 = src[offset+1];
-				uint32_t p01 = src[offset+bs];
-				uint32_t p11 = src[offset+bs+1];
-				p00 = ((p00 << 12) & 0x0F0F0000) | (p00 & 0x0F0F);
-				p10 = ((p10 << 12) & 0x0F0F0000) | (p10 & 0x0F0F);
-				p01 = ((p01 << 12) & 0x0F0F0000) | (p01 & 0x0F0F);
-				p11 = ((p11 << 12) & 0x0F0F0000) | (p11 & 0x0F0F);
-				uint32_t rbga = (p00 + p10 + p01 + p11) >> 2;
-				uint32_t rgba = (rbga & 0x0F0F) | ((rbga>>12) & 0xF0F0);
-				dst[x + y*stride] = rgba;
-				offset += 2;
-			}
-		}
-		break; }
+		downsample = kernels->downsampleAL88;
+		break;
+	case FGL_PIXFMT_L8:
+		downsample = kernels->downsampleL8;
+		break;
 	default:
-		LOGE("Unsupported format (%d)", obj->pixFormat);
+		LOGE("Unsupported format (%d)", img->pixFormat);
 		return;
 	}
 
-	// exit condition: we just processed the 1x1 LODs
-	if ((w&h) == 1)
-		return;
+	const FGLPixelFormat *pix = FGLPixelFormat::get(img->pixFormat);
+	size_t bpp = pix->pixelSize;
+	unsigned w = img->width;
+	unsigned h = img->height;
+	unsigned l = rect[0];
+	unsigned t = rect[1];
+	unsigned r = rect[2];
+	unsigned b = rect[3];
+
+	for (unsigned level = 1; level <= img->maxLevel; ++level) {
+		const uint8_t *src = img->vaddr + img->offset[level - 1];
+		uint8_t *dst = img->vaddr + img->offset[level];
+		unsigned dstW = (w >> 1) ? : 1;
+		unsigned dstH = (h >> 1) ? : 1;
+
+		/* Destination pixels depending on the region */
+		l >>= 1;
+		t >>= 1;
+		r = min((r + 1) >> 1, dstW);
+		b = min((b + 1) >> 1, dstH);
+
+		if (w == 1) {
+			/* Single column, pixels are contiguous */
+			downsample(dst + t*bpp, src + 2*t*bpp,
+						src + 2*t*bpp, b - t);
+		} else if (h == 1) {
+			/* Single row */
+			downsample(dst + l*bpp, src + 2*l*bpp,
+						src + 2*l*bpp, r - l);
+		} else {
+			size_t srcStride = w * bpp;
+			size_t dstStride = dstW * bpp;
+
+			src += 2*t*srcStride + 2*l*bpp;
+			dst += t*dstStride + l*bpp;
 
-	w = (w>>1) ? : 1;
-	h = (h>>1) ? : 1;
+			for (unsigned y = t; y < b; ++y) {
+				downsample(dst, src, src + srcStride, r - l);
+				src += 2 * srcStride;
+				dst += dstStride;
+			}
+		}
+
+		w = dstW;
+		h = dstH;
+	}
+}
 
-	curLevel = nextLevel;
-	nextLevel = (uint8_t *)obj->surface->vaddr
-		+ pix->pixelSize*fimgGetTexMipmapOffset(obj->fimg, level + 1);
+/* Number of pixels taken by a level, S3TC levels are made of 4x4 blocks */
+static inline size_t fglLevelSize(uint32_t pixFormat,
+					unsigned int width, unsigned int height)
+{
+	if (pixFormat == FGL_PIXFMT_S3TC)
+		return 16 * ((width + 3) / 4) * ((height + 3) / 4);
 
-	goto processNextLevel;
+	return width * height;
 }
 
 static size_t fglCalculateMipmaps(FGLTexture *obj, unsigned int width,
@@ -336,7 +321,7 @@ static size_t fglCalculateMipmaps(FGLTexture *obj, unsigned int width,
 	size_t offset, size;
 	unsigned int lvl, check;
 
-	size = width * height;
+	size = fglLevelSize(obj->pixFormat, width, height);
 	offset = 0;
 	check = max(width, height);
 	lvl = 0;
@@ -360,50 +345,48 @@ static size_t fglCalculateMipmaps(FGLTexture *obj, unsigned int width,
 		if (height >= 2)
 			height /= 2;
 
-		size = width * height;
+		size = fglLevelSize(obj->pixFormat, width, height);
 	} while (1);
 
 	obj->maxLevel = lvl;
 	return offset;
 }
 
-static void fglLoadTextureDirect(FGLTexture *obj, unsigned level,
+static void fglLoadTextureDirect(const FGLTextureImage *img, unsigned level,
 						const GLvoid *pixels)
 {
-	const FGLPixelFormat *pix = FGLPixelFormat::get(obj->pixFormat);
-	unsigned offset = pix->pixelSize*fimgGetTexMipmapOffset(obj->fimg, level);
+	const FGLPixelFormat *pix = FGLPixelFormat::get(img->pixFormat);
 
-	unsigned width = obj->width >> level;
+	unsigned width = img->width >> level;
 	if (!width)
 		width = 1;
 
-	unsigned height = obj->height >> level;
+	unsigned height = img->height >> level;
 	if (!height)
 		height = 1;
 
 	size_t size = width*height*pix->pixelSize;
 
-	memcpy((uint8_t *)obj->surface->vaddr + offset, pixels, size);
+	memcpy(img->vaddr + img->offset[level], pixels, size);
 }
 
-static void fglLoadTexture(FGLTexture *obj, unsigned level,
+static void fglLoadTexture(const FGLTextureImage *img, unsigned level,
 		    const GLvoid *pixels, unsigned alignment)
 {
-	const FGLPixelFormat *pix = FGLPixelFormat::get(obj->pixFormat);
-	unsigned offset = pix->pixelSize*fimgGetTexMipmapOffset(obj->fimg, level);
+	const FGLPixelFormat *pix = FGLPixelFormat::get(img->pixFormat);
 
-	unsigned width = obj->width >> level;
+	unsigned width = img->width >> level;
 	if (!width)
 		width = 1;
 
-	unsigned height = obj->height >> level;
+	unsigned height = img->height >> level;
 	if (!height)
 		height = 1;
 
 	size_t line = width*pix->pixelSize;
 	size_t stride = (line + alignment - 1) & ~(alignment - 1);
 	const uint8_t *src8 = (const uint8_t *)pixels;
-	uint8_t *dst8 = (uint8_t *)obj->surface->vaddr + offset;
+	uint8_t *dst8 = img->vaddr + img->offset[level];
 
 	do {
 		memcpy(dst8, src8, line);
@@ -412,22 +395,130 @@ static void fglLoadTexture(FGLTexture *obj, unsigned level,
 	} while(--height);
 }
 
-static inline uint32_t fglPackARGB8888(uint8_t r, uint8_t g, uint8_t b, uint8_t a)
+static void fglConvertTexture(const FGLTextureImage *img, unsigned level,
+			const GLvoid *pixels, unsigned alignment)
 {
-	return (a << 24) | (r << 16) | (g << 8) | b;
+	const FGLKernels *kernels = fglGetKernels();
+	FGLConvertKernel convert;
+	unsigned srcSize;
+
+	switch (img->format) {
+	case GL_RGB:
+		convert = kernels->convertRGB888;
+		srcSize = 3;
+		break;
+	case GL_RGBA:
+		convert = kernels->convertRGBA8888;
+		srcSize = 4;
+		break;
+	case GL_LUMINANCE:
+		convert = kernels->convertL8;
+		srcSize = 1;
+		break;
+	case GL_ALPHA:
+		convert = kernels->convertA8;
+		srcSize = 1;
+		break;
+	default:
+		LOGW("Unsupported texture conversion %d", img->format);
+		return;
+	}
+
+	const FGLPixelFormat *pix = FGLPixelFormat::get(img->pixFormat);
+	uint8_t *dst8 = img->vaddr + img->offset[level];
+
+	unsigned width = img->width >> level;
+	if (!width)
+		width = 1;
+
+	unsigned height = img->height >> level;
+	if (!height)
+		height = 1;
+
+	size_t line = srcSize*width;
+	size_t srcStride = (line + alignment - 1) & ~(alignment - 1);
+	size_t dstStride = pix->pixelSize*width;
+	const uint8_t *src8 = (const uint8_t *)pixels;
+
+	do {
+		convert(dst8, src8, width);
+		src8 += srcStride;
+		dst8 += dstStride;
+	} while (--height);
 }
 
-static inline uint16_t fglPackAL88(uint8_t l, uint8_t a)
+static void fglWriteTexture(const FGLTextureImage *img, unsigned level,
+		const GLvoid *pixels, unsigned alignment, bool convert)
 {
-	return (a << 8) | l;
+	const FGLPixelFormat *pix = FGLPixelFormat::get(img->pixFormat);
+
+	if (convert)
+		fglConvertTexture(img, level, pixels, alignment);
+	else if (alignment <= pix->pixelSize)
+		fglLoadTextureDirect(img, level, pixels);
+	else
+		fglLoadTexture(img, level, pixels, alignment);
 }
 
-static void fglConvertTexture(FGLTexture *obj, unsigned level,
-			const GLvoid *pixels, unsigned alignment)
+#ifdef FGL_THREADED_TEXTURE_UPLOAD
+
+/*
+ * Background texture upload
+ *
+ * Conversion is done by the worker thread, from a private copy of source
+ * pixels. Any user of texture memory must call
+ * FGLTexture::waitForUpload() first, which is done when setting up
+ * textures and framebuffer for a draw.
+ */
+
+class FGLTextureUploadJob : public FGLJob {
+	FGLTextureImage	image;
+	unsigned	level;
+	void		*pixels;
+	unsigned	alignment;
+	bool		convert;
+
+public:
+	FGLTextureUploadJob(FGLTexture *obj, unsigned level,
+					void *pixels, unsigned alignment) :
+		image(obj),
+		level(level),
+		pixels(pixels),
+		alignment(alignment),
+		convert(obj->convert) {}
+
+	virtual ~FGLTextureUploadJob()
+	{
+		free(pixels);
+	}
+
+	virtual void run(void)
+	{
+		fglWriteTexture(&image, level, pixels, alignment, convert);
+	}
+};
+
+static unsigned fglGetSourcePixelSize(GLenum format, GLenum type)
 {
-	const FGLPixelFormat *pix = FGLPixelFormat::get(obj->pixFormat);
-	unsigned offset = pix->pixelSize*fimgGetTexMipmapOffset(obj->fimg, level);
+	if (type != GL_UNSIGNED_BYTE)
+		return 2;
+
+	switch (format) {
+	case GL_RGB:
+		return 3;
+	case GL_RGBA:
+	case GL_BGRA_EXT:
+		return 4;
+	case GL_LUMINANCE_ALPHA:
+		return 2;
+	default:
+		return 1;
+	}
+}
 
+static bool fglQueueTextureUpload(FGLTexture *obj, unsigned level,
+				const GLvoid *pixels, unsigned alignment)
+{
 	unsigned width = obj->width >> level;
 	if (!width)
 		width = 1;
@@ -436,83 +527,265 @@ static void fglConvertTexture(FGLTexture *obj, unsigned level,
 	if (!height)
 		height = 1;
 
-	switch (obj->format) {
-	case GL_RGB: {
-		size_t line = 3*width;
-		size_t stride = (line + alignment - 1) & ~(alignment - 1);
-		size_t padding = stride - line;
-		const uint8_t *src8 = (const uint8_t *)pixels;
-		uint32_t *dst32 = (uint32_t *)((uint8_t *)obj->surface->vaddr + offset);
-		do {
-			unsigned x = width;
-			do {
-				*(dst32++) = fglPackARGB8888(src8[0],
-							src8[1], src8[2], 255);
-				src8 += 3;
-			} while(--x);
-			src8 += padding;
-		} while (--height);
-		break;
+	size_t line = width*fglGetSourcePixelSize(obj->format, obj->type);
+	size_t stride = (line + alignment - 1) & ~(alignment - 1);
+	size_t size = stride*(height - 1) + line;
+
+	if (size < FGL_MIN_THREADED_UPLOAD_SIZE)
+		return false;
+
+	void *copy = malloc(size);
+	if (!copy)
+		return false;
+
+	memcpy(copy, pixels, size);
+
+	FGLTextureUploadJob *job = new FGLTextureUploadJob(obj, level,
+							copy, alignment);
+	if (!job) {
+		free(copy);
+		return false;
 	}
-	case GL_RGBA: {
-		size_t line = 4*width;
-		size_t stride = (line + alignment - 1) & ~(alignment - 1);
-		size_t padding = stride - line;
-		const uint8_t *src8 = (const uint8_t *)pixels;
-		uint32_t *dst32 = (uint32_t *)((uint8_t *)obj->surface->vaddr + offset);
-		do {
-			unsigned x = width;
-			do {
-				*(dst32++) = fglPackARGB8888(src8[0],
-						src8[1], src8[2], src8[3]);
-				src8 += 4;
-			} while(--x);
-			src8 += padding;
-		} while (--height);
-		break;
+
+	/* Jobs complete in order, so waiting for the last one is enough */
+	obj->upload = fglQueueJob(job);
+
+	/* Framebuffers rendering to the texture must wait for the upload */
+	obj->markFramebufferDirty();
+
+	return true;
+}
+
+#endif /* FGL_THREADED_TEXTURE_UPLOAD */
+
+static void fglUploadTexture(FGLTexture *obj, unsigned level,
+				const GLvoid *pixels, unsigned alignment)
+{
+#ifdef FGL_THREADED_TEXTURE_UPLOAD
+	if (obj->convert && fglQueueTextureUpload(obj,
+						level, pixels, alignment))
+		return;
+#endif
+
+	obj->waitForUpload();
+
+	FGLTextureImage img(obj);
+	fglWriteTexture(&img, level, pixels, alignment, obj->convert);
+}
+
+/*
+ * Lazy mipmap generation
+ *
+ * With GL_GENERATE_MIPMAP enabled, base level updates only extend the
+ * region to propagate to mipmaps. Mipmaps are regenerated from it when
+ * the texture is used with a mipmapping filter or when another level
+ * is about to be specified directly.
+ */
+
+static void fglMarkMipmapsDirty(FGLTexture *obj,
+				GLint x, GLint y, GLint w, GLint h)
+{
+	GLint *rect = obj->mipmapRect;
+
+	if (!obj->maxLevel)
+		return;
+
+	/*
+	 * Compressed formats cannot be downsampled, except decoded ETC1
+	 * images, which are plain RGB565.
+	 */
+	if (obj->compressed && obj->pixFormat != FGL_PIXFMT_RGB565)
+		return;
+
+	if (!obj->mipmapsDirty()) {
+		rect[0] = x;
+		rect[1] = y;
+		rect[2] = x + w;
+		rect[3] = y + h;
+		return;
 	}
-	case GL_LUMINANCE: {
-		size_t stride = (width + alignment - 1) & ~(alignment - 1);
-		size_t padding = stride - width;
-		const uint8_t *src8 = (const uint8_t *)pixels;
-		uint16_t *dst16 = (uint16_t *)((uint8_t *)obj->surface->vaddr + offset);
-		do {
-			unsigned x = width;
-			do {
-				*(dst16++) = fglPackAL88(*(src8++), 255);
-			} while (--x);
-			src8 += padding;
-		} while (--height);
-		break;
+
+	rect[0] = min(rect[0], x);
+	rect[1] = min(rect[1], y);
+	rect[2] = max(rect[2], x + w);
+	rect[3] = max(rect[3], y + h);
+}
+
+void fglUpdateMipmaps(FGLTexture *obj)
+{
+	if (!obj->mipmapsDirty())
+		return;
+
+	obj->waitForUpload();
+
+	FGLTextureImage img(obj);
+	fglGenerateMipmaps(&img, obj->mipmapRect);
+
+	obj->cleanMipmaps();
+	obj->dirty = true;
+}
+
+/*
+ * Orphaned surfaces
+ *
+ * Instead of waiting for the GPU to finish with a texture that is being
+ * redefined, its surface is replaced with a new one and the old one is
+ * freed when all draws submitted until then have completed.
+ */
+
+static inline bool fglOrphanIdle(const FGLOrphanedSurface *orphan)
+{
+	return fimgFenceExpired(orphan->fence)
+					&& fglIsJobDone(orphan->upload);
+}
+
+static inline void fglRemoveOrphan(FGLOrphanState *orphans, unsigned i)
+{
+	orphans->surfaces[i] = orphans->surfaces[--orphans->count];
+}
+
+void fglReleaseOrphans(FGLContext *ctx, bool wait)
+{
+	FGLOrphanState *orphans = &ctx->orphans;
+	unsigned i = 0;
+
+	while (i < orphans->count) {
+		FGLOrphanedSurface *orphan = &orphans->surfaces[i];
+
+		if (wait) {
+			fimgWaitFence(ctx->fimg, orphan->fence);
+			fglWaitForJob(orphan->upload);
+		} else if (!fglOrphanIdle(orphan)) {
+			++i;
+			continue;
+		}
+
+		delete orphan->surface;
+		fglRemoveOrphan(orphans, i);
 	}
-	case GL_ALPHA: {
-		size_t stride = (width + alignment - 1) & ~(alignment - 1);
-		size_t padding = stride - width;
-		const uint8_t *src8 = (const uint8_t *)pixels;
-		uint16_t *dst16 = (uint16_t *)((uint8_t *)obj->surface->vaddr + offset);
-		do {
-			unsigned x = width;
-			do {
-				*(dst16++) = fglPackAL88(0xff, *(src8++));
-			} while (--x);
-			src8 += padding;
-		} while (--height);
-		break;
+}
+
+/* Takes an idle orphaned surface suitable for given size */
+static FGLSurface *fglReuseOrphan(FGLContext *ctx, uint32_t size)
+{
+	FGLOrphanState *orphans = &ctx->orphans;
+
+	for (unsigned i = 0; i < orphans->count; ++i) {
+		FGLOrphanedSurface *orphan = &orphans->surfaces[i];
+
+		if (!fglOrphanIdle(orphan))
+			continue;
+
+		int32_t delta = orphan->surface->size - size;
+		if (delta < 0 || delta > 16384)
+			continue;
+
+		FGLSurface *surface = orphan->surface;
+		fglRemoveOrphan(orphans, i);
+		return surface;
 	}
-	default:
-		LOGW("Unsupported texture conversion %d", obj->format);
-		return;
+
+	return 0;
+}
+
+static void fglOrphanSurface(FGLContext *ctx, FGLTexture *obj)
+{
+	FGLOrphanState *orphans = &ctx->orphans;
+
+	if (orphans->count == FGL_MAX_ORPHANED_SURFACES) {
+		fglReleaseOrphans(ctx, false);
+		if (orphans->count == FGL_MAX_ORPHANED_SURFACES)
+			fglReleaseOrphans(ctx, true);
 	}
+
+	FGLOrphanedSurface *orphan = &orphans->surfaces[orphans->count++];
+	orphan->surface = obj->surface;
+	orphan->fence = fimgCreateFence(ctx->fimg);
+	orphan->upload = obj->upload;
+
+	obj->surface = 0;
+	obj->upload = FGL_NO_JOB;
+
+	/* The GPU does not use the new surface yet */
+	for (int i = 0; i < FGL_MAX_TEXTURE_UNITS; ++i)
+		if (ctx->busyTexture[i] == obj)
+			ctx->busyTexture[i] = 0;
+}
+
+static inline bool fglTextureBusy(FGLContext *ctx, FGLTexture *tex)
+{
+	for (int i = 0; i < FGL_MAX_TEXTURE_UNITS; ++i)
+		if (ctx->busyTexture[i] == tex)
+			return true;
+
+	return false;
 }
 
 static inline void fglWaitForTexture(FGLContext *ctx, FGLTexture *tex)
 {
-	for (int i = 0; i < FGL_MAX_TEXTURE_UNITS; ++i) {
-		if (ctx->busyTexture[i] == tex) {
-			glFinish();
-			break;
+	if (fglTextureBusy(ctx, tex))
+		glFinish();
+}
+
+/* Drops texture surface, deferring its deletion if the GPU may use it */
+static void fglDropSurface(FGLContext *ctx, FGLTexture *obj, bool busy)
+{
+	obj->cleanMipmaps();
+
+	if (busy) {
+		fglOrphanSurface(ctx, obj);
+		return;
+	}
+
+	obj->waitForUpload();
+	delete obj->surface;
+	obj->surface = 0;
+}
+
+/* Detaches EGL image from texture about to be redefined */
+static void fglReleaseImage(FGLTexture *obj, bool busy)
+{
+	/* Image surface is not ours, so it can't be orphaned */
+	if (busy)
+		glFinish();
+
+	obj->eglImage->disconnect();
+	obj->eglImage = 0;
+	obj->surface = 0;
+}
+
+/* Makes sure that texture has a surface of given size */
+static bool fglAllocTexture(FGLContext *ctx, FGLTexture *obj,
+						uint32_t size, bool busy)
+{
+	if (obj->surface) {
+		int32_t delta = obj->surface->size - size;
+		if (busy || delta < 0 || delta > 16384)
+			fglDropSurface(ctx, obj, busy);
+	}
+
+	/* (Re)allocate the texture if needed */
+	if (!obj->surface) {
+		obj->markFramebufferDirty();
+
+		fglReleaseOrphans(ctx, false);
+		obj->surface = fglReuseOrphan(ctx, size);
+		if (!obj->surface)
+			obj->surface = fglCreateLocalSurface(size);
+		if(!obj->surface || !obj->surface->isValid()) {
+			delete obj->surface;
+			obj->surface = 0;
+			obj->width = 0;
+			obj->height = 0;
+			obj->format = 0;
+			obj->type = 0;
+			obj->pixFormat = 0;
+			setError(GL_OUT_OF_MEMORY);
+			return false;
 		}
 	}
+
+	return true;
 }
 
 GL_API void GL_APIENTRY glTexImage2D (GLenum target, GLint level,
@@ -575,7 +848,8 @@ GL_API void GL_APIENTRY glTexImage2D (GLenum target, GLint level,
 		}
 
 		/* Check format */
-		if (obj->format != format || obj->type != type) {
+		if (obj->compressed || obj->format != format
+		    || obj->type != type) {
 			/* Must be the same format as base level */
 			setError(GL_INVALID_ENUM);
 			return;
@@ -583,22 +857,10 @@ GL_API void GL_APIENTRY glTexImage2D (GLenum target, GLint level,
 
 		/* Copy the image (with conversion if needed) */
 		if (pixels != NULL) {
-			const FGLPixelFormat *pix =
-					FGLPixelFormat::get(obj->pixFormat);
-
 			fglWaitForTexture(ctx, obj);
-
-			if (obj->convert) {
-				fglConvertTexture(obj, level, pixels,
-							ctx->unpackAlignment);
-			} else {
-				if (ctx->unpackAlignment <= pix->pixelSize)
-					fglLoadTextureDirect(obj, level, pixels);
-				else
-					fglLoadTexture(obj, level, pixels,
-						       ctx->unpackAlignment);
-			}
-
+			fglUpdateMipmaps(obj);
+			fglUploadTexture(obj, level, pixels,
+						ctx->unpackAlignment);
 			obj->dirty = true;
 		}
 
@@ -613,17 +875,18 @@ GL_API void GL_APIENTRY glTexImage2D (GLenum target, GLint level,
 		return;
 	}
 
-	fglWaitForTexture(ctx, obj);
+	bool busy = fglTextureBusy(ctx, obj);
 
 	if (obj->eglImage) {
-		obj->eglImage->disconnect();
-		obj->eglImage = 0;
-		obj->surface = 0;
+		fglReleaseImage(obj, busy);
+		busy = false;
 	}
 
 	if (width != obj->width || height != obj->height
-	    || (uint32_t)pixFormat != obj->pixFormat)
+	    || (uint32_t)pixFormat != obj->pixFormat) {
 		obj->markFramebufferDirty();
+		obj->cleanMipmaps();
+	}
 
 	const FGLPixelFormat *pix = FGLPixelFormat::get(pixFormat);
 	obj->invReady = false;
@@ -632,14 +895,15 @@ GL_API void GL_APIENTRY glTexImage2D (GLenum target, GLint level,
 	obj->format = format;
 	obj->type = type;
 	obj->pixFormat = pixFormat;
+	obj->compressed = GL_FALSE;
 	obj->convert = convert;
 	obj->mask = 0;
 	if (pix->pixFormat != (uint32_t)-1)
 		obj->mask = BIT_VAL(FGL_ATTACHMENT_COLOR);
 
 	if (!width || !height) {
-		delete obj->surface;
-		obj->surface = 0;
+		if (obj->surface)
+			fglDropSurface(ctx, obj, busy);
 		return;
 	}
 
@@ -647,29 +911,8 @@ GL_API void GL_APIENTRY glTexImage2D (GLenum target, GLint level,
 	uint32_t size = pix->pixelSize*fglCalculateMipmaps(obj,
 						width, height, pix->pixelSize);
 
-	if (obj->surface) {
-		int32_t delta = obj->surface->size - size;
-		if (delta < 0 || delta > 16384) {
-			delete obj->surface;
-			obj->surface = 0;
-		}
-	}
-
-	/* (Re)allocate the texture if needed */
-	if (!obj->surface) {
-		obj->surface = new FGLLocalSurface(size);
-		if(!obj->surface || !obj->surface->isValid()) {
-			delete obj->surface;
-			obj->surface = 0;
-			obj->width = 0;
-			obj->height = 0;
-			obj->format = 0;
-			obj->type = 0;
-			obj->pixFormat = 0;
-			setError(GL_OUT_OF_MEMORY);
-			return;
-		}
-	}
+	if (!fglAllocTexture(ctx, obj, size, busy))
+		return;
 
 	fimgInitTexture(obj->fimg, pix->flags,
 					pix->texFormat, obj->surface->paddr);
@@ -677,20 +920,11 @@ GL_API void GL_APIENTRY glTexImage2D (GLenum target, GLint level,
 
 	/* Copy the image (with conversion if needed) */
 	if (pixels != NULL) {
-		if (obj->convert) {
-			fglConvertTexture(obj, level, pixels,
-						ctx->unpackAlignment);
-		} else {
-			if (ctx->unpackAlignment <= pix->pixelSize)
-				fglLoadTextureDirect(obj, level, pixels);
-			else
-				fglLoadTexture(obj, level, pixels,
-						ctx->unpackAlignment);
-		}
-
+		if (!obj->genMipmap)
+			fglUpdateMipmaps(obj);
+		fglUploadTexture(obj, level, pixels, ctx->unpackAlignment);
 		if (obj->genMipmap)
-			fglGenerateMipmaps(obj);
-
+			fglMarkMipmapsDirty(obj, 0, 0, width, height);
 		obj->dirty = true;
 	}
 }
@@ -728,110 +962,53 @@ static void fglConvertTexturePartial(FGLTexture *obj, unsigned level,
 			const GLvoid *pixels, unsigned alignment,
 			unsigned x, unsigned y, unsigned w, unsigned h)
 {
-	const FGLPixelFormat *pix = FGLPixelFormat::get(obj->pixFormat);
-	unsigned offset = pix->pixelSize*fimgGetTexMipmapOffset(obj->fimg, level);
-
-	unsigned width = obj->width >> level;
-	if (!width)
-		width = 1;
-
-	unsigned height = obj->height >> level;
-	if (!height)
-		height = 1;
+	const FGLKernels *kernels = fglGetKernels();
+	FGLConvertKernel convert;
+	unsigned srcSize;
 
 	switch (obj->format) {
-	case GL_RGB: {
-		size_t line = 3*w;
-		size_t srcStride = (line + alignment - 1) & ~(alignment - 1);
-		size_t dstStride = 4*width;
-		size_t xOffset = 4*x;
-		size_t yOffset = y*dstStride;
-		size_t srcPad = srcStride - line;
-		size_t dstPad = width - w;
-		const uint8_t *src8 = (const uint8_t *)pixels;
-		uint32_t *dst32 = (uint32_t *)((uint8_t *)obj->surface->vaddr
-						+ offset + yOffset + xOffset);
-		do {
-			unsigned x = w;
-			do {
-				*(dst32++) = fglPackARGB8888(src8[0],
-						src8[1], src8[2], 255);
-				src8 += 3;
-			} while (--x);
-			src8 += srcPad;
-			dst32 += dstPad;
-		} while (--h);
+	case GL_RGB:
+		convert = kernels->convertRGB888;
+		srcSize = 3;
 		break;
-	}
-	case GL_RGBA: {
-		size_t line = 4*w;
-		size_t srcStride = (line + alignment - 1) & ~(alignment - 1);
-		size_t dstStride = 4*width;
-		size_t xOffset = 4*x;
-		size_t yOffset = y*dstStride;
-		size_t srcPad = srcStride - line;
-		size_t dstPad = width - w;
-		const uint8_t *src8 = (const uint8_t *)pixels;
-		uint32_t *dst32 = (uint32_t *)((uint8_t *)obj->surface->vaddr
-						+ offset + yOffset + xOffset);
-		do {
-			unsigned x = w;
-			do {
-				*(dst32++) = fglPackARGB8888(src8[0],
-						src8[1], src8[2], src8[3]);
-				src8 += 4;
-			} while (--x);
-			src8 += srcPad;
-			dst32 += dstPad;
-		} while (--h);
+	case GL_RGBA:
+		convert = kernels->convertRGBA8888;
+		srcSize = 4;
 		break;
-	}
-	case GL_LUMINANCE: {
-		size_t line = w;
-		size_t srcStride = (line + alignment - 1) & ~(alignment - 1);
-		size_t dstStride = 2*width;
-		size_t xOffset = 2*x;
-		size_t yOffset = y*dstStride;
-		size_t srcPad = srcStride - line;
-		size_t dstPad = width - w;
-		const uint8_t *src8 = (const uint8_t *)pixels;
-		uint16_t *dst16 = (uint16_t *)((uint8_t *)obj->surface->vaddr
-						+ offset + yOffset + xOffset);
-		do {
-			unsigned x = w;
-			do {
-				*(dst16++) = fglPackAL88(*(src8++), 255);
-			} while (--x);
-			src8 += srcPad;
-			dst16 += dstPad;
-		} while (--h);
+	case GL_LUMINANCE:
+		convert = kernels->convertL8;
+		srcSize = 1;
 		break;
-	}
-	case GL_ALPHA: {
-		size_t line = w;
-		size_t srcStride = (line + alignment - 1) & ~(alignment - 1);
-		size_t dstStride = 2*width;
-		size_t xOffset = 2*x;
-		size_t yOffset = y*dstStride;
-		size_t srcPad = srcStride - line;
-		size_t dstPad = width - w;
-		const uint8_t *src8 = (const uint8_t *)pixels;
-		uint16_t *dst16 = (uint16_t *)((uint8_t *)obj->surface->vaddr
-						+ offset + yOffset + xOffset);
-		do {
-			unsigned x = w;
-			do {
-				*(dst16++) = fglPackAL88(0xff, *(src8++));
-			} while (--x);
-			src8 += srcPad;
-			dst16 += dstPad;
-		} while (--h);
+	case GL_ALPHA:
+		convert = kernels->convertA8;
+		srcSize = 1;
 		break;
-	}
 	default:
 		LOGW("Unsupported texture conversion %d", obj->format);
 		return;
 	}
+
+	const FGLPixelFormat *pix = FGLPixelFormat::get(obj->pixFormat);
+	unsigned offset = pix->pixelSize*fimgGetTexMipmapOffset(obj->fimg, level);
+
+	unsigned width = obj->width >> level;
+	if (!width)
+		width = 1;
+
+	size_t line = srcSize*w;
+	size_t srcStride = (line + alignment - 1) & ~(alignment - 1);
+	size_t dstStride = pix->pixelSize*width;
+	size_t xOffset = pix->pixelSize*x;
+	size_t yOffset = y*dstStride;
+	const uint8_t *src8 = (const uint8_t *)pixels;
+	uint8_t *dst8 = (uint8_t *)obj->surface->vaddr
+					+ offset + yOffset + xOffset;
+
+	do {
+		convert(dst8, src8, w);
+		src8 += srcStride;
+		dst8 += dstStride;
+	} while (--h);
 }
 
 GL_API void GL_APIENTRY glTexSubImage2D (GLenum target, GLint level,
@@ -852,7 +1029,7 @@ GL_API void GL_APIENTRY glTexSubImage2D (GLenum target, GLint level,
 		return;
 	}
 
-	if (!obj->surface) {
+	if (!obj->surface || obj->compressed) {
 		setError(GL_INVALID_OPERATION);
 		return;
 	}
@@ -897,6 +1074,9 @@ GL_API void GL_APIENTRY glTexSubImage2D (GLenum target, GLint level,
 		return;
 
 	fglWaitForTexture(ctx, obj);
+	if (level > 0 || !obj->genMipmap)
+		fglUpdateMipmaps(obj);
+	obj->waitForUpload();
 
 	if (obj->convert)
 		fglConvertTexturePartial(obj, level, pixels,
@@ -905,21 +1085,488 @@ GL_API void GL_APIENTRY glTexSubImage2D (GLenum target, GLint level,
 		fglLoadTexturePartial(obj, level, pixels,
 			ctx->unpackAlignment, xoffset, yoffset, width, height);
 
+	if (!level && obj->genMipmap)
+		fglMarkMipmapsDirty(obj, xoffset, yoffset, width, height);
+
 	obj->dirty = true;
 }
 
+/*
+ * Compressed textures
+ *
+ * S3TC (DXT1) blocks already have the layout of hardware S3TC format, so
+ * they are copied to texture memory as they are. ETC1 is not supported by
+ * the hardware and gets decoded to RGB565 at upload time.
+ *
+ * Paletted textures are expanded to ARGB8888 at upload time. The hardware
+ * has a single palette shared by all texture units, so sampling them through
+ * it would misrender draws using two paletted textures at once.
+ */
+
+/* Bytes per palette entry of PALETTE4 and PALETTE8 formats */
+static const unsigned fglPaletteEntrySize[] = {
+	3,	/* RGB8 */
+	4,	/* RGBA8 */
+	2,	/* R5_G6_B5 */
+	2,	/* RGBA4 */
+	2,	/* RGB5_A1 */
+};
+
+static inline bool fglIsPaletted(GLenum format)
+{
+	return format >= GL_PALETTE4_RGB8_OES
+				&& format <= GL_PALETTE8_RGB5_A1_OES;
+}
+
+static inline unsigned fglGetIndexBits(GLenum format)
+{
+	return (format < GL_PALETTE8_RGB8_OES) ? 4 : 8;
+}
+
+static int fglGetCompressedFormatInfo(GLenum format)
+{
+	switch (format) {
+	case GL_PALETTE4_RGB8_OES:
+	case GL_PALETTE4_RGBA8_OES:
+	case GL_PALETTE4_R5_G6_B5_OES:
+	case GL_PALETTE4_RGBA4_OES:
+	case GL_PALETTE4_RGB5_A1_OES:
+	case GL_PALETTE8_RGB8_OES:
+	case GL_PALETTE8_RGBA8_OES:
+	case GL_PALETTE8_R5_G6_B5_OES:
+	case GL_PALETTE8_RGBA4_OES:
+	case GL_PALETTE8_RGB5_A1_OES:
+		return FGL_PIXFMT_ARGB8888;
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+		return FGL_PIXFMT_S3TC;
+	case GL_ETC1_RGB8_OES:
+		return FGL_PIXFMT_RGB565;
+	default:
+		return -1;
+	}
+}
+
+/* Size of compressed data of a level */
+static size_t fglCompressedLevelSize(GLenum format,
+					unsigned width, unsigned height)
+{
+	if (fglIsPaletted(format))
+		return (width * height * fglGetIndexBits(format) + 7) / 8;
+
+	/* DXT1 and ETC1 use 64-bit blocks of 4x4 pixels */
+	return 8 * ((width + 3) / 4) * ((height + 3) / 4);
+}
+
+/* Converts pixel count to size in texture memory */
+static inline uint32_t fglCompressedBytes(uint32_t pixFormat, uint32_t pixels)
+{
+	switch (pixFormat) {
+	case FGL_PIXFMT_S3TC:
+		return pixels / 2;
+	default:
+		return FGLPixelFormat::get(pixFormat)->pixelSize * pixels;
+	}
+}
+
+/* Converts palette entries to ARGB8888 */
+static void fglConvertPalette(uint32_t *dst, const uint8_t *src,
+						GLenum format, unsigned count)
+{
+	const FGLKernels *kernels = fglGetKernels();
+
+	switch ((format - GL_PALETTE4_RGB8_OES) % NELEM(fglPaletteEntrySize)) {
+	case 0:
+		kernels->convertRGB888(dst, src, count);
+		return;
+	case 1:
+		kernels->convertRGBA8888(dst, src, count);
+		return;
+	case 2:
+		while (count--) {
+			uint32_t p = src[0] | (src[1] << 8);
+			uint32_t r = (p >> 11) & 0x1f;
+			uint32_t g = (p >> 5) & 0x3f;
+			uint32_t b = p & 0x1f;
+
+			*(dst++) = 0xff000000 | (((r << 3) | (r >> 2)) << 16)
+				| (((g << 2) | (g >> 4)) << 8)
+				| ((b << 3) | (b >> 2));
+			src += 2;
+		}
+		return;
+	case 3:
+		while (count--) {
+			uint32_t p = src[0] | (src[1] << 8);
+
+			*(dst++) = (0x11 * (p & 0xf) << 24)
+				| (0x11 * (p >> 12) << 16)
+				| (0x11 * ((p >> 8) & 0xf) << 8)
+				| (0x11 * ((p >> 4) & 0xf));
+			src += 2;
+		}
+		return;
+	case 4:
+		while (count--) {
+			uint32_t p = src[0] | (src[1] << 8);
+			uint32_t r = (p >> 11) & 0x1f;
+			uint32_t g = (p >> 6) & 0x1f;
+			uint32_t b = (p >> 1) & 0x1f;
+
+			*(dst++) = ((p & 1) ? 0xff000000 : 0)
+				| (((r << 3) | (r >> 2)) << 16)
+				| (((g << 3) | (g >> 2)) << 8)
+				| ((b << 3) | (b >> 2));
+			src += 2;
+		}
+		return;
+	}
+}
+
+/* Decodes ETC1 image, passing only whole blocks to the kernel */
+static void fglDecodeETC1(uint8_t *dst, const uint8_t *src,
+					unsigned width, unsigned height)
+{
+	FGLDecodeKernel decode = fglGetKernels()->decodeETC1;
+	unsigned blocks = (width + 3) / 4;
+	size_t stride = 2 * width;
+	size_t tmpStride = 8 * blocks;
+	uint8_t *tmp = 0;
+
+	for (unsigned y = 0; y < height; y += 4) {
+		unsigned rows = min(height - y, 4U);
+
+		if (!(width & 3) && rows == 4) {
+			decode(dst, stride, src, blocks);
+		} else {
+			if (!tmp)
+				tmp = (uint8_t *)malloc(4 * tmpStride);
+			if (!tmp)
+				return;
+
+			decode(tmp, tmpStride, src, blocks);
+			for (unsigned i = 0; i < rows; ++i)
+				memcpy(dst + i*stride, tmp + i*tmpStride, stride);
+		}
+
+		dst += 4 * stride;
+		src += 8 * blocks;
+	}
+
+	free(tmp);
+}
+
+static void fglLoadCompressedLevel(FGLTexture *obj, unsigned level,
+				const uint8_t *src, const uint32_t *palette)
+{
+	unsigned width = obj->width >> level;
+	if (!width)
+		width = 1;
+	unsigned height = obj->height >> level;
+	if (!height)
+		height = 1;
+
+	uint32_t offset = fglCompressedBytes(obj->pixFormat,
+				fimgGetTexMipmapOffset(obj->fimg, level));
+	uint8_t *dst = (uint8_t *)obj->surface->vaddr + offset;
+	size_t pixels = width * height;
+
+	switch (obj->pixFormat) {
+	case FGL_PIXFMT_S3TC:
+		memcpy(dst, src,
+			fglCompressedLevelSize(obj->format, width, height));
+		break;
+	case FGL_PIXFMT_ARGB8888: {
+		uint32_t *dst32 = (uint32_t *)dst;
+
+		if (fglGetIndexBits(obj->format) == 8) {
+			for (size_t i = 0; i < pixels; ++i)
+				*(dst32++) = palette[src[i]];
+			break;
+		}
+
+		/* First pixel in high nibble */
+		for (size_t i = 0; i < pixels / 2; ++i) {
+			*(dst32++) = palette[src[i] >> 4];
+			*(dst32++) = palette[src[i] & 0xf];
+		}
+		if (pixels & 1)
+			*dst32 = palette[src[pixels / 2] >> 4];
+		break; }
+	case FGL_PIXFMT_RGB565:
+		fglDecodeETC1(dst, src, width, height);
+		break;
+	}
+}
+
 GL_API void GL_APIENTRY glCompressedTexImage2D (GLenum target, GLint level,
 		GLenum internalformat, GLsizei width, GLsizei height,
 		GLint border, GLsizei imageSize, const GLvoid *data)
 {
-	FUNC_UNIMPLEMENTED;
+	/* Check conditions required by specification */
+	if (target != GL_TEXTURE_2D) {
+		setError(GL_INVALID_ENUM);
+		return;
+	}
+
+	int pixFormat = fglGetCompressedFormatInfo(internalformat);
+	if (pixFormat < 0) {
+		setError(GL_INVALID_ENUM);
+		return;
+	}
+
+	if (border != 0 || width < 0 || height < 0) {
+		setError(GL_INVALID_VALUE);
+		return;
+	}
+
+	/* Also keeps size calculations below from overflowing */
+	if (width > FGL_MAX_TEXTURE_SIZE || height > FGL_MAX_TEXTURE_SIZE) {
+		setError(GL_INVALID_VALUE);
+		return;
+	}
+
+	/* Paletted images include all mipmaps, negative level gives count */
+	bool paletted = fglIsPaletted(internalformat);
+	if (paletted ? (level > 0) : (level < 0)) {
+		setError(GL_INVALID_VALUE);
+		return;
+	}
+
+	FGLContext *ctx = getContext();
+	FGLTexture *obj = ctx->texture[ctx->activeTexture].getTexture();
+
+	/* Mipmap image specification */
+	if (level > 0) {
+		if (obj->eglImage || !obj->surface) {
+			setError(GL_INVALID_OPERATION);
+			return;
+		}
+
+		/* Must be the same format as base level */
+		if (!obj->compressed || obj->format != internalformat) {
+			setError(GL_INVALID_OPERATION);
+			return;
+		}
+
+		GLint mipmapW, mipmapH;
+
+		mipmapW = obj->width >> level;
+		if (!mipmapW)
+			mipmapW = 1;
+
+		mipmapH = obj->height >> level;
+		if (!mipmapH)
+			mipmapH = 1;
+
+		if (level > obj->maxLevel
+		    || mipmapW != width || mipmapH != height) {
+			setError(GL_INVALID_VALUE);
+			return;
+		}
+
+		if ((size_t)imageSize != fglCompressedLevelSize(
+					internalformat, width, height)) {
+			setError(GL_INVALID_VALUE);
+			return;
+		}
+
+		if (data != NULL) {
+			fglWaitForTexture(ctx, obj);
+			fglUpdateMipmaps(obj);
+			obj->waitForUpload();
+			fglLoadCompressedLevel(obj, level,
+						(const uint8_t *)data, 0);
+			obj->dirty = true;
+		}
+
+		return;
+	}
+
+	/* Base image specification */
+	unsigned levels = 1 - level;
+	size_t expected = 0;
+	size_t paletteSize = 0;
+	unsigned paletteCount = 0;
+
+	if (paletted) {
+		paletteCount = 1 << fglGetIndexBits(internalformat);
+		paletteSize = paletteCount * fglPaletteEntrySize[
+			(internalformat - GL_PALETTE4_RGB8_OES)
+					% NELEM(fglPaletteEntrySize)];
+		expected = paletteSize;
+	}
+
+	for (unsigned lvl = 0; lvl < levels; ++lvl) {
+		unsigned w = max(width >> lvl, 1);
+		unsigned h = max(height >> lvl, 1);
+
+		/* More levels than the mipmap chain has */
+		if (lvl && !((width | height) >> lvl)) {
+			setError(GL_INVALID_VALUE);
+			return;
+		}
+
+		expected += fglCompressedLevelSize(internalformat, w, h);
+	}
+
+	if ((size_t)imageSize != expected) {
+		setError(GL_INVALID_VALUE);
+		return;
+	}
+
+	bool busy = fglTextureBusy(ctx, obj);
+
+	if (obj->eglImage) {
+		fglReleaseImage(obj, busy);
+		busy = false;
+	}
+
+	if (width != obj->width || height != obj->height
+	    || (uint32_t)pixFormat != obj->pixFormat)
+		obj->markFramebufferDirty();
+
+	/* Whole contents get replaced */
+	obj->cleanMipmaps();
+
+	const FGLPixelFormat *pix = FGLPixelFormat::get(pixFormat);
+	obj->invReady = false;
+	obj->width = width;
+	obj->height = height;
+	obj->format = internalformat;
+	obj->type = 0;
+	obj->pixFormat = pixFormat;
+	obj->compressed = GL_TRUE;
+	obj->convert = false;
+	obj->mask = 0;
+	if (pix->pixFormat != (uint32_t)-1)
+		obj->mask = BIT_VAL(FGL_ATTACHMENT_COLOR);
+
+	if (!width || !height) {
+		if (obj->surface)
+			fglDropSurface(ctx, obj, busy);
+		return;
+	}
+
+	/* Calculate mipmaps */
+	uint32_t size = fglCompressedBytes(pixFormat,
+				fglCalculateMipmaps(obj, width, height, 0));
+
+	if (!fglAllocTexture(ctx, obj, size, busy))
+		return;
+
+	fimgInitTexture(obj->fimg, pix->flags,
+					pix->texFormat, obj->surface->paddr);
+	fimgSetTex2DSize(obj->fimg, width, height, obj->maxLevel);
+
+	if (data == NULL)
+		return;
+
+	const uint8_t *src = (const uint8_t *)data;
+	uint32_t palette[FGTU_MAX_PALETTE_SIZE];
+
+	obj->waitForUpload();
+
+	if (paletted) {
+		fglConvertPalette(palette, src, internalformat, paletteCount);
+		src += paletteSize;
+	}
+
+	for (unsigned lvl = 0; lvl < levels; ++lvl) {
+		fglLoadCompressedLevel(obj, lvl, src, palette);
+		src += fglCompressedLevelSize(internalformat,
+				max(width >> lvl, 1), max(height >> lvl, 1));
+	}
+
+	if (obj->genMipmap)
+		fglMarkMipmapsDirty(obj, 0, 0, width, height);
+
+	obj->dirty = true;
 }
 
 GL_API void GL_APIENTRY glCompressedTexSubImage2D (GLenum target, GLint level,
 		GLint xoffset, GLint yoffset, GLsizei width, GLsizei height,
 		GLenum format, GLsizei imageSize, const GLvoid *data)
 {
-	FUNC_UNIMPLEMENTED;
+	if (target != GL_TEXTURE_2D) {
+		setError(GL_INVALID_ENUM);
+		return;
+	}
+
+	FGLContext *ctx = getContext();
+	FGLTexture *obj = ctx->texture[ctx->activeTexture].getTexture();
+
+	if (!obj->surface || !obj->compressed || obj->format != format) {
+		setError(GL_INVALID_OPERATION);
+		return;
+	}
+
+	/* Paletted and ETC1 images can be only specified as a whole */
+	if (obj->pixFormat != FGL_PIXFMT_S3TC) {
+		setError(GL_INVALID_OPERATION);
+		return;
+	}
+
+	if (level < 0 || level > obj->maxLevel) {
+		setError(GL_INVALID_VALUE);
+		return;
+	}
+
+	GLint mipmapW, mipmapH;
+
+	mipmapW = obj->width >> level;
+	if (!mipmapW)
+		mipmapW = 1;
+
+	mipmapH = obj->height >> level;
+	if (!mipmapH)
+		mipmapH = 1;
+
+	if (xoffset < 0 || yoffset < 0 || width < 0 || height < 0) {
+		setError(GL_INVALID_VALUE);
+		return;
+	}
+
+	if (xoffset + width > mipmapW || yoffset + height > mipmapH) {
+		setError(GL_INVALID_VALUE);
+		return;
+	}
+
+	/* Only whole blocks can be replaced */
+	if ((xoffset & 3) || (yoffset & 3)
+	    || ((width & 3) && xoffset + width != mipmapW)
+	    || ((height & 3) && yoffset + height != mipmapH)) {
+		setError(GL_INVALID_OPERATION);
+		return;
+	}
+
+	if ((size_t)imageSize != fglCompressedLevelSize(format, width, height)) {
+		setError(GL_INVALID_VALUE);
+		return;
+	}
+
+	if (!data || !width || !height)
+		return;
+
+	fglWaitForTexture(ctx, obj);
+	obj->waitForUpload();
+
+	uint32_t offset = fglCompressedBytes(obj->pixFormat,
+				fimgGetTexMipmapOffset(obj->fimg, level));
+	size_t line = 8 * ((width + 3) / 4);
+	size_t dstStride = 8 * ((mipmapW + 3) / 4);
+	const uint8_t *src8 = (const uint8_t *)data;
+	uint8_t *dst8 = (uint8_t *)obj->surface->vaddr + offset
+				+ (yoffset / 4) * dstStride + 2 * xoffset;
+	unsigned rows = (height + 3) / 4;
+
+	do {
+		memcpy(dst8, src8, line);
+		src8 += line;
+		dst8 += dstStride;
+	} while (--rows);
+
+	obj->dirty = true;
 }
 
 GL_API void GL_APIENTRY glCopyTexImage2D (GLenum target, GLint level,
@@ -962,6 +1609,8 @@ GL_API void GL_APIENTRY glEGLImageTargetTexture2DOES (GLenum target,
 
 	const FGLPixelFormat *cfg = FGLPixelFormat::get(image->pixelFormat);
 
+	tex->waitForUpload();
+
 	if (tex->eglImage)
 		tex->eglImage->disconnect();
 	else
@@ -973,8 +1622,10 @@ GL_API void GL_APIENTRY glEGLImageTargetTexture2DOES (GLenum target,
 	tex->format	= cfg->readFormat;
 	tex->type	= cfg->readType;
 	tex->pixFormat	= image->pixelFormat;
+	tex->compressed	= GL_FALSE;
 	tex->convert	= 0;
 	tex->maxLevel	= 0;
+	tex->cleanMipmaps();
 	tex->dirty	= true;
 	tex->width	= image->width;
 	tex->height	= image->height;
@@ -1006,7 +1657,8 @@ GL_API void GL_APIENTRY glActiveTexture (GLenum texture)
 		return;
 	}
 
-	FGLContext *ctx = getContext();
+	/* Selecting a unit alone does not affect merged draws */
+	FGLContext *ctx = getContextNoFlush();
 
 	ctx->activeTexture = unit;
 }
@@ -10,13 +10,16 @@ LOCAL_CFLAGS += -DLOG_TAG=\"libfimg\"
 LOCAL_CFLAGS += -DFGL_PLATFORM_ANDROID
 
 LOCAL_SRC_FILES := \
+	clear.c \
 	compat.c \
 	fragment.c \
 	global.c \
 	host_new.c \
+	model.c \
 	primitive.c \
 	raster.c \
 	shaders.c \
+	shadercache.c \
 	system.c \
 	texture.c \
 	dump.c
@@ -0,0 +1,182 @@
+/*
+ * fimg/clear.c
+ *
+ * SAMSUNG S3C6410 FIMG-3DSE BUFFER CLEAR FUNCTIONS
+ *
+ * Copyrights:	2010 by Tomasz Figa < tomasz.figa at gmail.com >
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Buffers are cleared by drawing a quad covering the whole framebuffer with
+ * constant color and depth. Scissor rectangle (programmed as raster clip
+ * region), color, depth and stencil write masks are left untouched, so
+ * they apply to the clear just as required by OpenGL ES. Any state changed
+ * here is saved beforehand and brought back afterwards through the register
+ * shadow, so only the registers that really differ get written again.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <string.h>
+
+#include "fimg_private.h"
+
+#ifdef FIMG_FIXED_PIPELINE
+
+static const float identity[16] = {
+	1.0f, 0.0f, 0.0f, 0.0f,
+	0.0f, 1.0f, 0.0f, 0.0f,
+	0.0f, 0.0f, 1.0f, 0.0f,
+	0.0f, 0.0f, 0.0f, 1.0f
+};
+
+/* Marks registers changed since saving for writing on next flush */
+static void restoreRegisters(fimgContext *ctx, const fimgRegBlock *saved)
+{
+	unsigned int block;
+	unsigned int reg;
+
+	for (block = 0; block < FIMG_NUM_REG_BLOCKS; ++block, ++saved) {
+		fimgRegBlock *regs = &ctx->regs[block];
+		uint32_t changed = 0;
+
+		for (reg = 0; reg < FIMG_REG_BLOCK_SIZE; ++reg) {
+			if (!(saved->valid & (1 << reg)))
+				continue;
+
+			if (regs->val[reg] == saved->val[reg])
+				continue;
+
+			regs->val[reg] = saved->val[reg];
+			changed |= 1 << reg;
+		}
+
+		if (!changed)
+			continue;
+
+		regs->dirty |= changed;
+		ctx->dirtyBlocks |= 1 << block;
+	}
+}
+
+/*****************************************************************************
+ * FUNCTIONS:	fimgClear
+ * SYNOPSIS:	This function clears selected buffers inside current clip
+ *		region using the 3D pipeline.
+ * PARAMETERS:	[IN] buffers - bitwise OR of FIMG_CLEAR_* flags
+ *		[IN] color - RGBA clear color (used with FIMG_CLEAR_COLOR)
+ *		[IN] depth - clear depth in [0, 1] (used with FIMG_CLEAR_DEPTH)
+ *		[IN] stencil - clear stencil (used with FIMG_CLEAR_STENCIL)
+ *****************************************************************************/
+void fimgClear(fimgContext *ctx, unsigned int buffers,
+			const float *color, float depth, unsigned char stencil)
+{
+	fimgRegBlock regs[FIMG_NUM_REG_BLOCKS];
+	fimgHostContext host = ctx->host;
+	fimgPrimitiveContext primitive = ctx->primitive;
+	fimgRasterizerContext rasterizer = ctx->rasterizer;
+	fimgFragmentContext fragment = ctx->fragment;
+	unsigned int numAttribs = ctx->numAttribs;
+	fimgCompatState compat;
+	float width = ctx->fragment.bufWidth;
+	float height = ctx->fbHeight;
+	float vertices[3*4];
+	fimgArray array;
+	unsigned int unit;
+
+	if (!(buffers & FIMG_CLEAR_ALL))
+		return;
+
+	/* Save current state */
+	memcpy(regs, ctx->regs, sizeof(regs));
+	fimgCompatSaveState(ctx, &compat);
+
+	/* Vertices are given in window coordinates */
+	fimgSetViewportBypass(ctx);
+	fimgSetFaceCullEnable(ctx, 0);
+	fimgEnableDepthOffset(ctx, 0);
+	fimgLoadMatrix(ctx, FGFP_MATRIX_TRANSFORM, identity);
+
+	/* Constant color without any texturing */
+	for (unit = 0; unit < FIMG_NUM_TEXTURE_UNITS; ++unit)
+		fimgCompatSetTextureFunc(ctx, unit, FGFP_TEXFUNC_NONE);
+	fimgCompatSetAttribConst(ctx, FGFP_ATTRIB_COLOR, color);
+
+	/* Fragments are written as they are */
+	fimgSetAlphaEnable(ctx, 0);
+	fimgSetBlendEnable(ctx, 0);
+	fimgSetLogicalOpEnable(ctx, 0);
+	fimgSetDitherEnable(ctx, 0);
+
+	if (!(buffers & FIMG_CLEAR_COLOR))
+		fimgSetColorBufWriteMask(ctx, 0xf);
+
+	if (buffers & FIMG_CLEAR_DEPTH) {
+		fimgSetDepthParams(ctx, FGPF_TEST_MODE_ALWAYS);
+		fimgSetDepthEnable(ctx, 1);
+	} else {
+		fimgSetDepthEnable(ctx, 0);
+	}
+
+	if (buffers & FIMG_CLEAR_STENCIL) {
+		fimgSetFrontStencilFunc(ctx,
+					FGPF_STENCIL_MODE_ALWAYS, stencil, 0xff);
+		fimgSetFrontStencilOp(ctx, FGPF_TEST_ACTION_REPLACE,
+			FGPF_TEST_ACTION_REPLACE, FGPF_TEST_ACTION_REPLACE);
+		fimgSetBackStencilFunc(ctx,
+					FGPF_STENCIL_MODE_ALWAYS, stencil, 0xff);
+		fimgSetBackStencilOp(ctx, FGPF_TEST_ACTION_REPLACE,
+			FGPF_TEST_ACTION_REPLACE, FGPF_TEST_ACTION_REPLACE);
+		fimgSetStencilEnable(ctx, 1);
+	} else {
+		fimgSetStencilEnable(ctx, 0);
+	}
+
+	vertices[ 0] = 0.0f;
+	vertices[ 1] = height;
+	vertices[ 2] = depth;
+	vertices[ 3] = width;
+	vertices[ 4] = height;
+	vertices[ 5] = depth;
+	vertices[ 6] = 0.0f;
+	vertices[ 7] = 0.0f;
+	vertices[ 8] = depth;
+	vertices[ 9] = width;
+	vertices[10] = 0.0f;
+	vertices[11] = depth;
+
+	array.pointer = vertices;
+	array.stride = 12;
+	array.width = 12;
+
+	fimgSetAttribute(ctx, 0, FGHI_ATTRIB_DT_FLOAT, 3);
+	fimgSetAttribCount(ctx, 1);
+
+	fimgDrawArrays(ctx, FGPE_TRIANGLE_STRIP, &array, 4);
+
+	/* Restore previous state */
+	ctx->host = host;
+	ctx->primitive = primitive;
+	ctx->rasterizer = rasterizer;
+	ctx->fragment = fragment;
+	ctx->numAttribs = numAttribs;
+	restoreRegisters(ctx, regs);
+	fimgCompatLoadState(ctx, &compat);
+}
+
+#endif /* FIMG_FIXED_PIPELINE */
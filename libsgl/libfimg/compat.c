@@ -94,7 +94,8 @@ typedef union {
 /*****************************************************************************
  * FUNCTIONS:	fimgLoadMatrix
  * SYNOPSIS:	This function loads the specified matrix (4x4) into const float
- *		registers of vertex shader.
+ *		registers of vertex shader. Elements are read on next flush
+ *		and written only if they differ from the ones loaded before.
  * PARAMETERS:	[IN] matrix - which matrix to load (FGL_MATRIX_*)
  *		[IN] pData - pointer to matrix elements in column-major ordering
  *****************************************************************************/
@@ -104,10 +105,54 @@ void fimgLoadMatrix(fimgContext *ctx, uint32_t matrix, const float *pfData)
 	ctx->compat.matrixDirty[matrix] = 1;
 }
 
+/*****************************************************************************
+ * FUNCTIONS:	fimgCompatSetAttribConst
+ * SYNOPSIS:	This function selects the source of vertex attribute used by
+ *		fixed pipeline emulation. Constant attributes are passed to
+ *		vertex shader in const float registers instead of being sent
+ *		for every vertex, while the remaining ones are expected to be
+ *		packed in host interface attributes directly after position,
+ *		in FGFP_ATTRIB_* order (skipping disabled texture units).
+ * PARAMETERS:	[IN] attrib - which attribute to set (FGFP_ATTRIB_*)
+ *		[IN] value - pointer to four attribute components or NULL
+ *		if the attribute is fed from vertex array
+ *****************************************************************************/
+void fimgCompatSetAttribConst(fimgContext *ctx, uint32_t attrib,
+							const float *value)
+{
+	ctx->compat.attribConst[attrib] = value;
+
+	if (attrib == FGFP_ATTRIB_COLOR) {
+		FGFP_BITFIELD_SET(ctx->compat.vsState.vs,
+						VS_COLOR_CONST, !!value);
+	} else {
+		FGFP_BITFIELD_SET_IDX(ctx->compat.vsState.vs, VS_TEX_CONST,
+					attrib - FGFP_ATTRIB_TEXTURE, !!value);
+	}
+
+	fimgCompatUpdateVSKey(&ctx->compat);
+}
+
+/*****************************************************************************
+ * FUNCTIONS:	fimgCompatSetTransformBypass
+ * SYNOPSIS:	This function selects shader variant passing position and
+ *		texture coordinates untransformed, for vertices given in window
+ *		coordinates (with viewport bypass). Loaded matrices are left
+ *		intact, so they apply again once the bypass is disabled.
+ * PARAMETERS:	[IN] bypass - non-zero to skip transformation
+ *****************************************************************************/
+void fimgCompatSetTransformBypass(fimgContext *ctx, int bypass)
+{
+	FGFP_BITFIELD_SET(ctx->compat.vsState.vs, VS_BYPASS, !!bypass);
+	fimgCompatUpdateVSKey(&ctx->compat);
+}
+
 /*
  * SHADERS
  */
 
+#define NELEM(i)	(sizeof(i)/sizeof(*i))
+
 struct shaderBlock {
 	const uint32_t *data;
 	uint32_t len;
@@ -118,13 +163,28 @@ struct shaderBlock {
 
 static const struct shaderBlock vertexConstFloat = SHADER_BLOCK(vert_cfloat);
 static const struct shaderBlock vertexHeader = SHADER_BLOCK(vert_header);
+static const struct shaderBlock vertexHeaderBypass =
+					SHADER_BLOCK(vert_header_bypass);
 static const struct shaderBlock vertexFooter = SHADER_BLOCK(vert_footer);
+static const struct shaderBlock vertexColor = SHADER_BLOCK(vert_color);
+static const struct shaderBlock vertexColorConst =
+					SHADER_BLOCK(vert_color_const);
 
 static const struct shaderBlock texcoordTransform[] = {
 	SHADER_BLOCK(vert_texture0),
 	SHADER_BLOCK(vert_texture1)
 };
 
+static const struct shaderBlock texcoordConst[] = {
+	SHADER_BLOCK(vert_texture0_const),
+	SHADER_BLOCK(vert_texture1_const)
+};
+
+static const struct shaderBlock texcoordPass[] = {
+	SHADER_BLOCK(vert_texture0_pass),
+	SHADER_BLOCK(vert_texture1_pass)
+};
+
 /* Pixel shader */
 
 static const struct shaderBlock pixelConstFloat = SHADER_BLOCK(frag_cfloat);
@@ -936,44 +996,154 @@ static uint32_t optimizeShader(uint32_t *start, uint32_t *end)
  * Shader generation code
  */
 
-#define MAX_INSTR	(64)
-
 static inline uint32_t *SHADER_SLOT(uint32_t *buf, uint32_t slot)
 {
 	return buf
-		+ slot*MAX_INSTR*sizeof(fimgShaderInstruction)/sizeof(uint32_t);
+		+ slot*FGFP_MAX_INSTR*sizeof(fimgShaderInstruction)/sizeof(uint32_t);
+}
+
+static uint32_t *allocShaderBuf(uint32_t slots)
+{
+	uint32_t *buf;
+
+	buf = malloc(slots * FGFP_MAX_INSTR * sizeof(fimgShaderInstruction));
+	if (!buf) {
+		LOGE("Failed to allocate memory for shader buffer, terminating.");
+		exit(1);
+	}
+
+	return buf;
+}
+
+/*
+ * Bump when shader generation changes in a way not covered by shader blocks
+ * (i.e. the optimizer), to invalidate stored shader cache files.
+ */
+#define FGFP_SHADER_GENERATOR_VERSION	1
+
+static uint32_t hashShaderBlocks(uint32_t hash,
+				const struct shaderBlock *blk, uint32_t count)
+{
+	uint32_t i;
+
+	for (; count--; ++blk) {
+		for (i = 0; i < 4*blk->len; ++i) {
+			hash ^= blk->data[i];
+			hash *= 16777619;
+		}
+	}
+
+	return hash;
+}
+
+/*****************************************************************************
+ * FUNCTIONS:	fimgCompatShaderVersion
+ * SYNOPSIS:	This function identifies code generated for shader variants
+ * RETURNS:	hash of shader blocks and shader generator version
+ *****************************************************************************/
+uint32_t fimgCompatShaderVersion(void)
+{
+	uint32_t hash = 2166136261U ^ FGFP_SHADER_GENERATOR_VERSION;
+	uint32_t i;
+
+	hash = hashShaderBlocks(hash, &vertexHeader, 1);
+	hash = hashShaderBlocks(hash, &vertexHeaderBypass, 1);
+	hash = hashShaderBlocks(hash, &vertexFooter, 1);
+	hash = hashShaderBlocks(hash, &vertexColor, 1);
+	hash = hashShaderBlocks(hash, &vertexColorConst, 1);
+	hash = hashShaderBlocks(hash, texcoordTransform,
+					NELEM(texcoordTransform));
+	hash = hashShaderBlocks(hash, texcoordConst, NELEM(texcoordConst));
+	hash = hashShaderBlocks(hash, texcoordPass, NELEM(texcoordPass));
+	hash = hashShaderBlocks(hash, &pixelHeader, 1);
+	hash = hashShaderBlocks(hash, &pixelFooter, 1);
+	hash = hashShaderBlocks(hash, textureUnit, NELEM(textureUnit));
+	hash = hashShaderBlocks(hash, textureFunc, NELEM(textureFunc));
+	hash = hashShaderBlocks(hash, combineFunc, NELEM(combineFunc));
+	for (i = 0; i < 3; ++i) {
+		hash = hashShaderBlocks(hash, combineArg[i], 4);
+		hash = hashShaderBlocks(hash, combineArgMod[i], 4);
+	}
+	hash = hashShaderBlocks(hash, &combine_c, 1);
+	hash = hashShaderBlocks(hash, &combine_a, 1);
+	hash = hashShaderBlocks(hash, &combine_u, 1);
+	hash = hashShaderBlocks(hash, &tex_swap, 1);
+	hash = hashShaderBlocks(hash, &out_swap, 1);
+
+	return hash;
+}
+
+/*
+ * Instruction fields holding input register index of source operands
+ * (word of the instruction and bit offset of 8-bit register index)
+ */
+#define FGVS_SRC0_IDX_WORD	1
+#define FGVS_SRC0_IDX_SHIFT	16
+#define FGVS_SRC1_IDX_WORD	0
+#define FGVS_SRC1_IDX_SHIFT	24
+
+/* Const float registers holding constant vertex attributes */
+#define FGVS_ATTRIB_CONST(attrib)	(16 + (attrib))
+
+static void setInputRegister(uint32_t *addr, uint32_t words,
+				uint32_t word, uint32_t shift, uint32_t reg)
+{
+	for (; words; words -= 4, addr += 4) {
+		addr[word] &= ~(0xff << shift);
+		addr[word] |= reg << shift;
+	}
 }
 
 void fimgCompatBuildVertexShader(fimgContext *ctx, uint32_t slot)
 {
+	const struct shaderBlock *texcoord = texcoordTransform;
 	uint32_t unit;
 	uint32_t *addr;
 	uint32_t *start;
+	uint32_t input = 1;
+	uint32_t words;
 
-	if (!ctx->compat.vshaderBuf) {
-		ctx->compat.vshaderBuf = malloc(VS_CACHE_SIZE * MAX_INSTR * sizeof(fimgShaderInstruction));
-		if (!ctx->compat.vshaderBuf) {
-			LOGE("Failed to allocate memory for shader buffer, terminating.");
-			exit(1);
-		}
-	}
 	start = addr = SHADER_SLOT(ctx->compat.vshaderBuf, slot);
 
-	addr += loadShaderBlock(&vertexHeader, addr);
+	if (FGFP_BITFIELD_GET(ctx->compat.vsState.vs, VS_BYPASS)) {
+		addr += loadShaderBlock(&vertexHeaderBypass, addr);
+		texcoord = texcoordPass;
+	} else {
+		addr += loadShaderBlock(&vertexHeader, addr);
+	}
+
+	if (FGFP_BITFIELD_GET(ctx->compat.vsState.vs, VS_COLOR_CONST)) {
+		addr += loadShaderBlock(&vertexColorConst, addr);
+	} else {
+		words = loadShaderBlock(&vertexColor, addr);
+		setInputRegister(addr, words, FGVS_SRC0_IDX_WORD,
+					FGVS_SRC0_IDX_SHIFT, input++);
+		addr += words;
+	}
 
 	for (unit = 0; unit < FIMG_NUM_TEXTURE_UNITS; unit++) {
 		if (!FGFP_BITFIELD_GET_IDX(ctx->compat.vsState.vs, VS_TEX_EN, unit))
 			continue;
 
-		addr += loadShaderBlock(&texcoordTransform[unit], addr);
+		if (FGFP_BITFIELD_GET_IDX(ctx->compat.vsState.vs,
+							VS_TEX_CONST, unit)) {
+			addr += loadShaderBlock(&texcoordConst[unit], addr);
+			continue;
+		}
+
+		words = loadShaderBlock(&texcoord[unit], addr);
+		if (texcoord == texcoordPass)
+			setInputRegister(addr, words, FGVS_SRC0_IDX_WORD,
+					FGVS_SRC0_IDX_SHIFT, input++);
+		else
+			setInputRegister(addr, words, FGVS_SRC1_IDX_WORD,
+					FGVS_SRC1_IDX_SHIFT, input++);
+		addr += words;
 	}
 
 	addr += loadShaderBlock(&vertexFooter, addr);
 
-	FGFP_BITFIELD_SET(ctx->compat.vsState.vs, VS_INVALID, 0);
-
 	ctx->compat.vertexShaders[slot].instrCount = (addr - start) / 4;
-	ctx->compat.vertexShaders[slot].state = ctx->compat.vsState;
 }
 
 void fimgCompatLoadVertexShader(fimgContext *ctx)
@@ -981,21 +1151,21 @@ void fimgCompatLoadVertexShader(fimgContext *ctx)
 	volatile uint32_t *reg;
 	struct shaderBlock blk;
 	uint32_t slot = ctx->compat.curVsNum;
-	struct fimgVertexShaderProgram *vs = &ctx->compat.vertexShaders[slot];
+	fimgShaderProgram *vs = &ctx->compat.vertexShaders[slot];
 #ifdef FIMG_DYNSHADER_DEBUG
 	LOGD("Loading optimized shader");
 #endif
 	reg = vsInstAddr(ctx, 0);
 	blk.data = SHADER_SLOT(ctx->compat.vshaderBuf, slot);
 	blk.len = vs->instrCount;
-	loadShaderBlock(&blk, reg);
+	fimgWriteBlockDone(ctx, reg, loadShaderBlock(&blk, reg));
 
 	setVertexShaderRange(ctx, 0, vs->instrCount - 1);
 #ifdef FIMG_DYNSHADER_DEBUG
 	LOGD("Loading const float");
 #endif
 	reg = (volatile uint32_t *)(ctx->base + FGVS_CFLOAT_START);
-	loadShaderBlock(&vertexConstFloat, reg);
+	fimgWriteBlockDone(ctx, reg, loadShaderBlock(&vertexConstFloat, reg));
 #ifdef FIMG_DYNSHADER_DEBUG
 	LOGD("Loaded pixel shader");
 #endif
@@ -1010,13 +1180,6 @@ void fimgCompatBuildPixelShader(fimgContext *ctx, uint32_t slot)
 #ifdef FIMG_DYNSHADER_DEBUG
 	LOGD("Loading pixel shader");
 #endif
-	if (!ctx->compat.pshaderBuf) {
-		ctx->compat.pshaderBuf = malloc(PS_CACHE_SIZE * MAX_INSTR * sizeof(fimgShaderInstruction));
-		if (!ctx->compat.pshaderBuf) {
-			LOGE("Failed to allocate memory for shader buffer, terminating.");
-			exit(1);
-		}
-	}
 	start = addr = SHADER_SLOT(ctx->compat.pshaderBuf, slot);
 
 #ifdef FIMG_DYNSHADER_DEBUG
@@ -1075,10 +1238,7 @@ void fimgCompatBuildPixelShader(fimgContext *ctx, uint32_t slot)
 #endif
 	instrCount = optimizeShader(start, addr);
 
-	FGFP_BITFIELD_SET(ctx->compat.psState.ps, PS_INVALID, 0);
-
 	ctx->compat.pixelShaders[slot].instrCount = instrCount;
-	ctx->compat.pixelShaders[slot].state = ctx->compat.psState;
 }
 
 void fimgCompatLoadPixelShader(fimgContext *ctx)
@@ -1086,21 +1246,21 @@ void fimgCompatLoadPixelShader(fimgContext *ctx)
 	volatile uint32_t *reg;
 	struct shaderBlock blk;
 	uint32_t slot = ctx->compat.curPsNum;
-	struct fimgPixelShaderProgram *ps = &ctx->compat.pixelShaders[slot];
+	fimgShaderProgram *ps = &ctx->compat.pixelShaders[slot];
 #ifdef FIMG_DYNSHADER_DEBUG
 	LOGD("Loading optimized shader");
 #endif
 	reg = psInstAddr(ctx, 0);
 	blk.data = SHADER_SLOT(ctx->compat.pshaderBuf, slot);
 	blk.len = ps->instrCount;
-	loadShaderBlock(&blk, reg);
+	fimgWriteBlockDone(ctx, reg, loadShaderBlock(&blk, reg));
 
 	setPixelShaderRange(ctx, 0, ps->instrCount - 1);
 #ifdef FIMG_DYNSHADER_DEBUG
 	LOGD("Loading const float");
 #endif
 	reg = (volatile uint32_t *)(ctx->base + FGPS_CFLOAT_START);
-	loadShaderBlock(&pixelConstFloat, reg);
+	fimgWriteBlockDone(ctx, reg, loadShaderBlock(&pixelConstFloat, reg));
 #ifdef FIMG_DYNSHADER_DEBUG
 	LOGD("Loaded pixel shader");
 #endif
@@ -1123,42 +1283,51 @@ void fimgCompatSetTextureFunc(fimgContext *ctx, uint32_t unit, fimgTexFunc func)
 		ctx->compat.psMask[unit] =
 				FGFP_TEX_MODE_MASK | FGFP_TEX_SWAP_MASK;
 	}
+
+	fimgCompatUpdateVSKey(&ctx->compat);
+	fimgCompatUpdatePSKey(&ctx->compat, unit);
 }
 
 void fimgCompatSetColorCombiner(fimgContext *ctx, uint32_t unit,
 							fimgCombFunc func)
 {
 	FGFP_BITFIELD_SET(ctx->compat.psState.tex[unit], TEX_COMBC_FUNC, func);
+	fimgCompatUpdatePSKey(&ctx->compat, unit);
 }
 
 void fimgCompatSetAlphaCombiner(fimgContext *ctx, uint32_t unit,
 							fimgCombFunc func)
 {
 	FGFP_BITFIELD_SET(ctx->compat.psState.tex[unit], TEX_COMBA_FUNC, func);
+	fimgCompatUpdatePSKey(&ctx->compat, unit);
 }
 
 void fimgCompatSetColorCombineArgSrc(fimgContext *ctx, uint32_t unit,
 					uint32_t arg, fimgCombArgSrc src)
 {
 	FGFP_BITFIELD_SET_IDX(ctx->compat.psState.tex[unit], TEX_COMBC_SRC, arg, src);
+	fimgCompatUpdatePSKey(&ctx->compat, unit);
 }
 
 void fimgCompatSetColorCombineArgMod(fimgContext *ctx, uint32_t unit,
 					uint32_t arg, fimgCombArgMod mod)
 {
 	FGFP_BITFIELD_SET_IDX(ctx->compat.psState.tex[unit], TEX_COMBC_MOD, arg, mod);
+	fimgCompatUpdatePSKey(&ctx->compat, unit);
 }
 
 void fimgCompatSetAlphaCombineArgSrc(fimgContext *ctx, uint32_t unit,
 					uint32_t arg, fimgCombArgSrc src)
 {
 	FGFP_BITFIELD_SET_IDX(ctx->compat.psState.tex[unit], TEX_COMBA_SRC, arg, src);
+	fimgCompatUpdatePSKey(&ctx->compat, unit);
 }
 
 void fimgCompatSetAlphaCombineArgMod(fimgContext *ctx, uint32_t unit,
 					uint32_t arg, fimgCombArgMod mod)
 {
 	FGFP_BITFIELD_SET_IDX(ctx->compat.psState.tex[unit], TEX_COMBA_MOD, arg, mod & 1);
+	fimgCompatUpdatePSKey(&ctx->compat, unit);
 }
 
 void fimgCompatSetColorScale(fimgContext *ctx, uint32_t unit, float scale)
@@ -1191,9 +1360,12 @@ void fimgCompatSetEnvColor(fimgContext *ctx, uint32_t unit,
 void fimgCompatSetupTexture(fimgContext *ctx, fimgTexture *tex, uint32_t unit)
 {
 	ctx->compat.texture[unit].texture = tex;
-	if (tex)
-		FGFP_BITFIELD_SET(ctx->compat.psState.tex[unit],
+	if (!tex)
+		return;
+
+	FGFP_BITFIELD_SET(ctx->compat.psState.tex[unit],
 				TEX_SWAP, !!(tex->reserved2 & FGTU_TEX_BGR));
+	fimgCompatUpdatePSKey(&ctx->compat, unit);
 }
 
 void fimgCreateCompatContext(fimgContext *ctx)
@@ -1230,15 +1402,16 @@ void fimgCreateCompatContext(fimgContext *ctx)
 		ctx->compat.psState.tex[unit] = reg;
 	}
 
-	for (unit = 0; unit < VS_CACHE_SIZE; ++unit)
-		FGFP_BITFIELD_SET(ctx->compat.vertexShaders[unit].state.vs,
-								VS_INVALID, 1);
+	ctx->compat.psMask[FIMG_NUM_TEXTURE_UNITS] = 0xffffffff;
 
-	for (unit = 0; unit < PS_CACHE_SIZE; ++unit)
-		FGFP_BITFIELD_SET(ctx->compat.pixelShaders[unit].state.ps,
-								PS_INVALID, 1);
+	ctx->compat.vsHash = fimgHashShaderKey(ctx->compat.vsKey);
+	fimgCompatUpdateVSKey(&ctx->compat);
+	ctx->compat.vsDirty = 1;
 
-	ctx->compat.psMask[FIMG_NUM_TEXTURE_UNITS] = 0xffffffff;
+	ctx->compat.psHash = fimgHashShaderKey(ctx->compat.psKey);
+	for (unit = 0; unit < FGFP_SHADER_KEY_WORDS; ++unit)
+		fimgCompatUpdatePSKey(&ctx->compat, unit);
+	ctx->compat.psDirty = 1;
 }
 
 #define FGFP_TEXENV(unit)	(4 + 2*(unit))
@@ -1274,6 +1447,7 @@ static void loadPSConstFloat(fimgContext *ctx, const float *pfData,
 	*(reg++) = *(data++);
 	*(reg++) = *(data++);
 #endif
+	fimgWriteBlockDone(ctx, reg - 4, 4);
 }
 
 static void loadVSMatrix(fimgContext *ctx, const float *pfData, uint32_t slot)
@@ -1296,126 +1470,286 @@ static void loadVSMatrix(fimgContext *ctx, const float *pfData, uint32_t slot)
 		*(reg++) = *(data++);
 #endif
 	}
+	fimgWriteBlockDone(ctx, reg - 16, 16);
 }
 
-static int compareVertexShaders(fimgContext *ctx,
-			fimgVertexShaderState *a, fimgVertexShaderState *b)
+static void loadVSConstFloat(fimgContext *ctx, const float *pfData,
+								uint32_t slot)
 {
-	return a->val[0] != b->val[0];
+	const uint32_t *data = (const uint32_t *)pfData;
+	volatile uint32_t *reg = (volatile uint32_t *)(ctx->base
+						+ FGVS_CFLOAT_START + 16*slot);
+
+	*(reg++) = *(data++);
+	*(reg++) = *(data++);
+	*(reg++) = *(data++);
+	*(reg++) = *(data++);
+
+	fimgWriteBlockDone(ctx, reg - 4, 4);
 }
 
-#define NELEM(i)	(sizeof(i)/sizeof(*i))
+/*
+ * Uploads matrix, unless the registers already hold its value. Matrices
+ * are often recomputed without actually changing (e.g. after popping
+ * the matrix pushed before drawing), so comparing 16 words in memory
+ * saves writes to the (much slower) constant register file.
+ */
+static void loadMatrix(fimgContext *ctx, uint32_t matrix)
+{
+	float *cur = ctx->compat.matrixValue[matrix];
+	const float *value = ctx->compat.matrix[matrix];
+
+	if (ctx->compat.matrixValid[matrix]
+	    && !memcmp(cur, value, sizeof(ctx->compat.matrixValue[0])))
+		return;
+
+	memcpy(cur, value, sizeof(ctx->compat.matrixValue[0]));
+	loadVSMatrix(ctx, cur, 4*matrix);
+	ctx->compat.matrixValid[matrix] = 1;
+}
 
-static int comparePixelShaders(fimgContext *ctx,
-			fimgPixelShaderState *a, fimgPixelShaderState *b)
+/* Uploads constant attribute, unless the registers already hold its value */
+static void loadAttribConst(fimgContext *ctx, uint32_t attrib,
+							const float *value)
 {
-	unsigned int i;
+	float *cur = ctx->compat.attribConstValue[attrib];
 
-	for (i = 0; i < NELEM(a->val); ++i)
-		if ((a->val[i] ^ b->val[i]) & ctx->compat.psMask[i])
-			return 1;
+	if (!ctx->compat.attribConstDirty[attrib]
+	    && !memcmp(cur, value, sizeof(ctx->compat.attribConstValue[0])))
+		return;
 
-	return 0;
+	memcpy(cur, value, sizeof(ctx->compat.attribConstValue[0]));
+	loadVSConstFloat(ctx, cur, FGVS_ATTRIB_CONST(attrib));
+	ctx->compat.attribConstDirty[attrib] = 0;
 }
 
-static void validateVertexShader(fimgContext *ctx)
+/*
+ * Texture coordinates do not change across the primitive, so they are
+ * transformed once here instead of for every vertex by the shader.
+ */
+static void transformTexCoord(float *out, const float *m, const float *in)
 {
-	unsigned int i;
-	int ret;
-#ifdef FIMG_SHADER_CACHE_STATS
-	if (++ctx->compat.vsStatsCounter == 128) {
-		LOGD("Vertex shader cache stats:");
-		LOGD("Same hits: %d\n", ctx->compat.vsSameHits);
-		LOGD("Cache hits: %d\n", ctx->compat.vsCacheHits);
-		LOGD("Misses: %d\n", ctx->compat.vsMisses);
-		ctx->compat.vsSameHits = 0;
-		ctx->compat.vsCacheHits = 0;
-		ctx->compat.vsMisses = 0;
-		ctx->compat.vsStatsCounter = 0;
-	}
-#endif
-	ret = compareVertexShaders(ctx, &ctx->compat.vsState,
-			&ctx->compat.vertexShaders[ctx->compat.curVsNum].state);
-	if (!ret) {
-#ifdef FIMG_SHADER_CACHE_STATS
-		++ctx->compat.vsSameHits;
-#endif
+	uint32_t i;
+
+	if (!m) {
+		memcpy(out, in, 4*sizeof(float));
 		return;
 	}
 
-	ctx->compat.vshaderLoaded = 0;
+	for (i = 0; i < 4; ++i)
+		out[i] = m[i]*in[0] + m[4 + i]*in[1]
+					+ m[8 + i]*in[2] + m[12 + i]*in[3];
+}
 
-	for (i = 0; i < VS_CACHE_SIZE; ++i) {
-		if (i == ctx->compat.curVsNum)
+static void loadAttribConsts(fimgContext *ctx)
+{
+	uint32_t vs = ctx->compat.vsState.vs;
+	int bypass = FGFP_BITFIELD_GET(vs, VS_BYPASS);
+	uint32_t unit;
+	float coord[4];
+
+	if (FGFP_BITFIELD_GET(vs, VS_COLOR_CONST))
+		loadAttribConst(ctx, FGFP_ATTRIB_COLOR,
+				ctx->compat.attribConst[FGFP_ATTRIB_COLOR]);
+
+	for (unit = 0; unit < FIMG_NUM_TEXTURE_UNITS; ++unit) {
+		if (!FGFP_BITFIELD_GET_IDX(vs, VS_TEX_EN, unit))
 			continue;
-		ret = compareVertexShaders(ctx, &ctx->compat.vsState,
-					&ctx->compat.vertexShaders[i].state);
-		if (!ret) {
-#ifdef FIMG_SHADER_CACHE_STATS
-			++ctx->compat.vsCacheHits;
-#endif
-			ctx->compat.curVsNum = i;
-			return;
+
+		if (!FGFP_BITFIELD_GET_IDX(vs, VS_TEX_CONST, unit))
+			continue;
+
+		transformTexCoord(coord, bypass ? NULL :
+			ctx->compat.matrix[FGFP_MATRIX_TEXTURE(unit)],
+			ctx->compat.attribConst[FGFP_ATTRIB_TEXTURE(unit)]);
+		loadAttribConst(ctx, FGFP_ATTRIB_TEXTURE(unit), coord);
+	}
+}
+
+/*
+ * Shader variants are looked up in the small per-context cache first.
+ * On a miss, the variant is copied from process-wide cache or generated
+ * and then stored there for other contexts.
+ *
+ * Setters keep the key (masked shader state) and its hash up to date and
+ * mark the state dirty only when the key actually changes, so validation
+ * is free if nothing changed since previous draw. Otherwise the hash
+ * selects a pair of slots of the per-context cache, the less recently
+ * used of them being replaced on a miss.
+ */
+static inline uint32_t programSet(uint32_t hash, uint32_t size)
+{
+	return (hash ^ (hash >> 16)) % (size / 2);
+}
+
+static inline void touchProgram(uint32_t *lruWays, uint32_t slot)
+{
+	uint32_t set = slot / 2;
+
+	/* Bit of each set tells which way is the less recently used one */
+	*lruWays &= ~(1 << set);
+	*lruWays |= (~slot & 1) << set;
+}
+
+static inline int matchProgram(const fimgShaderProgram *prog,
+				const uint32_t *key, uint32_t hash)
+{
+	return prog->instrCount && prog->hash == hash
+		&& !memcmp(prog->key, key, sizeof(prog->key));
+}
+
+/* Returns slot holding matching program or -1 */
+static int findProgram(fimgShaderProgram *progs, uint32_t size,
+		uint32_t *lruWays, const uint32_t *key, uint32_t hash)
+{
+	uint32_t slot = 2 * programSet(hash, size);
+	uint32_t way;
+
+	for (way = 0; way < 2; ++way, ++slot) {
+		if (matchProgram(&progs[slot], key, hash)) {
+			touchProgram(lruWays, slot);
+			return slot;
 		}
 	}
-#ifdef FIMG_SHADER_CACHE_STATS
-	++ctx->compat.vsMisses;
-#endif
-	i = ctx->compat.vsEvictCounter++;
-	ctx->compat.vsEvictCounter %= VS_CACHE_SIZE;
 
-	fimgCompatBuildVertexShader(ctx, i);
-	ctx->compat.curVsNum = i;
+	return -1;
+}
+
+/* Returns slot to be replaced by program with given hash */
+static uint32_t evictProgram(fimgShaderProgram *progs, uint32_t size,
+				uint32_t *lruWays, const uint32_t *key, uint32_t hash)
+{
+	uint32_t set = programSet(hash, size);
+	uint32_t slot = 2 * set + ((*lruWays >> set) & 1);
+
+	touchProgram(lruWays, slot);
+	progs[slot].hash = hash;
+	memcpy(progs[slot].key, key, sizeof(progs[slot].key));
+
+	return slot;
+}
+
+static void validateVertexShader(fimgContext *ctx)
+{
+	fimgCompatContext *compat = &ctx->compat;
+	uint32_t instrCount;
+	int slot;
+
+	if (!compat->vsDirty
+	    || matchProgram(&compat->vertexShaders[compat->curVsNum],
+					compat->vsKey, compat->vsHash)) {
+		compat->vsDirty = 0;
+		++compat->vsStats.sameHits;
+		return;
+	}
+
+	compat->vsDirty = 0;
+	compat->vshaderLoaded = 0;
+
+	slot = findProgram(compat->vertexShaders, VS_CACHE_SIZE,
+			&compat->vsLruWays, compat->vsKey, compat->vsHash);
+	if (slot >= 0) {
+		++compat->vsStats.contextHits;
+		compat->curVsNum = slot;
+		return;
+	}
+
+	if (unlikely(!compat->vshaderBuf))
+		compat->vshaderBuf = allocShaderBuf(VS_CACHE_SIZE);
+
+	slot = evictProgram(compat->vertexShaders, VS_CACHE_SIZE,
+			&compat->vsLruWays, compat->vsKey, compat->vsHash);
+	compat->curVsNum = slot;
+
+	instrCount = fimgShaderCacheLookup(FGFP_SHADER_VERTEX,
+				compat->vsKey, compat->vsHash,
+				SHADER_SLOT(compat->vshaderBuf, slot));
+	if (instrCount) {
+		++compat->vsStats.sharedHits;
+		compat->vertexShaders[slot].instrCount = instrCount;
+		return;
+	}
+
+	++compat->vsStats.misses;
+	fimgCompatBuildVertexShader(ctx, slot);
+	fimgShaderCacheInsert(FGFP_SHADER_VERTEX,
+				compat->vsKey, compat->vsHash,
+				SHADER_SLOT(compat->vshaderBuf, slot),
+				compat->vertexShaders[slot].instrCount);
 }
 
 static void validatePixelShader(fimgContext *ctx)
 {
-	unsigned int i;
-	int ret;
-#ifdef FIMG_SHADER_CACHE_STATS
-	if (++ctx->compat.psStatsCounter == 128) {
-		LOGD("Pixel shader cache stats:");
-		LOGD("Same hits: %d\n", ctx->compat.psSameHits);
-		LOGD("Cache hits: %d\n", ctx->compat.psCacheHits);
-		LOGD("Misses: %d\n", ctx->compat.psMisses);
-		ctx->compat.psSameHits = 0;
-		ctx->compat.psCacheHits = 0;
-		ctx->compat.psMisses = 0;
-		ctx->compat.psStatsCounter = 0;
+	fimgCompatContext *compat = &ctx->compat;
+	uint32_t instrCount;
+	int slot;
+
+	if (!compat->psDirty
+	    || matchProgram(&compat->pixelShaders[compat->curPsNum],
+					compat->psKey, compat->psHash)) {
+		compat->psDirty = 0;
+		++compat->psStats.sameHits;
+		return;
 	}
-#endif
-	ret = comparePixelShaders(ctx, &ctx->compat.psState,
-			&ctx->compat.pixelShaders[ctx->compat.curPsNum].state);
-	if (!ret) {
-#ifdef FIMG_SHADER_CACHE_STATS
-		++ctx->compat.psSameHits;
-#endif
+
+	compat->psDirty = 0;
+	compat->pshaderLoaded = 0;
+
+	slot = findProgram(compat->pixelShaders, PS_CACHE_SIZE,
+			&compat->psLruWays, compat->psKey, compat->psHash);
+	if (slot >= 0) {
+		++compat->psStats.contextHits;
+		compat->curPsNum = slot;
 		return;
 	}
 
-	ctx->compat.pshaderLoaded = 0;
+	if (unlikely(!compat->pshaderBuf))
+		compat->pshaderBuf = allocShaderBuf(PS_CACHE_SIZE);
 
-	for (i = 0; i < PS_CACHE_SIZE; ++i) {
-		if (i == ctx->compat.curPsNum)
-			continue;
-		ret = comparePixelShaders(ctx, &ctx->compat.psState,
-					&ctx->compat.pixelShaders[i].state);
-		if (!ret) {
-#ifdef FIMG_SHADER_CACHE_STATS
-			++ctx->compat.psCacheHits;
-#endif
-			ctx->compat.curPsNum = i;
-			return;
-		}
+	slot = evictProgram(compat->pixelShaders, PS_CACHE_SIZE,
+			&compat->psLruWays, compat->psKey, compat->psHash);
+	compat->curPsNum = slot;
+
+	instrCount = fimgShaderCacheLookup(FGFP_SHADER_PIXEL,
+				compat->psKey, compat->psHash,
+				SHADER_SLOT(compat->pshaderBuf, slot));
+	if (instrCount) {
+		++compat->psStats.sharedHits;
+		compat->pixelShaders[slot].instrCount = instrCount;
+		return;
 	}
-#ifdef FIMG_SHADER_CACHE_STATS
-	++ctx->compat.psMisses;
-#endif
-	i = ctx->compat.psEvictCounter++;
-	ctx->compat.psEvictCounter %= PS_CACHE_SIZE;
 
-	fimgCompatBuildPixelShader(ctx, i);
-	ctx->compat.curPsNum = i;
+	++compat->psStats.misses;
+	fimgCompatBuildPixelShader(ctx, slot);
+	fimgShaderCacheInsert(FGFP_SHADER_PIXEL,
+				compat->psKey, compat->psHash,
+				SHADER_SLOT(compat->pshaderBuf, slot),
+				compat->pixelShaders[slot].instrCount);
+}
+
+/*****************************************************************************
+ * FUNCTIONS:	fimgCompatGetShaderCacheStats
+ * SYNOPSIS:	This function retrieves shader cache hit/miss counters
+ *		of the context
+ * PARAMETERS:	[OUT] vs - vertex shader counters
+ *		[OUT] ps - pixel shader counters
+ *****************************************************************************/
+void fimgCompatGetShaderCacheStats(fimgContext *ctx,
+		fimgShaderCacheStats *vs, fimgShaderCacheStats *ps)
+{
+	*vs = ctx->compat.vsStats;
+	*ps = ctx->compat.psStats;
+}
+
+/*****************************************************************************
+ * FUNCTIONS:	fimgCompatResetShaderCacheStats
+ * SYNOPSIS:	This function clears shader cache hit/miss counters
+ *		of the context
+ *****************************************************************************/
+void fimgCompatResetShaderCacheStats(fimgContext *ctx)
+{
+	memset(&ctx->compat.vsStats, 0, sizeof(ctx->compat.vsStats));
+	memset(&ctx->compat.psStats, 0, sizeof(ctx->compat.psStats));
 }
 
 void fimgCompatFlush(fimgContext *ctx)
@@ -1434,10 +1768,12 @@ void fimgCompatFlush(fimgContext *ctx)
 		if (!ctx->compat.matrixDirty[i] || ctx->compat.matrix[i] == NULL)
 			continue;
 
-		loadVSMatrix(ctx, ctx->compat.matrix[i], 4*i);
+		loadMatrix(ctx, i);
 		ctx->compat.matrixDirty[i] = 0;
 	}
 
+	loadAttribConsts(ctx);
+
 	validatePixelShader(ctx);
 	if (!ctx->compat.pshaderLoaded) {
 		setPixelShaderState(ctx, 0);
@@ -1481,12 +1817,65 @@ void fimgRestoreCompatState(fimgContext *ctx)
 {
 	uint32_t i;
 
-	for (i = 0; i < 2 + FIMG_NUM_TEXTURE_UNITS; i++)
+	for (i = 0; i < 2 + FIMG_NUM_TEXTURE_UNITS; i++) {
 		ctx->compat.matrixDirty[i] = 1;
+		ctx->compat.matrixValid[i] = 0;
+	}
 
 	for (i = 0; i < FIMG_NUM_TEXTURE_UNITS; i++)
 		ctx->compat.texture[i].dirty = 1;
 
+	for (i = 0; i < FGFP_ATTRIB_NUM; i++)
+		ctx->compat.attribConstDirty[i] = 1;
+
 	ctx->compat.vshaderLoaded = 0;
 	ctx->compat.pshaderLoaded = 0;
 }
+
+/*****************************************************************************
+ * FUNCTIONS:	fimgCompatSaveState
+ * SYNOPSIS:	This function saves shader state selected by the user, so
+ *		the library can draw with its own state in between.
+ * PARAMETERS:	[OUT] state - structure to store the state in
+ *****************************************************************************/
+void fimgCompatSaveState(fimgContext *ctx, fimgCompatState *state)
+{
+	state->vsState = ctx->compat.vsState;
+	state->psState = ctx->compat.psState;
+	memcpy(state->psMask, ctx->compat.psMask, sizeof(state->psMask));
+	memcpy(state->matrix, ctx->compat.matrix, sizeof(state->matrix));
+	memcpy(state->attribConst, ctx->compat.attribConst,
+						sizeof(state->attribConst));
+}
+
+/*****************************************************************************
+ * FUNCTIONS:	fimgCompatLoadState
+ * SYNOPSIS:	This function brings back shader state saved with
+ *		fimgCompatSaveState. Only matrices replaced in the meantime
+ *		are reloaded.
+ * PARAMETERS:	[IN] state - previously saved state
+ *****************************************************************************/
+void fimgCompatLoadState(fimgContext *ctx, const fimgCompatState *state)
+{
+	uint32_t i;
+
+	ctx->compat.vsState = state->vsState;
+	fimgCompatUpdateVSKey(&ctx->compat);
+
+	ctx->compat.psState = state->psState;
+	memcpy(ctx->compat.psMask, state->psMask, sizeof(state->psMask));
+	for (i = 0; i < FIMG_NUM_TEXTURE_UNITS + 1; i++)
+		fimgCompatUpdatePSKey(&ctx->compat, i);
+
+	for (i = 0; i < 2 + FIMG_NUM_TEXTURE_UNITS; i++) {
+		if (ctx->compat.matrix[i] == state->matrix[i])
+			continue;
+
+		ctx->compat.matrix[i] = state->matrix[i];
+		ctx->compat.matrixDirty[i] = 1;
+	}
+
+	/* Constant values are compared before being loaded anyway */
+	memcpy(ctx->compat.attribConst, state->attribConst,
+						sizeof(state->attribConst));
+}
@@ -28,6 +28,9 @@
 /* Use fixed pipeline emulation */
 #define FIMG_FIXED_PIPELINE
 
+/* Number of vertex batches that can be packed ahead of the hardware */
+#define FIMG_VERTEX_BATCHES	4
+
 /* Dump register state before sending draw request (for debugging) */
 //#define FIMG_DUMP_STATE_BEFORE_DRAW
 
@@ -43,13 +46,46 @@
 /* Check for hardware lock before register access */
 //#define FIMG_DEBUG_HW_LOCK
 
+/*
+ * Keep hardware lock across consecutive draws. Leases are ended by
+ * a watchdog thread as well, see fimgLeaseHardware().
+ */
+#define FIMG_HW_LOCK_LEASE
+
+/* Maximum number of draws and time (in us) of a single lease */
+#define FIMG_HW_LOCK_LEASE_DRAWS	256
+#define FIMG_HW_LOCK_LEASE_TIME		4000
+
+/* Range of register polls before sleeping or yielding in hardware waits */
+#define FIMG_WAIT_POLLS_MIN	8
+#define FIMG_WAIT_POLLS_MAX	256
+
+/* Time (in ms) after which waiting for a cache operation is given up */
+#define FIMG_WAIT_TIMEOUT	1000
+
+/* Log statistics of hardware waits when destroying a context */
+//#define FIMG_WAIT_STATS_DEBUG
+
 /* Dump generated shaders */
 //#define FIMG_DYNSHADER_DEBUG
 
-/* Show shader cache hit/miss statistics in log */
-//#define FIMG_SHADER_CACHE_STATS
+/* Number of shader variants in cache shared by all contexts of a process */
+#define FIMG_SHADER_CACHE_SIZE	64
+
+/*
+ * Keep shader cache in a file per user in given directory. The directory
+ * must be writable by all GL clients and sticky (like /tmp), so users
+ * cannot replace files of each other.
+ */
+//#define FIMG_SHADER_CACHE_DIR	"/data/fimg"
 
 /* Disable shader optimizer */
 //#define FIMG_BYPASS_SHADER_OPTIMIZER
 
+/* Use in-process register model instead of the G3D device (for profiling) */
+//#define FIMG_SOFTWARE_MODEL
+
+/* Number of register writes kept in the software model log */
+#define FIMG_MODEL_LOG_SIZE	65536
+
 #endif /* _FIMG_CONFIG_H_ */
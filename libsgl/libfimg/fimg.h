@@ -74,6 +74,39 @@ int fimgFlushCache(fimgContext *ctx,
 int fimgWaitForCacheFlush(fimgContext *ctx,
 				unsigned int ccflush, unsigned int zcflush);
 void fimgFinish(fimgContext *ctx);
+
+/* Kinds of waits for the hardware */
+enum {
+	FIMG_WAIT_PIPELINE = 0,		/* pipeline becoming idle */
+	FIMG_WAIT_CACHE_FLUSH,		/* color and depth cache flush */
+	FIMG_WAIT_CACHE_CLEAR,		/* texture and vertex cache clear */
+
+	FIMG_NUM_WAITS
+};
+
+/* Bucket i counts waits of [2^i, 2^(i + 1)) us (first one below 2 us) */
+#define FIMG_WAIT_HIST_BUCKETS	16
+
+typedef struct {
+	uint32_t	waits;		/* waits that found the hardware busy */
+	uint32_t	sleeps;		/* waits not finished by polling */
+	uint32_t	timeouts;
+	uint32_t	maxTime;	/* longest wait in us */
+	uint64_t	totalTime;	/* in us */
+	uint32_t	hist[FIMG_WAIT_HIST_BUCKETS];
+} fimgWaitStats;
+
+void fimgGetWaitStats(fimgContext *ctx, unsigned int wait,
+						fimgWaitStats *stats);
+void fimgResetWaitStats(fimgContext *ctx);
+
+typedef uint32_t fimgFence;
+
+fimgFence fimgCreateFence(fimgContext *ctx);
+int fimgFenceExpired(fimgFence fence);
+int fimgFenceSignaled(fimgContext *ctx, fimgFence fence);
+void fimgWaitFence(fimgContext *ctx, fimgFence fence);
+
 void fimgSoftReset(fimgContext *ctx);
 void fimgGetVersion(fimgContext *ctx, int *major, int *minor, int *rev);
 unsigned int fimgGetInterrupt(fimgContext *ctx);
@@ -223,6 +256,7 @@ int fimgLoadPShader(fimgContext *ctx,
  */
 
 #define FGTU_MAX_MIPMAP_LEVEL	11
+#define FGTU_MAX_PALETTE_SIZE	256
 
 /* Type definitions */
 enum {
@@ -311,6 +345,8 @@ void fimgInitTexture(fimgTexture *texture, unsigned int flags,
 void fimgSetTexMipmapOffset(fimgTexture *texture, unsigned int level,
 						unsigned int offset);
 unsigned int fimgGetTexMipmapOffset(fimgTexture *texture, unsigned level);
+int fimgSetTexPalette(fimgTexture *texture, unsigned int format,
+			const uint32_t *entries, unsigned int count);
 void fimgSetupTexture(fimgContext *ctx, fimgTexture *texture, unsigned unit);
 void fimgSetTexMipmapLevel(fimgTexture *texture, int level);
 void fimgSetTexBaseAddr(fimgTexture *texture, unsigned int addr);
@@ -342,6 +378,13 @@ typedef enum {
 } fimgMatrix;
 #define FGFP_MATRIX_TEXTURE(i)	(FGFP_MATRIX_TEXTURE + (i))
 
+typedef enum {
+	FGFP_ATTRIB_COLOR = 0,
+	FGFP_ATTRIB_TEXTURE
+} fimgCompatAttrib;
+#define FGFP_ATTRIB_TEXTURE(i)	(FGFP_ATTRIB_TEXTURE + (i))
+#define FGFP_ATTRIB_NUM		(FGFP_ATTRIB_TEXTURE(FIMG_NUM_TEXTURE_UNITS))
+
 typedef enum {
 	FGFP_TEXFUNC_NONE = 0,
 	FGFP_TEXFUNC_REPLACE,
@@ -378,6 +421,9 @@ typedef enum {
 } fimgCombArgMod;
 
 void fimgLoadMatrix(fimgContext *ctx, unsigned int matrix, const float *pData);
+void fimgCompatSetAttribConst(fimgContext *ctx, unsigned int attrib,
+							const float *value);
+void fimgCompatSetTransformBypass(fimgContext *ctx, int bypass);
 void fimgEnableTexture(fimgContext *ctx, unsigned int unit);
 void fimgDisableTexture(fimgContext *ctx, unsigned int unit);
 void fimgCompatLoadPixelShader(fimgContext *ctx);
@@ -400,6 +446,31 @@ void fimgCompatSetEnvColor(fimgContext *ctx, unsigned unit,
 					float r, float g, float b, float a);
 void fimgCompatSetupTexture(fimgContext *ctx, fimgTexture *tex, uint32_t unit);
 
+typedef struct {
+	unsigned int sameHits;		/* same shader as in previous draw */
+	unsigned int contextHits;	/* found in per-context cache */
+	unsigned int sharedHits;	/* found in process-wide cache */
+	unsigned int misses;		/* generated */
+} fimgShaderCacheStats;
+
+void fimgCompatGetShaderCacheStats(fimgContext *ctx,
+		fimgShaderCacheStats *vs, fimgShaderCacheStats *ps);
+void fimgCompatResetShaderCacheStats(fimgContext *ctx);
+
+/*
+ * Buffer clear
+ */
+
+enum {
+	FIMG_CLEAR_COLOR	= (1 << 0),
+	FIMG_CLEAR_DEPTH	= (1 << 1),
+	FIMG_CLEAR_STENCIL	= (1 << 2),
+	FIMG_CLEAR_ALL		= (1 << 3) - 1
+};
+
+void fimgClear(fimgContext *ctx, unsigned int buffers,
+			const float *color, float depth, unsigned char stencil);
+
 #endif
 
 /*
@@ -572,14 +643,66 @@ enum {
  * OS support
  */
 
+/* Type definitions */
+typedef struct {
+	uint32_t	frames;
+	uint32_t	restores;	/* state restores after losing hardware */
+	uint32_t	locks;		/* hardware lock acquisitions */
+	uint32_t	regWrites;	/* single register writes in last frame */
+	uint32_t	blockWords;	/* words written in blocks in last frame */
+	uint32_t	maxRegWrites;	/* highest regWrites seen */
+	uint64_t	totalRegWrites;
+	uint64_t	totalBlockWords;
+} fimgRegisterStats;
+
+/* Functions */
 fimgContext *fimgCreateContext(void);
 void fimgDestroyContext(fimgContext *ctx);
 void fimgRestoreContext(fimgContext *ctx);
 int fimgAcquireHardwareLock(fimgContext *ctx);
 int fimgReleaseHardwareLock(fimgContext *ctx);
+void fimgReleaseHardware(fimgContext *ctx);
 int fimgDeviceOpen(fimgContext *ctx);
 void fimgDeviceClose(fimgContext *ctx);
 int fimgWaitForFlush(fimgContext *ctx, uint32_t target);
+void fimgEndFrame(fimgContext *ctx);
+void fimgGetRegisterStats(fimgContext *ctx, fimgRegisterStats *stats);
+void fimgResetRegisterStats(fimgContext *ctx);
+
+/*
+ * Software model
+ */
+
+#ifdef FIMG_SOFTWARE_MODEL
+
+/* Type definitions */
+typedef struct {
+	uint64_t	regWrites;
+	uint64_t	blockWrites;
+	uint64_t	vbWords;
+	uint64_t	fifoWords;
+	uint64_t	shaderWords;
+	uint64_t	constWords;
+	uint32_t	draws;
+	uint32_t	locks;
+	uint32_t	unlocks;
+	uint32_t	flushes;
+} fimgModelStats;
+
+typedef struct {
+	uint64_t	time;
+	uint32_t	addr;
+	uint32_t	data;
+} fimgModelRecord;
+
+/* Functions */
+void fimgModelGetStats(fimgContext *ctx, fimgModelStats *stats);
+void fimgModelResetStats(fimgContext *ctx);
+unsigned int fimgModelGetLog(fimgContext *ctx,
+				fimgModelRecord *buf, unsigned int max);
+int fimgModelDumpLog(fimgContext *ctx, const char *path);
+
+#endif
 
 //=============================================================================
 
@@ -23,9 +23,12 @@
 #define _FIMG_PRIVATE_H_
 
 /* Include public part */
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <pthread.h>
+#include <time.h>
 #include "platform.h"
 #include "fimg.h"
 
@@ -34,6 +37,18 @@
 #define likely(x)       __builtin_expect((x),1)
 #define unlikely(x)     __builtin_expect((x),0)
 
+#define FIMG_SFR_SIZE	0x80000
+
+/* Monotonic time in ns */
+static inline uint64_t fimgGetTimestamp(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 /*
  * Global block
  */
@@ -363,31 +378,65 @@ struct _fimgTexture {
 	unsigned int baseAddr;
 	unsigned int reserved1;
 	unsigned int reserved2;
+	/* Palette of indexed formats, not a part of the register image */
+	uint32_t *palette;
+	unsigned int paletteSize;
+	unsigned int paletteStamp;
 };
 
+/* Number of texture unit registers mirrored by fimgTexture */
+#define FGTU_TEX_REG_COUNT	(offsetof(fimgTexture, palette) / 4)
+
 /*
  * Hardware context
  */
 
+typedef struct {
+	unsigned int polls;
+	fimgWaitStats stats;
+} fimgWaitState;
+
 typedef struct {
 	unsigned int intEn;
 	unsigned int intMask;
 	unsigned int intTarget;
+	fimgWaitState wait[FIMG_NUM_WAITS];
 } fimgGlobalContext;
 
 void fimgCreateGlobalContext(fimgContext *ctx);
 void fimgRestoreGlobalState(fimgContext *ctx);
+void fimgSubmitFence(fimgContext *ctx);
+#ifdef FIMG_WAIT_STATS_DEBUG
+void fimgDumpWaitStats(fimgContext *ctx);
+#endif
 
 typedef struct {
 	fimgAttribute attrib[FIMG_ATTRIB_NUM];
-	fimgVtxBufAttrib vbctrl[FIMG_ATTRIB_NUM];
-	unsigned int vbbase[FIMG_ATTRIB_NUM];
 	fimgHInterface control;
 	unsigned int indexOffset;
 } fimgHostContext;
 
+typedef void (*fimgPackFunc)(uint32_t *buf, const fimgArray *a,
+				const void *indices, uint32_t pos, uint32_t cnt);
+
+typedef struct {
+	unsigned int idxType;
+	unsigned int numAttribs;
+	uint32_t layout[FIMG_ATTRIB_NUM];
+	uint32_t align;
+	unsigned int batchSize;
+	fimgPackFunc pack[FIMG_ATTRIB_NUM];
+} fimgPackCache;
+
+typedef struct {
+	uint8_t *data;
+	size_t size;
+	unsigned int count;
+	fimgVtxBufAttrib vbctrl[FIMG_ATTRIB_NUM];
+	unsigned int vbbase[FIMG_ATTRIB_NUM];
+} fimgVertexBatch;
+
 void fimgCreateHostContext(fimgContext *ctx);
-void fimgRestoreHostState(fimgContext *ctx);
 
 typedef struct {
 	fimgVertexContext vctx;
@@ -400,7 +449,6 @@ typedef struct {
 } fimgPrimitiveContext;
 
 void fimgCreatePrimitiveContext(fimgContext *ctx);
-void fimgRestorePrimitiveState(fimgContext *ctx);
 
 typedef struct {
 	unsigned int samplePos;
@@ -419,7 +467,6 @@ typedef struct {
 } fimgRasterizerContext;
 
 void fimgCreateRasterizerContext(fimgContext *ctx);
-void fimgRestoreRasterizerState(fimgContext *ctx);
 
 typedef struct {
 	fimgScissorTestData scY;
@@ -440,7 +487,34 @@ typedef struct {
 } fimgFragmentContext;
 
 void fimgCreateFragmentContext(fimgContext *ctx);
-void fimgRestoreFragmentState(fimgContext *ctx);
+
+/*
+ * Register shadow
+ *
+ * State registers set through fimgQueue are kept in per-block shadow
+ * register files. Only registers marked dirty are written to hardware
+ * on flush and losing the hardware just marks all known registers dirty.
+ */
+
+enum {
+	FIMG_REGS_HOST = 0,	/* 0x08000 */
+	FIMG_REGS_PRIMITIVE,	/* 0x30000 */
+	FIMG_REGS_RASTER,	/* 0x38000 */
+	FIMG_REGS_RASTER_CLIP,	/* 0x3c000 */
+	FIMG_REGS_FRAGMENT,	/* 0x70000 */
+	FIMG_NUM_REG_BLOCKS
+};
+
+/* Maximum number of shadowed registers in a block */
+#define FIMG_REG_BLOCK_SIZE	16
+
+typedef struct {
+	uint32_t valid;		/* registers with known value */
+	uint32_t dirty;		/* registers to be written on next flush */
+	uint32_t val[FIMG_REG_BLOCK_SIZE];
+} fimgRegBlock;
+
+void fimgWriteDirtyRegisters(fimgContext *ctx);
 
 #ifdef FIMG_FIXED_PIPELINE
 
@@ -476,8 +550,6 @@ void fimgRestoreFragmentState(fimgContext *ctx);
 #define FGFP_TEX_COMBA_FUNC_MASK	(0x7 << 28)
 #define FGFP_PS_SWAP_SHIFT		(0)
 #define FGFP_PS_SWAP_MASK		(0x1 << 0)
-#define FGFP_PS_INVALID_SHIFT		(31)
-#define FGFP_PS_INVALID_MASK		(0x1 << 31)
 
 typedef union _fimgPixelShaderState {
 	uint32_t val[FIMG_NUM_TEXTURE_UNITS + 1];
@@ -489,8 +561,12 @@ typedef union _fimgPixelShaderState {
 
 #define FGFP_VS_TEX_EN_SHIFT(i)		(i)
 #define FGFP_VS_TEX_EN_MASK(i)		(0x1 << (i))
-#define FGFP_VS_INVALID_SHIFT		(31)
-#define FGFP_VS_INVALID_MASK		(0x1 << 31)
+#define FGFP_VS_COLOR_CONST_SHIFT	(2)
+#define FGFP_VS_COLOR_CONST_MASK	(0x1 << 2)
+#define FGFP_VS_TEX_CONST_SHIFT(i)	(3 + (i))
+#define FGFP_VS_TEX_CONST_MASK(i)	(0x1 << (3 + (i)))
+#define FGFP_VS_BYPASS_SHIFT		(5)
+#define FGFP_VS_BYPASS_MASK		(0x1 << 5)
 
 typedef union _fimgVertexShaderState {
 	uint32_t val[1];
@@ -506,62 +582,163 @@ typedef struct {
 	fimgTexture *texture;
 } fimgTextureCompat;
 
-typedef struct fimgPixelShaderProgram {
-	uint32_t instrCount;
-	fimgPixelShaderState state;
-} fimgPixelShaderProgram;
+/* Maximum length of generated shader */
+#define FGFP_MAX_INSTR		64
+/* Shader cache key, large enough for any shader state */
+#define FGFP_SHADER_KEY_WORDS	(FIMG_NUM_TEXTURE_UNITS + 1)
 
-typedef struct fimgVertexShaderProgram {
-	uint32_t instrCount;
-	fimgVertexShaderState state;
-} fimgVertexShaderProgram;
+typedef struct fimgShaderProgram {
+	uint32_t instrCount;	/* zero if the slot is unused */
+	uint32_t hash;
+	uint32_t key[FGFP_SHADER_KEY_WORDS];
+} fimgShaderProgram;
 
+/* Per-context caches are two-way set associative (sizes must be even) */
 #define VS_CACHE_SIZE	4
 #define PS_CACHE_SIZE	8
 
+enum {
+	FGFP_SHADER_VERTEX = 0,
+	FGFP_SHADER_PIXEL,
+	FGFP_SHADER_TYPES
+};
+
 typedef struct {
 	uint32_t		*vshaderBuf;
 	int			vshaderLoaded;
 	uint32_t		curVsNum;
-	uint32_t		vsEvictCounter;
+	uint32_t		vsLruWays;
 	fimgVertexShaderState	vsState;
-	fimgVertexShaderProgram	vertexShaders[VS_CACHE_SIZE];
-#ifdef FIMG_SHADER_CACHE_STATS
-	uint8_t			vsMisses;
-	uint8_t			vsSameHits;
-	uint8_t			vsCacheHits;
-	uint8_t			vsStatsCounter;
-#endif
+	int			vsDirty;
+	uint32_t		vsHash;
+	uint32_t		vsKey[FGFP_SHADER_KEY_WORDS];
+	fimgShaderProgram	vertexShaders[VS_CACHE_SIZE];
+	fimgShaderCacheStats	vsStats;
 
 	uint32_t		*pshaderBuf;
 	int			pshaderLoaded;
 	uint32_t		curPsNum;
-	uint32_t		psEvictCounter;
+	uint32_t		psLruWays;
 	uint32_t		psMask[FIMG_NUM_TEXTURE_UNITS + 1];
 	fimgPixelShaderState	psState;
-	fimgPixelShaderProgram	pixelShaders[PS_CACHE_SIZE];
-#ifdef FIMG_SHADER_CACHE_STATS
-	uint8_t			psMisses;
-	uint8_t			psSameHits;
-	uint8_t			psCacheHits;
-	uint8_t			psStatsCounter;
-#endif
+	int			psDirty;
+	uint32_t		psHash;
+	uint32_t		psKey[FGFP_SHADER_KEY_WORDS];
+	fimgShaderProgram	pixelShaders[PS_CACHE_SIZE];
+	fimgShaderCacheStats	psStats;
 
 	fimgTextureCompat	texture[FIMG_NUM_TEXTURE_UNITS];
 
 	int			matrixDirty[2 + FIMG_NUM_TEXTURE_UNITS];
 	const float		*matrix[2 + FIMG_NUM_TEXTURE_UNITS];
+	int			matrixValid[2 + FIMG_NUM_TEXTURE_UNITS];
+	float			matrixValue[2 + FIMG_NUM_TEXTURE_UNITS][16];
+
+	const float		*attribConst[FGFP_ATTRIB_NUM];
+	int			attribConstDirty[FGFP_ATTRIB_NUM];
+	float			attribConstValue[FGFP_ATTRIB_NUM][4];
 } fimgCompatContext;
 
+/*
+ * Hash of shader key is a XOR of hashes of its words, so it can be updated
+ * incrementally whenever a single word of shader state changes.
+ */
+static inline uint32_t fimgHashStateWord(uint32_t word, uint32_t val)
+{
+	val ^= (word + 1) * 0x9e3779b9;
+	val ^= val >> 16;
+	val *= 0x85ebca6b;
+	val ^= val >> 13;
+	val *= 0xc2b2ae35;
+	val ^= val >> 16;
+
+	return val;
+}
+
+static inline uint32_t fimgHashShaderKey(const uint32_t *key)
+{
+	uint32_t hash = 0;
+	uint32_t i;
+
+	for (i = 0; i < FGFP_SHADER_KEY_WORDS; ++i)
+		hash ^= fimgHashStateWord(i, key[i]);
+
+	return hash;
+}
+
+/* Must be called after modifying vsState */
+static inline void fimgCompatUpdateVSKey(fimgCompatContext *compat)
+{
+	uint32_t key = compat->vsState.vs;
+
+	if (key == compat->vsKey[0])
+		return;
+
+	compat->vsHash ^= fimgHashStateWord(0, compat->vsKey[0])
+						^ fimgHashStateWord(0, key);
+	compat->vsKey[0] = key;
+	compat->vsDirty = 1;
+}
+
+/* Must be called after modifying psState.val[word] or psMask[word] */
+static inline void fimgCompatUpdatePSKey(fimgCompatContext *compat,
+								uint32_t word)
+{
+	uint32_t key = compat->psState.val[word] & compat->psMask[word];
+
+	if (key == compat->psKey[word])
+		return;
+
+	compat->psHash ^= fimgHashStateWord(word, compat->psKey[word])
+						^ fimgHashStateWord(word, key);
+	compat->psKey[word] = key;
+	compat->psDirty = 1;
+}
+
+/* Shader state saved around draws issued by the library itself */
+typedef struct {
+	fimgVertexShaderState	vsState;
+	fimgPixelShaderState	psState;
+	uint32_t		psMask[FIMG_NUM_TEXTURE_UNITS + 1];
+	const float		*matrix[2 + FIMG_NUM_TEXTURE_UNITS];
+	const float		*attribConst[FGFP_ATTRIB_NUM];
+} fimgCompatState;
+
 void fimgCreateCompatContext(fimgContext *ctx);
 void fimgRestoreCompatState(fimgContext *ctx);
+void fimgCompatSaveState(fimgContext *ctx, fimgCompatState *state);
+void fimgCompatLoadState(fimgContext *ctx, const fimgCompatState *state);
 void fimgCompatFlush(fimgContext *ctx);
+uint32_t fimgCompatShaderVersion(void);
+
+uint32_t fimgShaderCacheLookup(uint32_t type, const uint32_t *key,
+					uint32_t hash, uint32_t *code);
+void fimgShaderCacheInsert(uint32_t type, const uint32_t *key, uint32_t hash,
+				const uint32_t *code, uint32_t instrCount);
+uint32_t fimgShaderCacheSize(void);
+
+#endif
+
+#ifdef FIMG_SOFTWARE_MODEL
+
+struct _fimgModel;
+typedef struct _fimgModel fimgModel;
+
+int fimgModelOpen(fimgContext *ctx);
+void fimgModelClose(fimgContext *ctx);
+int fimgModelIoctl(fimgContext *ctx, unsigned int request, unsigned long arg);
+void fimgModelWrite(fimgContext *ctx, unsigned int data, unsigned int addr);
+void fimgModelWriteBlock(fimgContext *ctx, unsigned int addr,
+							unsigned int count);
 
 #endif
 
 struct _fimgContext {
 	volatile char *base;
 	int fd;
+#ifdef FIMG_SOFTWARE_MODEL
+	fimgModel *model;
+#endif
 	/* Individual contexts */
 	fimgGlobalContext global;
 	fimgHostContext host;
@@ -577,15 +754,36 @@ struct _fimgContext {
 	unsigned int fbHeight;
 	unsigned int fbFlags;
 	int flipY;
-	/* Register queue */
-	unsigned int *queueStart;
-	unsigned int *queue;
-	unsigned int queueLen;
+	/* Register shadow */
+	fimgRegBlock regs[FIMG_NUM_REG_BLOCKS];
+	unsigned int dirtyBlocks;
+	fimgTexture texture[FIMG_NUM_TEXTURE_UNITS];
+	unsigned int textureValid;
+	/* Stamp of palette loaded to hardware */
+	unsigned int paletteStamp;
+	/* Register write statistics */
+	unsigned int frameRegWrites;
+	unsigned int frameBlockWords;
+	fimgRegisterStats regStats;
 	/* Lock state */
 	unsigned int locked;
+#ifdef FIMG_HW_LOCK_LEASE
+	unsigned int leaseDraws;
+	uint64_t leaseStart;
+	/* Held while the context accesses the hardware */
+	pthread_mutex_t leaseMutex;
+	/* Leased contexts watched for lease expiry */
+	int leaseWatched;
+	fimgContext *leaseNext;
+#endif
 	/* Vertex data */
 	uint8_t *vertexData;
 	size_t vertexDataSize;
+	fimgPackCache packCache;
+	fimgVertexBatch *packBatch;
+	fimgVertexBatch vertexBatch[FIMG_VERTEX_BATCHES];
+	unsigned int batchHead;
+	unsigned int batchCount;
 };
 
 /* Registry accessors */
@@ -600,6 +798,10 @@ static inline void fimgWrite(fimgContext *ctx, unsigned int data, unsigned int a
 #endif
 	*reg = data;
 	__sync_synchronize();
+	++ctx->frameRegWrites;
+#ifdef FIMG_SOFTWARE_MODEL
+	fimgModelWrite(ctx, data, addr);
+#endif
 }
 
 static inline unsigned int fimgRead(fimgContext *ctx, unsigned int addr)
@@ -628,6 +830,10 @@ static inline void fimgWriteF(fimgContext *ctx, float data, unsigned int addr)
 #endif
 	*reg = data;
 	__sync_synchronize();
+	++ctx->frameRegWrites;
+#ifdef FIMG_SOFTWARE_MODEL
+	fimgModelWrite(ctx, *(volatile unsigned int *)reg, addr);
+#endif
 }
 
 static inline float fimgReadF(fimgContext *ctx, unsigned int addr)
@@ -645,79 +851,105 @@ static inline float fimgReadF(fimgContext *ctx, unsigned int addr)
 	return val;
 }
 
-/* Register queue */
-#define FIMG_MAX_QUEUE_LEN	64
-
-static inline void fimgQueueFlush(fimgContext *ctx)
+/* Notifies the software model about registers written through ctx->base */
+static inline void fimgWriteBlockDone(fimgContext *ctx,
+				volatile void *start, unsigned int count)
 {
-	unsigned int cnt;
-	unsigned int *ptr;
-
-	if (!ctx->queueLen)
-		return;
-
-	/* Above the maximum length it's more effective to restore the whole
-	 * context than just the changed registers */
-	if (ctx->queueLen == FIMG_MAX_QUEUE_LEN) {
-		fimgRestoreContext(ctx);
-		return;
-	}
+	ctx->frameBlockWords += count;
+#ifdef FIMG_SOFTWARE_MODEL
+	fimgModelWriteBlock(ctx, (volatile char *)start - ctx->base, count);
+#endif
+}
 
-	cnt = ctx->queueLen;
-	ptr = ctx->queueStart + 2;
+/* Register queue */
 
-	while (cnt--) {
-		fimgWrite(ctx, ptr[1], ptr[0]);
-		ptr += 2;
+static inline unsigned int fimgRegBlockIndex(unsigned int addr)
+{
+	switch (addr & ~0xfff) {
+	case 0x08000:
+		return FIMG_REGS_HOST;
+	case 0x30000:
+		return FIMG_REGS_PRIMITIVE;
+	case 0x38000:
+		return FIMG_REGS_RASTER;
+	case 0x3c000:
+		return FIMG_REGS_RASTER_CLIP;
+	default:
+		return FIMG_REGS_FRAGMENT;
 	}
+}
 
-	ctx->queueLen = 0;
-	ctx->queue = ctx->queueStart;
-	ctx->queue[0] = 0;
+static inline void fimgQueueFlush(fimgContext *ctx)
+{
+	if (ctx->dirtyBlocks)
+		fimgWriteDirtyRegisters(ctx);
 }
 
 static inline void fimgQueue(fimgContext *ctx, unsigned int data, unsigned int addr)
 {
-	if (ctx->queue[0] == addr) {
-		ctx->queue[1] = data;
-		return;
-	}
+	unsigned int block = fimgRegBlockIndex(addr);
+	unsigned int reg = (addr & 0xfff) / 4;
+	fimgRegBlock *regs = &ctx->regs[block];
+	uint32_t bit = 1 << reg;
 
-	/* Above the maximum length it's more effective to restore the whole
-	 * context than just the changed registers */
-	if (ctx->queueLen == FIMG_MAX_QUEUE_LEN)
+	/* Writing the same value again has no effect */
+	if ((regs->valid & bit) && regs->val[reg] == data)
 		return;
 
-	ctx->queue += 2;
-	ctx->queueLen++;
-	ctx->queue[0] = addr;
-	ctx->queue[1] = data;
+	regs->val[reg] = data;
+	regs->valid |= bit;
+	regs->dirty |= bit;
+	ctx->dirtyBlocks |= 1 << block;
 }
 
 static inline void fimgQueueF(fimgContext *ctx, float data, unsigned int addr)
 {
-	if (ctx->queue[0] == addr) {
-		((float *)ctx->queue)[1] = data;
-		return;
-	}
-
-	/* Above the maximum length it's more effective to restore the whole
-	 * context than just the changed registers */
-	if (ctx->queueLen == FIMG_MAX_QUEUE_LEN)
-		return;
+	union {
+		float f;
+		unsigned int i;
+	} val;
 
-	ctx->queue += 2;
-	ctx->queueLen++;
-	ctx->queue[0] = addr;
-	((float *)ctx->queue)[1] = data;
+	val.f = data;
+	fimgQueue(ctx, val.i, addr);
 }
 
 /* Hardware context */
 
+/*
+ * Draws do not release the hardware lock, but lease it until the context
+ * gets finished or flushed, the lease expires or another context of the
+ * process waits for the hardware. This saves two ioctls per draw call.
+ * Expiry of leases is also checked by a watchdog thread, so a context
+ * that stops drawing does not keep the hardware. The context holds its
+ * lease mutex from getting the hardware until putting or leasing it, so
+ * the watchdog never releases the lock in the middle of register access.
+ */
+
+#ifdef FIMG_HW_LOCK_LEASE
+static inline void fimgLockLease(fimgContext *ctx)
+{
+	pthread_mutex_lock(&ctx->leaseMutex);
+}
+
+static inline void fimgUnlockLease(fimgContext *ctx)
+{
+	pthread_mutex_unlock(&ctx->leaseMutex);
+}
+#else
+static inline void fimgLockLease(fimgContext *ctx) {}
+static inline void fimgUnlockLease(fimgContext *ctx) {}
+#endif
+
 static inline void fimgGetHardware(fimgContext *ctx)
 {
 	int ret;
 
+	fimgLockLease(ctx);
+
+	/* Still leased since previous draw */
+	if (ctx->locked)
+		return;
+
 	ret = fimgAcquireHardwareLock(ctx);
 	if (likely(!ret))
 		return;
@@ -752,8 +984,30 @@ static inline void fimgFlushContext(fimgContext *ctx)
 static inline void fimgPutHardware(fimgContext *ctx)
 {
 	fimgReleaseHardwareLock(ctx);
+	fimgUnlockLease(ctx);
 }
 
+#ifdef FIMG_HW_LOCK_LEASE
+extern int fimgLeaseExpired(fimgContext *ctx);
+extern void fimgWatchLease(fimgContext *ctx);
+extern void fimgUnwatchLease(fimgContext *ctx);
+
+static inline void fimgLeaseHardware(fimgContext *ctx)
+{
+	if (fimgLeaseExpired(ctx))
+		fimgReleaseHardwareLock(ctx);
+	else if (!ctx->leaseWatched)
+		fimgWatchLease(ctx);
+
+	fimgUnlockLease(ctx);
+}
+#else
+static inline void fimgLeaseHardware(fimgContext *ctx)
+{
+	fimgReleaseHardwareLock(ctx);
+}
+#endif
+
 extern void fimgDumpState(fimgContext *ctx, unsigned mode, unsigned count, const char *func);
 
 #endif /* _FIMG_PRIVATE_H_ */
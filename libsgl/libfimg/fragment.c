@@ -429,6 +429,7 @@ void fimgSetFrameBufParams(fimgContext *ctx,
 #ifdef FIMG_FIXED_PIPELINE
 	FGFP_BITFIELD_SET(ctx->compat.psState.ps,
 			PS_SWAP, !!(flags & FGPF_COLOR_MODE_BGR));
+	fimgCompatUpdatePSKey(&ctx->compat, FIMG_NUM_TEXTURE_UNITS);
 #endif
 	ctx->fbFlags = flags;
 	fimgQueue(ctx, ctx->fragment.fbctl.val, FGPF_FBCTL);
@@ -483,23 +484,20 @@ void fimgCreateFragmentContext(fimgContext *ctx)
 	ctx->fragment.blend.asrcblendfunc = FGPF_BLEND_FUNC_ONE;
 	ctx->fragment.blend.csrcblendfunc = FGPF_BLEND_FUNC_ONE;
 	ctx->fragment.fbctl.dither = 1;
-}
 
-void fimgRestoreFragmentState(fimgContext *ctx)
-{
-	fimgWrite(ctx, ctx->fragment.scY.val, FGPF_SCISSOR_Y);
-	fimgWrite(ctx, ctx->fragment.scX.val, FGPF_SCISSOR_X);
-	fimgWrite(ctx, ctx->fragment.alpha.val, FGPF_ALPHAT);
-	fimgWrite(ctx, ctx->fragment.stBack.val, FGPF_BACKST);
-	fimgWrite(ctx, ctx->fragment.stFront.val, FGPF_FRONTST);
-	fimgWrite(ctx, ctx->fragment.depth.val, FGPF_DEPTHT);
-	fimgWrite(ctx, ctx->fragment.blend.val, FGPF_BLEND);
-	fimgWrite(ctx, ctx->fragment.blendColor, FGPF_CCLR);
-	fimgWrite(ctx, ctx->fragment.fbctl.val, FGPF_FBCTL);
-	fimgWrite(ctx, ctx->fragment.logop.val, FGPF_LOGOP);
-	fimgWrite(ctx, ctx->fragment.mask.val, FGPF_CBMSK);
-	fimgWrite(ctx, ctx->fragment.dbmask.val, FGPF_DBMSK);
-	fimgWrite(ctx, ctx->fragment.depthAddr, FGPF_DBADDR);
-	fimgWrite(ctx, ctx->fragment.colorAddr, FGPF_CBADDR);
-	fimgWrite(ctx, ctx->fragment.bufWidth, FGPF_FBW);
+	fimgQueue(ctx, ctx->fragment.scY.val, FGPF_SCISSOR_Y);
+	fimgQueue(ctx, ctx->fragment.scX.val, FGPF_SCISSOR_X);
+	fimgQueue(ctx, ctx->fragment.alpha.val, FGPF_ALPHAT);
+	fimgQueue(ctx, ctx->fragment.stBack.val, FGPF_BACKST);
+	fimgQueue(ctx, ctx->fragment.stFront.val, FGPF_FRONTST);
+	fimgQueue(ctx, ctx->fragment.depth.val, FGPF_DEPTHT);
+	fimgQueue(ctx, ctx->fragment.blend.val, FGPF_BLEND);
+	fimgQueue(ctx, ctx->fragment.blendColor, FGPF_CCLR);
+	fimgQueue(ctx, ctx->fragment.fbctl.val, FGPF_FBCTL);
+	fimgQueue(ctx, ctx->fragment.logop.val, FGPF_LOGOP);
+	fimgQueue(ctx, ctx->fragment.mask.val, FGPF_CBMSK);
+	fimgQueue(ctx, ctx->fragment.dbmask.val, FGPF_DBMSK);
+	fimgQueue(ctx, ctx->fragment.depthAddr, FGPF_DBADDR);
+	fimgQueue(ctx, ctx->fragment.colorAddr, FGPF_CBADDR);
+	fimgQueue(ctx, ctx->fragment.bufWidth, FGPF_FBW);
 }
@@ -24,7 +24,9 @@
 #endif
 
 #include "fimg_private.h"
+#include <string.h>
 #include <unistd.h>
+#include <sched.h>
 
 /*
  * Global hardware
@@ -54,6 +56,159 @@ typedef union {
 	};
 } fimgCacheCtl;
 
+/*
+ * Waits
+ *
+ * The CPU has a single core, so spinning on a busy register steals time
+ * from the application thread preparing next frame. Every wait polls
+ * the register only for a while first. The number of polls adapts to
+ * each kind of wait: it is halved whenever polling was not enough and
+ * doubled otherwise. Pipeline waits then sleep in the kernel until the
+ * pipeline interrupt (S3C_G3D_FLUSH). Cache operations have no interrupt
+ * and are too short to sleep for, so their waits keep spinning on the
+ * single core, only yielding it to other runnable threads between polls.
+ *
+ * Statistics of waits are kept per context and can be read by the
+ * application with fimgGetWaitStats() or logged when the context gets
+ * destroyed, if FIMG_WAIT_STATS_DEBUG is enabled.
+ */
+
+static void accountWait(fimgWaitStats *stats, uint64_t start, int slept)
+{
+	uint32_t time = (fimgGetTimestamp() - start) / 1000;
+	unsigned int bucket = 0;
+
+	if (time > 1)
+		bucket = 31 - __builtin_clz(time);
+	if (bucket >= FIMG_WAIT_HIST_BUCKETS)
+		bucket = FIMG_WAIT_HIST_BUCKETS - 1;
+
+	++stats->waits;
+	stats->sleeps += slept;
+	stats->totalTime += time;
+	if (time > stats->maxTime)
+		stats->maxTime = time;
+	++stats->hist[bucket];
+}
+
+/* Waits until all bits of mask in given register become cleared */
+static int waitRegister(fimgContext *ctx, unsigned int wait,
+					unsigned int addr, uint32_t mask)
+{
+	fimgWaitState *state = &ctx->global.wait[wait];
+	unsigned int polls;
+	uint64_t start;
+	int ret = 0;
+
+	if (!(fimgRead(ctx, addr) & mask))
+		return 0;
+
+	start = fimgGetTimestamp();
+
+	for (polls = state->polls; polls; --polls) {
+		if (fimgRead(ctx, addr) & mask)
+			continue;
+
+		if (state->polls < FIMG_WAIT_POLLS_MAX)
+			state->polls *= 2;
+		accountWait(&state->stats, start, 0);
+		return 0;
+	}
+
+	if (state->polls > FIMG_WAIT_POLLS_MIN)
+		state->polls /= 2;
+
+	if (wait == FIMG_WAIT_PIPELINE) {
+		ret = fimgWaitForFlush(ctx, mask);
+		accountWait(&state->stats, start, 1);
+		return ret;
+	}
+
+	/*
+	 * Cache operations take microseconds, while even the shortest sleep
+	 * lasts until the next scheduler tick, with the hardware lock held.
+	 * Keep polling, only letting other runnable threads in between.
+	 */
+	for (polls = 0; fimgRead(ctx, addr) & mask; ++polls) {
+		if (polls < FIMG_WAIT_POLLS_MIN)
+			continue;
+
+		polls = 0;
+
+		if (fimgGetTimestamp() - start
+		    >= FIMG_WAIT_TIMEOUT * 1000000ULL) {
+			LOGE("%s: Timeout waiting for register %04x (%08x)",
+				__func__, addr, fimgRead(ctx, addr));
+			++state->stats.timeouts;
+			ret = -1;
+			break;
+		}
+
+		sched_yield();
+	}
+
+	accountWait(&state->stats, start, 1);
+	return ret;
+}
+
+/*****************************************************************************
+ * FUNCTIONS:	fimgGetWaitStats
+ * SYNOPSIS:	This function retrieves statistics of waits for hardware
+ * PARAMETERS:	[IN] wait - kind of wait (FIMG_WAIT_*)
+ *		[OUT] stats - structure to fill with statistics
+ *****************************************************************************/
+void fimgGetWaitStats(fimgContext *ctx, unsigned int wait,
+						fimgWaitStats *stats)
+{
+	*stats = ctx->global.wait[wait].stats;
+}
+
+/*****************************************************************************
+ * FUNCTIONS:	fimgResetWaitStats
+ * SYNOPSIS:	This function clears statistics of all kinds of waits
+ *****************************************************************************/
+void fimgResetWaitStats(fimgContext *ctx)
+{
+	unsigned int i;
+
+	for (i = 0; i < FIMG_NUM_WAITS; ++i)
+		memset(&ctx->global.wait[i].stats, 0,
+					sizeof(ctx->global.wait[i].stats));
+}
+
+#ifdef FIMG_WAIT_STATS_DEBUG
+static const char *const waitNames[FIMG_NUM_WAITS] = {
+	[FIMG_WAIT_PIPELINE]	= "pipeline",
+	[FIMG_WAIT_CACHE_FLUSH]	= "cache flush",
+	[FIMG_WAIT_CACHE_CLEAR]	= "cache clear",
+};
+
+/*****************************************************************************
+ * FUNCTIONS:	fimgDumpWaitStats
+ * SYNOPSIS:	This function logs statistics of all kinds of waits
+ *****************************************************************************/
+void fimgDumpWaitStats(fimgContext *ctx)
+{
+	char hist[FIMG_WAIT_HIST_BUCKETS * 11 + 1];
+	unsigned int i, bucket;
+
+	for (i = 0; i < FIMG_NUM_WAITS; ++i) {
+		const fimgWaitStats *stats = &ctx->global.wait[i].stats;
+		int len = 0;
+
+		for (bucket = 0; bucket < FIMG_WAIT_HIST_BUCKETS; ++bucket)
+			len += snprintf(hist + len, sizeof(hist) - len,
+						" %u", stats->hist[bucket]);
+
+		LOGI("%s: %s waits %u, sleeps %u, timeouts %u, "
+			"max %u us, total %llu us, histogram:%s", __func__,
+			waitNames[i], stats->waits, stats->sleeps,
+			stats->timeouts, stats->maxTime,
+			(unsigned long long)stats->totalTime, hist);
+	}
+}
+#endif
+
 /* TODO: Function inlining */
 
 /*****************************************************************************
@@ -75,12 +230,8 @@ uint32_t fimgGetPipelineStatus(fimgContext *ctx)
  *****************************************************************************/
 int fimgFlush(fimgContext *ctx)
 {
-	/* Return if already flushed */
-	if((fimgRead(ctx, FGGB_PIPESTATE) & FGHI_PIPELINE_ALL) == 0)
-		return 0;
-
-	/* Flush whole pipeline */
-	return fimgWaitForFlush(ctx, FGHI_PIPELINE_ALL);
+	return waitRegister(ctx, FIMG_WAIT_PIPELINE,
+					FGGB_PIPESTATE, FGHI_PIPELINE_ALL);
 }
 
 #if 0
@@ -95,9 +246,11 @@ int fimgSelectiveFlush(fimgContext *ctx, uint32_t mask)
 
 /*****************************************************************************
  * FUNCTIONS:	fimgInvalidateCache
- * SYNOPSIS:
- * PARAMETERS:
- * RETURNS:
+ * SYNOPSIS:	This function clears selected caches and waits for completion
+ * PARAMETERS:	[IN] vtcclear - vertex texture cache clear mask
+ *		[IN] tcclear - texture cache clear mask
+ * RETURNS:	 0, on success
+ *		-1, on timeout
  *
  *****************************************************************************/
 int fimgInvalidateCache(fimgContext *ctx,
@@ -111,9 +264,7 @@ int fimgInvalidateCache(fimgContext *ctx,
 
 	fimgWrite(ctx, ctl.val, FGGB_CACHECTL); // start clearing the cache
 
-	while(fimgRead(ctx, FGGB_CACHECTL) & ctl.val);
-
-	return 0;
+	return waitRegister(ctx, FIMG_WAIT_CACHE_CLEAR, FGGB_CACHECTL, ctl.val);
 }
 
 /*****************************************************************************
@@ -138,9 +289,11 @@ int fimgFlushCache(fimgContext *ctx, unsigned int ccflush, unsigned int zcflush)
 
 /*****************************************************************************
  * FUNCTIONS:	fimgWaitForCacheFlush
- * SYNOPSIS:
- * PARAMETERS:
- * RETURNS:
+ * SYNOPSIS:	This function waits for cache flush started by fimgFlushCache
+ * PARAMETERS:	[IN] ccflush - color cache flush mask
+ *		[IN] zcflush - depth cache flush mask
+ * RETURNS:	 0, on success
+ *		-1, on timeout
  *
  *****************************************************************************/
 int fimgWaitForCacheFlush(fimgContext *ctx,
@@ -152,25 +305,127 @@ int fimgWaitForCacheFlush(fimgContext *ctx,
 	ctl.ccflush = ccflush;
 	ctl.zcflush = zcflush;
 
-	while(fimgRead(ctx, FGGB_CACHECTL) & ctl.val);
+	return waitRegister(ctx, FIMG_WAIT_CACHE_FLUSH, FGGB_CACHECTL, ctl.val);
+}
 
-	return 0;
+/*
+ * Fences
+ *
+ * Draws are numbered in submission order across the whole process, so
+ * a fence is just the number of the last draw submitted before it. The
+ * hardware executes draws in order, so once the pipeline is seen idle
+ * with caches flushed, all draws submitted until then have retired.
+ */
+
+static volatile fimgFence fenceSubmitted;
+static volatile fimgFence fenceRetired;
+
+static inline int fenceAfter(fimgFence a, fimgFence b)
+{
+	return (int32_t)(a - b) > 0;
+}
+
+static void fimgRetireFences(fimgFence fence)
+{
+	fimgFence retired;
+
+	do {
+		retired = fenceRetired;
+		if (!fenceAfter(fence, retired))
+			return;
+	} while (!__sync_bool_compare_and_swap(&fenceRetired, retired, fence));
+}
+
+/* Called with hardware locked, after the draw has been submitted */
+void fimgSubmitFence(fimgContext *ctx)
+{
+	__sync_add_and_fetch(&fenceSubmitted, 1);
+}
+
+/*****************************************************************************
+ * FUNCTIONS:	fimgCreateFence
+ * SYNOPSIS:	This function creates a fence after all draws submitted so far
+ * RETURNS:	created fence
+ *****************************************************************************/
+fimgFence fimgCreateFence(fimgContext *ctx)
+{
+	return fenceSubmitted;
+}
+
+/*****************************************************************************
+ * FUNCTIONS:	fimgFenceExpired
+ * SYNOPSIS:	This function checks whether a fence is already known to be
+ *		signaled without accessing the hardware
+ * PARAMETERS:	[IN] fence - fence to check
+ * RETURNS:	non-zero if signaled, zero if status is unknown
+ *****************************************************************************/
+int fimgFenceExpired(fimgFence fence)
+{
+	return !fenceAfter(fence, fenceRetired);
+}
+
+/*****************************************************************************
+ * FUNCTIONS:	fimgFenceSignaled
+ * SYNOPSIS:	This function checks whether all draws before a fence have
+ *		completed, without waiting for the pipeline
+ * PARAMETERS:	[IN] fence - fence to check
+ * RETURNS:	non-zero if signaled, zero otherwise
+ *****************************************************************************/
+int fimgFenceSignaled(fimgContext *ctx, fimgFence fence)
+{
+	fimgFence submitted;
+	int idle;
+
+	if (fimgFenceExpired(fence))
+		return 1;
+
+	fimgGetHardware(ctx);
+	submitted = fenceSubmitted;
+	idle = !(fimgGetPipelineStatus(ctx) & FGHI_PIPELINE_ALL);
+	if (idle) {
+		fimgFlushCache(ctx, 3, 3);
+		fimgWaitForCacheFlush(ctx, 3, 3);
+		fimgRetireFences(submitted);
+	}
+	fimgPutHardware(ctx);
+
+	return idle;
+}
+
+/*****************************************************************************
+ * FUNCTIONS:	fimgWaitFence
+ * SYNOPSIS:	This function waits until all draws before a fence complete
+ * PARAMETERS:	[IN] fence - fence to wait for
+ *****************************************************************************/
+void fimgWaitFence(fimgContext *ctx, fimgFence fence)
+{
+	if (fimgFenceExpired(fence))
+		return;
+
+	fimgFinish(ctx);
 }
 
 /*****************************************************************************
  * FUNCTIONS:	fimgFinish
- * SYNOPSIS:
- * PARAMETERS:
- * RETURNS:
- *
+ * SYNOPSIS:	This function waits until all submitted draws complete
  *****************************************************************************/
 void fimgFinish(fimgContext *ctx)
 {
+	fimgFence submitted;
+
+	/* Nothing submitted since the pipeline was seen idle */
+	if (fimgFenceExpired(fenceSubmitted)) {
+		fimgReleaseHardware(ctx);
+		return;
+	}
+
 	fimgGetHardware(ctx);
+	submitted = fenceSubmitted;
 	fimgFlush(ctx);
 	fimgFlushCache(ctx, 3, 3);
 	fimgSelectiveFlush(ctx, FGHI_PIPELINE_CCACHE);
 	fimgWaitForCacheFlush(ctx, 3, 3);
+	fimgRetireFences(submitted);
 	fimgPutHardware(ctx);
 }
 
@@ -280,7 +535,10 @@ uint32_t fimgGetInterruptState(fimgContext *ctx)
 
 void fimgCreateGlobalContext(fimgContext *ctx)
 {
-	// Nothing to initialize yet
+	unsigned int i;
+
+	for (i = 0; i < FIMG_NUM_WAITS; ++i)
+		ctx->global.wait[i].polls = FIMG_WAIT_POLLS_MAX;
 }
 
 void fimgRestoreGlobalState(fimgContext *ctx)
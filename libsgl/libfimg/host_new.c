@@ -61,6 +61,8 @@ void fimgSetAttribCount(fimgContext *ctx, unsigned char count)
 	ctx->host.control.numoutattrib = count;
 #endif
 	ctx->numAttribs = count;
+
+	fimgQueue(ctx, ctx->host.control.val, FGHI_CONTROL);
 }
 
 /*****************************************************************************
@@ -85,9 +87,11 @@ void fimgSetAttribute(fimgContext *ctx, unsigned int idx,
 static inline void setVtxBufAttrib(fimgContext *ctx, unsigned char idx,
 		unsigned short base, unsigned char stride, unsigned short range)
 {
-	ctx->host.vbbase[idx] = base;
-	ctx->host.vbctrl[idx].stride = stride;
-	ctx->host.vbctrl[idx].range = range;
+	fimgVertexBatch *batch = ctx->packBatch;
+
+	batch->vbbase[idx] = base;
+	batch->vbctrl[idx].stride = stride;
+	batch->vbctrl[idx].range = range;
 }
 
 /*
@@ -180,15 +184,16 @@ static unsigned int calculateBatchSize(fimgArray *arrays, int count)
 	return vertexWordsToVertexCount[size];
 }
 
-static void fillVertexBuffer(fimgContext *ctx)
+static void fillVertexBuffer(fimgContext *ctx, fimgVertexBatch *batch)
 {
 	volatile uint32_t *reg =
 			(volatile uint32_t *)(ctx->base + FGHI_VB_ENTRY);
-	uint32_t *data = (uint32_t *)ctx->vertexData;
-	unsigned count = (ctx->vertexDataSize + 31) / 32;
+	uint32_t *data = (uint32_t *)batch->data;
+	unsigned count = (batch->size + 31) / 32;
 
 	fimgWrite(ctx, 0, FGHI_VBADDR);
 
+#ifdef __arm__
 	asm volatile (
 		"1:\n\t"
 		"ldmia %1!, {r0-r7}\n\t"
@@ -199,972 +204,521 @@ static void fillVertexBuffer(fimgContext *ctx)
 		: "r"(reg), "r"(data), "r"(count)
 		: "r0", "r1", "r2", "r3", "r4", "r5", "r6", "r7"
 	);
+#else
+	memcpy((void *)reg, data, 32*count);
+#endif
+	fimgWriteBlockDone(ctx, ctx->base + FGHI_VB_ENTRY, 8*count);
 }
 
-#define BUF_ADDR_32(buf, offs)	\
-			((const uint32_t *)((const uint8_t *)(buf) + (offs)))
-#define BUF_ADDR_16(buf, offs)	\
-			((const uint16_t *)((const uint8_t *)(buf) + (offs)))
-#define BUF_ADDR_8(buf, offs)	\
-			((const uint8_t *)(buf) + (offs))
-
 /*
- * Unindexed
+ * Vertex packing
+ *
+ * Attribute data are copied to the vertex buffer by routines specialized
+ * for attribute layout (element width and alignment) and index type, so
+ * the inner loops don't need to make any per-vertex decisions. Routines
+ * selected for particular layout of arrays are cached, as consecutive
+ * draws usually use the same vertex format.
  */
 
-static uint32_t packAttribute(fimgContext *ctx, uint32_t *buf,
-						fimgArray *a, int pos, int cnt)
-{
-	register uint32_t word;
-	uint32_t size;
-
-	/* Vertices must be word aligned */
-	size = (a->width + 3) & ~3;
-	size *= cnt;
-
-	switch(a->width % 4) {
-	/* words */
-	case 0:
-		/* Check if vertices are word aligned */
-		if ((uintptr_t)a->pointer % 4 == 0 && a->stride % 4 == 0) {
-			uint32_t len, srcpad = (a->stride - a->width) / 4;
-			const uint32_t *data =
-					BUF_ADDR_32(a->pointer, pos*a->stride);
-
-			while (cnt--) {
-				len = a->width;
+enum {
+	FIMG_INDEX_NONE = 0,
+	FIMG_INDEX_UBYTE,
+	FIMG_INDEX_USHORT,
 
-				while (len) {
-					*(buf++) = *(data++);
-					len -= 4;
-				}
-
-				data += srcpad;
-			}
+	FIMG_INDEX_TYPES
+};
 
-			break;
-		}
-	/* halfwords */
-	case 2:
-		/* Check if vertices are halfword aligned */
-		if ((uintptr_t)a->pointer % 2 == 0 && a->stride % 2 == 0) {
-			uint32_t len, srcpad = (a->stride - a->width) / 2;
-			const uint16_t *data =
-					BUF_ADDR_16(a->pointer, pos*a->stride);
-
-			while (cnt--) {
-				len = a->width;
-
-				while (len >= 4) {
-					word = *(data++);
-					word |= *(data++) << 16;
-					*(buf++) = word;
-					len -= 4;
-				}
-
-				/* Single halfword left */
-				if (len)
-					*(buf++) = *(data++);
-
-				data += srcpad;
-			}
+#if defined(__ARM_ARCH_6__) || defined(__ARM_ARCH_6J__) \
+	|| defined(__ARM_ARCH_6K__) || defined(__ARM_ARCH_6Z__) \
+	|| defined(__ARM_ARCH_6ZK__) || defined(__ARM_ARCH_7A__)
+#define FIMG_ARMV6_PACK
+#endif
 
-			break;
-		}
-	/* bytes */
-	default:
-		/* Fallback - no check required */
-		{
-			uint32_t len, srcpad = a->stride - a->width;
-			const uint8_t *data =
-					BUF_ADDR_8(a->pointer, pos*a->stride);
-
-			while (cnt--) {
-				len = a->width;
-
-				while (len >= 4) {
-					word = *(data++);
-					word |= *(data++) << 8;
-					word |= *(data++) << 16;
-					word |= *(data++) << 24;
-					*(buf++) = word;
-					len -= 4;
-				}
-
-				// Up to 3 bytes left
-				if (len) {
-					word = *(data++);
-					if (len == 2)
-						word |= *(data++) << 8;
-					if (len == 3)
-						word |= *(data++) << 16;
-
-					*(buf++) = word;
-				}
-
-				data += srcpad;
-			}
+static inline uint32_t mergeHalfwords(uint32_t lo, uint32_t hi)
+{
+#ifdef FIMG_ARMV6_PACK
+	uint32_t word;
 
-			break;
-		}
-	}
+	asm ("pkhbt %0, %1, %2, lsl #16"
+		: "=r"(word)
+		: "r"(lo), "r"(hi)
+	);
 
-	return size;
+	return word;
+#else
+	return lo | (hi << 16);
+#endif
 }
 
-/* Generic vertex copy */
-static uint32_t copyVertices1To1(fimgContext *ctx, fimgArray *arrays,
-						uint32_t *first, uint32_t *count)
+static inline uint32_t mergeBytes(const uint8_t *data)
 {
-	fimgArray *a = arrays;
-	uint32_t batchSize = calculateBatchSize(arrays, ctx->numAttribs);
-	uint32_t i;
-	uint32_t offset = DATA_OFFSET;
-	uint8_t *buf = ctx->vertexData;
-
-	if (batchSize > *count)
-		batchSize = *count;
+	return data[0] | (data[1] << 8) | (data[2] << 16) | (data[3] << 24);
+}
 
-	for (i = 0; i < ctx->numAttribs; ++i, ++a) {
-		if (!a->stride) {
-			setVtxBufAttrib(ctx, i, CONST_ADDR(i), 0, batchSize);
-			memcpy(buf + CONST_ADDR(i), a->pointer, a->width);
-			continue;
-		}
-		setVtxBufAttrib(ctx, i, offset, (a->width + 3) & ~3, batchSize);
-		if (a->stride == a->width && !(a->width % 4)) {
-			memcpy(buf + offset, (const uint8_t *)a->pointer
-					+ *first*a->stride, batchSize*a->width);
-			offset += batchSize*a->width;
-			continue;
-		}
-		offset += packAttribute(ctx,
-				(uint32_t *)(buf + offset), a, *first, batchSize);
-	}
+/* Word aligned elements */
 
-	ctx->vertexDataSize = offset;
+static inline uint32_t *copyWords1(uint32_t *buf,
+					const uint8_t *src, uint32_t width)
+{
+	*(buf++) = *(const uint32_t *)src;
 
-	*first += batchSize;
-	*count -= batchSize;
-	return batchSize;
+	return buf;
 }
 
-static uint32_t copyVerticesLinestrip(fimgContext *ctx,
-			fimgArray *arrays, uint32_t *first, uint32_t *count)
+static inline uint32_t *copyWords2(uint32_t *buf,
+					const uint8_t *src, uint32_t width)
 {
-	fimgArray *a = arrays;
-	uint32_t batchSize = calculateBatchSize(arrays, ctx->numAttribs);
-	uint32_t i;
-	uint32_t offset = DATA_OFFSET;
-	uint8_t *buf = ctx->vertexData;
-
-	if (*count < 2)
-		return 0;
-
-	if (batchSize > *count)
-		batchSize = *count;
+#ifdef __arm__
+	asm volatile (
+		"ldmia %1, {r0-r1}\n\t"
+		"stmia %0!, {r0-r1}\n\t"
+		: "+r"(buf)
+		: "r"(src)
+		: "r0", "r1", "memory"
+	);
+#else
+	const uint32_t *data = (const uint32_t *)src;
 
-	for (i = 0; i < ctx->numAttribs; ++i, ++a) {
-		if (!a->stride) {
-			setVtxBufAttrib(ctx, i, CONST_ADDR(i), 0, batchSize);
-			memcpy(buf + CONST_ADDR(i), a->pointer, a->width);
-			continue;
-		}
-		setVtxBufAttrib(ctx, i, offset, (a->width + 3) & ~3, batchSize);
-		if (a->stride == a->width && !(a->width % 4)) {
-			memcpy(buf + offset, (const uint8_t *)a->pointer
-					+ *first*a->stride, batchSize*a->width);
-			offset += batchSize*a->width;
-			continue;
-		}
-		offset += packAttribute(ctx,
-				(uint32_t *)(buf + offset), a, *first, batchSize);
-	}
+	*(buf++) = *(data++);
+	*(buf++) = *(data++);
+#endif
+	return buf;
+}
 
-	ctx->vertexDataSize = offset;
+static inline uint32_t *copyWords3(uint32_t *buf,
+					const uint8_t *src, uint32_t width)
+{
+#ifdef __arm__
+	asm volatile (
+		"ldmia %1, {r0-r2}\n\t"
+		"stmia %0!, {r0-r2}\n\t"
+		: "+r"(buf)
+		: "r"(src)
+		: "r0", "r1", "r2", "memory"
+	);
+#else
+	const uint32_t *data = (const uint32_t *)src;
 
-	*first += batchSize - 1;
-	*count -= batchSize - 1;
-	return batchSize;
+	*(buf++) = *(data++);
+	*(buf++) = *(data++);
+	*(buf++) = *(data++);
+#endif
+	return buf;
 }
 
-static uint32_t copyVerticesLines(fimgContext *ctx, fimgArray *arrays,
-						uint32_t *first, uint32_t *count)
+static inline uint32_t *copyWords4(uint32_t *buf,
+					const uint8_t *src, uint32_t width)
 {
-	fimgArray *a = arrays;
-	uint32_t batchSize = calculateBatchSize(arrays, ctx->numAttribs);
-	uint32_t i;
-	uint32_t offset = DATA_OFFSET;
-	uint8_t *buf = ctx->vertexData;
-
-	if (*count < 2)
-		return 0;
+#ifdef __arm__
+	asm volatile (
+		"ldmia %1, {r0-r3}\n\t"
+		"stmia %0!, {r0-r3}\n\t"
+		: "+r"(buf)
+		: "r"(src)
+		: "r0", "r1", "r2", "r3", "memory"
+	);
+#else
+	const uint32_t *data = (const uint32_t *)src;
 
-	if (batchSize > *count)
-		batchSize = *count;
+	*(buf++) = *(data++);
+	*(buf++) = *(data++);
+	*(buf++) = *(data++);
+	*(buf++) = *(data++);
+#endif
+	return buf;
+}
 
-	if (batchSize % 2)
-		--batchSize;
+static inline uint32_t *copyWords(uint32_t *buf,
+					const uint8_t *src, uint32_t width)
+{
+	const uint32_t *data = (const uint32_t *)src;
 
-	for (i = 0; i < ctx->numAttribs; ++i, ++a) {
-		if (!a->stride) {
-			setVtxBufAttrib(ctx, i, CONST_ADDR(i), 0, batchSize);
-			memcpy(buf + CONST_ADDR(i), a->pointer, a->width);
-			continue;
-		}
-		setVtxBufAttrib(ctx, i, offset, (a->width + 3) & ~3, batchSize);
-		if (a->stride == a->width && !(a->width % 4)) {
-			memcpy(buf + offset, (const uint8_t*)a->pointer
-					+ *first*a->stride, batchSize*a->width);
-			offset += batchSize*a->width;
-			continue;
-		}
-		offset += packAttribute(ctx,
-				(uint32_t *)(buf + offset), a, *first, batchSize);
+	while (width) {
+		*(buf++) = *(data++);
+		width -= 4;
 	}
 
-	ctx->vertexDataSize = offset;
-
-	*first += batchSize;
-	*count -= batchSize;
-	return batchSize;
+	return buf;
 }
 
-static uint32_t copyVerticesTristrip(fimgContext *ctx,
-			fimgArray *arrays, uint32_t *first, uint32_t *count)
-{
-	fimgArray *a = arrays;
-	uint32_t batchSize = calculateBatchSize(arrays, ctx->numAttribs) - 1;
-	uint32_t i;
-	uint32_t offset = DATA_OFFSET;
-	uint8_t *buf = ctx->vertexData;
+/* Halfword aligned elements */
 
-	if (*count < 3)
-		return 0;
-
-	if (batchSize >= *count)
-		batchSize = *count;
-	else if (batchSize % 2)
-		--batchSize;
-
-	for (i = 0; i < ctx->numAttribs; ++i, ++a) {
-		if (!a->stride) {
-			setVtxBufAttrib(ctx, i, CONST_ADDR(i), 0, batchSize + 1);
-			memcpy(buf + CONST_ADDR(i), a->pointer, a->width);
-			continue;
-		}
-		setVtxBufAttrib(ctx, i, offset, (a->width + 3) & ~3, batchSize + 1);
-		if (a->stride == a->width && !(a->width % 4)) {
-			memcpy(buf + offset, (const uint8_t *)a->pointer
-					+ *first*a->stride, batchSize*a->width);
-			offset += batchSize*a->width;
-			memcpy(buf + offset, (const uint8_t *)a->pointer
-					+ (*first + batchSize - 1)*a->stride, 1*a->width);
-			offset += 1*a->width;
-			continue;
-		}
-		offset += packAttribute(ctx,
-				(uint32_t *)(buf + offset), a, *first, batchSize);
-		offset += packAttribute(ctx,
-				(uint32_t *)(buf + offset), a, *first + batchSize - 1, 1);
-	}
+static inline uint32_t *copyHalfwords2(uint32_t *buf,
+					const uint8_t *src, uint32_t width)
+{
+	const uint16_t *data = (const uint16_t *)src;
 
-	ctx->vertexDataSize = offset;
+	*(buf++) = mergeHalfwords(data[0], data[1]);
 
-	*first += batchSize - 2;
-	*count -= batchSize - 2;
-	return batchSize + 1;
+	return buf;
 }
 
-static uint32_t copyVerticesTrifan(fimgContext *ctx,
-			fimgArray *arrays, uint32_t *first, uint32_t *count)
+static inline uint32_t *copyHalfwords3(uint32_t *buf,
+					const uint8_t *src, uint32_t width)
 {
-	fimgArray *a = arrays;
-	uint32_t batchSize = calculateBatchSize(arrays, ctx->numAttribs) - 2;
-	uint32_t i;
-	uint32_t offset = DATA_OFFSET;
-	uint8_t *buf = ctx->vertexData;
+	const uint16_t *data = (const uint16_t *)src;
 
-	if (*count < 3)
-		return 0;
+	*(buf++) = mergeHalfwords(data[0], data[1]);
+	*(buf++) = data[2];
 
-	if (batchSize > *count)
-		batchSize = *count;
+	return buf;
+}
 
-	for (i = 0; i < ctx->numAttribs; ++i, ++a) {
-		if (!a->stride) {
-			setVtxBufAttrib(ctx, i, CONST_ADDR(i), 0, batchSize + 2);
-			memcpy(buf + CONST_ADDR(i), a->pointer, a->width);
-			continue;
-		}
-		setVtxBufAttrib(ctx, i, offset, (a->width + 3) & ~3, batchSize + 2);
-		if (a->stride == a->width && !(a->width % 4)) {
-			memcpy(buf + offset, a->pointer, a->width);
-			offset += a->width;
-			memcpy(buf + offset, a->pointer, a->width);
-			offset += a->width;
-			memcpy(buf + offset, a->pointer, a->width);
-			offset += a->width;
-			memcpy(buf + offset, (const uint8_t *)a->pointer
-						+ (*first + 1)*a->stride,
-						(batchSize - 1)*a->width);
-			offset += (batchSize - 1)*a->width;
-			continue;
-		}
-		offset += packAttribute(ctx,
-				(uint32_t *)(buf + offset), a, 0, 1);
-		offset += packAttribute(ctx,
-				(uint32_t *)(buf + offset), a, 0, 1);
-		offset += packAttribute(ctx,
-				(uint32_t *)(buf + offset), a, 0, 1);
-		offset += packAttribute(ctx,
-				(uint32_t *)(buf + offset), a,
-						*first + 1, batchSize - 1);
-	}
+static inline uint32_t *copyHalfwords4(uint32_t *buf,
+					const uint8_t *src, uint32_t width)
+{
+	const uint16_t *data = (const uint16_t *)src;
 
-	ctx->vertexDataSize = offset;
+	*(buf++) = mergeHalfwords(data[0], data[1]);
+	*(buf++) = mergeHalfwords(data[2], data[3]);
 
-	*first += batchSize - 2;
-	*count -= batchSize - 2;
-	return batchSize + 2;
+	return buf;
 }
 
-static uint32_t copyVerticesTris(fimgContext *ctx, fimgArray *arrays,
-					uint32_t *first, uint32_t *count)
+static inline uint32_t *copyHalfwords(uint32_t *buf,
+					const uint8_t *src, uint32_t width)
 {
-	fimgArray *a = arrays;
-	uint32_t batchSize = calculateBatchSize(arrays, ctx->numAttribs);
-	uint32_t i;
-	uint32_t offset = DATA_OFFSET;
-	uint8_t *buf = ctx->vertexData;
+	const uint16_t *data = (const uint16_t *)src;
 
-	if (*count < 3)
-		return 0;
+	while (width >= 4) {
+		*(buf++) = mergeHalfwords(data[0], data[1]);
+		data += 2;
+		width -= 4;
+	}
 
-	if (batchSize > *count)
-		batchSize = *count;
+	/* Single halfword left */
+	if (width)
+		*(buf++) = *data;
 
-	if (batchSize % 3)
-		batchSize -= batchSize % 3;
+	return buf;
+}
 
-	for (i = 0; i < ctx->numAttribs; ++i, ++a) {
-		if (!a->stride) {
-			setVtxBufAttrib(ctx, i, CONST_ADDR(i), 0, batchSize);
-			memcpy(buf + CONST_ADDR(i), a->pointer, a->width);
-			continue;
-		}
-		setVtxBufAttrib(ctx, i, offset, (a->width + 3) & ~3, batchSize);
-		if (a->stride == a->width && !(a->width % 4)) {
-			memcpy(buf + offset, (const uint8_t *)a->pointer
-					+ *first*a->stride, batchSize*a->width);
-			offset += batchSize*a->width;
-			continue;
-		}
-		offset += packAttribute(ctx,
-				(uint32_t *)(buf + offset), a, *first, batchSize);
-	}
+/* Unaligned elements */
 
-	ctx->vertexDataSize = offset;
+static inline uint32_t *copyBytes4(uint32_t *buf,
+					const uint8_t *src, uint32_t width)
+{
+	*(buf++) = mergeBytes(src);
 
-	*first += batchSize;
-	*count -= batchSize;
-	return batchSize;
+	return buf;
 }
 
-/*
- * Indexed uint16_t
- */
-
-static uint32_t packAttributeIdx16(fimgContext *ctx, uint32_t *buf,
-				fimgArray *a, const uint16_t *idx, int cnt)
+static inline uint32_t *copyBytes(uint32_t *buf,
+					const uint8_t *src, uint32_t width)
 {
 	register uint32_t word;
-	uint32_t size;
-	uint32_t len;
-
-	if (!cnt)
-		return 0;
 
-	/* Vertices must be word aligned */
-	size = (a->width + 3) & ~3;
-	size *= cnt;
+	while (width >= 4) {
+		*(buf++) = mergeBytes(src);
+		src += 4;
+		width -= 4;
+	}
 
-	switch(a->width % 4) {
-	/* words */
-	case 0:
-		/* Check if vertices are word aligned */
-		if ((uintptr_t)a->pointer % 4 == 0 && a->stride % 4 == 0) {
-			const uint32_t *data, *next_data;
+	/* Up to 3 bytes left */
+	if (width) {
+		word = *(src++);
+		if (width >= 2)
+			word |= *(src++) << 8;
+		if (width == 3)
+			word |= *(src++) << 16;
 
-			next_data = BUF_ADDR_32(a->pointer, *(idx++)*a->stride);
-			--cnt;
+		*(buf++) = word;
+	}
 
-			while (cnt--) {
-				data = next_data;
-				next_data = BUF_ADDR_32(a->pointer,
-							*(idx++)*a->stride);
-				len = a->width;
+	return buf;
+}
 
-				while (len) {
-					*(buf++) = *(data++);
-					len -= 4;
-				}
-			}
+/* Pack routine generators */
+
+#define VERTEX_DIRECT(indices, pos)	(pos)
+#define VERTEX_UBYTE(indices, pos)	(((const uint8_t *)(indices))[pos])
+#define VERTEX_USHORT(indices, pos)	(((const uint16_t *)(indices))[pos])
+
+#define DEFINE_PACK_FUNC(name, copy, vertex)				\
+static void name(uint32_t *buf, const fimgArray *a,			\
+			const void *indices, uint32_t pos, uint32_t cnt)\
+{									\
+	const uint8_t *ptr = (const uint8_t *)a->pointer;		\
+	uint32_t stride = a->stride;					\
+	uint32_t width = a->width;					\
+									\
+	while (cnt--) {							\
+		buf = copy(buf, ptr + vertex(indices, pos)*stride, width);\
+		++pos;							\
+	}								\
+}
 
-			data = next_data;
-			len = a->width;
+#define DEFINE_PACK_FUNCS(name, copy)					\
+	DEFINE_PACK_FUNC(name, copy, VERTEX_DIRECT)			\
+	DEFINE_PACK_FUNC(name ## Idx8, copy, VERTEX_UBYTE)		\
+	DEFINE_PACK_FUNC(name ## Idx16, copy, VERTEX_USHORT)
+
+DEFINE_PACK_FUNCS(packWords1, copyWords1)
+DEFINE_PACK_FUNCS(packWords2, copyWords2)
+DEFINE_PACK_FUNCS(packWords3, copyWords3)
+DEFINE_PACK_FUNCS(packWords4, copyWords4)
+DEFINE_PACK_FUNCS(packWords, copyWords)
+DEFINE_PACK_FUNCS(packHalfwords2, copyHalfwords2)
+DEFINE_PACK_FUNCS(packHalfwords3, copyHalfwords3)
+DEFINE_PACK_FUNCS(packHalfwords4, copyHalfwords4)
+DEFINE_PACK_FUNCS(packHalfwords, copyHalfwords)
+DEFINE_PACK_FUNCS(packBytes4, copyBytes4)
+DEFINE_PACK_FUNCS(packBytes, copyBytes)
+
+/* Unindexed, tightly packed words */
+static void packContiguous(uint32_t *buf, const fimgArray *a,
+			const void *indices, uint32_t pos, uint32_t cnt)
+{
+	memcpy(buf, (const uint8_t *)a->pointer + pos*a->stride,
+							cnt*a->width);
+}
 
-			while (len) {
-				*(buf++) = *(data++);
-				len -= 4;
-			}
+enum {
+	PACK_WORDS1 = 0,
+	PACK_WORDS2,
+	PACK_WORDS3,
+	PACK_WORDS4,
+	PACK_WORDS,
+	PACK_HALFWORDS2,
+	PACK_HALFWORDS3,
+	PACK_HALFWORDS4,
+	PACK_HALFWORDS,
+	PACK_BYTES4,
+	PACK_BYTES,
+
+	PACK_LAYOUTS
+};
 
-			break;
-		}
-	/* halfwords */
-	case 2:
-		/* Check if vertices are halfword aligned */
-		if ((uintptr_t)a->pointer % 2 == 0 && a->stride % 2 == 0) {
-			const uint16_t *data, *next_data;
-
-			next_data = BUF_ADDR_16(a->pointer, *(idx++)*a->stride);
-			--cnt;
-
-			while (cnt--) {
-				data = next_data;
-				next_data = BUF_ADDR_16(a->pointer,
-							*(idx++)*a->stride);
-				len = a->width;
-
-				while (len >= 4) {
-					word = *(data++);
-					word |= *(data++) << 16;
-					*(buf++) = word;
-					len -= 4;
-				}
-
-				/* Single halfword left */
-				if (len)
-					*(buf++) = *(data++);
-			}
-
-			data = next_data;
-			len = a->width;
-
-			while (len >= 4) {
-				word = *(data++);
-				word |= *(data++) << 16;
-				*(buf++) = word;
-				len -= 4;
-			}
+#define PACK_FUNCS(name)	{ name, name ## Idx8, name ## Idx16 }
+
+static const fimgPackFunc packFuncs[PACK_LAYOUTS][FIMG_INDEX_TYPES] = {
+	[PACK_WORDS1]		= PACK_FUNCS(packWords1),
+	[PACK_WORDS2]		= PACK_FUNCS(packWords2),
+	[PACK_WORDS3]		= PACK_FUNCS(packWords3),
+	[PACK_WORDS4]		= PACK_FUNCS(packWords4),
+	[PACK_WORDS]		= PACK_FUNCS(packWords),
+	[PACK_HALFWORDS2]	= PACK_FUNCS(packHalfwords2),
+	[PACK_HALFWORDS3]	= PACK_FUNCS(packHalfwords3),
+	[PACK_HALFWORDS4]	= PACK_FUNCS(packHalfwords4),
+	[PACK_HALFWORDS]	= PACK_FUNCS(packHalfwords),
+	[PACK_BYTES4]		= PACK_FUNCS(packBytes4),
+	[PACK_BYTES]		= PACK_FUNCS(packBytes),
+};
 
-			break;
+static unsigned int getPackLayout(const fimgArray *a)
+{
+	uintptr_t align = (uintptr_t)a->pointer | a->stride;
+
+	if (!(a->width % 4) && !(align % 4)) {
+		switch (a->width) {
+		case 4:
+			return PACK_WORDS1;
+		case 8:
+			return PACK_WORDS2;
+		case 12:
+			return PACK_WORDS3;
+		case 16:
+			return PACK_WORDS4;
+		default:
+			return PACK_WORDS;
 		}
-	/* bytes */
-	default:
-		/* Fallback - no check required */
-		{
-			const uint8_t *data, *next_data;
-
-			next_data = BUF_ADDR_8(a->pointer, *(idx++)*a->stride);
-			--cnt;
-
-			while (cnt--) {
-				data = next_data;
-				next_data = BUF_ADDR_8(a->pointer,
-							*(idx++)*a->stride);
-				len = a->width;
-
-				while (len >= 4) {
-					word = *(data++);
-					word |= *(data++) << 8;
-					word |= *(data++) << 16;
-					word |= *(data++) << 24;
-					*(buf++) = word;
-					len -= 4;
-				}
-
-				// Up to 3 bytes left
-				if (len) {
-					word = *(data++);
-					if (len == 2)
-						word |= *(data++) << 8;
-					if (len == 3)
-						word |= *(data++) << 16;
-
-					*(buf++) = word;
-				}
-			}
-
-			data = next_data;
-			len = a->width;
-
-			while (len >= 4) {
-				word = *(data++);
-				word |= *(data++) << 8;
-				word |= *(data++) << 16;
-				word |= *(data++) << 24;
-				*(buf++) = word;
-				len -= 4;
-			}
-
-			// Up to 3 bytes left
-			if (len) {
-				word = *(data++);
-				if (len == 2)
-					word |= *(data++) << 8;
-				if (len == 3)
-					word |= *(data++) << 16;
-
-				*(buf++) = word;
-			}
+	}
 
-			break;
+	if (!(a->width % 2) && !(align % 2)) {
+		switch (a->width) {
+		case 4:
+			return PACK_HALFWORDS2;
+		case 6:
+			return PACK_HALFWORDS3;
+		case 8:
+			return PACK_HALFWORDS4;
+		default:
+			return PACK_HALFWORDS;
 		}
 	}
 
-	return size;
+	if (a->width == 4)
+		return PACK_BYTES4;
+
+	return PACK_BYTES;
 }
 
-static uint32_t copyVertices1To1Idx16(fimgContext *ctx, fimgArray *arrays,
-			const uint16_t *indices, uint32_t *pos, uint32_t *count)
+/* Selects pack routines for given arrays, unless cached ones still apply */
+static void setupPacking(fimgContext *ctx,
+				fimgArray *arrays, unsigned int idxType)
 {
+	fimgPackCache *cache = &ctx->packCache;
 	fimgArray *a = arrays;
-	uint32_t batchSize = calculateBatchSize(arrays, ctx->numAttribs);
-	uint32_t i;
-	uint32_t offset = DATA_OFFSET;
-	uint8_t *buf = ctx->vertexData;
+	uint32_t layout, align = 0;
+	int valid;
+	unsigned int i;
 
-	if (batchSize > *count)
-		batchSize = *count;
+	valid = cache->idxType == idxType
+				&& cache->numAttribs == ctx->numAttribs;
 
 	for (i = 0; i < ctx->numAttribs; ++i, ++a) {
-		if (!a->stride) {
-			setVtxBufAttrib(ctx, i, CONST_ADDR(i), 0, batchSize);
-			memcpy(buf + CONST_ADDR(i), a->pointer, a->width);
-			continue;
+		layout = (a->width << 16) | a->stride;
+		align |= ((uintptr_t)a->pointer % 4) << (2*i);
+
+		if (cache->layout[i] != layout) {
+			cache->layout[i] = layout;
+			valid = 0;
 		}
-		setVtxBufAttrib(ctx, i, offset, (a->width + 3) & ~3, batchSize);
-		offset += packAttributeIdx16(ctx, (uint32_t *)(buf + offset),
-						a, indices + *pos, batchSize);
 	}
 
-	ctx->vertexDataSize = offset;
-
-	*pos += batchSize;
-	*count -= batchSize;
-	return batchSize;
-}
-
-static uint32_t copyVerticesLinestripIdx16(fimgContext *ctx, fimgArray *arrays,
-			const uint16_t *indices, uint32_t *pos, uint32_t *count)
-{
-	fimgArray *a = arrays;
-	uint32_t batchSize = calculateBatchSize(arrays, ctx->numAttribs);
-	uint32_t i;
-	uint32_t offset = DATA_OFFSET;
-	uint8_t *buf = ctx->vertexData;
-
-	if (*count < 2)
-		return 0;
+	if (valid && cache->align == align)
+		return;
 
-	if (batchSize > *count)
-		batchSize = *count;
+	cache->idxType = idxType;
+	cache->numAttribs = ctx->numAttribs;
+	cache->align = align;
+	cache->batchSize = calculateBatchSize(arrays, ctx->numAttribs);
 
+	a = arrays;
 	for (i = 0; i < ctx->numAttribs; ++i, ++a) {
 		if (!a->stride) {
-			setVtxBufAttrib(ctx, i, CONST_ADDR(i), 0, batchSize);
-			memcpy(buf + CONST_ADDR(i), a->pointer, a->width);
+			cache->pack[i] = NULL;
 			continue;
 		}
-		setVtxBufAttrib(ctx, i, offset, (a->width + 3) & ~3, batchSize);
-		offset += packAttributeIdx16(ctx, (uint32_t *)(buf + offset),
-						a, indices + *pos, batchSize);
-	}
-
-	ctx->vertexDataSize = offset;
-
-	*pos += batchSize - 1;
-	*count -= batchSize - 1;
-	return batchSize;
-}
 
-
-static uint32_t copyVerticesLinesIdx16(fimgContext *ctx, fimgArray *arrays,
-				const uint16_t *indices, uint32_t *pos, uint32_t *count)
-{
-	fimgArray *a = arrays;
-	uint32_t batchSize = calculateBatchSize(arrays, ctx->numAttribs);
-	uint32_t i;
-	uint32_t offset = DATA_OFFSET;
-	uint8_t *buf = ctx->vertexData;
-
-	if (*count < 2)
-		return 0;
-
-	if (batchSize > *count)
-		batchSize = *count;
-
-	if (batchSize % 2)
-		--batchSize;
-
-	for (i = 0; i < ctx->numAttribs; ++i, ++a) {
-		if (!a->stride) {
-			setVtxBufAttrib(ctx, i, CONST_ADDR(i), 0, batchSize);
-			memcpy(buf + CONST_ADDR(i), a->pointer, a->width);
+		if (idxType == FIMG_INDEX_NONE
+		    && a->stride == a->width && !(a->width % 4)) {
+			cache->pack[i] = packContiguous;
 			continue;
 		}
-		setVtxBufAttrib(ctx, i, offset, (a->width + 3) & ~3, batchSize);
-		offset += packAttributeIdx16(ctx, (uint32_t *)(buf + offset),
-						a, indices + *pos, batchSize);
+
+		cache->pack[i] = packFuncs[getPackLayout(a)][idxType];
 	}
+}
 
-	ctx->vertexDataSize = offset;
+/*
+ * Primitive handlers
+ */
 
-	*pos += batchSize;
-	*count -= batchSize;
-	return batchSize;
-}
+struct vertexSpan {
+	uint32_t pos;
+	uint32_t count;
+};
 
-static uint32_t copyVerticesTristripIdx16(fimgContext *ctx, fimgArray *arrays,
-			const uint16_t *indices, uint32_t *pos, uint32_t *count)
+/* Packs given ranges of vertices into current staging buffer */
+static void packBatch(fimgContext *ctx, fimgArray *arrays,
+			const void *indices, const struct vertexSpan *spans,
+			uint32_t numSpans, uint32_t vertices)
 {
+	fimgPackCache *cache = &ctx->packCache;
 	fimgArray *a = arrays;
-	uint32_t batchSize = calculateBatchSize(arrays, ctx->numAttribs) - 1;
-	uint32_t i;
 	uint32_t offset = DATA_OFFSET;
 	uint8_t *buf = ctx->vertexData;
-
-	if (*count < 3)
-		return 0;
-
-	if (batchSize >= *count)
-		batchSize = *count;
-	else if (batchSize % 2)
-		--batchSize;
+	uint32_t size;
+	uint32_t i, j;
 
 	for (i = 0; i < ctx->numAttribs; ++i, ++a) {
 		if (!a->stride) {
-			setVtxBufAttrib(ctx, i, CONST_ADDR(i), 0, batchSize + 1);
+			setVtxBufAttrib(ctx, i, CONST_ADDR(i), 0, vertices);
 			memcpy(buf + CONST_ADDR(i), a->pointer, a->width);
 			continue;
 		}
-		setVtxBufAttrib(ctx, i, offset, (a->width + 3) & ~3, batchSize + 1);
-		offset += packAttributeIdx16(ctx, (uint32_t *)(buf + offset),
-						a, indices + *pos, batchSize);
-		offset += packAttributeIdx16(ctx, (uint32_t *)(buf + offset),
-						a, indices + *pos + batchSize - 1, 1);
-	}
-
-	ctx->vertexDataSize = offset;
-
-	*pos += batchSize - 2;
-	*count -= batchSize - 2;
-	return batchSize + 1;
-}
-
-static uint32_t copyVerticesTrifanIdx16(fimgContext *ctx, fimgArray *arrays,
-			const uint16_t *indices, uint32_t *pos, uint32_t *count)
-{
-	fimgArray *a = arrays;
-	uint32_t batchSize = calculateBatchSize(arrays, ctx->numAttribs) - 2;
-	uint32_t i;
-	uint32_t offset = DATA_OFFSET;
-	uint8_t *buf = ctx->vertexData;
-
-	if (*count < 3)
-		return 0;
 
-	if (batchSize > *count)
-		batchSize = *count;
+		/* Vertices must be word aligned */
+		size = (a->width + 3) & ~3;
+		setVtxBufAttrib(ctx, i, offset, size, vertices);
 
-	for (i = 0; i < ctx->numAttribs; ++i, ++a) {
-		if (!a->stride) {
-			setVtxBufAttrib(ctx, i, CONST_ADDR(i), 0, batchSize + 2);
-			memcpy(buf + CONST_ADDR(i), a->pointer, a->width);
-			continue;
+		for (j = 0; j < numSpans; ++j) {
+			cache->pack[i]((uint32_t *)(buf + offset), a,
+					indices, spans[j].pos, spans[j].count);
+			offset += size*spans[j].count;
 		}
-		setVtxBufAttrib(ctx, i, offset, (a->width + 3) & ~3, batchSize + 2);
-		offset += packAttributeIdx16(ctx,
-				(uint32_t *)(buf + offset), a, indices, 1);
-		offset += packAttributeIdx16(ctx,
-				(uint32_t *)(buf + offset), a, indices, 1);
-		offset += packAttributeIdx16(ctx,
-				(uint32_t *)(buf + offset), a, indices, 1);
-		offset += packAttributeIdx16(ctx, (uint32_t *)(buf + offset),
-					a, indices + *pos + 1, batchSize - 1);
 	}
 
 	ctx->vertexDataSize = offset;
-
-	*pos += batchSize - 2;
-	*count -= batchSize - 2;
-	return batchSize + 2;
 }
 
-static uint32_t copyVerticesTrisIdx16(fimgContext *ctx, fimgArray *arrays,
-			const uint16_t *indices, uint32_t *pos, uint32_t *count)
+/* Generic vertex copy */
+static uint32_t copyVertices1To1(fimgContext *ctx, fimgArray *arrays,
+			const void *indices, uint32_t *pos, uint32_t *count)
 {
-	fimgArray *a = arrays;
-	uint32_t batchSize = calculateBatchSize(arrays, ctx->numAttribs);
-	uint32_t i;
-	uint32_t offset = DATA_OFFSET;
-	uint8_t *buf = ctx->vertexData;
+	uint32_t batchSize = ctx->packCache.batchSize;
+	struct vertexSpan span;
 
-	if (*count < 3)
+	if (!*count)
 		return 0;
 
 	if (batchSize > *count)
 		batchSize = *count;
 
-	if (batchSize % 3)
-		batchSize -= batchSize % 3;
-
-	for (i = 0; i < ctx->numAttribs; ++i, ++a) {
-		if (!a->stride) {
-			setVtxBufAttrib(ctx, i, CONST_ADDR(i), 0, batchSize);
-			memcpy(buf + CONST_ADDR(i), a->pointer, a->width);
-			continue;
-		}
-		setVtxBufAttrib(ctx, i, offset, (a->width + 3) & ~3, batchSize);
-		offset += packAttributeIdx16(ctx, (uint32_t *)(buf + offset),
-						a, indices + *pos, batchSize);
-	}
-
-	ctx->vertexDataSize = offset;
+	span.pos = *pos;
+	span.count = batchSize;
+	packBatch(ctx, arrays, indices, &span, 1, batchSize);
 
 	*pos += batchSize;
 	*count -= batchSize;
 	return batchSize;
 }
 
-/*
- * Indexed uint8_t
- */
-
-static uint32_t packAttributeIdx8(fimgContext *ctx, uint32_t *buf,
-				fimgArray *a, const uint8_t *idx, int cnt)
+static uint32_t copyVerticesLinestrip(fimgContext *ctx, fimgArray *arrays,
+			const void *indices, uint32_t *pos, uint32_t *count)
 {
-	register uint32_t word;
-	uint32_t size;
-	uint32_t len;
+	uint32_t batchSize = ctx->packCache.batchSize;
+	struct vertexSpan span;
 
-	if (!cnt)
+	if (*count < 2)
 		return 0;
 
-	/* Vertices must be word aligned */
-	size = (a->width + 3) & ~3;
-	size *= cnt;
-
-	switch(a->width % 4) {
-	/* words */
-	case 0:
-		/* Check if vertices are word aligned */
-		if ((uintptr_t)a->pointer % 4 == 0 && a->stride % 4 == 0) {
-			const uint32_t *data, *next_data;
-
-			next_data = BUF_ADDR_32(a->pointer, *(idx++)*a->stride);
-			--cnt;
-
-			while (cnt--) {
-				data = next_data;
-				next_data = BUF_ADDR_32(a->pointer,
-							*(idx++)*a->stride);
-				len = a->width;
-
-				while (len) {
-					*(buf++) = *(data++);
-					len -= 4;
-				}
-			}
-
-			data = next_data;
-			len = a->width;
-
-			while (len) {
-				*(buf++) = *(data++);
-				len -= 4;
-			}
-
-			break;
-		}
-	/* halfwords */
-	case 2:
-		/* Check if vertices are halfword aligned */
-		if ((uintptr_t)a->pointer % 2 == 0 && a->stride % 2 == 0) {
-			const uint16_t *data, *next_data;
-
-			next_data = BUF_ADDR_16(a->pointer, *(idx++)*a->stride);
-			--cnt;
-
-			while (cnt--) {
-				data = next_data;
-				next_data = BUF_ADDR_16(a->pointer,
-							*(idx++)*a->stride);
-				len = a->width;
-
-				while (len >= 4) {
-					word = *(data++);
-					word |= *(data++) << 16;
-					*(buf++) = word;
-					len -= 4;
-				}
-
-				/* Single halfword left */
-				if (len)
-					*(buf++) = *(data++);
-			}
-
-			data = next_data;
-			len = a->width;
-
-			while (len >= 4) {
-				word = *(data++);
-				word |= *(data++) << 16;
-				*(buf++) = word;
-				len -= 4;
-			}
-
-			break;
-		}
-	/* bytes */
-	default:
-		/* Fallback - no check required */
-		{
-			const uint8_t *data, *next_data;
-
-			next_data = BUF_ADDR_8(a->pointer, *(idx++)*a->stride);
-			--cnt;
-
-			while (cnt--) {
-				data = next_data;
-				next_data = BUF_ADDR_8(a->pointer,
-							*(idx++)*a->stride);
-				len = a->width;
-
-				while (len >= 4) {
-					word = *(data++);
-					word |= *(data++) << 8;
-					word |= *(data++) << 16;
-					word |= *(data++) << 24;
-					*(buf++) = word;
-					len -= 4;
-				}
-
-				// Up to 3 bytes left
-				if (len) {
-					word = *(data++);
-					if (len == 2)
-						word |= *(data++) << 8;
-					if (len == 3)
-						word |= *(data++) << 16;
-
-					*(buf++) = word;
-				}
-			}
-
-			data = next_data;
-			len = a->width;
-
-			while (len >= 4) {
-				word = *(data++);
-				word |= *(data++) << 8;
-				word |= *(data++) << 16;
-				word |= *(data++) << 24;
-				*(buf++) = word;
-				len -= 4;
-			}
-
-			// Up to 3 bytes left
-			if (len) {
-				word = *(data++);
-				if (len == 2)
-					word |= *(data++) << 8;
-				if (len == 3)
-					word |= *(data++) << 16;
-
-				*(buf++) = word;
-			}
-
-			break;
-		}
-	}
-
-	return size;
-}
-
-static uint32_t copyVertices1To1Idx8(fimgContext *ctx, fimgArray *arrays,
-			const uint8_t *indices, uint32_t *pos, uint32_t *count)
-{
-	fimgArray *a = arrays;
-	uint32_t batchSize = calculateBatchSize(arrays, ctx->numAttribs);
-	uint32_t i;
-	uint32_t offset = DATA_OFFSET;
-	uint8_t *buf = ctx->vertexData;
-
 	if (batchSize > *count)
 		batchSize = *count;
 
-	for (i = 0; i < ctx->numAttribs; ++i, ++a) {
-		if (!a->stride) {
-			setVtxBufAttrib(ctx, i, CONST_ADDR(i), 0, batchSize);
-			memcpy(buf + CONST_ADDR(i), a->pointer, a->width);
-			continue;
-		}
-		setVtxBufAttrib(ctx, i, offset, (a->width + 3) & ~3, batchSize);
-		offset += packAttributeIdx8(ctx, (uint32_t *)(buf + offset),
-						a, indices + *pos, batchSize);
-	}
-
-	ctx->vertexDataSize = offset;
+	span.pos = *pos;
+	span.count = batchSize;
+	packBatch(ctx, arrays, indices, &span, 1, batchSize);
 
-	*pos += batchSize;
-	*count -= batchSize;
+	*pos += batchSize - 1;
+	*count -= batchSize - 1;
 	return batchSize;
 }
 
-static uint32_t copyVerticesLinestripIdx8(fimgContext *ctx, fimgArray *arrays,
-			const uint8_t *indices, uint32_t *pos, uint32_t *count)
+/*
+ * Line loops are drawn as line strips with the first vertex appended
+ * after the last one. If the closing vertex doesn't fit into the batch
+ * with the last vertex, the strip ends without it and the closing segment
+ * goes to the next batch.
+ */
+static uint32_t copyVerticesLineloop(fimgContext *ctx, fimgArray *arrays,
+			const void *indices, uint32_t *pos, uint32_t *count)
 {
-	fimgArray *a = arrays;
-	uint32_t batchSize = calculateBatchSize(arrays, ctx->numAttribs);
-	uint32_t i;
-	uint32_t offset = DATA_OFFSET;
-	uint8_t *buf = ctx->vertexData;
+	uint32_t batchSize = ctx->packCache.batchSize;
+	struct vertexSpan spans[2];
 
-	if (*count < 2)
+	if (!*count)
 		return 0;
 
-	if (batchSize > *count)
+	if (batchSize > *count) {
 		batchSize = *count;
 
-	for (i = 0; i < ctx->numAttribs; ++i, ++a) {
-		if (!a->stride) {
-			setVtxBufAttrib(ctx, i, CONST_ADDR(i), 0, batchSize);
-			memcpy(buf + CONST_ADDR(i), a->pointer, a->width);
-			continue;
-		}
-		setVtxBufAttrib(ctx, i, offset, (a->width + 3) & ~3, batchSize);
-		offset += packAttributeIdx8(ctx, (uint32_t *)(buf + offset),
-						a, indices + *pos, batchSize);
+		spans[0].pos = *pos;
+		spans[0].count = batchSize;
+		spans[1].pos = 0;
+		spans[1].count = 1;
+		packBatch(ctx, arrays, indices, spans, 2, batchSize + 1);
+
+		*pos += batchSize;
+		*count = 0;
+		return batchSize + 1;
 	}
 
-	ctx->vertexDataSize = offset;
+	spans[0].pos = *pos;
+	spans[0].count = batchSize;
+	packBatch(ctx, arrays, indices, spans, 1, batchSize);
 
 	*pos += batchSize - 1;
 	*count -= batchSize - 1;
 	return batchSize;
 }
 
-
-static uint32_t copyVerticesLinesIdx8(fimgContext *ctx, fimgArray *arrays,
-			const uint8_t *indices, uint32_t *pos, uint32_t *count)
+static uint32_t copyVerticesLines(fimgContext *ctx, fimgArray *arrays,
+			const void *indices, uint32_t *pos, uint32_t *count)
 {
-	fimgArray *a = arrays;
-	uint32_t batchSize = calculateBatchSize(arrays, ctx->numAttribs);
-	uint32_t i;
-	uint32_t offset = DATA_OFFSET;
-	uint8_t *buf = ctx->vertexData;
+	uint32_t batchSize = ctx->packCache.batchSize;
+	struct vertexSpan span;
 
 	if (*count < 2)
 		return 0;
@@ -1175,32 +729,20 @@ static uint32_t copyVerticesLinesIdx8(fimgContext *ctx, fimgArray *arrays,
 	if (batchSize % 2)
 		--batchSize;
 
-	for (i = 0; i < ctx->numAttribs; ++i, ++a) {
-		if (!a->stride) {
-			setVtxBufAttrib(ctx, i, CONST_ADDR(i), 0, batchSize);
-			memcpy(buf + CONST_ADDR(i), a->pointer, a->width);
-			continue;
-		}
-		setVtxBufAttrib(ctx, i, offset, (a->width + 3) & ~3, batchSize);
-		offset += packAttributeIdx8(ctx, (uint32_t *)(buf + offset),
-						a, indices + *pos, batchSize);
-	}
-
-	ctx->vertexDataSize = offset;
+	span.pos = *pos;
+	span.count = batchSize;
+	packBatch(ctx, arrays, indices, &span, 1, batchSize);
 
 	*pos += batchSize;
 	*count -= batchSize;
 	return batchSize;
 }
 
-static uint32_t copyVerticesTristripIdx8(fimgContext *ctx, fimgArray *arrays,
-			const uint8_t *indices, uint32_t *pos, uint32_t *count)
+static uint32_t copyVerticesTristrip(fimgContext *ctx, fimgArray *arrays,
+			const void *indices, uint32_t *pos, uint32_t *count)
 {
-	fimgArray *a = arrays;
-	uint32_t batchSize = calculateBatchSize(arrays, ctx->numAttribs) - 1;
-	uint32_t i;
-	uint32_t offset = DATA_OFFSET;
-	uint8_t *buf = ctx->vertexData;
+	uint32_t batchSize = ctx->packCache.batchSize - 1;
+	struct vertexSpan spans[2];
 
 	if (*count < 3)
 		return 0;
@@ -1210,34 +752,22 @@ static uint32_t copyVerticesTristripIdx8(fimgContext *ctx, fimgArray *arrays,
 	else if (batchSize % 2)
 		--batchSize;
 
-	for (i = 0; i < ctx->numAttribs; ++i, ++a) {
-		if (!a->stride) {
-			setVtxBufAttrib(ctx, i, CONST_ADDR(i), 0, batchSize + 1);
-			memcpy(buf + CONST_ADDR(i), a->pointer, a->width);
-			continue;
-		}
-		setVtxBufAttrib(ctx, i, offset, (a->width + 3) & ~3, batchSize + 1);
-		offset += packAttributeIdx8(ctx, (uint32_t *)(buf + offset),
-						a, indices + *pos, batchSize);
-		offset += packAttributeIdx8(ctx, (uint32_t *)(buf + offset),
-						a, indices + *pos + batchSize - 1, 1);
-	}
-
-	ctx->vertexDataSize = offset;
+	spans[0].pos = *pos;
+	spans[0].count = batchSize;
+	spans[1].pos = *pos + batchSize - 1;
+	spans[1].count = 1;
+	packBatch(ctx, arrays, indices, spans, 2, batchSize + 1);
 
 	*pos += batchSize - 2;
 	*count -= batchSize - 2;
 	return batchSize + 1;
 }
 
-static uint32_t copyVerticesTrifanIdx8(fimgContext *ctx, fimgArray *arrays,
-			const uint8_t *indices, uint32_t *pos, uint32_t *count)
+static uint32_t copyVerticesTrifan(fimgContext *ctx, fimgArray *arrays,
+			const void *indices, uint32_t *pos, uint32_t *count)
 {
-	fimgArray *a = arrays;
-	uint32_t batchSize = calculateBatchSize(arrays, ctx->numAttribs) - 2;
-	uint32_t i;
-	uint32_t offset = DATA_OFFSET;
-	uint8_t *buf = ctx->vertexData;
+	uint32_t batchSize = ctx->packCache.batchSize - 2;
+	struct vertexSpan spans[4];
 
 	if (*count < 3)
 		return 0;
@@ -1245,38 +775,24 @@ static uint32_t copyVerticesTrifanIdx8(fimgContext *ctx, fimgArray *arrays,
 	if (batchSize > *count)
 		batchSize = *count;
 
-	for (i = 0; i < ctx->numAttribs; ++i, ++a) {
-		if (!a->stride) {
-			setVtxBufAttrib(ctx, i, CONST_ADDR(i), 0, batchSize + 2);
-			memcpy(buf + CONST_ADDR(i), a->pointer, a->width);
-			continue;
-		}
-		setVtxBufAttrib(ctx, i, offset, (a->width + 3) & ~3, batchSize + 2);
-		offset += packAttributeIdx8(ctx,
-				(uint32_t *)(buf + offset), a, indices, 1);
-		offset += packAttributeIdx8(ctx,
-				(uint32_t *)(buf + offset), a, indices, 1);
-		offset += packAttributeIdx8(ctx,
-				(uint32_t *)(buf + offset), a, indices, 1);
-		offset += packAttributeIdx8(ctx, (uint32_t *)(buf + offset),
-					a, indices + *pos + 1, batchSize - 1);
-	}
-
-	ctx->vertexDataSize = offset;
+	spans[0].pos = 0;
+	spans[0].count = 1;
+	spans[1] = spans[0];
+	spans[2] = spans[0];
+	spans[3].pos = *pos + 1;
+	spans[3].count = batchSize - 1;
+	packBatch(ctx, arrays, indices, spans, 4, batchSize + 2);
 
 	*pos += batchSize - 2;
 	*count -= batchSize - 2;
 	return batchSize + 2;
 }
 
-static uint32_t copyVerticesTrisIdx8(fimgContext *ctx, fimgArray *arrays,
-				const uint8_t *indices, uint32_t *pos, uint32_t *count)
+static uint32_t copyVerticesTris(fimgContext *ctx, fimgArray *arrays,
+			const void *indices, uint32_t *pos, uint32_t *count)
 {
-	fimgArray *a = arrays;
-	uint32_t batchSize = calculateBatchSize(arrays, ctx->numAttribs);
-	uint32_t i;
-	uint32_t offset = DATA_OFFSET;
-	uint8_t *buf = ctx->vertexData;
+	uint32_t batchSize = ctx->packCache.batchSize;
+	struct vertexSpan span;
 
 	if (*count < 3)
 		return 0;
@@ -1287,18 +803,9 @@ static uint32_t copyVerticesTrisIdx8(fimgContext *ctx, fimgArray *arrays,
 	if (batchSize % 3)
 		batchSize -= batchSize % 3;
 
-	for (i = 0; i < ctx->numAttribs; ++i, ++a) {
-		if (!a->stride) {
-			setVtxBufAttrib(ctx, i, CONST_ADDR(i), 0, batchSize);
-			memcpy(buf + CONST_ADDR(i), a->pointer, a->width);
-			continue;
-		}
-		setVtxBufAttrib(ctx, i, offset, (a->width + 3) & ~3, batchSize);
-		offset += packAttributeIdx8(ctx, (uint32_t *)(buf + offset),
-						a, indices + *pos, batchSize);
-	}
-
-	ctx->vertexDataSize = offset;
+	span.pos = *pos;
+	span.count = batchSize;
+	packBatch(ctx, arrays, indices, &span, 1, batchSize);
 
 	*pos += batchSize;
 	*count -= batchSize;
@@ -1309,60 +816,18 @@ static uint32_t copyVerticesTrisIdx8(fimgContext *ctx, fimgArray *arrays,
  * Primitive engine has problems with triangle strips and triangle fans,
  * so in those cases geometry must be converted to separate triangles
  */
-struct primitiveHandler {
-	uint32_t (*direct)(fimgContext *, fimgArray *, uint32_t *, uint32_t *);
-	uint32_t (*indexed_8)(fimgContext *, fimgArray *,
-				const uint8_t *, uint32_t *, uint32_t *);
-	uint32_t (*indexed_16)(fimgContext *, fimgArray *,
-				const uint16_t *, uint32_t *, uint32_t *);
-};
-
-static const struct primitiveHandler primitiveHandler[FGPE_PRIMITIVE_MAX] = {
-	[FGPE_POINT_SPRITE] = {
-		.direct		= copyVertices1To1,
-		.indexed_8	= copyVertices1To1Idx8,
-		.indexed_16	= copyVertices1To1Idx16
-	},
-	[FGPE_POINTS] = {
-		.direct		= copyVertices1To1,
-		.indexed_8	= copyVertices1To1Idx8,
-		.indexed_16	= copyVertices1To1Idx16
-	},
-	[FGPE_LINE_STRIP] = {
-		.direct		= copyVerticesLinestrip,
-		.indexed_8	= copyVerticesLinestripIdx8,
-		.indexed_16	= copyVerticesLinestripIdx16
-	},
-	[FGPE_LINE_LOOP] = {
-		/*
-		 * Line loops don't go well with buffered transfers,
-		 * so let's just force higher level code to emulate them
-		 * using line strips.
-		 */
-		.direct		= 0,
-		.indexed_8	= 0,
-		.indexed_16	= 0
-	},
-	[FGPE_LINES] = {
-		.direct		= copyVerticesLines,
-		.indexed_8	= copyVerticesLinesIdx8,
-		.indexed_16	= copyVerticesLinesIdx16
-	},
-	[FGPE_TRIANGLE_STRIP] = {
-		.direct		= copyVerticesTristrip,
-		.indexed_8	= copyVerticesTristripIdx8,
-		.indexed_16	= copyVerticesTristripIdx16
-	},
-	[FGPE_TRIANGLE_FAN] = {
-		.direct		= copyVerticesTrifan,
-		.indexed_8	= copyVerticesTrifanIdx8,
-		.indexed_16	= copyVerticesTrifanIdx16
-	},
-	[FGPE_TRIANGLES] = {
-		.direct		= copyVerticesTris,
-		.indexed_8	= copyVerticesTrisIdx8,
-		.indexed_16	= copyVerticesTrisIdx16
-	},
+typedef uint32_t (*primitiveHandler)(fimgContext *, fimgArray *,
+					const void *, uint32_t *, uint32_t *);
+
+static const primitiveHandler primitiveHandlers[FGPE_PRIMITIVE_MAX] = {
+	[FGPE_POINT_SPRITE]	= copyVertices1To1,
+	[FGPE_POINTS]		= copyVertices1To1,
+	[FGPE_LINE_STRIP]	= copyVerticesLinestrip,
+	[FGPE_LINE_LOOP]	= copyVerticesLineloop,
+	[FGPE_LINES]		= copyVerticesLines,
+	[FGPE_TRIANGLE_STRIP]	= copyVerticesTristrip,
+	[FGPE_TRIANGLE_FAN]	= copyVerticesTrifan,
+	[FGPE_TRIANGLES]	= copyVerticesTris,
 };
 
 static inline void drawAutoinc(fimgContext *ctx,
@@ -1387,154 +852,129 @@ static void setupAttributes(fimgContext *ctx, fimgArray *arrays)
 	fimgWrite(ctx, last.val, FGHI_ATTRIB(i));
 }
 
-static void setupVertexBuffer(fimgContext *ctx)
+static void setupVertexBuffer(fimgContext *ctx, fimgVertexBatch *batch)
 {
 	unsigned int i;
 
 	for (i = 0; i < ctx->numAttribs; i++) {
-		fimgWrite(ctx, ctx->host.vbctrl[i].val, FGHI_ATTRIB_VBCTRL(i));
-		fimgWrite(ctx, ctx->host.vbbase[i], FGHI_ATTRIB_VBBASE(i));
+		fimgWrite(ctx, batch->vbctrl[i].val, FGHI_ATTRIB_VBCTRL(i));
+		fimgWrite(ctx, batch->vbbase[i], FGHI_ATTRIB_VBBASE(i));
 	}
 }
 
-void fimgDrawArrays(fimgContext *ctx, unsigned int mode,
-					fimgArray *arrays, unsigned int count)
+/*
+ * Vertex batch staging
+ *
+ * Packed batches are queued in a ring of staging buffers. While the
+ * hardware is busy with previously submitted batch, following batches
+ * are packed in advance, so the CPU has to wait for the pipeline only
+ * when the ring is full or there is nothing more to pack.
+ */
+
+static void allocVertexBatches(fimgContext *ctx)
 {
-	unsigned int copied;
-	unsigned int first = 0;
+	uint8_t *data;
+	unsigned int i;
 
-	if (mode >= FGPE_PRIMITIVE_MAX)
+	if (ctx->vertexBatch[0].data)
 		return;
 
-	if (!primitiveHandler[mode].direct) {
-		LOGE("%s: Unsupported mode %d", __func__, mode);
-		return;
+	data = memalign(32, FIMG_VERTEX_BATCHES*VERTEX_BUFFER_SIZE);
+	if (!data) {
+		LOGE("Failed to allocate vertex data buffer. Terminating.");
+		exit(ENOMEM);
 	}
 
-	if (!ctx->vertexData) {
-		ctx->vertexData = memalign(32, VERTEX_BUFFER_SIZE);
-		if (!ctx->vertexData) {
-			LOGE("Failed to allocate vertex data buffer. Terminating.");
-			exit(ENOMEM);
-		}
+	for (i = 0; i < FIMG_VERTEX_BATCHES; ++i) {
+		ctx->vertexBatch[i].data = data;
+		data += VERTEX_BUFFER_SIZE;
 	}
 
-	/* Prepare first batch without waiting for hardware */
-	copied = primitiveHandler[mode].direct(ctx, arrays, &first, &count);
-	if (!copied)
-		return;
+	ctx->batchHead = 0;
+	ctx->batchCount = 0;
+}
 
-	/* Get hardware */
-	fimgGetHardware(ctx);
-	fimgFlush(ctx);
-	fimgFlushContext(ctx);
-	fimgSetVertexContext(ctx, mode);
+/* Selects next free staging buffer as packing destination */
+static inline void beginBatch(fimgContext *ctx)
+{
+	unsigned int slot = ctx->batchHead + ctx->batchCount;
 
-	setupAttributes(ctx, arrays);
-#ifdef FIMG_DUMP_STATE_BEFORE_DRAW
-	fimgDumpState(ctx, mode, count, __func__);
-#endif
+	if (slot >= FIMG_VERTEX_BATCHES)
+		slot -= FIMG_VERTEX_BATCHES;
 
-	do {
-#if 0
-		fimgSelectiveFlush(ctx, FGHI_PIPELINE_FIFO
-				| FGHI_PIPELINE_HOSTIF | FGHI_PIPELINE_HVF);
-#else
-		fimgFlush(ctx);
-#endif
-		fillVertexBuffer(ctx);
-		setupVertexBuffer(ctx);
-		drawAutoinc(ctx, 0, copied);
-		copied = primitiveHandler[mode].direct(ctx,
-							arrays, &first, &count);
-	} while (copied);
-
-	/* Release hardware */
-	fimgPutHardware(ctx);
+	ctx->packBatch = &ctx->vertexBatch[slot];
+	ctx->vertexData = ctx->packBatch->data;
 }
 
-void fimgDrawElementsUByteIdx(fimgContext *ctx, unsigned int mode,
-		fimgArray *arrays, unsigned int count, const uint8_t *indices)
+/* Queues packed batch for submission, if anything has been packed */
+static inline void endBatch(fimgContext *ctx, uint32_t copied)
 {
-	unsigned int copied;
-	unsigned int pos = 0;
-
-	if (mode >= FGPE_PRIMITIVE_MAX)
+	if (!copied)
 		return;
 
-	if (!primitiveHandler[mode].indexed_8) {
-		LOGE("%s: Unsupported mode %d", __func__, mode);
-		return;
-	}
+	ctx->packBatch->size = ctx->vertexDataSize;
+	ctx->packBatch->count = copied;
+	++ctx->batchCount;
+}
 
-	if (!ctx->vertexData) {
-		ctx->vertexData = memalign(32, VERTEX_BUFFER_SIZE);
-		if (!ctx->vertexData) {
-			LOGE("Failed to allocate vertex data buffer. Terminating.");
-			exit(ENOMEM);
-		}
-	}
+/* Checks whether next batch should be packed before submitting queued ones */
+static inline int canStageBatch(fimgContext *ctx)
+{
+	if (!ctx->batchCount)
+		return 1;
 
-	/* Prepare first batch without waiting for hardware */
-	copied = primitiveHandler[mode].indexed_8(ctx,
-						arrays, indices, &pos, &count);
-	if (!copied)
-		return;
+	if (ctx->batchCount == FIMG_VERTEX_BATCHES)
+		return 0;
 
-	/* Get hardware */
-	fimgGetHardware(ctx);
-	fimgFlush(ctx);
-	fimgFlushContext(ctx);
-	fimgSetVertexContext(ctx, mode);
+	/* Pack ahead only if we would have to wait for hardware anyway */
+	return (fimgGetPipelineStatus(ctx) & FGHI_PIPELINE_ALL) != 0;
+}
 
-	setupAttributes(ctx, arrays);
-#ifdef FIMG_DUMP_STATE_BEFORE_DRAW
-	fimgDumpState(ctx, mode, count, __func__);
-#endif
+/* Transfers oldest queued batch to hardware and starts drawing it */
+static void submitBatch(fimgContext *ctx)
+{
+	fimgVertexBatch *batch = &ctx->vertexBatch[ctx->batchHead];
 
-	do {
 #if 0
-		fimgSelectiveFlush(ctx, FGHI_PIPELINE_FIFO
-				| FGHI_PIPELINE_HOSTIF | FGHI_PIPELINE_HVF);
+	fimgSelectiveFlush(ctx, FGHI_PIPELINE_FIFO
+			| FGHI_PIPELINE_HOSTIF | FGHI_PIPELINE_HVF);
 #else
-		fimgFlush(ctx);
+	fimgFlush(ctx);
 #endif
-		fillVertexBuffer(ctx);
-		setupVertexBuffer(ctx);
-		drawAutoinc(ctx, 0, copied);
-		copied = primitiveHandler[mode].indexed_8(ctx,
-						arrays, indices, &pos, &count);
-	} while (copied);
-
-	/* Release hardware */
-	fimgPutHardware(ctx);
+	fillVertexBuffer(ctx, batch);
+	setupVertexBuffer(ctx, batch);
+	drawAutoinc(ctx, 0, batch->count);
+
+	if (++ctx->batchHead == FIMG_VERTEX_BATCHES)
+		ctx->batchHead = 0;
+	--ctx->batchCount;
 }
 
-void fimgDrawElementsUShortIdx(fimgContext *ctx, unsigned int mode,
-		fimgArray *arrays, unsigned int count, const uint16_t *indices)
+
+static void drawPrimitives(fimgContext *ctx, unsigned int mode,
+			fimgArray *arrays, unsigned int count,
+			const void *indices, unsigned int idxType)
 {
+	primitiveHandler handler;
 	unsigned int copied;
 	unsigned int pos = 0;
 
 	if (mode >= FGPE_PRIMITIVE_MAX)
 		return;
 
-	if (!primitiveHandler[mode].indexed_16) {
+	handler = primitiveHandlers[mode];
+	if (!handler) {
 		LOGE("%s: Unsupported mode %d", __func__, mode);
 		return;
 	}
 
-	if (!ctx->vertexData) {
-		ctx->vertexData = memalign(32, VERTEX_BUFFER_SIZE);
-		if (!ctx->vertexData) {
-			LOGE("Failed to allocate vertex data buffer. Terminating.");
-			exit(ENOMEM);
-		}
-	}
+	allocVertexBatches(ctx);
+	setupPacking(ctx, arrays, idxType);
 
 	/* Prepare first batch without waiting for hardware */
-	copied = primitiveHandler[mode].indexed_16(ctx,
-						arrays, indices, &pos, &count);
+	beginBatch(ctx);
+	copied = handler(ctx, arrays, indices, &pos, &count);
+	endBatch(ctx, copied);
 	if (!copied)
 		return;
 
@@ -1542,29 +982,52 @@ void fimgDrawElementsUShortIdx(fimgContext *ctx, unsigned int mode,
 	fimgGetHardware(ctx);
 	fimgFlush(ctx);
 	fimgFlushContext(ctx);
-	fimgSetVertexContext(ctx, mode);
+	/* Batches of line loops are closed explicitly, see above */
+	if (mode == FGPE_LINE_LOOP)
+		fimgSetVertexContext(ctx, FGPE_LINE_STRIP);
+	else
+		fimgSetVertexContext(ctx, mode);
 
 	setupAttributes(ctx, arrays);
 #ifdef FIMG_DUMP_STATE_BEFORE_DRAW
 	fimgDumpState(ctx, mode, count, __func__);
 #endif
 
-	do {
-#if 0
-		fimgSelectiveFlush(ctx, FGHI_PIPELINE_FIFO
-				| FGHI_PIPELINE_HOSTIF | FGHI_PIPELINE_HVF);
-#else
-		fimgFlush(ctx);
-#endif
-		fillVertexBuffer(ctx);
-		setupVertexBuffer(ctx);
-		drawAutoinc(ctx, 0, copied);
-		copied = primitiveHandler[mode].indexed_16(ctx,
-						arrays, indices, &pos, &count);
-	} while (copied);
-
-	/* Release hardware */
-	fimgPutHardware(ctx);
+	for (;;) {
+		while (copied && canStageBatch(ctx)) {
+			beginBatch(ctx);
+			copied = handler(ctx, arrays, indices, &pos, &count);
+			endBatch(ctx, copied);
+		}
+
+		if (!ctx->batchCount)
+			break;
+
+		submitBatch(ctx);
+	}
+
+	fimgSubmitFence(ctx);
+
+	/* Keep hardware for next draw, unless the lease expired */
+	fimgLeaseHardware(ctx);
+}
+
+void fimgDrawArrays(fimgContext *ctx, unsigned int mode,
+					fimgArray *arrays, unsigned int count)
+{
+	drawPrimitives(ctx, mode, arrays, count, NULL, FIMG_INDEX_NONE);
+}
+
+void fimgDrawElementsUByteIdx(fimgContext *ctx, unsigned int mode,
+		fimgArray *arrays, unsigned int count, const uint8_t *indices)
+{
+	drawPrimitives(ctx, mode, arrays, count, indices, FIMG_INDEX_UBYTE);
+}
+
+void fimgDrawElementsUShortIdx(fimgContext *ctx, unsigned int mode,
+		fimgArray *arrays, unsigned int count, const uint16_t *indices)
+{
+	drawPrimitives(ctx, mode, arrays, count, indices, FIMG_INDEX_USHORT);
 }
 
 /*
@@ -1588,10 +1051,7 @@ void fimgCreateHostContext(fimgContext *ctx)
 
 	for(i = 0; i < FIMG_ATTRIB_NUM; i++)
 		ctx->host.attrib[i].val = template.val;
-}
 
-void fimgRestoreHostState(fimgContext *ctx)
-{
-	fimgWrite(ctx, 1, FGHI_IDXOFFSET);
-	fimgWrite(ctx, ctx->host.control.val, FGHI_CONTROL);
+	fimgQueue(ctx, 1, FGHI_IDXOFFSET);
+	fimgQueue(ctx, ctx->host.control.val, FGHI_CONTROL);
 }
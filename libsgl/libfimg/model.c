@@ -0,0 +1,386 @@
+/*
+ * fimg/model.c
+ *
+ * SAMSUNG S3C6410 FIMG-3DSE SOFTWARE REGISTER MODEL
+ *
+ * Copyrights:	2026 by agent < agent at local >
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The model replaces /dev/s3c-g3d with an in-process register file, so
+ * the library can be run (and profiled) on machines without the GPU.
+ * Every register write is recorded in a ring buffer together with
+ * a timestamp and accounted in per-block counters. Registers with side
+ * effects (cache control, interrupt pending) behave as if the hardware
+ * completed the requested operation immediately and the pipeline is
+ * always reported as idle. Like the device, all models share a single
+ * hardware lock, which blocks until released by its holder.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include "fimg_private.h"
+#include "s3c_g3d.h"
+
+#ifdef FIMG_SOFTWARE_MODEL
+
+/* Selected registers with side effects */
+#define FGGB_PIPESTATE		0x0000
+#define FGGB_CACHECTL		0x0004
+#define FGGB_VERSION		0x0010
+#define FGGB_INTPENDING		0x0040
+#define FGHI_DWSPACE		0x8000
+#define FGHI_FIFO_ENTRY		0xc000
+
+/* Register regions used for write accounting */
+#define FGHI_VB_START		0xe000
+#define FGHI_VB_END		0x10000
+#define FGVS_INSTMEM_START	0x10000
+#define FGVS_INSTMEM_END	0x14000
+#define FGVS_CONST_START	0x14000
+#define FGVS_CONST_END		0x1c000
+#define FGPS_INSTMEM_START	0x40000
+#define FGPS_INSTMEM_END	0x44000
+#define FGPS_CONST_START	0x44000
+#define FGPS_CONST_END		0x4c000
+
+/* Reported hardware version (FIMG-3DSE v1.5) */
+#define FIMG_MODEL_VERSION	((1 << 24) | (5 << 16))
+/* Free space reported by the host interface FIFO */
+#define FIMG_MODEL_FIFO_SIZE	32
+
+struct _fimgModel {
+	uint32_t		*regs;
+	int			contextLost;
+	fimgModelStats		stats;
+	unsigned int		logHead;
+	unsigned int		logCount;
+	fimgModelRecord		log[FIMG_MODEL_LOG_SIZE];
+};
+
+/* Hardware lock shared by all models of the process */
+static pthread_mutex_t lockMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lockCond = PTHREAD_COND_INITIALIZER;
+/* Model holding the lock, NULL if free */
+static fimgModel *lockOwner;
+/* Model which held the lock last, so its context is in the hardware */
+static fimgModel *lockLastOwner;
+
+static inline void logWrite(fimgModel *model, uint64_t time,
+					unsigned int data, unsigned int addr)
+{
+	fimgModelRecord *rec = &model->log[model->logHead];
+
+	rec->time = time;
+	rec->addr = addr;
+	rec->data = data;
+
+	model->logHead = (model->logHead + 1) % FIMG_MODEL_LOG_SIZE;
+	if (model->logCount < FIMG_MODEL_LOG_SIZE)
+		++model->logCount;
+}
+
+static inline void accountWrite(fimgModelStats *stats, unsigned int addr)
+{
+	if (addr >= FGHI_VB_START && addr < FGHI_VB_END)
+		++stats->vbWords;
+	else if (addr >= FGVS_INSTMEM_START && addr < FGVS_INSTMEM_END)
+		++stats->shaderWords;
+	else if (addr >= FGPS_INSTMEM_START && addr < FGPS_INSTMEM_END)
+		++stats->shaderWords;
+	else if (addr >= FGVS_CONST_START && addr < FGVS_CONST_END)
+		++stats->constWords;
+	else if (addr >= FGPS_CONST_START && addr < FGPS_CONST_END)
+		++stats->constWords;
+}
+
+/*****************************************************************************
+ * FUNCTION:	fimgModelWrite
+ * SYNOPSIS:	This function records a single register write and emulates
+ *		side effects of the written register. It is called by
+ *		fimgWrite after the value has been stored in the register file.
+ * ARGUMENTS:	data - written value
+ *		addr - register offset
+ *****************************************************************************/
+void fimgModelWrite(fimgContext *ctx, unsigned int data, unsigned int addr)
+{
+	fimgModel *model = ctx->model;
+
+	logWrite(model, fimgGetTimestamp(), data, addr);
+	++model->stats.regWrites;
+
+	switch (addr) {
+	case FGGB_CACHECTL:
+		/* Cache operations complete immediately */
+		model->regs[addr / 4] = 0;
+		break;
+	case FGGB_INTPENDING:
+		/* Writing clears pending interrupt */
+		model->regs[addr / 4] = 0;
+		break;
+	case FGHI_FIFO_ENTRY:
+		/* Every draw request consists of vertex count and index */
+		if (!(++model->stats.fifoWords % 2))
+			++model->stats.draws;
+		break;
+	default:
+		accountWrite(&model->stats, addr);
+	}
+}
+
+/*****************************************************************************
+ * FUNCTION:	fimgModelWriteBlock
+ * SYNOPSIS:	This function records a block of words stored directly
+ *		through the register mapping (vertex buffer, shader program
+ *		and constant memory, texture state).
+ * ARGUMENTS:	addr - offset of first written register
+ *		count - number of written words
+ *****************************************************************************/
+void fimgModelWriteBlock(fimgContext *ctx, unsigned int addr,
+							unsigned int count)
+{
+	fimgModel *model = ctx->model;
+	const uint32_t *reg = &model->regs[addr / 4];
+	uint64_t time = fimgGetTimestamp();
+
+	model->stats.blockWrites += count;
+
+	while (count--) {
+		logWrite(model, time, *(reg++), addr);
+		accountWrite(&model->stats, addr);
+		addr += 4;
+	}
+}
+
+/*****************************************************************************
+ * FUNCTION:	fimgModelIoctl
+ * SYNOPSIS:	This function emulates ioctls of the G3D device
+ * RETURNS:	the same values as respective ioctl of the real device
+ * ARGUMENTS:	request - S3C_G3D_LOCK, S3C_G3D_UNLOCK or S3C_G3D_FLUSH
+ *		arg - ioctl argument
+ *****************************************************************************/
+int fimgModelIoctl(fimgContext *ctx, unsigned int request, unsigned long arg)
+{
+	fimgModel *model = ctx->model;
+	int ret;
+
+	switch (request) {
+	case S3C_G3D_LOCK:
+		pthread_mutex_lock(&lockMutex);
+		if (lockOwner == model) {
+			pthread_mutex_unlock(&lockMutex);
+			LOGE("Model: Hardware lock acquired recursively.");
+			return -1;
+		}
+		while (lockOwner)
+			pthread_cond_wait(&lockCond, &lockMutex);
+		lockOwner = model;
+		++model->stats.locks;
+		/*
+		 * Report lost context after (re)opening the device
+		 * or after the hardware was used by someone else.
+		 */
+		ret = model->contextLost
+			|| (lockLastOwner && lockLastOwner != model);
+		model->contextLost = 0;
+		lockLastOwner = model;
+		pthread_mutex_unlock(&lockMutex);
+		return ret;
+	case S3C_G3D_UNLOCK:
+		pthread_mutex_lock(&lockMutex);
+		if (lockOwner != model) {
+			pthread_mutex_unlock(&lockMutex);
+			LOGE("Model: Hardware lock released without being held.");
+			return -1;
+		}
+		lockOwner = NULL;
+		++model->stats.unlocks;
+		pthread_cond_broadcast(&lockCond);
+		pthread_mutex_unlock(&lockMutex);
+		return 0;
+	case S3C_G3D_FLUSH:
+		/* Pipeline is always idle */
+		++model->stats.flushes;
+		return 0;
+	default:
+		LOGE("Model: Unsupported ioctl %08x.", request);
+		return -1;
+	}
+}
+
+/*****************************************************************************
+ * FUNCTION:	fimgModelOpen
+ * SYNOPSIS:	This function creates the register model in place of the G3D
+ *		device.
+ * RETURNS:	 0, on success
+ *		-errno, on error
+ *****************************************************************************/
+int fimgModelOpen(fimgContext *ctx)
+{
+	fimgModel *model;
+
+	model = malloc(sizeof(*model));
+	if (!model) {
+		LOGE("Couldn't allocate register model.");
+		return -ENOMEM;
+	}
+
+	model->regs = calloc(1, FIMG_SFR_SIZE);
+	if (!model->regs) {
+		LOGE("Couldn't allocate register model.");
+		free(model);
+		return -ENOMEM;
+	}
+
+	model->contextLost = 1;
+	model->logHead = 0;
+	model->logCount = 0;
+	memset(&model->stats, 0, sizeof(model->stats));
+
+	model->regs[FGGB_PIPESTATE / 4] = 0;
+	model->regs[FGGB_VERSION / 4] = FIMG_MODEL_VERSION;
+	model->regs[FGHI_DWSPACE / 4] = FIMG_MODEL_FIFO_SIZE;
+
+	ctx->model = model;
+	ctx->base = (volatile char *)model->regs;
+	ctx->fd = -1;
+
+	LOGD("Opened FIMG software model.");
+
+	return 0;
+}
+
+/*****************************************************************************
+ * FUNCTION:	fimgModelClose
+ * SYNOPSIS:	This function destroys the register model
+ *****************************************************************************/
+void fimgModelClose(fimgContext *ctx)
+{
+	fimgModel *model = ctx->model;
+
+	/* Closing the device releases the lock */
+	pthread_mutex_lock(&lockMutex);
+	if (lockOwner == model) {
+		lockOwner = NULL;
+		pthread_cond_broadcast(&lockCond);
+	}
+	if (lockLastOwner == model)
+		lockLastOwner = NULL;
+	pthread_mutex_unlock(&lockMutex);
+
+	free(model->regs);
+	free(model);
+
+	ctx->model = NULL;
+	ctx->base = NULL;
+
+	LOGD("Closed FIMG software model.");
+}
+
+/*****************************************************************************
+ * FUNCTION:	fimgModelGetStats
+ * SYNOPSIS:	This function retrieves register write statistics
+ * ARGUMENTS:	stats - structure to fill with current statistics
+ *****************************************************************************/
+void fimgModelGetStats(fimgContext *ctx, fimgModelStats *stats)
+{
+	*stats = ctx->model->stats;
+}
+
+/*****************************************************************************
+ * FUNCTION:	fimgModelResetStats
+ * SYNOPSIS:	This function clears register write statistics and the log
+ *****************************************************************************/
+void fimgModelResetStats(fimgContext *ctx)
+{
+	fimgModel *model = ctx->model;
+
+	memset(&model->stats, 0, sizeof(model->stats));
+	model->logHead = 0;
+	model->logCount = 0;
+}
+
+/*****************************************************************************
+ * FUNCTION:	fimgModelGetLog
+ * SYNOPSIS:	This function copies recorded register writes, oldest first
+ * RETURNS:	number of copied records
+ * ARGUMENTS:	buf - destination buffer
+ *		max - maximum number of records to copy
+ *****************************************************************************/
+unsigned int fimgModelGetLog(fimgContext *ctx,
+				fimgModelRecord *buf, unsigned int max)
+{
+	fimgModel *model = ctx->model;
+	unsigned int count = model->logCount;
+	unsigned int pos;
+	unsigned int i;
+
+	if (count > max)
+		count = max;
+
+	pos = (model->logHead + FIMG_MODEL_LOG_SIZE - count)
+						% FIMG_MODEL_LOG_SIZE;
+
+	for (i = 0; i < count; ++i) {
+		buf[i] = model->log[pos];
+		pos = (pos + 1) % FIMG_MODEL_LOG_SIZE;
+	}
+
+	return count;
+}
+
+/*****************************************************************************
+ * FUNCTION:	fimgModelDumpLog
+ * SYNOPSIS:	This function writes recorded register writes to a text file
+ * RETURNS:	 0, on success
+ *		-errno, on error
+ * ARGUMENTS:	path - path of the file to create
+ *****************************************************************************/
+int fimgModelDumpLog(fimgContext *ctx, const char *path)
+{
+	fimgModel *model = ctx->model;
+	unsigned int pos;
+	unsigned int i;
+	FILE *file;
+
+	file = fopen(path, "w");
+	if (!file) {
+		LOGE("Couldn't open %s (%s).", path, strerror(errno));
+		return -errno;
+	}
+
+	pos = (model->logHead + FIMG_MODEL_LOG_SIZE - model->logCount)
+						% FIMG_MODEL_LOG_SIZE;
+
+	for (i = 0; i < model->logCount; ++i) {
+		const fimgModelRecord *rec = &model->log[pos];
+
+		fprintf(file, "%llu %05x %08x\n",
+			(unsigned long long)rec->time, rec->addr, rec->data);
+		pos = (pos + 1) % FIMG_MODEL_LOG_SIZE;
+	}
+
+	fclose(file);
+
+	return 0;
+}
+
+#endif /* FIMG_SOFTWARE_MODEL */
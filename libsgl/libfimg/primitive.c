@@ -50,6 +50,9 @@ void fimgSetVertexContext(fimgContext *ctx, unsigned int type)
 	ctx->primitive.vctx.type = 1 << type; // See fimgPrimitiveType enum
 #ifdef FIMG_INTERPOLATION_WORKAROUND
 	ctx->primitive.vctx.vsOut = FIMG_ATTRIB_NUM - 1; // WORKAROUND
+#elif defined(FIMG_FIXED_PIPELINE)
+	/* Color and texture coordinates, regardless of vertex shader inputs */
+	ctx->primitive.vctx.vsOut = 1 + FIMG_NUM_TEXTURE_UNITS;
 #else
 	ctx->primitive.vctx.vsOut = ctx->numAttribs - 1; // Without position
 #endif
@@ -144,15 +147,12 @@ void fimgCreatePrimitiveContext(fimgContext *ctx)
 {
 	ctx->primitive.halfDistance = 0.5f;
 	ctx->primitive.center = 0.5f;
-}
 
-void fimgRestorePrimitiveState(fimgContext *ctx)
-{
-	fimgWrite(ctx, ctx->primitive.vctx.val, FGPE_VERTEX_CONTEXT);
-	fimgWriteF(ctx, ctx->primitive.ox, FGPE_VIEWPORT_OX);
-	fimgWriteF(ctx, ctx->primitive.oy, FGPE_VIEWPORT_OY);
-	fimgWriteF(ctx, ctx->primitive.halfPX, FGPE_VIEWPORT_HALF_PX);
-	fimgWriteF(ctx, ctx->primitive.halfPY, FGPE_VIEWPORT_HALF_PY);
-	fimgWriteF(ctx, ctx->primitive.halfDistance, FGPE_DEPTHRANGE_HALF_F_SUB_N);
-	fimgWriteF(ctx, ctx->primitive.center, FGPE_DEPTHRANGE_HALF_F_ADD_N);
+	/* Vertex context is not shadowed, as it is set for every draw */
+	fimgQueueF(ctx, ctx->primitive.ox, FGPE_VIEWPORT_OX);
+	fimgQueueF(ctx, ctx->primitive.oy, FGPE_VIEWPORT_OY);
+	fimgQueueF(ctx, ctx->primitive.halfPX, FGPE_VIEWPORT_HALF_PX);
+	fimgQueueF(ctx, ctx->primitive.halfPY, FGPE_VIEWPORT_HALF_PY);
+	fimgQueueF(ctx, ctx->primitive.halfDistance, FGPE_DEPTHRANGE_HALF_F_SUB_N);
+	fimgQueueF(ctx, ctx->primitive.center, FGPE_DEPTHRANGE_HALF_F_ADD_N);
 }
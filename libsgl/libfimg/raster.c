@@ -223,21 +223,18 @@ void fimgCreateRasterizerContext(fimgContext *ctx)
 	ctx->rasterizer.pointWidthMin = 1.0f;
 	ctx->rasterizer.pointWidthMax = 2048.0f;
 	ctx->rasterizer.lineWidth = 1.0f;
-}
 
-void fimgRestoreRasterizerState(fimgContext *ctx)
-{
-	fimgWrite(ctx, ctx->rasterizer.samplePos, FGRA_PIX_SAMP);
-	fimgWrite(ctx, ctx->rasterizer.dOffEn, FGRA_D_OFF_EN);
-	fimgWriteF(ctx, ctx->rasterizer.dOffFactor, FGRA_D_OFF_FACTOR);
-	fimgWriteF(ctx, ctx->rasterizer.dOffUnits, FGRA_D_OFF_UNITS);
-	fimgWrite(ctx, ctx->rasterizer.cull.val, FGRA_BFCULL);
-	fimgWrite(ctx, ctx->rasterizer.yClip.val, FGRA_YCLIP);
-	fimgWriteF(ctx, ctx->rasterizer.pointWidth, FGRA_PWIDTH);
-	fimgWriteF(ctx, ctx->rasterizer.pointWidthMin, FGRA_PSIZE_MIN);
-	fimgWriteF(ctx, ctx->rasterizer.pointWidthMax, FGRA_PSIZE_MAX);
-	fimgWrite(ctx, ctx->rasterizer.spriteCoordAttrib, FGRA_COORDREPLACE);
-	fimgWriteF(ctx, ctx->rasterizer.lineWidth, FGRA_LWIDTH);
-	fimgWrite(ctx, ctx->rasterizer.lodGen.val, FGRA_LODCTL);
-	fimgWrite(ctx, ctx->rasterizer.xClip.val, FGRA_XCLIP);
+	fimgQueue(ctx, ctx->rasterizer.samplePos, FGRA_PIX_SAMP);
+	fimgQueue(ctx, ctx->rasterizer.dOffEn, FGRA_D_OFF_EN);
+	fimgQueueF(ctx, ctx->rasterizer.dOffFactor, FGRA_D_OFF_FACTOR);
+	fimgQueueF(ctx, ctx->rasterizer.dOffUnits, FGRA_D_OFF_UNITS);
+	fimgQueue(ctx, ctx->rasterizer.cull.val, FGRA_BFCULL);
+	fimgQueue(ctx, ctx->rasterizer.yClip.val, FGRA_YCLIP);
+	fimgQueueF(ctx, ctx->rasterizer.pointWidth, FGRA_PWIDTH);
+	fimgQueueF(ctx, ctx->rasterizer.pointWidthMin, FGRA_PSIZE_MIN);
+	fimgQueueF(ctx, ctx->rasterizer.pointWidthMax, FGRA_PSIZE_MAX);
+	fimgQueue(ctx, ctx->rasterizer.spriteCoordAttrib, FGRA_COORDREPLACE);
+	fimgQueueF(ctx, ctx->rasterizer.lineWidth, FGRA_LWIDTH);
+	fimgQueue(ctx, ctx->rasterizer.lodGen.val, FGRA_LODCTL);
+	fimgQueue(ctx, ctx->rasterizer.xClip.val, FGRA_XCLIP);
 }
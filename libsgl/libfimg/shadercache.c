@@ -0,0 +1,444 @@
+/*
+ * fimg/shadercache.c
+ *
+ * SAMSUNG S3C6410 FIMG-3DSE PROCESS-WIDE SHADER VARIANT CACHE
+ *
+ * Copyrights:	2010 by Tomasz Figa < tomasz.figa at gmail.com >
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Shader variants generated by fixed pipeline emulation are kept in a cache
+ * shared by all contexts of the process, backing the small per-context
+ * caches in compat.c. Entries are keyed by (masked) shader state, found
+ * through a hash table indexed by hash of the key and evicted in least
+ * recently used order.
+ *
+ * Optionally the cache is persisted in a file, so generated variants survive
+ * restarts of the process. The file consists of a header identifying shader
+ * code generator and a sequence of records, appended as new variants are
+ * generated. The file is rewritten on load, if it has been invalidated
+ * or has grown too much.
+ *
+ * Shader code from the file is run by the GPU, so every user has its own
+ * file, private to the user. Files not owned by the user, accessible by
+ * others or not being regular files are ignored.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+#include <string.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "fimg_private.h"
+
+#ifdef FIMG_FIXED_PIPELINE
+
+typedef struct _fimgCachedShader {
+	struct _fimgCachedShader *prev;
+	struct _fimgCachedShader *next;
+	struct _fimgCachedShader *hashNext;
+	uint32_t type;
+	uint32_t hash;
+	uint32_t key[FGFP_SHADER_KEY_WORDS];
+	uint32_t instrCount;
+	uint32_t code[4*FGFP_MAX_INSTR];
+} fimgCachedShader;
+
+/* Head of LRU list (most recently used first) */
+static fimgCachedShader shaderList = { &shaderList, &shaderList };
+static fimgCachedShader shaderPool[FIMG_SHADER_CACHE_SIZE];
+/* Hash chains, the number of buckets must be a power of two */
+#define SHADER_HASH_SIZE	64
+static fimgCachedShader *shaderHash[SHADER_HASH_SIZE];
+static unsigned int shaderCount;
+static pthread_mutex_t shaderMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static inline void unlinkShader(fimgCachedShader *s)
+{
+	s->prev->next = s->next;
+	s->next->prev = s->prev;
+}
+
+static inline void linkShader(fimgCachedShader *s)
+{
+	s->next = shaderList.next;
+	s->prev = &shaderList;
+	shaderList.next->prev = s;
+	shaderList.next = s;
+}
+
+static inline fimgCachedShader **hashBucket(uint32_t type, uint32_t hash)
+{
+	hash ^= (hash >> 16) ^ type;
+
+	return &shaderHash[hash & (SHADER_HASH_SIZE - 1)];
+}
+
+static void unhashShader(fimgCachedShader *s)
+{
+	fimgCachedShader **p = hashBucket(s->type, s->hash);
+
+	while (*p != s)
+		p = &(*p)->hashNext;
+
+	*p = s->hashNext;
+}
+
+static inline void hashShader(fimgCachedShader *s)
+{
+	fimgCachedShader **p = hashBucket(s->type, s->hash);
+
+	s->hashNext = *p;
+	*p = s;
+}
+
+static fimgCachedShader *findShader(uint32_t type,
+					const uint32_t *key, uint32_t hash)
+{
+	fimgCachedShader *s;
+
+	for (s = *hashBucket(type, hash); s; s = s->hashNext)
+		if (s->hash == hash && s->type == type
+		    && !memcmp(s->key, key, sizeof(s->key)))
+			return s;
+
+	return NULL;
+}
+
+/* Takes free entry or, if the cache is full, the least recently used one */
+static fimgCachedShader *allocShader(void)
+{
+	fimgCachedShader *s;
+
+	if (shaderCount < FIMG_SHADER_CACHE_SIZE)
+		return &shaderPool[shaderCount++];
+
+	s = shaderList.prev;
+	unlinkShader(s);
+	unhashShader(s);
+
+	return s;
+}
+
+static fimgCachedShader *storeShader(uint32_t type, const uint32_t *key,
+		uint32_t hash, const uint32_t *code, uint32_t instrCount)
+{
+	fimgCachedShader *s;
+
+	s = findShader(type, key, hash);
+	if (s) {
+		unlinkShader(s);
+	} else {
+		s = allocShader();
+		s->type = type;
+		s->hash = hash;
+		memcpy(s->key, key, sizeof(s->key));
+		hashShader(s);
+	}
+
+	s->instrCount = instrCount;
+	memcpy(s->code, code, 16*instrCount);
+	linkShader(s);
+
+	return s;
+}
+
+#ifdef FIMG_SHADER_CACHE_DIR
+
+#define SHADER_FILE_MAGIC	0x43534746	/* "FGSC" */
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+} fimgShaderFileHeader;
+
+typedef struct {
+	uint32_t type;
+	uint32_t key[FGFP_SHADER_KEY_WORDS];
+	uint32_t instrCount;
+	uint32_t checksum;
+} fimgShaderFileRecord;
+
+static int shaderFile = -1;
+static int shaderFileLoaded;
+static char shaderPath[256];
+static char shaderTmpPath[256 + 4];
+
+/* Opens the file only if it is a regular file private to current user */
+static int openShaderFile(const char *path, int flags)
+{
+	struct stat st;
+	int fd;
+
+	fd = open(path, flags | O_NOFOLLOW);
+	if (fd < 0)
+		return -1;
+
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode)
+	    || st.st_uid != geteuid() || (st.st_mode & 077)) {
+		LOGW("Ignoring shader cache file %s of wrong owner or mode",
+									path);
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static uint32_t recordChecksum(const fimgShaderFileRecord *rec,
+							const uint32_t *code)
+{
+	uint32_t sum = rec->type ^ rec->instrCount;
+	uint32_t i;
+
+	for (i = 0; i < FGFP_SHADER_KEY_WORDS; ++i)
+		sum = (sum << 5 | sum >> 27) ^ rec->key[i];
+
+	for (i = 0; i < 4*rec->instrCount; ++i)
+		sum = (sum << 5 | sum >> 27) ^ code[i];
+
+	return sum;
+}
+
+/* Records are written at once, as other processes may append concurrently */
+static int writeRecord(int fd, const fimgCachedShader *s)
+{
+	struct {
+		fimgShaderFileRecord rec;
+		uint32_t code[4*FGFP_MAX_INSTR];
+	} buf;
+	ssize_t len = sizeof(buf.rec) + 16*s->instrCount;
+
+	buf.rec.type = s->type;
+	memcpy(buf.rec.key, s->key, sizeof(buf.rec.key));
+	buf.rec.instrCount = s->instrCount;
+	buf.rec.checksum = recordChecksum(&buf.rec, s->code);
+	memcpy(buf.code, s->code, 16*s->instrCount);
+
+	if (write(fd, &buf, len) != len)
+		return -1;
+
+	return 0;
+}
+
+/* Reads records from the file, returns number of valid ones or -1 */
+static int readShaderFile(int fd, uint32_t version)
+{
+	fimgShaderFileHeader hdr;
+	fimgShaderFileRecord rec;
+	uint32_t code[4*FGFP_MAX_INSTR];
+	int count = 0;
+
+	if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+		return -1;
+
+	if (hdr.magic != SHADER_FILE_MAGIC || hdr.version != version)
+		return -1;
+
+	while (read(fd, &rec, sizeof(rec)) == sizeof(rec)) {
+		if (rec.type >= FGFP_SHADER_TYPES
+		    || !rec.instrCount || rec.instrCount > FGFP_MAX_INSTR)
+			return -1;
+
+		if (read(fd, code, 16*rec.instrCount)
+					!= (ssize_t)(16*rec.instrCount))
+			return -1;
+
+		if (rec.checksum != recordChecksum(&rec, code))
+			return -1;
+
+		storeShader(rec.type, rec.key, fimgHashShaderKey(rec.key),
+						code, rec.instrCount);
+		++count;
+	}
+
+	return count;
+}
+
+/* Replaces the file with current cache contents, least recently used first */
+static int rewriteShaderFile(uint32_t version)
+{
+	fimgShaderFileHeader hdr;
+	fimgCachedShader *s;
+	int fd;
+
+	/* Never write through a file or link planted by someone else */
+	unlink(shaderTmpPath);
+	fd = open(shaderTmpPath,
+		O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, S_IRUSR | S_IWUSR);
+	if (fd < 0)
+		return -1;
+
+	hdr.magic = SHADER_FILE_MAGIC;
+	hdr.version = version;
+	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+		goto err;
+
+	for (s = shaderList.prev; s != &shaderList; s = s->prev)
+		if (writeRecord(fd, s))
+			goto err;
+
+	if (rename(shaderTmpPath, shaderPath))
+		goto err;
+
+	close(fd);
+	return 0;
+
+err:
+	close(fd);
+	unlink(shaderTmpPath);
+	return -1;
+}
+
+static void loadShaderFile(void)
+{
+	uint32_t version = fimgCompatShaderVersion();
+	int count = -1;
+	int fd;
+
+	shaderFileLoaded = 1;
+
+	snprintf(shaderPath, sizeof(shaderPath), "%s/shaders-%u.bin",
+					FIMG_SHADER_CACHE_DIR, geteuid());
+	snprintf(shaderTmpPath, sizeof(shaderTmpPath), "%s.tmp", shaderPath);
+
+	fd = openShaderFile(shaderPath, O_RDONLY);
+	if (fd >= 0) {
+		count = readShaderFile(fd, version);
+		close(fd);
+	}
+
+	/* Start over with a clean file if it is invalid or too big */
+	if (count < 0 || count > 2*FIMG_SHADER_CACHE_SIZE) {
+		if (rewriteShaderFile(version)) {
+			LOGD("Shader cache file %s not writable, "
+				"persistence disabled", shaderPath);
+			return;
+		}
+		count = shaderCount;
+	}
+
+	shaderFile = openShaderFile(shaderPath, O_WRONLY | O_APPEND);
+	if (shaderFile < 0)
+		return;
+
+	LOGD("Loaded %d shader variants from %s",
+					count, shaderPath);
+}
+
+static inline void checkShaderFile(void)
+{
+	if (unlikely(!shaderFileLoaded))
+		loadShaderFile();
+}
+
+static inline void appendShaderFile(const fimgCachedShader *s)
+{
+	if (shaderFile < 0)
+		return;
+
+	if (writeRecord(shaderFile, s)) {
+		LOGE("Failed to write shader cache file, persistence disabled");
+		close(shaderFile);
+		shaderFile = -1;
+	}
+}
+
+#else /* FIMG_SHADER_CACHE_DIR */
+
+static inline void checkShaderFile(void) {}
+static inline void appendShaderFile(const fimgCachedShader *s) {}
+
+#endif /* FIMG_SHADER_CACHE_DIR */
+
+/*****************************************************************************
+ * FUNCTION:	fimgShaderCacheLookup
+ * SYNOPSIS:	This function looks for shader variant in process-wide cache
+ * RETURNS:	number of instructions copied to code buffer, 0 if not found
+ * ARGUMENTS:	type - FGFP_SHADER_VERTEX or FGFP_SHADER_PIXEL
+ *		key - shader state with don't care bits cleared
+ *		hash - hash of the key (see fimgHashShaderKey)
+ *		code - buffer for FGFP_MAX_INSTR instructions
+ *****************************************************************************/
+uint32_t fimgShaderCacheLookup(uint32_t type, const uint32_t *key,
+					uint32_t hash, uint32_t *code)
+{
+	fimgCachedShader *s;
+	uint32_t instrCount = 0;
+
+	pthread_mutex_lock(&shaderMutex);
+
+	checkShaderFile();
+
+	s = findShader(type, key, hash);
+	if (s) {
+		unlinkShader(s);
+		linkShader(s);
+		memcpy(code, s->code, 16*s->instrCount);
+		instrCount = s->instrCount;
+	}
+
+	pthread_mutex_unlock(&shaderMutex);
+
+	return instrCount;
+}
+
+/*****************************************************************************
+ * FUNCTION:	fimgShaderCacheInsert
+ * SYNOPSIS:	This function stores generated shader variant in process-wide
+ *		cache (and cache file, if enabled)
+ * ARGUMENTS:	type - FGFP_SHADER_VERTEX or FGFP_SHADER_PIXEL
+ *		key - shader state with don't care bits cleared
+ *		hash - hash of the key (see fimgHashShaderKey)
+ *		code - shader instructions
+ *		instrCount - number of instructions
+ *****************************************************************************/
+void fimgShaderCacheInsert(uint32_t type, const uint32_t *key, uint32_t hash,
+				const uint32_t *code, uint32_t instrCount)
+{
+	fimgCachedShader *s;
+
+	pthread_mutex_lock(&shaderMutex);
+
+	checkShaderFile();
+
+	s = storeShader(type, key, hash, code, instrCount);
+	appendShaderFile(s);
+
+	pthread_mutex_unlock(&shaderMutex);
+}
+
+/*****************************************************************************
+ * FUNCTION:	fimgShaderCacheSize
+ * SYNOPSIS:	This function returns number of variants in process-wide cache
+ *****************************************************************************/
+uint32_t fimgShaderCacheSize(void)
+{
+	uint32_t count;
+
+	pthread_mutex_lock(&shaderMutex);
+	count = shaderCount;
+	pthread_mutex_unlock(&shaderMutex);
+
+	return count;
+}
+
+#endif /* FIMG_FIXED_PIPELINE */
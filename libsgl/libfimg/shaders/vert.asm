@@ -50,6 +50,13 @@ fimg_version	0x01050000
 # def c14, 0.0, 0.0, 1.0, 0.0
 # def c15, 0.0, 0.0, 0.0, 1.0
 
+# Constant vertex color
+# def c16, 1.0, 1.0, 1.0, 1.0
+
+# Constant (already transformed) texture coordinates
+# def c17, 0.0, 0.0, 0.0, 1.0
+# def c18, 0.0, 0.0, 0.0, 1.0
+
 % v header
 
 # Shader header
@@ -60,10 +67,32 @@ label start
 	mad r0.xyzw, c2.xyzw, v0.zzzz, r0.xyzw
 	mad o0.xyzw, c3.xyzw, v0.wwww, r0.xyzw
 
+# Code is being inserted here dynamically
+
+% v header_bypass
+
+# Shader header for vertices already in window coordinates
+label start
+	# Pass position untransformed
+	mov o0, v0
+
+################################################################################
+
+# Input registers of attributes other than position depend on which of them
+# are fed from vertex arrays. Blocks below use the input register they would
+# get with all attributes enabled and are patched when the shader is built.
+
+% v color
+
+# Color
 	# Pass vertex color
-	mov o1, v2
+	mov o1, v1
 
-# Code is being inserted here dynamically
+% v color_const
+
+# Color
+	# Pass constant color
+	mov o1, c16
 
 ################################################################################
 
@@ -71,19 +100,43 @@ label start
 
 # Texture 0
 	# Transform texture0 coordinates
-	mul r1.xyzw, c8.xyzw,  v4.xxxx
-	mad r1.xyzw, c9.xyzw,  v4.yyyy, r1.xyzw
-	mad r1.xyzw, c10.xyzw, v4.zzzz, r1.xyzw
-	mad o2.xyzw, c11.xyzw, v4.wwww, r1.xyzw
+	mul r1.xyzw, c8.xyzw,  v2.xxxx
+	mad r1.xyzw, c9.xyzw,  v2.yyyy, r1.xyzw
+	mad r1.xyzw, c10.xyzw, v2.zzzz, r1.xyzw
+	mad o2.xyzw, c11.xyzw, v2.wwww, r1.xyzw
+
+% v texture0_const
+
+# Texture 0
+	# Pass constant texture0 coordinates
+	mov o2, c17
+
+% v texture0_pass
+
+# Texture 0
+	# Pass texture0 coordinates untransformed
+	mov o2, v2
 
 % v texture1
 
 # Texture 1
 	# Transform texture1 coordinates
-	mul r2.xyzw, c12.xyzw, v5.xxxx
-	mad r2.xyzw, c13.xyzw, v5.yyyy, r2.xyzw
-	mad r2.xyzw, c14.xyzw, v5.zzzz, r2.xyzw
-	mad o3.xyzw, c15.xyzw, v5.wwww, r2.xyzw
+	mul r2.xyzw, c12.xyzw, v3.xxxx
+	mad r2.xyzw, c13.xyzw, v3.yyyy, r2.xyzw
+	mad r2.xyzw, c14.xyzw, v3.zzzz, r2.xyzw
+	mad o3.xyzw, c15.xyzw, v3.wwww, r2.xyzw
+
+% v texture1_const
+
+# Texture 1
+	# Pass constant texture1 coordinates
+	mov o3, c18
+
+% v texture1_pass
+
+# Texture 1
+	# Pass texture1 coordinates untransformed
+	mov o3, v3
 
 ################################################################################
 
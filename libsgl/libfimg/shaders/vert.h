@@ -9,21 +9,48 @@ static const unsigned int vert_header[] = {
 	0x00e40100, 0x02015500, 0x2ef820e4, 0x00000000,
 	0x00e40100, 0x0202aa00, 0x2ef820e4, 0x00000000,
 	0x00e40100, 0x0203ff00, 0x0ef800e4, 0x00000000,
-	0x00000000, 0x00020000, 0x00f801e4, 0x00000000,
+};
+
+static const unsigned int vert_header_bypass[] = {
+	0x00000000, 0x00000000, 0x00f800e4, 0x00000000,
+};
+
+static const unsigned int vert_color[] = {
+	0x00000000, 0x00010000, 0x00f801e4, 0x00000000,
+};
+
+static const unsigned int vert_color_const[] = {
+	0x00000000, 0x02100000, 0x00f801e4, 0x00000000,
 };
 
 static const unsigned int vert_texture0[] = {
-	0x04000000, 0x02080000, 0x237821e4, 0x00000000,
-	0x04e40101, 0x02095500, 0x2ef821e4, 0x00000000,
-	0x04e40101, 0x020aaa00, 0x2ef821e4, 0x00000000,
-	0x04e40101, 0x020bff00, 0x0ef802e4, 0x00000000,
+	0x02000000, 0x02080000, 0x237821e4, 0x00000000,
+	0x02e40101, 0x02095500, 0x2ef821e4, 0x00000000,
+	0x02e40101, 0x020aaa00, 0x2ef821e4, 0x00000000,
+	0x02e40101, 0x020bff00, 0x0ef802e4, 0x00000000,
+};
+
+static const unsigned int vert_texture0_const[] = {
+	0x00000000, 0x02110000, 0x00f802e4, 0x00000000,
+};
+
+static const unsigned int vert_texture0_pass[] = {
+	0x00000000, 0x00020000, 0x00f802e4, 0x00000000,
 };
 
 static const unsigned int vert_texture1[] = {
-	0x05000000, 0x020c0000, 0x237822e4, 0x00000000,
-	0x05e40102, 0x020d5500, 0x2ef822e4, 0x00000000,
-	0x05e40102, 0x020eaa00, 0x2ef822e4, 0x00000000,
-	0x05e40102, 0x020fff00, 0x0ef803e4, 0x00000000,
+	0x03000000, 0x020c0000, 0x237822e4, 0x00000000,
+	0x03e40102, 0x020d5500, 0x2ef822e4, 0x00000000,
+	0x03e40102, 0x020eaa00, 0x2ef822e4, 0x00000000,
+	0x03e40102, 0x020fff00, 0x0ef803e4, 0x00000000,
+};
+
+static const unsigned int vert_texture1_const[] = {
+	0x00000000, 0x02120000, 0x00f803e4, 0x00000000,
+};
+
+static const unsigned int vert_texture1_pass[] = {
+	0x00000000, 0x00030000, 0x00f803e4, 0x00000000,
 };
 
 static const unsigned int vert_footer[] = {
@@ -37,7 +37,14 @@
 #include "fimg_private.h"
 #include "s3c_g3d.h"
 
-#define FIMG_SFR_SIZE 0x80000
+#ifdef FIMG_SOFTWARE_MODEL
+#ifdef FIMG_DEBUG_IOMEM_ACCESS
+#error FIMG_DEBUG_IOMEM_ACCESS can not be used with FIMG_SOFTWARE_MODEL
+#endif
+#define fimgIoctl(ctx, req, arg)	fimgModelIoctl((ctx), (req), (arg))
+#else
+#define fimgIoctl(ctx, req, arg)	ioctl((ctx)->fd, (req), (arg))
+#endif
 
 /*****************************************************************************
  * FUNCTION:	fimgDeviceOpen
@@ -47,6 +54,9 @@
  *****************************************************************************/
 int fimgDeviceOpen(fimgContext *ctx)
 {
+#ifdef FIMG_SOFTWARE_MODEL
+	return fimgModelOpen(ctx);
+#else
 	ctx->fd = open("/dev/s3c-g3d", O_RDWR | O_SYNC, 0);
 	if(ctx->fd < 0) {
 		LOGE("Couldn't open /dev/s3c-g3d (%s).", strerror(errno));
@@ -64,6 +74,7 @@ int fimgDeviceOpen(fimgContext *ctx)
 	LOGD("Opened /dev/s3c-g3d (%d).", ctx->fd);
 
 	return 0;
+#endif
 }
 
 /*****************************************************************************
@@ -72,12 +83,16 @@ int fimgDeviceOpen(fimgContext *ctx)
  *****************************************************************************/
 void fimgDeviceClose(fimgContext *ctx)
 {
+#ifdef FIMG_SOFTWARE_MODEL
+	fimgModelClose(ctx);
+#else
 #ifndef FIMG_DEBUG_IOMEM_ACCESS
 	munmap((void *)ctx->base, FIMG_SFR_SIZE);
 #endif
 	close(ctx->fd);
 
 	LOGD("fimg3D: Closed /dev/s3c-g3d (%d).", ctx->fd);
+#endif
 }
 
 /**
@@ -92,20 +107,13 @@ void fimgDeviceClose(fimgContext *ctx)
 fimgContext *fimgCreateContext(void)
 {
 	fimgContext *ctx;
-	uint32_t *queue;
 
 	if ((ctx = malloc(sizeof(*ctx))) == NULL)
 		return NULL;
 
-	if ((queue = malloc(2*(FIMG_MAX_QUEUE_LEN + 1)*sizeof(uint32_t))) == NULL) {
-		free(ctx);
-		return NULL;
-	}
-
 	memset(ctx, 0, sizeof(fimgContext));
 
 	if(fimgDeviceOpen(ctx)) {
-		free(queue);
 		free(ctx);
 		return NULL;
 	}
@@ -118,10 +126,9 @@ fimgContext *fimgCreateContext(void)
 #ifdef FIMG_FIXED_PIPELINE
 	fimgCreateCompatContext(ctx);
 #endif
-
-	ctx->queue = queue;
-	ctx->queue[0] = 0;
-	ctx->queueStart = queue;
+#ifdef FIMG_HW_LOCK_LEASE
+	pthread_mutex_init(&ctx->leaseMutex, NULL);
+#endif
 
 	return ctx;
 }
@@ -132,9 +139,17 @@ fimgContext *fimgCreateContext(void)
  *****************************************************************************/
 void fimgDestroyContext(fimgContext *ctx)
 {
+	/* Fences created by this context must not outlive its draws */
+	fimgFinish(ctx);
+#ifdef FIMG_WAIT_STATS_DEBUG
+	fimgDumpWaitStats(ctx);
+#endif
+#ifdef FIMG_HW_LOCK_LEASE
+	fimgUnwatchLease(ctx);
+	pthread_mutex_destroy(&ctx->leaseMutex);
+#endif
 	fimgDeviceClose(ctx);
-	free(ctx->queueStart);
-	free(ctx->vertexData);
+	free(ctx->vertexBatch[0].data);
 #ifdef FIMG_FIXED_PIPELINE
 	free(ctx->compat.vshaderBuf);
 	free(ctx->compat.pshaderBuf);
@@ -144,34 +159,120 @@ void fimgDestroyContext(fimgContext *ctx)
 
 /*****************************************************************************
  * FUNCTION:	fimgRestoreContext
- * SYNOPSIS:	This function restores a device context to hardware registers
+ * SYNOPSIS:	This function restores a device context to hardware registers.
+ *		All shadowed registers are marked dirty and written with next
+ *		flush of the context, together with any pending changes.
  *****************************************************************************/
 void fimgRestoreContext(fimgContext *ctx)
 {
-//	fprintf(stderr, "fimg: Restoring global state\n"); fflush(stderr);
+	unsigned int i;
+
 	fimgRestoreGlobalState(ctx);
-//	fprintf(stderr, "fimg: Restoring host state\n"); fflush(stderr);
-	fimgRestoreHostState(ctx);
-//	fprintf(stderr, "fimg: Restoring primitive state\n"); fflush(stderr);
-	fimgRestorePrimitiveState(ctx);
-//	fprintf(stderr, "fimg: Restoring rasterizer state\n"); fflush(stderr);
-	fimgRestoreRasterizerState(ctx);
-//	fprintf(stderr, "fimg: Restoring fragment state\n"); fflush(stderr);
-	fimgRestoreFragmentState(ctx);
+
+	for (i = 0; i < FIMG_NUM_REG_BLOCKS; ++i) {
+		ctx->regs[i].dirty = ctx->regs[i].valid;
+		if (ctx->regs[i].dirty)
+			ctx->dirtyBlocks |= 1 << i;
+	}
+
+	ctx->textureValid = 0;
+	ctx->paletteStamp = 0;
 #ifdef FIMG_FIXED_PIPELINE
-//	fprintf(stderr, "fimg: Restoring compat state\n"); fflush(stderr);
 	fimgRestoreCompatState(ctx);
 #endif
+	++ctx->regStats.restores;
+}
+
+static const unsigned int regBlockBase[FIMG_NUM_REG_BLOCKS] = {
+	[FIMG_REGS_HOST]	= 0x08000,
+	[FIMG_REGS_PRIMITIVE]	= 0x30000,
+	[FIMG_REGS_RASTER]	= 0x38000,
+	[FIMG_REGS_RASTER_CLIP]	= 0x3c000,
+	[FIMG_REGS_FRAGMENT]	= 0x70000,
+};
+
+/*****************************************************************************
+ * FUNCTION:	fimgWriteDirtyRegisters
+ * SYNOPSIS:	This function writes shadowed registers marked dirty
+ *		to hardware
+ *****************************************************************************/
+void fimgWriteDirtyRegisters(fimgContext *ctx)
+{
+	unsigned int blocks = ctx->dirtyBlocks;
+
+	while (blocks) {
+		unsigned int block = __builtin_ctz(blocks);
+		fimgRegBlock *regs = &ctx->regs[block];
+		uint32_t dirty = regs->dirty;
+
+		while (dirty) {
+			unsigned int reg = __builtin_ctz(dirty);
+
+			fimgWrite(ctx, regs->val[reg],
+					regBlockBase[block] + 4*reg);
+			dirty &= dirty - 1;
+		}
+
+		regs->dirty = 0;
+		blocks &= blocks - 1;
+	}
 
-	ctx->queue = ctx->queueStart;
-	ctx->queue[0] = 0;
-	ctx->queueLen = 0;
+	ctx->dirtyBlocks = 0;
+}
+
+/*****************************************************************************
+ * FUNCTION:	fimgEndFrame
+ * SYNOPSIS:	This function marks the end of a frame for register write
+ *		statistics
+ *****************************************************************************/
+void fimgEndFrame(fimgContext *ctx)
+{
+	fimgRegisterStats *stats = &ctx->regStats;
+
+	stats->regWrites = ctx->frameRegWrites;
+	stats->blockWords = ctx->frameBlockWords;
+	if (stats->regWrites > stats->maxRegWrites)
+		stats->maxRegWrites = stats->regWrites;
+	stats->totalRegWrites += ctx->frameRegWrites;
+	stats->totalBlockWords += ctx->frameBlockWords;
+	++stats->frames;
+
+	ctx->frameRegWrites = 0;
+	ctx->frameBlockWords = 0;
+}
+
+/*****************************************************************************
+ * FUNCTION:	fimgGetRegisterStats
+ * SYNOPSIS:	This function retrieves register write statistics
+ * ARGUMENTS:	stats - structure to fill with statistics of completed frames
+ *****************************************************************************/
+void fimgGetRegisterStats(fimgContext *ctx, fimgRegisterStats *stats)
+{
+	*stats = ctx->regStats;
+}
+
+/*****************************************************************************
+ * FUNCTION:	fimgResetRegisterStats
+ * SYNOPSIS:	This function clears register write statistics
+ *****************************************************************************/
+void fimgResetRegisterStats(fimgContext *ctx)
+{
+	memset(&ctx->regStats, 0, sizeof(ctx->regStats));
+	ctx->frameRegWrites = 0;
+	ctx->frameBlockWords = 0;
 }
 
 /**
 	Power management
 */
 
+/* Number of contexts of this process waiting for the hardware lock */
+static volatile int lockWaiters;
+
+#ifdef FIMG_HW_LOCK_LEASE
+static void fimgKickLeaseWatchdog(void);
+#endif
+
 /*****************************************************************************
  * FUNCTION:	fimgAcquireHardwareLock
  * SYNOPSIS:	This function claims the hardware for exclusive use
@@ -183,7 +284,15 @@ int fimgAcquireHardwareLock(fimgContext *ctx)
 {
 	int ret;
 
-	if((ret = ioctl(ctx->fd, S3C_G3D_LOCK, 0)) < 0) {
+	__sync_add_and_fetch(&lockWaiters, 1);
+#ifdef FIMG_HW_LOCK_LEASE
+	/* Leases of other contexts of this process are ended right away */
+	fimgKickLeaseWatchdog();
+#endif
+	ret = fimgIoctl(ctx, S3C_G3D_LOCK, 0);
+	__sync_sub_and_fetch(&lockWaiters, 1);
+
+	if(ret < 0) {
 		LOGE("Could not acquire the hardware lock");
 		return -1;
 	}
@@ -197,6 +306,11 @@ int fimgAcquireHardwareLock(fimgContext *ctx)
 	}
 #endif
 	ctx->locked = 1;
+	++ctx->regStats.locks;
+#ifdef FIMG_HW_LOCK_LEASE
+	ctx->leaseDraws = 0;
+	ctx->leaseStart = fimgGetTimestamp();
+#endif
 
 	return ret;
 }
@@ -212,7 +326,7 @@ int fimgReleaseHardwareLock(fimgContext *ctx)
 #ifdef FIMG_DEBUG_IOMEM_ACCESS
 	munmap((void *)ctx->base, FIMG_SFR_SIZE);
 #endif
-	if(ioctl(ctx->fd, S3C_G3D_UNLOCK, 0)) {
+	if(fimgIoctl(ctx, S3C_G3D_UNLOCK, 0)) {
 		LOGE("Could not release the hardware lock");
 		return -1;
 	}
@@ -222,6 +336,172 @@ int fimgReleaseHardwareLock(fimgContext *ctx)
 	return 0;
 }
 
+/*****************************************************************************
+ * FUNCTION:	fimgReleaseHardware
+ * SYNOPSIS:	This function ends lease of the hardware, if the context
+ *		holds one. It should be called whenever the context stops
+ *		drawing for a while (e.g. flush, end of frame, unbinding).
+ *****************************************************************************/
+void fimgReleaseHardware(fimgContext *ctx)
+{
+	fimgLockLease(ctx);
+	if (ctx->locked)
+		fimgReleaseHardwareLock(ctx);
+	fimgUnlockLease(ctx);
+}
+
+#ifdef FIMG_HW_LOCK_LEASE
+/*****************************************************************************
+ * FUNCTION:	fimgLeaseExpired
+ * SYNOPSIS:	This function accounts a draw done under current lease and
+ *		checks whether the hardware should be released now.
+ * RETURNS:	non-zero if the lease has expired, zero otherwise
+ *****************************************************************************/
+int fimgLeaseExpired(fimgContext *ctx)
+{
+	/* Another context of this process waits for the hardware */
+	if (lockWaiters)
+		return 1;
+
+	if (++ctx->leaseDraws >= FIMG_HW_LOCK_LEASE_DRAWS)
+		return 1;
+
+	return fimgGetTimestamp() - ctx->leaseStart
+					>= FIMG_HW_LOCK_LEASE_TIME * 1000ULL;
+}
+
+/*
+ * Lease watchdog
+ *
+ * Leases are otherwise checked only at the end of draws, so the watchdog
+ * releases the hardware held by contexts which stopped drawing without
+ * flushing, once their lease times out or another context of the process
+ * waits for the hardware.
+ */
+
+static pthread_mutex_t leaseListMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t leaseListCond = PTHREAD_COND_INITIALIZER;
+static fimgContext *leaseList;
+static pthread_once_t watchdogOnce = PTHREAD_ONCE_INIT;
+static int watchdogRunning;
+
+static void fimgUnlinkLease(fimgContext *ctx)
+{
+	fimgContext **link = &leaseList;
+
+	while (*link && *link != ctx)
+		link = &(*link)->leaseNext;
+
+	if (*link)
+		*link = ctx->leaseNext;
+
+	ctx->leaseNext = NULL;
+	ctx->leaseWatched = 0;
+}
+
+/* Called with list mutex held */
+static void fimgCheckLeases(void)
+{
+	fimgContext *ctx = leaseList;
+
+	while (ctx) {
+		fimgContext *next = ctx->leaseNext;
+
+		/* The context is drawing and will check its lease itself */
+		if (pthread_mutex_trylock(&ctx->leaseMutex)) {
+			ctx = next;
+			continue;
+		}
+
+		if (ctx->locked && (lockWaiters || fimgGetTimestamp()
+		    - ctx->leaseStart >= FIMG_HW_LOCK_LEASE_TIME * 1000ULL))
+			fimgReleaseHardwareLock(ctx);
+
+		if (!ctx->locked)
+			fimgUnlinkLease(ctx);
+
+		pthread_mutex_unlock(&ctx->leaseMutex);
+		ctx = next;
+	}
+}
+
+static void *fimgLeaseWatchdog(void *arg)
+{
+	pthread_mutex_lock(&leaseListMutex);
+
+	for (;;) {
+		struct timespec ts;
+
+		if (!leaseList) {
+			pthread_cond_wait(&leaseListCond, &leaseListMutex);
+			continue;
+		}
+
+		/* Leases are checked twice per lease time */
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += FIMG_HW_LOCK_LEASE_TIME * 500;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_nsec -= 1000000000;
+			++ts.tv_sec;
+		}
+		pthread_cond_timedwait(&leaseListCond, &leaseListMutex, &ts);
+
+		fimgCheckLeases();
+	}
+
+	return NULL;
+}
+
+static void fimgStartLeaseWatchdog(void)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	if (!pthread_create(&thread, &attr, fimgLeaseWatchdog, NULL))
+		watchdogRunning = 1;
+	else
+		LOGE("Could not start hardware lease watchdog");
+	pthread_attr_destroy(&attr);
+}
+
+/* Called with lease mutex of the context held */
+void fimgWatchLease(fimgContext *ctx)
+{
+	pthread_once(&watchdogOnce, fimgStartLeaseWatchdog);
+
+	/* Nobody would end the lease */
+	if (!watchdogRunning) {
+		fimgReleaseHardwareLock(ctx);
+		return;
+	}
+
+	pthread_mutex_lock(&leaseListMutex);
+	ctx->leaseNext = leaseList;
+	leaseList = ctx;
+	ctx->leaseWatched = 1;
+	pthread_cond_signal(&leaseListCond);
+	pthread_mutex_unlock(&leaseListMutex);
+}
+
+void fimgUnwatchLease(fimgContext *ctx)
+{
+	pthread_mutex_lock(&leaseListMutex);
+	fimgUnlinkLease(ctx);
+	pthread_mutex_unlock(&leaseListMutex);
+}
+
+/* Makes the watchdog check leases immediately */
+static void fimgKickLeaseWatchdog(void)
+{
+	pthread_mutex_lock(&leaseListMutex);
+	if (leaseList)
+		pthread_cond_signal(&leaseListCond);
+	pthread_mutex_unlock(&leaseListMutex);
+}
+#endif
+
 /*****************************************************************************
  * FUNCTION:	fimgWaitForFlush
  * SYNOPSIS:	This function waits for the hardware to flush the pipeline
@@ -231,7 +511,7 @@ int fimgReleaseHardwareLock(fimgContext *ctx)
  *****************************************************************************/
 int fimgWaitForFlush(fimgContext *ctx, uint32_t target)
 {
-	if(ioctl(ctx->fd, S3C_G3D_FLUSH, target)) {
+	if(fimgIoctl(ctx, S3C_G3D_FLUSH, target)) {
 		LOGE("Could not flush the hardware pipeline");
 		fimgDumpState(ctx, 0, 0, __func__);
 		return -1;
@@ -96,6 +96,7 @@ fimgTexture *fimgCreateTexture(void)
 
 void fimgDestroyTexture(fimgTexture *texture)
 {
+	free(texture->palette);
 	free(texture);
 }
 
@@ -106,6 +107,7 @@ void fimgInitTexture(fimgTexture *texture, unsigned int flags,
 	texture->control.textureFmt = format;
 	texture->control.alphaFmt = !!(flags & FGTU_TEX_RGBA);
 	texture->baseAddr = addr;
+	texture->paletteSize = 0;
 }
 
 void fimgSetTexMipmapOffset(fimgTexture *texture, unsigned int level,
@@ -125,17 +127,101 @@ unsigned int fimgGetTexMipmapOffset(fimgTexture *texture, unsigned level)
 	return texture->offset[level - 1];
 }
 
+/*****************************************************************************
+* FUNCTIONS:	fimgSetTexPalette
+* SYNOPSIS:	This function sets palette of texture using indexed format.
+*		The palette is loaded to hardware when the texture is set up
+*		and a different palette is loaded already.
+* PARAMETERS:	[IN] unsigned int format: palette format (FGTU_TSTA_PAL_*)
+*		[IN] const uint32_t *entries: palette entries in given format
+*		[IN] unsigned int count: number of entries (0~256)
+* RETURNS:	0 on success, -1 if out of memory
+*****************************************************************************/
+int fimgSetTexPalette(fimgTexture *texture, unsigned int format,
+			const uint32_t *entries, unsigned int count)
+{
+	static unsigned int lastStamp;
+
+	if (count > FGTU_MAX_PALETTE_SIZE)
+		count = FGTU_MAX_PALETTE_SIZE;
+
+	if (!texture->palette) {
+		texture->palette = malloc(4 * FGTU_MAX_PALETTE_SIZE);
+		if (!texture->palette)
+			return -1;
+	}
+
+	memcpy(texture->palette, entries, 4 * count);
+	texture->paletteSize = count;
+	texture->control.paletteFmt = format;
+
+	/* Zero means that no palette is loaded */
+	do {
+		texture->paletteStamp = __sync_add_and_fetch(&lastStamp, 1);
+	} while (!texture->paletteStamp);
+
+	return 0;
+}
+
 void fimgInvalidateTextureCache(fimgContext *ctx)
 {
 	ctx->invalTexCache = 1;
 }
 
+/*****************************************************************************
+* FUNCTIONS:	fimgSetTexPaletteAddr
+* SYNOPSIS:	This function sets palette address for texturing
+* PARAMETERS:	[IN] unsigned int addr: 8-bit palette address (0~255)
+*****************************************************************************/
+static inline void fimgSetTexPaletteAddr(fimgContext *ctx, unsigned char addr)
+{
+	fimgWrite(ctx, addr, FGTU_PALETTE_ADDR);
+}
+
+/*****************************************************************************
+* FUNCTIONS:	fimgSetTexPaletteEntry
+* SYNOPSIS:	This function sets palette entry for texturing
+* PARAMETERS:	[IN] unsigned int entry: palette data in
+*****************************************************************************/
+static inline void fimgSetTexPaletteEntry(fimgContext *ctx, unsigned int entry)
+{
+	fimgWrite(ctx, entry, FGTU_PALETTE_IN);
+}
+
+/*
+ * There is only one palette for all texture units. Palette address is set
+ * for every entry, as auto-increment of FGTU_PALETTE_ADDR is undocumented.
+ */
+static void fimgLoadTexPalette(fimgContext *ctx, fimgTexture *texture)
+{
+	unsigned int i;
+
+	for (i = 0; i < texture->paletteSize; ++i) {
+		fimgSetTexPaletteAddr(ctx, i);
+		fimgSetTexPaletteEntry(ctx, texture->palette[i]);
+	}
+
+	ctx->paletteStamp = texture->paletteStamp;
+}
+
+/* Texture unit registers are skipped if they already hold given state */
 void fimgSetupTexture(fimgContext *ctx, fimgTexture *texture, unsigned unit)
 {
 	volatile uint32_t *reg = (volatile uint32_t *)(ctx->base +FGTU_TSTA(unit));
 	uint32_t *data = (uint32_t *)texture;
-	unsigned count = sizeof(fimgTexture) / 4;
+	unsigned count = FGTU_TEX_REG_COUNT;
+
+	if (texture->paletteSize && ctx->paletteStamp != texture->paletteStamp)
+		fimgLoadTexPalette(ctx, texture);
 
+	if ((ctx->textureValid & (1 << unit))
+	    && !memcmp(&ctx->texture[unit], texture, sizeof(*texture)))
+		return;
+
+	ctx->texture[unit] = *texture;
+	ctx->textureValid |= 1 << unit;
+
+#ifdef __arm__
 	asm volatile (
 		"1:\n\t"
 		"ldmia %1!, {r0-r3}\n\t"
@@ -146,6 +232,10 @@ void fimgSetupTexture(fimgContext *ctx, fimgTexture *texture, unsigned unit)
 		: "0"(reg), "1"(data), "r"(count / 4)
 		: "r0", "r1", "r2", "r3"
 	);
+#else
+	memcpy((void *)reg, data, 4*count);
+#endif
+	fimgWriteBlockDone(ctx, ctx->base + FGTU_TSTA(unit), count);
 }
 
 /*****************************************************************************
@@ -524,26 +614,6 @@ void fimgSetTexColorKeyMask(fimgContext *ctx, unsigned char bitsToMask)
 	fimgWrite(ctx, bitsToMask, FGTU_CKMASK);
 }
 
-/*****************************************************************************
-* FUNCTIONS:	fimgSetTexPaletteAddr
-* SYNOPSIS:	This function sets palette address for texturing
-* PARAMETERS:	[IN] unsigned int addr: 8-bit palette address (0~255)
-*****************************************************************************/
-void fimgSetTexPaletteAddr(fimgContext *ctx, unsigned char addr)
-{
-	fimgWrite(ctx, addr, FGTU_PALETTE_ADDR);
-}
-
-/*****************************************************************************
-* FUNCTIONS:	fimgSetTexPaletteEntry
-* SYNOPSIS:	This function sets palette entry for texturing
-* PARAMETERS:	[IN] unsigned int entry: palette data in
-*****************************************************************************/
-void fimgSetTexPaletteEntry(fimgContext *ctx, unsigned int entry)
-{
-	fimgWrite(ctx, entry, FGTU_PALETTE_IN);
-}
-
 /*****************************************************************************
 * FUNCTIONS:	fimgSetVtxTexUnitParams
 * SYNOPSIS:	This function sets vertex texture status register
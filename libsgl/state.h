@@ -280,7 +280,8 @@ struct FGLEnableState {
 		depthTest(0),
 		blend(0),
 		dither(1),
-		colorLogicOp(0) {};
+		colorLogicOp(0),
+		alphaTest(0) {};
 };
 
 struct FGLFramebufferState {
@@ -310,6 +311,41 @@ struct FGLFramebufferState {
 	}
 };
 
+/* Texture surface replaced while still used by the GPU */
+struct FGLOrphanedSurface {
+	FGLSurface *surface;
+	fimgFence fence;
+	uint32_t upload;
+};
+
+struct FGLOrphanState {
+	FGLOrphanedSurface surfaces[FGL_MAX_ORPHANED_SURFACES];
+	unsigned count;
+
+	FGLOrphanState() :
+		count(0) {};
+};
+
+/* Small draws merged into a single submission */
+struct FGLDrawBatch {
+	bool pending;
+	bool drawTex;
+	uint32_t mode;
+	GLint count;
+	GLuint texUnits;
+	GLint attribs;
+	/* Array feeding each attribute, -1 for constant */
+	GLint source[2 + FGL_MAX_TEXTURE_UNITS];
+	GLint type[2 + FGL_MAX_TEXTURE_UNITS];
+	GLint size[2 + FGL_MAX_TEXTURE_UNITS];
+	GLint width[2 + FGL_MAX_TEXTURE_UNITS];
+	uint8_t *data;
+
+	FGLDrawBatch() :
+		pending(false),
+		data(0) {};
+};
+
 struct FGLContext {
 	/* HW state */
 	fimgContext *fimg;
@@ -325,6 +361,7 @@ struct FGLContext {
 	GLuint packAlignment;
 	FGLBufferObjectBinding arrayBuffer;
 	FGLBufferObjectBinding elementArrayBuffer;
+	FGLBufferObjectBinding pixelPackBuffer;
 	FGLViewportState viewport;
 	FGLRasterizerState rasterizer;
 	FGLPerFragmentState perFragment;
@@ -333,6 +370,8 @@ struct FGLContext {
 	FGLEnableState enable;
 	FGLFramebufferState framebuffer;
 	FGLRenderbufferBinding renderbuffer;
+	FGLOrphanState orphans;
+	FGLDrawBatch drawBatch;
 	/* EGL state */
 	FGLEGLState egl;
 	bool finished;